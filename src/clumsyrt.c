@@ -0,0 +1,854 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+// Runtime library linked into every compiled program. Output goes through
+// one large buffer, written out when it fills and when the program exits,
+// so printing costs no stdio locking or format parsing. Heap memory comes
+// from an arena released region by region.
+
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+
+static char output[OUTPUT_BUFFER_SIZE];
+static size_t output_used = 0;
+static int flush_registered = 0;
+
+// Set on threads running pfor chunks. clumsy_pfor flushes before it hands
+// out ranges, and calls to C functions from chunks must not race on the
+// buffer by flushing it again.
+static __thread int in_chunk = 0;
+
+static void write_all(const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(1, data, size);
+        if (written <= 0) return;
+        data += written;
+        size -= written;
+    }
+}
+
+void clumsy_flush(void) {
+    if (in_chunk) return;
+    write_all(output, output_used);
+    output_used = 0;
+}
+
+// Room for size more bytes, flushing first if they do not fit
+static char *reserve(size_t size) {
+    if (!flush_registered) {
+        atexit(clumsy_flush);
+        flush_registered = 1;
+    }
+    if (output_used + size > OUTPUT_BUFFER_SIZE) clumsy_flush();
+    return output + output_used;
+}
+
+static void append(const char *data, size_t size) {
+    if (size > OUTPUT_BUFFER_SIZE / 2) {
+        // Too big to be worth copying
+        reserve(0);
+        clumsy_flush();
+        write_all(data, size);
+        return;
+    }
+    memcpy(reserve(size), data, size);
+    output_used += size;
+}
+
+// Strings are length-prefixed: the length sits in the 8 bytes before the
+// characters, which stay NUL-terminated for C
+
+static long str_length(const char *str) {
+    return ((const long *)str)[-1];
+}
+
+static const char digit_pairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+// Decimal digits of value written backwards from end, two at a time;
+// returns the first character
+static char *format_int(long value, char *end) {
+    unsigned long magnitude = value < 0 ? 0UL - (unsigned long)value : (unsigned long)value;
+    char *p = end;
+    while (magnitude >= 100) {
+        const char *pair = digit_pairs + (magnitude % 100) * 2;
+        magnitude /= 100;
+        *--p = pair[1];
+        *--p = pair[0];
+    }
+    if (magnitude >= 10) {
+        *--p = digit_pairs[magnitude * 2 + 1];
+        *--p = digit_pairs[magnitude * 2];
+    } else {
+        *--p = (char)('0' + magnitude);
+    }
+    if (value < 0) *--p = '-';
+    return p;
+}
+
+void print_int(long value) {
+    char digits[24];
+    char *end = digits + sizeof(digits);
+    char *start = format_int(value, end);
+    append(start, end - start);
+}
+
+void print_str(const char *str, long length) {
+    append(str, length);
+}
+
+void print_char(char c) {
+    *reserve(1) = c;
+    output_used++;
+}
+
+// Several fused print statements in one call. layout is a string whose
+// characters print as they are, except PRINT_VALUE followed by d, c or s,
+// which prints the next value as an integer, a character or a string.
+#define PRINT_VALUE '\1'
+
+void print_values(const char *layout, long a, long b, long c, long d, long e, long f, long g) {
+    long values[] = {a, b, c, d, e, f, g};
+    int next = 0;
+    long length = str_length(layout);
+    long start = 0;
+    for (long i = 0; i < length; i++) {
+        if (layout[i] != PRINT_VALUE || i + 1 >= length) continue;
+        append(layout + start, i - start);
+        long value = values[next++];
+        switch (layout[++i]) {
+            case 'd': print_int(value); break;
+            case 'c': print_char((char)value); break;
+            case 's': print_str((const char *)value, str_length((const char *)value)); break;
+        }
+        start = i + 1;
+    }
+    append(layout + start, length - start);
+}
+
+const char *str_concat(const char *a, const char *b) {
+    long a_length = str_length(a), b_length = str_length(b);
+    long *block = malloc(sizeof(long) + a_length + b_length + 1);
+    if (!block) {
+        fprintf(stderr, "Error: out of memory in concat\n");
+        exit(1);
+    }
+    block[0] = a_length + b_length;
+    char *text = (char *)(block + 1);
+    memcpy(text, a, a_length);
+    memcpy(text + a_length, b, b_length + 1);
+    return text;
+}
+
+long str_eq(const char *a, const char *b) {
+    if (a == b) return 1;
+    long length = str_length(a);
+    return length == str_length(b) && memcmp(a, b, length) == 0;
+}
+
+// Arena. Memory is handed out by bumping a pointer through chunks mapped
+// straight from the kernel, 2 MB aligned and sized so they can be backed by
+// huge pages. A region remembers where the arena stood when it began and
+// ending it rewinds to there: its chunks go back to the kernel, except one
+// kept for the next region, so a region per loop iteration stays cheap.
+// With CLUMSY_ALLOC_STATS set, totals go to stderr at exit.
+
+#define CHUNK_ALIGNMENT (2 * 1024 * 1024)
+#define ALLOC_ALIGNMENT 16
+
+typedef struct Chunk {
+    struct Chunk *previous;
+    size_t size;
+} Chunk;
+
+// A vec's elements, count and capacity, as laid out in its stack slot
+typedef struct {
+    char *data;
+    long length;
+    long capacity;
+} Vec;
+
+// A vec or map declared inside a region, whose malloc'd buffer it frees
+// when it ends
+typedef struct Owned {
+    struct Owned *next;
+    void **buffer;
+} Owned;
+
+// Arena state when a region began, stored in the arena itself
+typedef struct Mark {
+    struct Mark *outer;
+    Chunk *chunk;
+    char *top;
+    long live;
+    Owned *owned;
+} Mark;
+
+static Chunk *chunk = NULL;     // chunk being allocated from
+static char *top = NULL;        // next free byte in it
+static char *limit = NULL;      // end of it
+static Chunk *spare = NULL;     // released chunk kept for reuse
+static Mark *marks = NULL;      // innermost region
+
+static long live = 0;           // bytes allocated and not yet released
+static long peak = 0;
+static long total = 0;
+static long allocations = 0;
+static int stats_checked = 0;
+
+static void print_alloc_stats(void) {
+    fprintf(stderr, "alloc: %ld bytes in %ld allocations, peak %ld bytes\n", total, allocations, peak);
+}
+
+// A 2 MB aligned mapping of at least size bytes: map one alignment more
+// than needed and trim both ends
+static Chunk *map_chunk(size_t size) {
+    size = (size + CHUNK_ALIGNMENT - 1) & ~(size_t)(CHUNK_ALIGNMENT - 1);
+    char *mapped = mmap(NULL, size + CHUNK_ALIGNMENT, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (mapped == MAP_FAILED) {
+        fprintf(stderr, "Error: out of memory in alloc\n");
+        exit(1);
+    }
+    char *start = (char *)(((size_t)mapped + CHUNK_ALIGNMENT - 1) & ~(size_t)(CHUNK_ALIGNMENT - 1));
+    if (start > mapped) munmap(mapped, start - mapped);
+    munmap(start + size, mapped + CHUNK_ALIGNMENT - start);
+#ifdef MADV_HUGEPAGE
+    madvise(start, size, MADV_HUGEPAGE);
+#endif
+    Chunk *fresh = (Chunk *)start;
+    fresh->size = size;
+    return fresh;
+}
+
+static void release_chunk(Chunk *released) {
+    if (!spare) {
+        spare = released;
+    } else if (released->size > spare->size) {
+        munmap(spare, spare->size);
+        spare = released;
+    } else {
+        munmap(released, released->size);
+    }
+}
+
+// Start a new chunk with room for size bytes after its header
+static void grow(size_t size) {
+    size_t needed = sizeof(Chunk) + size;
+    Chunk *fresh;
+    if (spare && spare->size >= needed) {
+        fresh = spare;
+        spare = NULL;
+    } else {
+        fresh = map_chunk(needed);
+    }
+    fresh->previous = chunk;
+    chunk = fresh;
+    top = (char *)fresh + ((sizeof(Chunk) + ALLOC_ALIGNMENT - 1) & ~(size_t)(ALLOC_ALIGNMENT - 1));
+    limit = (char *)fresh + fresh->size;
+}
+
+void *clumsy_alloc(long size) {
+    if (!stats_checked) {
+        stats_checked = 1;
+        if (getenv("CLUMSY_ALLOC_STATS")) atexit(print_alloc_stats);
+    }
+    if (size < 0) {
+        fprintf(stderr, "Error: negative allocation size %ld\n", size);
+        exit(1);
+    }
+    size_t rounded = ((size_t)size + ALLOC_ALIGNMENT - 1) & ~(size_t)(ALLOC_ALIGNMENT - 1);
+    if (!chunk || rounded > (size_t)(limit - top)) grow(rounded);
+    char *memory = top;
+    top += rounded;
+    live += rounded;
+    total += size;
+    allocations++;
+    if (live > peak) peak = live;
+    return memory;
+}
+
+void clumsy_region_begin(void) {
+    Chunk *before_chunk = chunk;
+    char *before_top = top;
+    long before_live = live;
+    Mark *mark = clumsy_alloc(sizeof(Mark));
+    // The mark itself is not counted as an allocation
+    total -= sizeof(Mark);
+    allocations--;
+    mark->outer = marks;
+    mark->chunk = before_chunk;
+    mark->top = before_top;
+    mark->live = before_live;
+    mark->owned = NULL;
+    marks = mark;
+}
+
+// Returns value untouched, so a function can leave its regions on the way
+// out without moving its result
+long clumsy_region_end(long value) {
+    if (!marks) return value;
+    // The mark lives in the arena, possibly in a chunk released below
+    Mark mark = *marks;
+    marks = mark.outer;
+    for (Owned *owned = mark.owned; owned; owned = owned->next) {
+        free(*owned->buffer);
+    }
+    while (chunk != mark.chunk) {
+        Chunk *released = chunk;
+        chunk = released->previous;
+        release_chunk(released);
+    }
+    top = mark.top;
+    limit = chunk ? (char *)chunk + chunk->size : NULL;
+    live = mark.live;
+    return value;
+}
+
+// Vecs. Their buffers come from malloc rather than the arena, since they
+// move as they grow; the stack slot holds the Vec itself. Pushes grow the
+// buffer to twice its capacity, so n pushes copy at most 2n elements.
+
+// Have the innermost region free *buffer when it ends. A let that runs
+// again inside the same region, as in a loop body, hands back a slot the
+// region already owns: free what it held last time rather than listing
+// the slot twice. Callers reset the slot afterwards.
+static void own(void **buffer) {
+    if (!marks) return;
+    for (Owned *owned = marks->owned; owned; owned = owned->next) {
+        if (owned->buffer == buffer) {
+            free(*buffer);
+            return;
+        }
+    }
+    Owned *owned = clumsy_alloc(sizeof(Owned));
+    total -= sizeof(Owned);
+    allocations--;
+    owned->buffer = buffer;
+    owned->next = marks->owned;
+    marks->owned = owned;
+}
+
+void clumsy_vec_init(Vec *vec) {
+    own((void **)&vec->data);
+    vec->data = NULL;
+    vec->length = 0;
+    vec->capacity = 0;
+}
+
+void clumsy_vec_reserve(Vec *vec, long capacity, long element_size) {
+    if (capacity <= vec->capacity) return;
+    char *data = realloc(vec->data, (size_t)capacity * element_size);
+    if (!data) {
+        fprintf(stderr, "Error: out of memory in vec\n");
+        exit(1);
+    }
+    vec->data = data;
+    vec->capacity = capacity;
+}
+
+void clumsy_vec_grow(Vec *vec, long element_size) {
+    clumsy_vec_reserve(vec, vec->capacity < 4 ? 8 : vec->capacity * 2, element_size);
+}
+
+// Maps. Open addressing with SwissTable-style control bytes: each slot has
+// one byte that is EMPTY, DELETED, or the low 7 bits of the hash of the key
+// stored there. A lookup checks the control bytes of a group of 16 slots at
+// once, with NEON where there is one, and compares keys only for the slots
+// whose byte matches; an EMPTY byte in the group ends the probe. Groups are
+// probed quadratically. The table is rebuilt when less than an eighth of it
+// is left empty, so probes stay short.
+//
+// Each operation exists once per key kind, clumsy_map_int_* and
+// clumsy_map_str_*, which the compiler picks by the declared key type;
+// both are the inline versions below with string_keys constant.
+
+#define GROUP_WIDTH 16
+#define MIN_MAP_CAPACITY 16
+#define CONTROL_EMPTY 0x80
+#define CONTROL_DELETED 0xfe
+
+// The control bytes, keys and values share one malloc'd block, whose start
+// is control
+typedef struct {
+    unsigned char *control;
+    long *keys;
+    long *values;
+    long count;
+    long capacity;      // slots, a power of two and a multiple of GROUP_WIDTH
+    long growth_left;   // EMPTY slots that may still be filled before a rebuild
+} Map;
+
+static unsigned long mix(unsigned long x) {
+    x ^= x >> 32;
+    x *= 0xd6e8feb86659fd93UL;
+    x ^= x >> 32;
+    return x;
+}
+
+static unsigned long hash_key(long key, int string_keys) {
+    if (!string_keys) return mix((unsigned long)key * 0x9e3779b97f4a7c15UL);
+    const char *str = (const char *)key;
+    long length = str_length(str);
+    unsigned long hash = mix((unsigned long)length * 0x9e3779b97f4a7c15UL);
+    long i = 0;
+    for (; i + 8 <= length; i += 8) {
+        unsigned long word;
+        memcpy(&word, str + i, 8);
+        hash = mix(hash ^ word) * 0x9e3779b97f4a7c15UL;
+    }
+    unsigned long tail = 0;
+    memcpy(&tail, str + i, length - i);
+    return mix(hash ^ tail);
+}
+
+static int keys_equal(long a, long b, int string_keys) {
+    return string_keys ? str_eq((const char *)a, (const char *)b) : a == b;
+}
+
+// Bit 4i+3 set for each byte i of the group that matches. free_slots
+// matches EMPTY and DELETED, the bytes with the top bit set.
+static unsigned long match_group(const unsigned char *group, unsigned char tag, int free_slots) {
+#ifdef __ARM_NEON
+    uint8x16_t bytes = vld1q_u8(group);
+    uint8x16_t matches = free_slots ? vreinterpretq_u8_s8(vshrq_n_s8(vreinterpretq_s8_u8(bytes), 7))
+                                    : vceqq_u8(bytes, vdupq_n_u8(tag));
+    uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(matches), 4);
+    return vget_lane_u64(vreinterpret_u64_u8(nibbles), 0) & 0x8888888888888888UL;
+#else
+    unsigned long mask = 0;
+    for (int i = 0; i < GROUP_WIDTH; i++) {
+        if (free_slots ? group[i] >= CONTROL_EMPTY : group[i] == tag) mask |= 8UL << (4 * i);
+    }
+    return mask;
+#endif
+}
+
+static long first_match(unsigned long mask) {
+    return __builtin_ctzl(mask) >> 2;
+}
+
+// Slot holding key, or -1
+static inline long find(const Map *map, long key, unsigned long hash, int string_keys) {
+    if (map->capacity == 0) return -1;
+    unsigned long groups = (unsigned long)map->capacity / GROUP_WIDTH - 1;
+    unsigned long group = (hash >> 7) & groups;
+    for (unsigned long step = 1;; step++) {
+        const unsigned char *control = map->control + group * GROUP_WIDTH;
+        for (unsigned long mask = match_group(control, hash & 0x7f, 0); mask; mask &= mask - 1) {
+            long slot = group * GROUP_WIDTH + first_match(mask);
+            if (keys_equal(map->keys[slot], key, string_keys)) return slot;
+        }
+        if (match_group(control, CONTROL_EMPTY, 0)) return -1;
+        group = (group + step) & groups;
+    }
+}
+
+// First EMPTY or DELETED slot on the probe sequence for hash
+static long find_free(const Map *map, unsigned long hash) {
+    unsigned long groups = (unsigned long)map->capacity / GROUP_WIDTH - 1;
+    unsigned long group = (hash >> 7) & groups;
+    for (unsigned long step = 1;; step++) {
+        unsigned long mask = match_group(map->control + group * GROUP_WIDTH, 0, 1);
+        if (mask) return group * GROUP_WIDTH + first_match(mask);
+        group = (group + step) & groups;
+    }
+}
+
+// Move the entries into a fresh table with room for at least count
+static void rebuild(Map *map, long count, int string_keys) {
+    long capacity = MIN_MAP_CAPACITY;
+    while (capacity - capacity / 8 < count) capacity *= 2;
+    
+    unsigned char *block = malloc(capacity + 2 * capacity * sizeof(long));
+    if (!block) {
+        fprintf(stderr, "Error: out of memory in map\n");
+        exit(1);
+    }
+    Map fresh = {block, (long *)(block + capacity), (long *)(block + capacity) + capacity, 0, capacity, 0};
+    memset(fresh.control, CONTROL_EMPTY, capacity);
+    for (long slot = 0; slot < map->capacity; slot++) {
+        if (map->control[slot] >= CONTROL_EMPTY) continue;
+        unsigned long hash = hash_key(map->keys[slot], string_keys);
+        long target = find_free(&fresh, hash);
+        fresh.control[target] = hash & 0x7f;
+        fresh.keys[target] = map->keys[slot];
+        fresh.values[target] = map->values[slot];
+    }
+    free(map->control);
+    map->control = fresh.control;
+    map->keys = fresh.keys;
+    map->values = fresh.values;
+    map->capacity = capacity;
+    map->growth_left = capacity - capacity / 8 - map->count;
+}
+
+static inline long map_put(Map *map, long key, long value, int string_keys) {
+    unsigned long hash = hash_key(key, string_keys);
+    long slot = find(map, key, hash, string_keys);
+    if (slot < 0) {
+        if (map->growth_left == 0) rebuild(map, 2 * (map->count + 1), string_keys);
+        slot = find_free(map, hash);
+        if (map->control[slot] == CONTROL_EMPTY) map->growth_left--;
+        map->control[slot] = hash & 0x7f;
+        map->keys[slot] = key;
+        map->count++;
+    }
+    map->values[slot] = value;
+    return value;
+}
+
+static inline long map_get(const Map *map, long key, long missing, int string_keys) {
+    long slot = find(map, key, hash_key(key, string_keys), string_keys);
+    return slot < 0 ? missing : map->values[slot];
+}
+
+static inline long map_del(Map *map, long key, int string_keys) {
+    long slot = find(map, key, hash_key(key, string_keys), string_keys);
+    if (slot < 0) return 0;
+    // A group that still has an EMPTY slot ends every probe reaching it,
+    // so no probe continues past this slot and it can become EMPTY too
+    if (match_group(map->control + (slot & ~(long)(GROUP_WIDTH - 1)), CONTROL_EMPTY, 0)) {
+        map->control[slot] = CONTROL_EMPTY;
+        map->growth_left++;
+    } else {
+        map->control[slot] = CONTROL_DELETED;
+    }
+    map->count--;
+    return 1;
+}
+
+static inline void map_reserve(Map *map, long count, int string_keys) {
+    if (count > map->count + map->growth_left) rebuild(map, count, string_keys);
+}
+
+long clumsy_map_int_put(Map *map, long key, long value) { return map_put(map, key, value, 0); }
+long clumsy_map_int_get(Map *map, long key, long missing) { return map_get(map, key, missing, 0); }
+long clumsy_map_int_has(Map *map, long key) { return find(map, key, hash_key(key, 0), 0) >= 0; }
+long clumsy_map_int_del(Map *map, long key) { return map_del(map, key, 0); }
+void clumsy_map_int_reserve(Map *map, long count) { map_reserve(map, count, 0); }
+
+long clumsy_map_str_put(Map *map, const char *key, long value) { return map_put(map, (long)key, value, 1); }
+long clumsy_map_str_get(Map *map, const char *key, long missing) { return map_get(map, (long)key, missing, 1); }
+long clumsy_map_str_has(Map *map, const char *key) { return find(map, (long)key, hash_key((long)key, 1), 1) >= 0; }
+long clumsy_map_str_del(Map *map, const char *key) { return map_del(map, (long)key, 1); }
+void clumsy_map_str_reserve(Map *map, long count) { map_reserve(map, count, 1); }
+
+void clumsy_map_init(Map *map) {
+    own((void **)&map->control);
+    memset(map, 0, sizeof(Map));
+}
+
+// The slot of the first entry after slot, or -1
+long clumsy_map_next(const Map *map, long slot) {
+    for (slot++; slot < map->capacity; slot++) {
+        if (map->control[slot] < CONTROL_EMPTY) return slot;
+    }
+    return -1;
+}
+
+// Bulk array operations, one entry point per element type:
+// clumsy_<op>_<i8|i16|i32|i64|u8|u16|u32|u64>, called with the address of
+// the first element and the count. The loops are written so the compiler
+// turns them into NEON: no early exits, no aliasing, and branchless
+// selects for min and max. sort is a bottom-up merge sort whose first pass
+// sorts blocks of eight with a sorting network.
+
+// Knuth's 19-comparator network for eight elements
+static const unsigned char sort8_network[19][2] = {
+    {0, 2}, {1, 3}, {4, 6}, {5, 7}, {0, 4}, {1, 5}, {2, 6}, {3, 7}, {0, 1}, {2, 3},
+    {4, 5}, {6, 7}, {2, 4}, {3, 5}, {1, 4}, {3, 6}, {1, 2}, {3, 4}, {5, 6},
+};
+
+#define DEFINE_ARRAY_KERNELS(name, type)                                                    \
+    static void sort8_##name(type *a) {                                                     \
+        for (int i = 0; i < 19; i++) {                                                      \
+            type x = a[sort8_network[i][0]], y = a[sort8_network[i][1]];                    \
+            a[sort8_network[i][0]] = y < x ? y : x;                                         \
+            a[sort8_network[i][1]] = y < x ? x : y;                                         \
+        }                                                                                   \
+    }                                                                                       \
+                                                                                            \
+    static void insertion_sort_##name(type *a, long n) {                                    \
+        for (long i = 1; i < n; i++) {                                                      \
+            type x = a[i];                                                                  \
+            long j = i;                                                                     \
+            for (; j > 0 && x < a[j - 1]; j--) a[j] = a[j - 1];                             \
+            a[j] = x;                                                                       \
+        }                                                                                   \
+    }                                                                                       \
+                                                                                            \
+    /* Stable merge of two sorted runs into out, taking from the left on ties */          \
+    static void merge_##name(const type *left, long left_count, const type *right,         \
+                             long right_count, type *out) {                                 \
+        long i = 0, j = 0, k = 0;                                                           \
+        while (i < left_count && j < right_count) {                                         \
+            type x = left[i], y = right[j];                                                 \
+            int take_right = y < x;                                                         \
+            out[k++] = take_right ? y : x;                                                  \
+            j += take_right;                                                                \
+            i += !take_right;                                                               \
+        }                                                                                   \
+        memcpy(out + k, left + i, (left_count - i) * sizeof(type));                         \
+        k += left_count - i;                                                                \
+        memcpy(out + k, right + j, (right_count - j) * sizeof(type));                       \
+    }                                                                                       \
+                                                                                            \
+    void clumsy_sort_##name(type *a, long n) {                                              \
+        long blocks = n / 8 * 8;                                                            \
+        for (long i = 0; i < blocks; i += 8) sort8_##name(a + i);                           \
+        insertion_sort_##name(a + blocks, n - blocks);                                      \
+        if (n <= 8) return;                                                                 \
+                                                                                            \
+        type *buffer = malloc(n * sizeof(type));                                            \
+        if (!buffer) {                                                                      \
+            fprintf(stderr, "Error: out of memory in sort\n");                              \
+            exit(1);                                                                        \
+        }                                                                                   \
+        type *from = a, *to = buffer;                                                       \
+        for (long width = 8; width < n; width *= 2) {                                       \
+            for (long start = 0; start < n; start += 2 * width) {                           \
+                long middle = start + width < n ? start + width : n;                        \
+                long end = start + 2 * width < n ? start + 2 * width : n;                   \
+                if (middle == end || !(from[middle] < from[middle - 1])) {                  \
+                    memcpy(to + start, from + start, (end - start) * sizeof(type));         \
+                } else {                                                                    \
+                    merge_##name(from + start, middle - start, from + middle,               \
+                                 end - middle, to + start);                                 \
+                }                                                                           \
+            }                                                                               \
+            type *swap = from;                                                              \
+            from = to;                                                                      \
+            to = swap;                                                                      \
+        }                                                                                   \
+        if (from != a) memcpy(a, from, n * sizeof(type));                                   \
+        free(buffer);                                                                       \
+    }                                                                                       \
+                                                                                            \
+    /* Index of the first x in the sorted a, or -1. Halving narrows it to a */              \
+    /* block of 16 without branches, then the block is counted at once. */                \
+    long clumsy_search_##name(const type *a, long n, long x) {                              \
+        type key = (type)x;                                                                 \
+        if ((long)key != x) return -1;                                                      \
+        const type *base = a;                                                               \
+        long length = n;                                                                    \
+        while (length > 16) {                                                               \
+            long half = length / 2;                                                         \
+            base = base[half - 1] < key ? base + half : base;                               \
+            length -= half;                                                                 \
+        }                                                                                   \
+        long below = 0;                                                                     \
+        for (long i = 0; i < length; i++) below += base[i] < key;                           \
+        long found = base - a + below;                                                      \
+        return found < n && a[found] == key ? found : -1;                                   \
+    }                                                                                       \
+                                                                                            \
+    long clumsy_sum_##name(const type *a, long n) {                                         \
+        long total = 0;                                                                     \
+        for (long i = 0; i < n; i++) total += a[i];                                         \
+        return total;                                                                       \
+    }                                                                                       \
+                                                                                            \
+    long clumsy_min_##name(const type *a, long n) {                                         \
+        if (n <= 0) return 0;                                                               \
+        type best = a[0];                                                                   \
+        for (long i = 1; i < n; i++) best = a[i] < best ? a[i] : best;                      \
+        return (long)best;                                                                  \
+    }                                                                                       \
+                                                                                            \
+    long clumsy_max_##name(const type *a, long n) {                                         \
+        if (n <= 0) return 0;                                                               \
+        type best = a[0];                                                                   \
+        for (long i = 1; i < n; i++) best = a[i] > best ? a[i] : best;                      \
+        return (long)best;                                                                  \
+    }                                                                                       \
+                                                                                            \
+    void clumsy_fill_##name(type *a, long n, long x) {                                      \
+        type value = (type)x;                                                               \
+        for (long i = 0; i < n; i++) a[i] = value;                                          \
+    }
+
+DEFINE_ARRAY_KERNELS(i8, signed char)
+DEFINE_ARRAY_KERNELS(i16, short)
+DEFINE_ARRAY_KERNELS(i32, int)
+DEFINE_ARRAY_KERNELS(i64, long)
+DEFINE_ARRAY_KERNELS(u8, unsigned char)
+DEFINE_ARRAY_KERNELS(u16, unsigned short)
+DEFINE_ARRAY_KERNELS(u32, unsigned int)
+DEFINE_ARRAY_KERNELS(u64, unsigned long)
+
+// Parallel loops. clumsy_pfor runs chunk(context, start, end) over pieces
+// of [start, end) on a pool of threads started on first use, one per online
+// core unless CLUMSY_THREADS says otherwise, with the calling thread as
+// worker 0. Every worker owns a deque of ranges. It splits the range it
+// holds in half, pushing the upper half to the bottom of its deque, until
+// the range is down to the grain, runs it, and pops the next one from the
+// bottom. A worker whose deque is empty steals from the top of another's,
+// where the oldest and biggest ranges wait, so one steal moves plenty of
+// work and owners and thieves work at opposite ends. Each deque has its
+// own lock, taken a few times per grain of iterations. A pfor reached from
+// inside a chunk runs serially on the thread that reaches it.
+
+#define MAX_WORKERS 64
+#define DEQUE_CAPACITY 64       // ranges halve as they go down a deque
+#define GRAINS_PER_WORKER 8
+
+typedef void (*ChunkFunction)(void *context, long start, long end);
+
+typedef struct {
+    long start;
+    long end;
+} Range;
+
+typedef struct {
+    pthread_mutex_t lock;
+    Range ranges[DEQUE_CAPACITY];   // indexed modulo the capacity
+    long top;                       // oldest range, taken by thieves
+    long bottom;                    // one past the newest, taken by the owner
+} Deque;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t posted;          // a loop is ready for the helpers
+    pthread_cond_t finished;        // the last helper left the loop
+    int workers;                    // threads sharing loops, the caller included
+    long generation;                // loops posted so far
+    int busy;                       // helpers still in the current loop
+    ChunkFunction chunk;
+    void *context;
+    long grain;
+    long remaining;                 // iterations not yet run
+    Deque deques[MAX_WORKERS];
+} pool = {.lock = PTHREAD_MUTEX_INITIALIZER, .posted = PTHREAD_COND_INITIALIZER, .finished = PTHREAD_COND_INITIALIZER};
+
+static pthread_once_t pool_started = PTHREAD_ONCE_INIT;
+
+static void push_range(Deque *deque, long start, long end) {
+    pthread_mutex_lock(&deque->lock);
+    Range *range = &deque->ranges[deque->bottom++ % DEQUE_CAPACITY];
+    range->start = start;
+    range->end = end;
+    pthread_mutex_unlock(&deque->lock);
+}
+
+// The newest range of the worker's own deque, else the oldest of the
+// first other deque that has one
+static int take_range(int self, Range *range) {
+    for (int i = 0; i < pool.workers; i++) {
+        Deque *deque = &pool.deques[(self + i) % pool.workers];
+        pthread_mutex_lock(&deque->lock);
+        int found = deque->top < deque->bottom;
+        if (found) {
+            long index = i == 0 ? --deque->bottom : deque->top++;
+            *range = deque->ranges[index % DEQUE_CAPACITY];
+        }
+        pthread_mutex_unlock(&deque->lock);
+        if (found) return 1;
+    }
+    return 0;
+}
+
+static void run_loop(int self) {
+    in_chunk = 1;
+    Range range;
+    while (__atomic_load_n(&pool.remaining, __ATOMIC_ACQUIRE) > 0) {
+        if (!take_range(self, &range)) {
+            sched_yield();
+            continue;
+        }
+        while (range.end - range.start > pool.grain) {
+            long middle = range.start + (range.end - range.start) / 2;
+            push_range(&pool.deques[self], middle, range.end);
+            range.end = middle;
+        }
+        pool.chunk(pool.context, range.start, range.end);
+        __atomic_sub_fetch(&pool.remaining, range.end - range.start, __ATOMIC_RELEASE);
+    }
+    in_chunk = 0;
+}
+
+static void *run_helper(void *argument) {
+    int self = (int)(long)argument;
+    long seen = 0;
+    pthread_mutex_lock(&pool.lock);
+    for (;;) {
+        while (pool.generation == seen) {
+            pthread_cond_wait(&pool.posted, &pool.lock);
+        }
+        seen = pool.generation;
+        pthread_mutex_unlock(&pool.lock);
+        run_loop(self);
+        pthread_mutex_lock(&pool.lock);
+        if (--pool.busy == 0) {
+            pthread_cond_signal(&pool.finished);
+        }
+    }
+    return NULL;
+}
+
+static void start_pool(void) {
+    const char *setting = getenv("CLUMSY_THREADS");
+    long workers = setting ? atol(setting) : sysconf(_SC_NPROCESSORS_ONLN);
+    if (workers < 1) workers = 1;
+    if (workers > MAX_WORKERS) workers = MAX_WORKERS;
+    
+    for (long i = 0; i < workers; i++) {
+        pthread_mutex_init(&pool.deques[i].lock, NULL);
+    }
+    pool.workers = 1;
+    for (long i = 1; i < workers; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, run_helper, (void *)i) != 0) break;
+        pthread_detach(thread);
+        pool.workers++;
+    }
+}
+
+void clumsy_pfor(ChunkFunction chunk, void *context, long start, long end) {
+    if (end <= start) return;
+    // Output printed so far goes out ahead of anything chunks write from C
+    clumsy_flush();
+    pthread_once(&pool_started, start_pool);
+    long count = end - start;
+    if (in_chunk || pool.workers == 1 || count == 1) {
+        chunk(context, start, end);
+        return;
+    }
+    
+    // Deal the range out in equal slices so every worker starts busy
+    pthread_mutex_lock(&pool.lock);
+    pool.chunk = chunk;
+    pool.context = context;
+    pool.grain = count / (pool.workers * GRAINS_PER_WORKER);
+    if (pool.grain < 1) pool.grain = 1;
+    pool.remaining = count;
+    long slice = count / pool.workers;
+    for (int i = 0; i < pool.workers; i++) {
+        Deque *deque = &pool.deques[i];
+        long slice_start = start + i * slice;
+        long slice_end = i == pool.workers - 1 ? end : slice_start + slice;
+        deque->top = deque->bottom = 0;
+        if (slice_end > slice_start) {
+            deque->ranges[deque->bottom++] = (Range){slice_start, slice_end};
+        }
+    }
+    pool.busy = pool.workers - 1;
+    pool.generation++;
+    pthread_cond_broadcast(&pool.posted);
+    pthread_mutex_unlock(&pool.lock);
+    
+    run_loop(0);
+    pthread_mutex_lock(&pool.lock);
+    while (pool.busy > 0) {
+        pthread_cond_wait(&pool.finished, &pool.lock);
+    }
+    pthread_mutex_unlock(&pool.lock);
+}
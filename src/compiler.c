@@ -1,4 +1,5 @@
 #include "compiler.h"
+#include <ctype.h>
 #include <stdarg.h>
 
 // Global struct type table  
@@ -21,6 +22,48 @@ CodeGen *create_codegen(void) {
     codegen->output[0] = '\0';
     codegen->output_size = 0;
     codegen->label_counter = 0;
+    codegen->return_label = NULL;
+    codegen->framed_return_label = NULL;
+    codegen->frame_record_offset = -1;
+    codegen->frame_saved = false;
+    codegen->framed_return_used = false;
+    codegen->tail_position = false;
+    codegen->dead_store = false;
+    codegen->spill_base = 0;
+    codegen->spill_depth = 0;
+    codegen->spill_max = 0;
+    codegen->region_depth = 0;
+    codegen->simd_depth = 0;
+    codegen->in_pfor_chunk = false;
+    memset(codegen->cached_values, 0, sizeof(codegen->cached_values));
+    codegen->repeated_exprs = NULL;
+    codegen->repeated_count = 0;
+    codegen->induction_count = 0;
+    codegen->pinned_regs = 0;
+    codegen->synthesized = NULL;
+    codegen->synthesized_count = 0;
+    codegen->synthesized_capacity = 0;
+    codegen->constants.output_capacity = 4096;
+    codegen->constants.output = malloc(codegen->constants.output_capacity);
+    if (!codegen->constants.output) {
+        fprintf(stderr, "Error: Failed to allocate memory for constants\n");
+        exit(1);
+    }
+    codegen->constants.output[0] = '\0';
+    codegen->constants.output_size = 0;
+    codegen->constant_count = 0;
+    codegen->outlined.output_capacity = 4096;
+    codegen->outlined.output = malloc(codegen->outlined.output_capacity);
+    if (!codegen->outlined.output) {
+        fprintf(stderr, "Error: Failed to allocate memory for outlined code\n");
+        exit(1);
+    }
+    codegen->outlined.output[0] = '\0';
+    codegen->outlined.output_size = 0;
+    codegen->outlined_count = 0;
+    codegen->strings = NULL;
+    codegen->string_count = 0;
+    codegen->string_capacity = 0;
     
     return codegen;
 }
@@ -28,6 +71,24 @@ CodeGen *create_codegen(void) {
 void free_codegen(CodeGen *codegen) {
     if (codegen) {
         free(codegen->output);
+        free(codegen->constants.output);
+        free(codegen->outlined.output);
+        for (size_t i = 0; i < codegen->string_count; i++) {
+            free(codegen->strings[i].text);
+        }
+        free(codegen->strings);
+        free(codegen->repeated_exprs);
+        // Synthesized nodes share subtrees, so each frees only itself
+        for (size_t i = 0; i < codegen->synthesized_count; i++) {
+            ASTNode *node = codegen->synthesized[i];
+            if (node->type == AST_IDENTIFIER || node->type == AST_STRING) {
+                free(node->data.string_value);
+            } else if (node->type == AST_LIST || node->type == AST_ARRAY) {
+                free(node->data.list.children);
+            }
+            free(node);
+        }
+        free(codegen->synthesized);
         free(codegen);
     }
 }
@@ -68,6 +129,287 @@ char *new_label(CodeGen *codegen, const char *prefix) {
     return label;
 }
 
+void push_output_buffer(CodeGen *codegen, OutputBuffer *saved) {
+    saved->output = codegen->output;
+    saved->output_size = codegen->output_size;
+    saved->output_capacity = codegen->output_capacity;
+    
+    codegen->output_capacity = 4096;
+    codegen->output = malloc(codegen->output_capacity);
+    if (!codegen->output) {
+        fprintf(stderr, "Error: Failed to allocate memory for output buffer\n");
+        exit(1);
+    }
+    codegen->output[0] = '\0';
+    codegen->output_size = 0;
+}
+
+// Returns the code emitted since the matching push; the caller frees it
+char *pop_output_buffer(CodeGen *codegen, OutputBuffer *saved) {
+    char *text = codegen->output;
+    codegen->output = saved->output;
+    codegen->output_size = saved->output_size;
+    codegen->output_capacity = saved->output_capacity;
+    return text;
+}
+
+// Spill slots sit above the locals (and the frame record, when reserved) and
+// hold intermediate values across code that clobbers every scratch register
+int push_spill_slot(CodeGen *codegen) {
+    int offset = codegen->spill_base + codegen->spill_depth * 8;
+    codegen->spill_depth++;
+    if (codegen->spill_depth > codegen->spill_max) {
+        codegen->spill_max = codegen->spill_depth;
+    }
+    return offset;
+}
+
+void pop_spill_slot(CodeGen *codegen) {
+    codegen->spill_depth--;
+}
+
+static const char *operator_name(ASTNode *expr);
+
+// A new identifier node, so each use in a rewritten tree is freed once
+static ASTNode *new_identifier(const char *name) {
+    ASTNode *identifier = create_ast_node(AST_IDENTIFIER);
+    identifier->data.string_value = strdup(name);
+    return identifier;
+}
+
+// (for (x v) body) over the elements of vec v becomes the counted loop
+// (for (x.index 0 (len v)) (begin (set x v[x.index]) body)), so it gets
+// unrolled and keeps a pointer to the element like any other loop
+static void lower_vec_loop(SymbolTable *table, ASTNode *loop, Symbol *symbol) {
+    ASTNode *header = loop->data.list.children[1];
+    ASTNode *element = header->data.list.children[0];
+    ASTNode *vec = header->data.list.children[1];
+    SymbolType element_type = symbol->type_info.pointer.element_type;
+    
+    char index_name[128];
+    snprintf(index_name, sizeof(index_name), "%s.index", element->data.string_value);
+    ASTNode *index = new_identifier(index_name);
+    ASTNode *start = create_ast_node(AST_INT);
+    start->data.int_value = 0;
+    ASTNode *end = create_ast_node(AST_LIST);
+    add_ast_child(end, new_identifier("len"));
+    add_ast_child(end, vec);
+    header->data.list.children[0] = index;
+    header->data.list.children[1] = start;
+    add_ast_child(header, end);
+    
+    ASTNode *load = create_ast_node(AST_LIST);
+    ASTNode *access = create_ast_node(AST_LIST);
+    const char *names[] = {"begin", "set", "[]"};
+    ASTNode *ops[3];
+    for (int i = 0; i < 3; i++) {
+        ops[i] = new_identifier(names[i]);
+    }
+    add_ast_child(access, ops[2]);
+    add_ast_child(access, new_identifier(vec->data.string_value));
+    add_ast_child(access, new_identifier(index_name));
+    add_ast_child(load, ops[1]);
+    add_ast_child(load, element);
+    add_ast_child(load, access);
+    ASTNode *body = create_ast_node(AST_LIST);
+    add_ast_child(body, ops[0]);
+    add_ast_child(body, load);
+    if (loop->data.list.count >= 3) add_ast_child(body, loop->data.list.children[2]);
+    if (loop->data.list.count >= 3) {
+        loop->data.list.children[2] = body;
+    } else {
+        add_ast_child(loop, body);
+    }
+    
+    if (!find_symbol(table, element->data.string_value)) {
+        Symbol declared = {0};
+        declared.name = strdup(element->data.string_value);
+        declared.type = element_type;
+        add_symbol(table, declared);
+    }
+}
+
+// (for (k m) body) binds k to each key of map m
+static void declare_map_loop(SymbolTable *table, ASTNode *loop, Symbol *symbol) {
+    const char *key = loop->data.list.children[1]->data.list.children[0]->data.string_value;
+    if (!find_symbol(table, key)) {
+        Symbol declared = {0};
+        declared.name = strdup(key);
+        declared.type = symbol->type_info.map.key_type;
+        add_symbol(table, declared);
+    }
+}
+
+// Declare the induction variable of every (for (i start end) body) in node
+// as an int, unless the table already has it
+static void declare_loop_variables(SymbolTable *table, ASTNode *node) {
+    if (!node || node->type != AST_LIST || is_function_definition(node)) return;
+    
+    const char *op = operator_name(node);
+    if (op && strcmp(op, "for") == 0 && node->data.list.count >= 2 &&
+        node->data.list.children[1]->type == AST_LIST && node->data.list.children[1]->data.list.count == 2 &&
+        node->data.list.children[1]->data.list.children[0]->type == AST_IDENTIFIER &&
+        node->data.list.children[1]->data.list.children[1]->type == AST_IDENTIFIER) {
+        const char *collection = node->data.list.children[1]->data.list.children[1]->data.string_value;
+        Symbol *symbol = find_symbol(table, collection);
+        if (symbol && symbol->type == SYM_VEC) {
+            lower_vec_loop(table, node, symbol);
+        } else if (symbol && symbol->type == SYM_MAP) {
+            declare_map_loop(table, node, symbol);
+        } else {
+            fprintf(stderr, "Error: for over %s needs a vec or a map\n", collection);
+            exit(1);
+        }
+    }
+    
+    const char *variable = loop_variable(node);
+    if (variable && !find_symbol(table, variable)) {
+        Symbol symbol = {0};
+        symbol.name = strdup(variable);
+        symbol.type = SYM_INT;
+        add_symbol(table, symbol);
+    }
+    for (size_t i = 0; i < node->data.list.count; i++) {
+        declare_loop_variables(table, node->data.list.children[i]);
+    }
+}
+
+// Element type and length of an array type ([] T n) or (array_type T n);
+// false when type_node is not one. The length may be left out, as it is
+// for parameters.
+static bool parse_array_type(ASTNode *type_node, Symbol *symbol) {
+    if (type_node->type != AST_LIST || type_node->data.list.count < 2) return false;
+    ASTNode *array_op = type_node->data.list.children[0];
+    if (array_op->type != AST_IDENTIFIER ||
+        (strcmp(array_op->data.string_value, "array_type") != 0 &&
+         strcmp(array_op->data.string_value, "[]") != 0)) {
+        return false;
+    }
+    symbol->type = SYM_ARRAY;
+    ASTNode *element = type_node->data.list.children[1];
+    if (element->type != AST_IDENTIFIER ||
+        !parse_scalar_type(element->data.string_value, &symbol->type_info.array.element_type)) {
+        fprintf(stderr, "Error: array elements of %s must be a scalar type\n", symbol->name);
+        exit(1);
+    }
+    if (type_node->data.list.count >= 3) {
+        ASTNode *length = type_node->data.list.children[2];
+        if (length->type != AST_INT || length->data.int_value <= 0) {
+            fprintf(stderr, "Error: array %s needs a positive constant length\n", symbol->name);
+            exit(1);
+        }
+        symbol->type_info.array.size = length->data.int_value;
+    }
+    return true;
+}
+
+// Add the variable a (let ...) statement declares
+static void declare_let(SymbolTable *table, ASTNode *stmt) {
+    ASTNode *name_node = stmt->data.list.children[1];
+    
+    if (name_node->type == AST_IDENTIFIER) {
+        Symbol symbol = {0};
+        symbol.name = strdup(name_node->data.string_value);
+        
+        // Determine if this is 3-element (let name value) or 4-element (let name type value) format
+        if (stmt->data.list.count == 3) {
+            // 3-element format: (let name value) - infer type from value
+            symbol.type = SYM_INT; // default type for 3-element format
+        } else if (stmt->data.list.count >= 4) {
+            // 4-element format: (let name type value) - explicit type
+            ASTNode *type_node = stmt->data.list.children[2];
+            
+            // Parse type
+            if (type_node->type == AST_IDENTIFIER) {
+                if (parse_scalar_type(type_node->data.string_value, &symbol.type)) {
+                    // int, str, char, bool or a sized integer
+                } else if (strcmp(type_node->data.string_value, "struct") == 0) {
+                    // Skip struct type definitions, they don't create variables
+                    return;
+                } else if (parse_vector_type(type_node->data.string_value, &symbol.type_info.vector)) {
+                    symbol.type = SYM_VECTOR;
+                } else if (parse_pointer_type(type_node->data.string_value, &symbol)) {
+                    // *T
+                } else if (parse_vec_type(type_node->data.string_value, &symbol)) {
+                    // vec<T>
+                } else if (parse_map_type(type_node->data.string_value, &symbol)) {
+                    // map<K,V>
+                } else {
+                    // This might be a user-defined struct type name
+                    symbol.type = SYM_STRUCT;
+                    symbol.type_info.struct_instance.struct_type_name = strdup(type_node->data.string_value);
+                }
+            } else if (!parse_array_type(type_node, &symbol)) {
+                symbol.type = SYM_INT; // default
+            }
+        } else {
+            symbol.type = SYM_INT; // default
+        }
+        
+        // Check different let statement formats:
+        // 3 elements: (let name (fn ...))  
+        // 4 elements: (let name type value) or (let name type (fn ...))
+        if (stmt->data.list.count == 3) {
+            symbol.init_value = stmt->data.list.children[2];
+        } else if (stmt->data.list.count >= 4) {
+            symbol.init_value = stmt->data.list.children[3];
+        } else {
+            symbol.init_value = NULL;
+        }
+        
+        // Check if this is a function definition: (let name (fn ...))
+        if (symbol.init_value && symbol.init_value->type == AST_LIST && 
+            symbol.init_value->data.list.count >= 3) {
+            ASTNode *fn_node = symbol.init_value->data.list.children[0];
+            if (fn_node->type == AST_IDENTIFIER && strcmp(fn_node->data.string_value, "fn") == 0) {
+                symbol.type = SYM_FUNCTION;
+                // For now, set basic function info (can be expanded later)
+                symbol.type_info.function.param_count = 0;
+                symbol.type_info.function.param_types = NULL;
+                symbol.type_info.function.return_type = SYM_INT; // default
+            }
+        }
+        
+        // (let name vec<T>) and (let name map<K,V>) declare empty ones
+        if (stmt->data.list.count == 3 && symbol.init_value->type == AST_IDENTIFIER &&
+            (parse_vec_type(symbol.init_value->data.string_value, &symbol) ||
+             parse_map_type(symbol.init_value->data.string_value, &symbol))) {
+            symbol.init_value = NULL;
+        }
+        
+        // (let name (alloc T n)) holds a pointer to the elements
+        SymbolType element_type;
+        if (stmt->data.list.count == 3 && alloc_element_type(symbol.init_value, &element_type)) {
+            symbol.type = SYM_POINTER;
+            symbol.type_info.pointer.element_type = element_type;
+        }
+        
+        add_symbol(table, symbol);
+    }
+}
+
+// Declare the variables of the lets inside region blocks in node. They live
+// in the frame of the enclosing function, or the program's, like any other.
+static void declare_region_variables(SymbolTable *table, ASTNode *node) {
+    if (!node || node->type != AST_LIST || is_function_definition(node)) return;
+    
+    const char *op = operator_name(node);
+    if (op && strcmp(op, "region") == 0) {
+        for (size_t i = 1; i < node->data.list.count; i++) {
+            ASTNode *stmt = node->data.list.children[i];
+            const char *stmt_op = operator_name(stmt);
+            if (stmt_op && strcmp(stmt_op, "let") == 0 && stmt->data.list.count >= 3 &&
+                stmt->data.list.children[1]->type == AST_IDENTIFIER &&
+                !find_symbol(table, stmt->data.list.children[1]->data.string_value)) {
+                declare_let(table, stmt);
+            }
+        }
+    }
+    for (size_t i = 0; i < node->data.list.count; i++) {
+        declare_region_variables(table, node->data.list.children[i]);
+    }
+}
+
 SymbolTable *build_symbol_table(ASTNode *ast) {
     SymbolTable *table = malloc(sizeof(SymbolTable));
     if (!table) {
@@ -90,84 +432,15 @@ SymbolTable *build_symbol_table(ASTNode *ast) {
                 
                 if (op->type == AST_IDENTIFIER && strcmp(op->data.string_value, "let") == 0) {
                     // Variable declaration
-                    ASTNode *name_node = stmt->data.list.children[1];
-                    
-                    if (name_node->type == AST_IDENTIFIER) {
-                        Symbol symbol;
-                        symbol.name = strdup(name_node->data.string_value);
-                        
-                        // Determine if this is 3-element (let name value) or 4-element (let name type value) format
-                        if (stmt->data.list.count == 3) {
-                            // 3-element format: (let name value) - infer type from value
-                            symbol.type = SYM_INT; // default type for 3-element format
-                        } else if (stmt->data.list.count >= 4) {
-                            // 4-element format: (let name type value) - explicit type
-                            ASTNode *type_node = stmt->data.list.children[2];
-                            
-                            // Parse type
-                            if (type_node->type == AST_IDENTIFIER) {
-                                if (strcmp(type_node->data.string_value, "int") == 0) {
-                                    symbol.type = SYM_INT;
-                                } else if (strcmp(type_node->data.string_value, "str") == 0) {
-                                    symbol.type = SYM_STR;
-                                } else if (strcmp(type_node->data.string_value, "char") == 0) {
-                                    symbol.type = SYM_CHAR;
-                                } else if (strcmp(type_node->data.string_value, "bool") == 0) {
-                                    symbol.type = SYM_BOOL;
-                                } else if (strcmp(type_node->data.string_value, "struct") == 0) {
-                                    // Skip struct type definitions, they don't create variables
-                                    continue;
-                                } else {
-                                    // This might be a user-defined struct type name
-                                    symbol.type = SYM_STRUCT;
-                                    symbol.type_info.struct_instance.struct_type_name = strdup(type_node->data.string_value);
-                                }
-                            } else if (type_node->type == AST_LIST && type_node->data.list.count >= 2) {
-                                // Handle array types: (array_type int 4) or ([] int 4)
-                                ASTNode *array_op = type_node->data.list.children[0];
-                                if (array_op->type == AST_IDENTIFIER && 
-                                    (strcmp(array_op->data.string_value, "array_type") == 0 ||
-                                     strcmp(array_op->data.string_value, "[]") == 0)) {
-                                    symbol.type = SYM_ARRAY; // Properly set as array type
-                                } else {
-                                    symbol.type = SYM_INT; // default
-                                }
-                            } else {
-                                symbol.type = SYM_INT; // default
-                            }
-                        } else {
-                            symbol.type = SYM_INT; // default
-                        }
-                        
-                        // Check different let statement formats:
-                        // 3 elements: (let name (fn ...))  
-                        // 4 elements: (let name type value) or (let name type (fn ...))
-                        if (stmt->data.list.count == 3) {
-                            symbol.init_value = stmt->data.list.children[2];
-                        } else if (stmt->data.list.count >= 4) {
-                            symbol.init_value = stmt->data.list.children[3];
-                        } else {
-                            symbol.init_value = NULL;
-                        }
-                        
-                        // Check if this is a function definition: (let name (fn ...))
-                        if (symbol.init_value && symbol.init_value->type == AST_LIST && 
-                            symbol.init_value->data.list.count >= 3) {
-                            ASTNode *fn_node = symbol.init_value->data.list.children[0];
-                            if (fn_node->type == AST_IDENTIFIER && strcmp(fn_node->data.string_value, "fn") == 0) {
-                                symbol.type = SYM_FUNCTION;
-                                // For now, set basic function info (can be expanded later)
-                                symbol.type_info.function.param_count = 0;
-                                symbol.type_info.function.param_types = NULL;
-                                symbol.type_info.function.return_type = SYM_INT; // default
-                            }
-                        }
-                        
-                        add_symbol(table, symbol);
-                    }
+                    declare_let(table, stmt);
                 }
             }
         }
+        for (size_t i = 0; i < ast->data.list.count; i++) {
+            declare_region_variables(table, ast->data.list.children[i]);
+            declare_loop_variables(table, ast->data.list.children[i]);
+        }
+        mark_address_taken(table, ast);
     }
     
     return table;
@@ -194,22 +467,363 @@ Symbol *find_symbol(SymbolTable *table, const char *name) {
     return NULL;
 }
 
-int get_symbol_offset(SymbolTable *table, const char *name) {
+// Scalar type names. int is i64; char and bool are single unsigned bytes.
+static const struct {
+    const char *name;
+    SymbolType type;
+} scalar_types[] = {
+    {"int", SYM_INT}, {"str", SYM_STR}, {"char", SYM_CHAR}, {"bool", SYM_BOOL},
+    {"i8", SYM_I8}, {"i16", SYM_I16}, {"i32", SYM_I32}, {"i64", SYM_INT},
+    {"u8", SYM_U8}, {"u16", SYM_U16}, {"u32", SYM_U32}, {"u64", SYM_U64},
+};
+
+bool parse_scalar_type(const char *name, SymbolType *type) {
+    for (size_t i = 0; i < sizeof(scalar_types) / sizeof(scalar_types[0]); i++) {
+        if (strcmp(scalar_types[i].name, name) == 0) {
+            *type = scalar_types[i].type;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Bytes a scalar takes in memory. In registers every value is widened to
+// 64 bits; stores keep the low bytes.
+int type_size(SymbolType type) {
+    switch (type) {
+        case SYM_CHAR: case SYM_BOOL: case SYM_I8: case SYM_U8:
+            return 1;
+        case SYM_I16: case SYM_U16:
+            return 2;
+        case SYM_I32: case SYM_U32:
+            return 4;
+        default:
+            return 8;
+    }
+}
+
+// log2 of a power-of-two size in bytes
+static int size_shift(int size) {
+    int shift = 0;
+    while ((1 << shift) < size) shift++;
+    return shift;
+}
+
+// log2 of type_size, the shift that scales an index to a byte offset
+static int type_shift(SymbolType type) {
+    return size_shift(type_size(type));
+}
+
+static bool type_is_signed(SymbolType type) {
+    return type == SYM_INT || type == SYM_I8 || type == SYM_I16 || type == SYM_I32;
+}
+
+static StructType *nested_struct_type(StructField *field) {
+    if (field->type != SYM_STRUCT) return NULL;
+    StructType *type = field->struct_type_name ? find_struct_type(global_struct_types, field->struct_type_name) : NULL;
+    if (!type) {
+        fprintf(stderr, "Error: unknown struct type %s for field %s\n",
+                field->struct_type_name ? field->struct_type_name : "?", field->name);
+        exit(1);
+    }
+    return type;
+}
+
+static int layout_struct_nested(StructType *type, int *offsets, int *alignment, int depth) {
+    if (depth > 64) {
+        fprintf(stderr, "Error: struct %s contains itself\n", type->name);
+        exit(1);
+    }
+    int size = 0, widest = 1;
+    for (size_t i = 0; i < type->count; i++) {
+        StructType *nested = nested_struct_type(&type->fields[i]);
+        int field_alignment = type_size(type->fields[i].type);
+        int field_size = nested ? layout_struct_nested(nested, NULL, &field_alignment, depth + 1) : field_alignment;
+        size = (size + field_alignment - 1) & ~(field_alignment - 1);
+        if (offsets) offsets[i] = size;
+        size += field_size;
+        if (field_alignment > widest) widest = field_alignment;
+    }
+    if (alignment) *alignment = widest;
+    return (size + widest - 1) & ~(widest - 1);
+}
+
+// Natural-alignment layout: each field at the next multiple of its own
+// alignment (a nested struct's widest field), the total padded to the
+// widest alignment. Fills offsets when given and returns the struct size.
+int layout_struct(StructType *type, int *offsets, int *alignment) {
+    return layout_struct_nested(type, offsets, alignment, 0);
+}
+
+// Declared element count; array parameters carry none and hold 4
+int array_length(Symbol *symbol) {
+    return symbol->type_info.array.size > 0 ? symbol->type_info.array.size : 4;
+}
+
+static StructType *symbol_struct_type(Symbol *symbol) {
+    return find_struct_type(global_struct_types, symbol->type_info.struct_instance.struct_type_name);
+}
+
+// Struct a *T pointer points at, or NULL when T is a scalar
+static StructType *pointee_struct_type(Symbol *symbol) {
+    const char *name = symbol->type_info.pointer.struct_type_name;
+    if (!name) return NULL;
+    StructType *type = find_struct_type(global_struct_types, name);
+    if (!type) {
+        fprintf(stderr, "Error: unknown struct type %s for pointer %s\n", name, symbol->name);
+        exit(1);
+    }
+    return type;
+}
+
+// Stack bytes a symbol occupies; functions and eliminated variables take none
+static int symbol_slot_size(Symbol *symbol) {
+    if (symbol->type == SYM_FUNCTION || symbol->eliminated) {
+        return 0;
+    } else if (symbol->type == SYM_ARRAY) {
+        return array_length(symbol) * type_size(symbol->type_info.array.element_type);
+    } else if (symbol->type == SYM_STRUCT) {
+        StructType *type = symbol_struct_type(symbol);
+        return type ? layout_struct(type, NULL, NULL) : 16;
+    } else if (symbol->type == SYM_VECTOR) {
+        return 16; // one q register
+    } else if (symbol->type == SYM_VEC) {
+        return VEC_HEADER_SIZE;
+    } else if (symbol->type == SYM_MAP) {
+        return MAP_HEADER_SIZE;
+    }
+    return type_size(symbol->type);
+}
+
+// Every slot is naturally aligned; vectors go on 16 bytes so ldr/str q can
+// address them
+static int symbol_alignment(Symbol *symbol) {
+    int alignment = 8;
+    if (symbol->type == SYM_VECTOR) {
+        alignment = 16;
+    } else if (symbol->type == SYM_ARRAY) {
+        alignment = type_size(symbol->type_info.array.element_type);
+    } else if (symbol->type == SYM_STRUCT) {
+        StructType *type = symbol_struct_type(symbol);
+        if (type) layout_struct(type, NULL, &alignment);
+    } else if (symbol->type != SYM_FUNCTION) {
+        alignment = type_size(symbol->type);
+    }
+    // Aggregates start on 8 bytes so they can move as whole x registers
+    if ((symbol->type == SYM_ARRAY || symbol->type == SYM_STRUCT) && alignment < 8) {
+        alignment = 8;
+    }
+    return alignment;
+}
+
+static bool is_aggregate(Symbol *symbol) {
+    return symbol->type == SYM_ARRAY || symbol->type == SYM_STRUCT;
+}
+
+// Pointers and vecs keep their elements behind the pointer in their slot
+static bool is_indirect(Symbol *symbol) {
+    return symbol && (symbol->type == SYM_POINTER || symbol->type == SYM_VEC);
+}
+
+// Offset of the named slot, or the frame size when name is NULL. Scalars
+// and vectors come first and aggregates after them, so the slots most code
+// touches keep short sp offsets even behind a large buffer.
+static int layout_frame(SymbolTable *table, const char *name) {
     int offset = 0;
-    for (size_t i = 0; i < table->count; i++) {
-        if (strcmp(table->symbols[i].name, name) == 0) {
-            return offset;
+    for (int aggregates = 0; aggregates < 2; aggregates++) {
+        for (size_t i = 0; i < table->count; i++) {
+            Symbol *symbol = &table->symbols[i];
+            if (is_aggregate(symbol) != (aggregates == 1)) continue;
+            int size = symbol_slot_size(symbol);
+            if (size > 0) {
+                int alignment = symbol_alignment(symbol);
+                offset = (offset + alignment - 1) & ~(alignment - 1);
+            }
+            if (name && strcmp(symbol->name, name) == 0) {
+                return size > 0 ? offset : -1;
+            }
+            offset += size;
         }
-        // Calculate space needed for this symbol
-        if (table->symbols[i].type == SYM_ARRAY) {
-            offset += 32; // 4 elements × 8 bytes for arrays (assuming int[4])
-        } else if (table->symbols[i].type == SYM_STRUCT) {
-            offset += 16; // 2 fields × 8 bytes for structs  
-        } else {
-            offset += 8; // 8 bytes for regular variables
+    }
+    return name ? -1 : offset; // Not found
+}
+
+int get_symbol_offset(SymbolTable *table, const char *name) {
+    return layout_frame(table, name);
+}
+
+
+// Field path rooted at a struct variable, whose offset is in the frame, or
+// at a pointer to a struct, set in *pointer, whose offset is from where it
+// points
+static bool resolve_field_path(SymbolTable *symbols, ASTNode *expr, int *offset, SymbolType *type, StructType **nested,
+                               Symbol **pointer) {
+    if (expr->type == AST_IDENTIFIER) {
+        Symbol *symbol = find_symbol(symbols, expr->data.string_value);
+        if (symbol && symbol->type == SYM_POINTER && symbol->type_info.pointer.struct_type_name) {
+            *pointer = symbol;
+            *offset = 0;
+            *type = SYM_STRUCT;
+            *nested = pointee_struct_type(symbol);
+            return true;
+        }
+        if (!symbol || symbol->type != SYM_STRUCT) return false;
+        *offset = get_symbol_offset(symbols, expr->data.string_value);
+        *type = SYM_STRUCT;
+        *nested = symbol_struct_type(symbol);
+        return *offset >= 0 && *nested;
+    }
+    
+    const char *op = operator_name(expr);
+    if (!op || strcmp(op, ".") != 0 || expr->data.list.count < 3 ||
+        expr->data.list.children[2]->type != AST_IDENTIFIER) {
+        return false;
+    }
+    StructType *base;
+    if (!resolve_field_path(symbols, expr->data.list.children[1], offset, type, &base, pointer) || !base) return false;
+    
+    const char *field = expr->data.list.children[2]->data.string_value;
+    int offsets[base->count > 0 ? base->count : 1];
+    layout_struct(base, offsets, NULL);
+    for (size_t i = 0; i < base->count; i++) {
+        if (strcmp(base->fields[i].name, field) == 0) {
+            *offset += offsets[i];
+            *type = base->fields[i].type;
+            *nested = nested_struct_type(&base->fields[i]);
+            return true;
         }
     }
-    return -1; // Not found
+    return false;
+}
+
+// Offset and type of the field selected by a struct variable or a field
+// access such as p.x or p.inner.x. *nested is the field's struct type, or
+// NULL for a scalar. False when expr names no field in the frame.
+bool resolve_field(SymbolTable *symbols, ASTNode *expr, int *offset, SymbolType *type, StructType **nested) {
+    Symbol *pointer = NULL;
+    return resolve_field_path(symbols, expr, offset, type, nested, &pointer) && !pointer;
+}
+
+// Like resolve_field for p.x or p.inner.x with p a pointer to a struct;
+// the offset is from where p points
+static bool resolve_pointer_field(SymbolTable *symbols, ASTNode *expr, int *offset, SymbolType *type, StructType **nested,
+                                  Symbol **pointer) {
+    *pointer = NULL;
+    return resolve_field_path(symbols, expr, offset, type, nested, pointer) && *pointer;
+}
+
+// Offset, type and struct type (NULL for a scalar) of element i of array
+// or field i of struct type; false past the end
+static bool sequence_element(Symbol *array, StructType *type, size_t i, int *offset, SymbolType *element_type, StructType **nested) {
+    if (array) {
+        if ((int)i >= array_length(array)) return false;
+        *element_type = array->type_info.array.element_type;
+        *offset = (int)i * type_size(*element_type);
+        *nested = NULL;
+        return true;
+    }
+    if (!type || i >= type->count) return false;
+    int offsets[type->count];
+    layout_struct(type, offsets, NULL);
+    *element_type = type->fields[i].type;
+    *offset = offsets[i];
+    *nested = nested_struct_type(&type->fields[i]);
+    return true;
+}
+
+// A function parameter, a bare name or (name type), as a symbol. Struct
+// types are named, so anything capitalised or defined is a struct.
+static bool parse_parameter(ASTNode *param, Symbol *symbol) {
+    memset(symbol, 0, sizeof(*symbol));
+    symbol->type = SYM_INT;
+    if (param->type == AST_IDENTIFIER) {
+        symbol->name = param->data.string_value;
+        return true;
+    }
+    if (param->type != AST_LIST || param->data.list.count < 2 ||
+        param->data.list.children[0]->type != AST_IDENTIFIER) {
+        return false;
+    }
+    symbol->name = param->data.list.children[0]->data.string_value;
+    ASTNode *type_node = param->data.list.children[1];
+    if (type_node->type == AST_IDENTIFIER) {
+        const char *type_name = type_node->data.string_value;
+        if (parse_scalar_type(type_name, &symbol->type)) {
+            // int, str, char, bool or a sized integer
+        } else if (parse_pointer_type(type_name, symbol)) {
+            // *T, passed as an address
+        } else if (find_struct_type(global_struct_types, type_name) ||
+                   strcmp(type_name, "struct") == 0 || (type_name[0] >= 'A' && type_name[0] <= 'Z')) {
+            symbol->type = SYM_STRUCT;
+            symbol->type_info.struct_instance.struct_type_name = type_node->data.string_value;
+        }
+    } else {
+        parse_array_type(type_node, symbol);
+    }
+    return true;
+}
+
+// Argument registers of a function defined in the program; arguments that
+// need more are a compile error rather than passed on the stack
+#define ARGUMENT_REGS 4
+
+static void argument_register_error(const char *kind, const char *name, int limit) {
+    fprintf(stderr, "Error: %s %s takes at most %d argument registers\n", kind, name, limit);
+    exit(1);
+}
+
+// Registers an argument takes: one for a scalar, whole 8-byte chunks for an
+// aggregate of up to 16 bytes, and otherwise one holding its address, from
+// which the callee copies it into its own slot
+static int argument_registers(Symbol *symbol, bool *by_reference) {
+    *by_reference = false;
+    if (!is_aggregate(symbol)) return 1;
+    int size = symbol_slot_size(symbol);
+    if (size > 0 && size <= 16 && size % 8 == 0) return size / 8;
+    *by_reference = true;
+    return 1;
+}
+
+// C functions. A fn without a body, (fn [params] type), declares a function
+// linked in from C. Calls go straight to its symbol under AAPCS64, with no
+// wrapper: up to eight argument registers, narrow results widened on return.
+
+bool is_extern_declaration(ASTNode *fn_node) {
+    return fn_node && fn_node->type == AST_LIST && fn_node->data.list.count == 3;
+}
+
+// Registers an argument to a C function takes: an array decays to a pointer
+// to its first element, a struct of up to 16 bytes travels in one or two
+// registers and a bigger one as a pointer to a copy
+static int c_argument_registers(Symbol *symbol, bool *by_reference) {
+    *by_reference = false;
+    int size = symbol_slot_size(symbol);
+    if (symbol->type == SYM_STRUCT && size <= 16) return (size + 7) / 8;
+    *by_reference = true;
+    return 1;
+}
+
+// A C function leaves the bits of a narrow result above its width
+// unspecified; clumsy keeps every value widened to 64 bits
+static void emit_c_result_extension(CodeGen *codegen, const char *name, ASTNode *fn_node) {
+    ASTNode *type_node = fn_node->data.list.children[2];
+    SymbolType type;
+    if (type_node->type != AST_IDENTIFIER || !parse_scalar_type(type_node->data.string_value, &type)) return;
+    
+    switch (type) {
+        case SYM_STR:
+            fprintf(stderr, "Error: C function %s cannot return str, which needs a length prefix\n", name);
+            exit(1);
+        case SYM_I8:  emit_code(codegen, "    sxtb  x0, w0\n"); break;
+        case SYM_I16: emit_code(codegen, "    sxth  x0, w0\n"); break;
+        case SYM_I32: emit_code(codegen, "    sxtw  x0, w0\n"); break;
+        case SYM_CHAR: case SYM_BOOL: case SYM_U8:
+            emit_code(codegen, "    uxtb  w0, w0\n");
+            break;
+        case SYM_U16: emit_code(codegen, "    uxth  w0, w0\n"); break;
+        case SYM_U32: emit_code(codegen, "    mov   w0, w0\n"); break;
+        default: break;
+    }
 }
 
 void free_symbol_table(SymbolTable *table) {
@@ -237,13 +851,27 @@ Symbol *find_symbol_recursive(SymbolTable *table, const char *name) {
     return NULL;
 }
 
+// Exponentiation only needs the pow routine when neither the exponent is a
+// constant (expanded into a multiplication chain) nor the base is 2 (a shift)
+bool is_runtime_pow(ASTNode *node) {
+    if (!node || node->type != AST_LIST || node->data.list.count < 3) return false;
+    
+    ASTNode *first = node->data.list.children[0];
+    if (first->type != AST_IDENTIFIER || strcmp(first->data.string_value, "**") != 0) return false;
+    
+    ASTNode *base = node->data.list.children[1];
+    ASTNode *exponent = node->data.list.children[2];
+    if (exponent->type == AST_INT && exponent->data.int_value >= 0) return false;
+    if (base->type == AST_INT && base->data.int_value == 2) return false;
+    return true;
+}
+
 bool uses_exponentiation(ASTNode *node) {
     if (!node) return false;
     
     if (node->type == AST_LIST && node->data.list.count > 0) {
-        // Check if this is an exponentiation operation
-        ASTNode *first = node->data.list.children[0];
-        if (first->type == AST_IDENTIFIER && strcmp(first->data.string_value, "**") == 0) {
+        // Check if this is an exponentiation that calls pow
+        if (is_runtime_pow(node)) {
             return true;
         }
         
@@ -261,89 +889,264 @@ bool uses_exponentiation(ASTNode *node) {
 void generate_pow_function(CodeGen *codegen) {
     emit_code(codegen,
         "\n"
-        "// Power function: x0 = x0 ^ x1\n"
+        "// Power function: x0 = x0 ^ x1, clobbers x1 and x2\n"
+        "// Binary exponentiation kept entirely in registers\n"
         "pow:\n"
-        "    // Save registers\n"
-        "    stp x2, x3, [sp, #-16]!\n"
-        "    stp x4, x30, [sp, #-16]!\n"
-        "    \n"
-        "    // Handle special cases\n"
         "    mov x2, x0           // x2 = base\n"
-        "    mov x3, x1           // x3 = exponent\n"
         "    mov x0, #1           // result = 1\n"
         "    \n"
-        "    // If exponent is 0, return 1\n"
-        "    cbz x3, pow_done\n"
+        "    // Negative exponents are 0 in integer math, zero exponent is 1\n"
+        "    tbnz x1, #63, pow_zero\n"
+        "    cbz x1, pow_done\n"
         "    \n"
-        "    // Handle negative exponent (return 0 for negative exponents in integer math)\n"
-        "    tbnz x3, #63, pow_zero\n"
-        "    \n"
-        "    // Main exponentiation loop\n"
         "pow_loop:\n"
-        "    // If exponent is 0, we're done\n"
-        "    cbz x3, pow_done\n"
-        "    \n"
-        "    // Check if exponent is odd\n"
-        "    tbnz x3, #0, pow_odd\n"
-        "    \n"
-        "    // Exponent is even: square the base, halve the exponent\n"
-        "    mul x2, x2, x2\n"
-        "    lsr x3, x3, #1\n"
-        "    b pow_loop\n"
-        "    \n"
-        "pow_odd:\n"
-        "    // Multiply result by current base\n"
+        "    // Multiply the result in for every set bit of the exponent\n"
+        "    tbz x1, #0, pow_square\n"
         "    mul x0, x0, x2\n"
-        "    // Decrement exponent by 1\n"
-        "    sub x3, x3, #1\n"
-        "    // Continue with the loop\n"
-        "    b pow_loop\n"
+        "pow_square:\n"
+        "    mul x2, x2, x2\n"
+        "    lsr x1, x1, #1\n"
+        "    cbnz x1, pow_loop\n"
+        "    ret\n"
         "    \n"
         "pow_zero:\n"
         "    mov x0, #0\n"
         "    \n"
         "pow_done:\n"
-        "    // Restore registers and return\n"
-        "    ldp x4, x30, [sp], #16\n"
-        "    ldp x2, x3, [sp], #16\n"
         "    ret\n"
         "\n");
 }
 
-void generate_preamble(CodeGen *codegen) {
-    emit_code(codegen,
-        "    .text\n"
-        "    .globl  _main\n"
-        "    .p2align    2\n");
-}
+// Shortest addition chain search for constant exponents. value[0] = 1 and
+// every later element is the sum of two earlier ones (recorded in lhs/rhs).
+#define MAX_ADDITION_CHAIN 64
+#define MAX_SEARCHED_CHAIN 16
+#define MAX_SEARCHED_EXPONENT 256
+#define CHAIN_SCRATCH_REGS 2
 
-void emit_mov_immediate(CodeGen *codegen, const char *reg, int value) {
-    emit_code(codegen, "    mov   %s, #%d\n", reg, value);
+// Chain intermediates live in the intra-procedure scratch registers so the
+// expression temporaries (x0, x9-x15) stay untouched
+static const int chain_scratch_regs[CHAIN_SCRATCH_REGS] = {16, 17};
+
+typedef struct {
+    int value[MAX_ADDITION_CHAIN];
+    int lhs[MAX_ADDITION_CHAIN];
+    int rhs[MAX_ADDITION_CHAIN];
+    int length;
+} AdditionChain;
+
+static bool search_addition_chain(AdditionChain *chain, int limit, int target) {
+    int last = chain->value[chain->length - 1];
+    if (last == target) return true;
+    if (chain->length == limit) return false;
+    
+    // Even doubling every remaining step cannot reach the target
+    if (((long)last << (limit - chain->length)) < target) return false;
+    
+    for (int i = chain->length - 1; i >= 0; i--) {
+        for (int j = i; j >= 0; j--) {
+            int next = chain->value[i] + chain->value[j];
+            if (next <= last) break;
+            if (next > target) continue;
+            
+            chain->value[chain->length] = next;
+            chain->lhs[chain->length] = i;
+            chain->rhs[chain->length] = j;
+            chain->length++;
+            if (search_addition_chain(chain, limit, target)) return true;
+            chain->length--;
+        }
+    }
+    return false;
 }
 
-void emit_load_variable(CodeGen *codegen, const char *reg, const char *var_name, SymbolTable *symbols) {
-    emit_load_variable_with_adjustment(codegen, reg, var_name, symbols, 0);
+static bool build_shortest_addition_chain(AdditionChain *chain, int exponent) {
+    chain->value[0] = 1;
+    for (int limit = 1; limit <= MAX_SEARCHED_CHAIN; limit++) {
+        chain->length = 1;
+        if (search_addition_chain(chain, limit, exponent)) return true;
+    }
+    return false;
 }
 
-void emit_load_variable_with_adjustment(CodeGen *codegen, const char *reg, const char *var_name, SymbolTable *symbols, int stack_adjustment) {
-    int offset = get_symbol_offset(symbols, var_name);
-    if (offset >= 0) {
-        emit_code(codegen, "    ldr   %s, [sp, #%d]\n", reg, offset + stack_adjustment);
-    } else {
-        emit_code(codegen, "    mov   %s, #0  // Error: undefined variable %s\n", reg, var_name);
+// Left-to-right binary method: square, then multiply by the base on set bits
+static void build_binary_addition_chain(AdditionChain *chain, int exponent) {
+    chain->value[0] = 1;
+    chain->length = 1;
+    
+    int top = 30;
+    while (!(exponent & (1 << top))) top--;
+    for (int bit = top - 1; bit >= 0; bit--) {
+        int current = chain->length - 1;
+        chain->value[chain->length] = chain->value[current] * 2;
+        chain->lhs[chain->length] = current;
+        chain->rhs[chain->length] = current;
+        chain->length++;
+        if (exponent & (1 << bit)) {
+            current = chain->length - 1;
+            chain->value[chain->length] = chain->value[current] + 1;
+            chain->lhs[chain->length] = current;
+            chain->rhs[chain->length] = 0;
+            chain->length++;
+        }
     }
 }
 
-void emit_store_variable(CodeGen *codegen, const char *reg, const char *var_name, SymbolTable *symbols) {
-    int offset = get_symbol_offset(symbols, var_name);
-    if (offset >= 0) {
-        emit_code(codegen, "    str   %s, [sp, #%d]\n", reg, offset);
-    } else {
-        emit_code(codegen, "    // Error: undefined variable %s\n", var_name);
+// Assign x16/x17 to the intermediate chain elements, reusing a register once
+// the last step reading it has issued. Element 0 stays in the base register.
+static bool allocate_chain_registers(AdditionChain *chain, int *reg_of) {
+    int last_use[MAX_ADDITION_CHAIN];
+    for (int i = 0; i < chain->length; i++) last_use[i] = i;
+    for (int i = 1; i < chain->length; i++) {
+        last_use[chain->lhs[i]] = i;
+        last_use[chain->rhs[i]] = i;
+    }
+    
+    bool busy[CHAIN_SCRATCH_REGS] = {false};
+    reg_of[0] = -1;
+    for (int i = 1; i < chain->length - 1; i++) {
+        if (chain->lhs[i] > 0 && last_use[chain->lhs[i]] == i) busy[reg_of[chain->lhs[i]]] = false;
+        if (chain->rhs[i] > 0 && last_use[chain->rhs[i]] == i) busy[reg_of[chain->rhs[i]]] = false;
+        
+        reg_of[i] = -1;
+        for (int r = 0; r < CHAIN_SCRATCH_REGS && reg_of[i] < 0; r++) {
+            if (!busy[r]) {
+                busy[r] = true;
+                reg_of[i] = r;
+            }
+        }
+        if (reg_of[i] < 0) return false;
     }
+    reg_of[chain->length - 1] = -1;
+    return true;
 }
 
-void emit_arithmetic(CodeGen *codegen, const char *op, const char *dest, const char *src1, const char *src2) {
+// dest = base ^ exponent for a constant exponent, as an inline multiplication
+// chain. base is left untouched and may be the same register as dest, since
+// dest is only written by the final step.
+void emit_power_constant(CodeGen *codegen, const char *dest, const char *base, int exponent) {
+    if (exponent == 0) {
+        emit_mov_immediate(codegen, dest, 1);
+        return;
+    }
+    if (exponent == 1) {
+        emit_code(codegen, "    mov   %s, %s\n", dest, base);
+        return;
+    }
+    
+    // The binary chain only ever has one intermediate live, so it always fits
+    AdditionChain chain;
+    int reg_of[MAX_ADDITION_CHAIN];
+    if (exponent > MAX_SEARCHED_EXPONENT ||
+        !build_shortest_addition_chain(&chain, exponent) ||
+        !allocate_chain_registers(&chain, reg_of)) {
+        build_binary_addition_chain(&chain, exponent);
+        allocate_chain_registers(&chain, reg_of);
+    }
+    
+    for (int i = 1; i < chain.length; i++) {
+        char lhs[8], rhs[8], out[8];
+        snprintf(lhs, sizeof(lhs), "x%d", chain.lhs[i] > 0 ? chain_scratch_regs[reg_of[chain.lhs[i]]] : 0);
+        snprintf(rhs, sizeof(rhs), "x%d", chain.rhs[i] > 0 ? chain_scratch_regs[reg_of[chain.rhs[i]]] : 0);
+        snprintf(out, sizeof(out), "x%d", i < chain.length - 1 ? chain_scratch_regs[reg_of[i]] : 0);
+        emit_code(codegen, "    mul   %s, %s, %s\n",
+                  i == chain.length - 1 ? dest : out,
+                  chain.lhs[i] == 0 ? base : lhs,
+                  chain.rhs[i] == 0 ? base : rhs);
+    }
+}
+
+// dest = 2 ^ exponent as a shift; out-of-range and negative exponents give 0
+// just like pow does; clobbers x16
+void emit_power_of_two(CodeGen *codegen, const char *dest, const char *exponent) {
+    emit_code(codegen, "    mov   x16, #1\n");
+    emit_code(codegen, "    lsl   x16, x16, %s\n", exponent);
+    emit_code(codegen, "    cmp   %s, #63\n", exponent);
+    emit_code(codegen, "    csel  %s, x16, xzr, ls\n", dest);
+}
+
+void generate_preamble(CodeGen *codegen) {
+    emit_code(codegen,
+        "    .text\n"
+        "    .globl  _main\n"
+        "    .p2align    2\n");
+}
+
+// Values a single movz or movn can build go through the mov alias; anything
+// wider is assembled halfword by halfword
+void emit_mov_immediate(CodeGen *codegen, const char *reg, int value) {
+    if (value >= -65536 && value <= 65535) {
+        emit_code(codegen, "    mov   %s, #%d\n", reg, value);
+    } else {
+        emit_mov_wide(codegen, reg, (unsigned long)(long)value);
+    }
+}
+
+void emit_load_variable(CodeGen *codegen, const char *reg, const char *var_name, SymbolTable *symbols) {
+    emit_load_variable_with_adjustment(codegen, reg, var_name, symbols, 0);
+}
+
+// Memory type of a scalar variable
+static SymbolType variable_type(SymbolTable *symbols, const char *var_name) {
+    Symbol *symbol = find_symbol(symbols, var_name);
+    return symbol ? symbol->type : SYM_INT;
+}
+
+void emit_load_variable_with_adjustment(CodeGen *codegen, const char *reg, const char *var_name, SymbolTable *symbols, int stack_adjustment) {
+    int offset = get_symbol_offset(symbols, var_name);
+    if (offset >= 0) {
+        char address[32];
+        snprintf(address, sizeof(address), "[sp, #%d]", offset + stack_adjustment);
+        emit_sized_access(codegen, false, variable_type(symbols, var_name), reg, address);
+    } else {
+        emit_code(codegen, "    mov   %s, #0  // Error: undefined variable %s\n", reg, var_name);
+    }
+}
+
+void emit_store_variable(CodeGen *codegen, const char *reg, const char *var_name, SymbolTable *symbols) {
+    int offset = get_symbol_offset(symbols, var_name);
+    if (offset >= 0) {
+        char address[32];
+        snprintf(address, sizeof(address), "[sp, #%d]", offset);
+        emit_sized_access(codegen, true, variable_type(symbols, var_name), reg, address);
+    } else {
+        emit_code(codegen, "    // Error: undefined variable %s\n", var_name);
+    }
+}
+
+// ldr/str of a scalar of the given type between the x register reg and
+// address. Narrow loads sign- or zero-extend (ldrsb/ldrsh/ldrsw against
+// ldrb/ldrh/ldr w); narrow stores write the low bytes of the w register.
+void emit_sized_access(CodeGen *codegen, bool store, SymbolType type, const char *reg, const char *address) {
+    int size = type_size(type);
+    bool sign_extend = !store && size < 8 && type_is_signed(type);
+    const char *mnemonic;
+    if (size == 1) {
+        mnemonic = store ? "strb" : sign_extend ? "ldrsb" : "ldrb";
+    } else if (size == 2) {
+        mnemonic = store ? "strh" : sign_extend ? "ldrsh" : "ldrh";
+    } else if (size == 4) {
+        mnemonic = store ? "str" : sign_extend ? "ldrsw" : "ldr";
+    } else {
+        mnemonic = store ? "str" : "ldr";
+    }
+    
+    char name[8];
+    snprintf(name, sizeof(name), "%c%s", size == 8 || sign_extend ? 'x' : 'w', reg + 1);
+    emit_code(codegen, "    %-5s %s, %s\n", mnemonic, name, address);
+}
+
+// [base, index, lsl #n] with the index scaled by the element size
+void format_indexed_address(char *operand, size_t size, const char *base, const char *index, SymbolType type) {
+    int shift = type_shift(type);
+    if (shift == 0) {
+        snprintf(operand, size, "[%s, %s]", base, index);
+    } else {
+        snprintf(operand, size, "[%s, %s, lsl #%d]", base, index, shift);
+    }
+}
+
+void emit_arithmetic(CodeGen *codegen, const char *op, const char *dest, const char *src1, const char *src2) {
     if (strcmp(op, "+") == 0) {
         emit_code(codegen, "    add   %s, %s, %s\n", dest, src1, src2);
     } else if (strcmp(op, "-") == 0) {
@@ -353,13 +1156,15 @@ void emit_arithmetic(CodeGen *codegen, const char *op, const char *dest, const c
     } else if (strcmp(op, "/") == 0) {
         emit_code(codegen, "    sdiv  %s, %s, %s\n", dest, src1, src2);
     } else if (strcmp(op, "%") == 0) {
-        emit_code(codegen, "    sdiv  x4, %s, %s\n", src1, src2);
-        emit_code(codegen, "    msub  %s, x4, %s, %s\n", dest, src2, src1);
+        emit_code(codegen, "    sdiv  x16, %s, %s\n", src1, src2);
+        emit_code(codegen, "    msub  %s, x16, %s, %s\n", dest, src2, src1);
     } else if (strcmp(op, "**") == 0) {
-        emit_code(codegen, "    mov   x0, %s\n", src1);
-        emit_code(codegen, "    mov   x1, %s\n", src2);
+        // The exponent moves first in case it already sits in x0
+        if (strcmp(src2, "x1") != 0) emit_code(codegen, "    mov   x1, %s\n", src2);
+        if (strcmp(src1, "x0") != 0) emit_code(codegen, "    mov   x0, %s\n", src1);
+        invalidate_cached_values(codegen, NULL);
         emit_code(codegen, "    bl    pow\n");
-        emit_code(codegen, "    mov   %s, x0\n", dest);
+        if (strcmp(dest, "x0") != 0) emit_code(codegen, "    mov   %s, x0\n", dest);
     } else if (strcmp(op, "==") == 0) {
         emit_code(codegen, "    cmp   %s, %s\n", src1, src2);
         emit_code(codegen, "    cset  %s, eq\n", dest);
@@ -378,371 +1183,4119 @@ void emit_arithmetic(CodeGen *codegen, const char *op, const char *dest, const c
     }
 }
 
-void generate_expression_with_adjustment(CodeGen *codegen, ASTNode *expr, SymbolTable *symbols, int stack_adjustment) {
-    if (!expr) return;
+// Strength reduction for arithmetic with a constant right operand.
+// Multiplies become shifts and shifted adds, divisions by constants use a
+// multiply-high by a magic reciprocal, and power-of-two modulo is a mask with
+// a sign fixup. Only positive constants are handled.
+
+static bool is_power_of_two(long value) {
+    return value > 0 && (value & (value - 1)) == 0;
+}
+
+static int log2_exact(long value) {
+    int shift = 0;
+    while ((1L << shift) != value) shift++;
+    return shift;
+}
+
+// x * value as (x << k) +/- x, possibly shifted once more, in at most two
+// instructions; returns the form through the out parameters
+static bool decompose_multiplier(long value, int *shift, int *post_shift, bool *subtract) {
+    *post_shift = 0;
+    while (value > 1 && value % 2 == 0) {
+        value /= 2;
+        (*post_shift)++;
+    }
+    if (value == 1) {
+        *shift = 0;
+        *subtract = false;
+        return true;
+    }
+    if (is_power_of_two(value - 1)) {
+        *shift = log2_exact(value - 1);
+        *subtract = false;
+        return true;
+    }
+    // 2^k - 1 needs a separate shift, so only without a trailing one
+    if (is_power_of_two(value + 1) && *post_shift == 0) {
+        *shift = log2_exact(value + 1);
+        *subtract = true;
+        return true;
+    }
+    return false;
+}
+
+bool is_strength_reducible(const char *op, int value) {
+    int shift, post_shift;
+    bool subtract;
     
-    switch (expr->type) {
+    if (value <= 0) return false;
+    if (strcmp(op, "*") == 0) return decompose_multiplier(value, &shift, &post_shift, &subtract);
+    if (strcmp(op, "/") == 0 || strcmp(op, "%") == 0) return true;
+    return false;
+}
+
+// Signed division magic number (Hacker's Delight, 10-1) for 2 <= divisor
+static void signed_division_magic(long divisor, long *magic, int *shift) {
+    const unsigned long two63 = 1UL << 63;
+    unsigned long ad = (unsigned long)divisor;
+    unsigned long anc = two63 - 1 - two63 % ad;
+    unsigned long q1 = two63 / anc, r1 = two63 - q1 * anc;
+    unsigned long q2 = two63 / ad, r2 = two63 - q2 * ad;
+    unsigned long delta;
+    int p = 63;
+    
+    do {
+        p++;
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= anc) {
+            q1++;
+            r1 -= anc;
+        }
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= ad) {
+            q2++;
+            r2 -= ad;
+        }
+        delta = ad - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+    
+    *magic = (long)(q2 + 1);
+    *shift = p - 64;
+}
+
+// Materialize an arbitrary 64-bit constant with movz/movk, or movn/movk when
+// more halfwords are all ones than all zeros (negative values)
+void emit_mov_wide(CodeGen *codegen, const char *reg, unsigned long value) {
+    int zero_halfwords = 0, ones_halfwords = 0;
+    for (int hw = 0; hw < 4; hw++) {
+        unsigned long chunk = (value >> (hw * 16)) & 0xffff;
+        if (chunk == 0) zero_halfwords++;
+        if (chunk == 0xffff) ones_halfwords++;
+    }
+    
+    bool inverted = ones_halfwords > zero_halfwords;
+    unsigned long skip = inverted ? 0xffff : 0;
+    bool first = true;
+    for (int hw = 0; hw < 4; hw++) {
+        unsigned long chunk = (value >> (hw * 16)) & 0xffff;
+        if (chunk == skip) continue;
+        if (first) {
+            emit_code(codegen, "    %s  %s, #%lu, lsl #%d\n", inverted ? "movn" : "movz", reg,
+                      inverted ? (~chunk & 0xffff) : chunk, hw * 16);
+        } else {
+            emit_code(codegen, "    movk  %s, #%lu, lsl #%d\n", reg, chunk, hw * 16);
+        }
+        first = false;
+    }
+    if (first) {
+        emit_code(codegen, "    mov   %s, #%d\n", reg, inverted ? -1 : 0);
+    }
+}
+
+// dest = src / divisor, truncating toward zero; clobbers x16
+static void emit_divide_constant(CodeGen *codegen, const char *dest, const char *src, long divisor) {
+    if (divisor == 1) {
+        emit_code(codegen, "    mov   %s, %s\n", dest, src);
+    } else if (is_power_of_two(divisor)) {
+        // Bias negative dividends by divisor - 1 before the arithmetic shift
+        int k = log2_exact(divisor);
+        if (k == 1) {
+            emit_code(codegen, "    add   x16, %s, %s, lsr #63\n", src, src);
+        } else {
+            emit_code(codegen, "    asr   x16, %s, #63\n", src);
+            emit_code(codegen, "    add   x16, %s, x16, lsr #%d\n", src, 64 - k);
+        }
+        emit_code(codegen, "    asr   %s, x16, #%d\n", dest, k);
+    } else {
+        long magic;
+        int shift;
+        signed_division_magic(divisor, &magic, &shift);
+        emit_mov_wide(codegen, "x16", (unsigned long)magic);
+        emit_code(codegen, "    smulh x16, %s, x16\n", src);
+        if (magic < 0) {
+            emit_code(codegen, "    add   x16, x16, %s\n", src);
+        }
+        if (shift > 0) {
+            emit_code(codegen, "    asr   x16, x16, #%d\n", shift);
+        }
+        // Round toward zero: add one for negative quotients
+        emit_code(codegen, "    add   %s, x16, x16, lsr #63\n", dest);
+    }
+}
+
+// dest = src op value for a constant the caller checked with
+// is_strength_reducible; clobbers x16 and x17
+void emit_arithmetic_constant(CodeGen *codegen, const char *op, const char *dest, const char *src, int value) {
+    if (strcmp(op, "*") == 0) {
+        int shift, post_shift;
+        bool subtract;
+        decompose_multiplier(value, &shift, &post_shift, &subtract);
+        
+        if (shift == 0) {
+            emit_code(codegen, "    lsl   %s, %s, #%d\n", dest, src, post_shift);
+            return;
+        }
+        if (subtract) {
+            emit_code(codegen, "    lsl   x16, %s, #%d\n", src, shift);
+            emit_code(codegen, "    sub   %s, x16, %s\n", dest, src);
+        } else {
+            emit_code(codegen, "    add   %s, %s, %s, lsl #%d\n", dest, src, src, shift);
+        }
+        if (post_shift > 0) {
+            emit_code(codegen, "    lsl   %s, %s, #%d\n", dest, dest, post_shift);
+        }
+    } else if (strcmp(op, "/") == 0) {
+        emit_divide_constant(codegen, dest, src, value);
+    } else if (strcmp(op, "%") == 0) {
+        if (value == 1) {
+            emit_mov_immediate(codegen, dest, 0);
+        } else if (is_power_of_two(value)) {
+            // Mask the magnitude and give the result the dividend's sign
+            emit_code(codegen, "    negs  x16, %s\n", src);
+            emit_code(codegen, "    and   x17, %s, #%d\n", src, value - 1);
+            emit_code(codegen, "    and   x16, x16, #%d\n", value - 1);
+            emit_code(codegen, "    csneg %s, x17, x16, mi\n", dest);
+        } else {
+            emit_divide_constant(codegen, "x17", src, value);
+            emit_mov_wide(codegen, "x16", (unsigned long)value);
+            emit_code(codegen, "    msub  %s, x17, x16, %s\n", dest, src);
+        }
+    }
+}
+
+void emit_load_operand(CodeGen *codegen, const char *reg, ASTNode *operand, SymbolTable *symbols) {
+    if (operand->type == AST_INT) {
+        emit_mov_immediate(codegen, reg, operand->data.int_value);
+    } else if (operand->type == AST_IDENTIFIER) {
+        emit_load_variable(codegen, reg, operand->data.string_value, symbols);
+    } else {
+        generate_expression(codegen, operand, symbols);
+        emit_code(codegen, "    mov   %s, x0\n", reg);
+    }
+}
+
+
+// Value numbering. Expressions that occur more than once in a function are
+// kept in x3-x8 after their first evaluation, and later occurrences read that
+// register instead of recomputing or reloading. An entry dies when a variable
+// it mentions is assigned and at every call, since x3-x8 are caller-saved.
+// if and while keep only the entries valid on all incoming paths, so a reused
+// value always dominates its use.
+static const char *value_cache_regs[VALUE_CACHE_REGS] = {"x3", "x4", "x5", "x6", "x7", "x8"};
+
+bool expressions_equal(ASTNode *a, ASTNode *b) {
+    if (a == b) return true;
+    if (!a || !b || a->type != b->type) return false;
+    
+    switch (a->type) {
         case AST_INT:
-            emit_mov_immediate(codegen, "x0", expr->data.int_value);
-            break;
-            
+            return a->data.int_value == b->data.int_value;
         case AST_CHAR:
-            emit_mov_immediate(codegen, "x0", (int)expr->data.char_value);
-            break;
-            
+            return a->data.char_value == b->data.char_value;
         case AST_IDENTIFIER:
-            emit_load_variable_with_adjustment(codegen, "x0", expr->data.string_value, symbols, stack_adjustment);
-            break;
-            
+        case AST_STRING:
+            return strcmp(a->data.string_value, b->data.string_value) == 0;
         case AST_LIST:
-            if (expr->data.list.count > 0) {
-                ASTNode *op = expr->data.list.children[0];
-                
-                if (op->type == AST_IDENTIFIER) {
-                    // Handle arithmetic and comparison operators
-                    if (strcmp(op->data.string_value, "+") == 0 ||
-                        strcmp(op->data.string_value, "-") == 0 ||
-                        strcmp(op->data.string_value, "*") == 0 ||
-                        strcmp(op->data.string_value, "/") == 0 ||
-                        strcmp(op->data.string_value, "%") == 0 ||
-                        strcmp(op->data.string_value, "**") == 0 ||
-                        strcmp(op->data.string_value, "==") == 0 ||
-                        strcmp(op->data.string_value, "<") == 0 ||
-                        strcmp(op->data.string_value, ">") == 0 ||
-                        strcmp(op->data.string_value, "<=") == 0 ||
-                        strcmp(op->data.string_value, ">=") == 0) {
-                        
-                        if (expr->data.list.count >= 3) {
-                            // Generate code for operands
-                            ASTNode *left = expr->data.list.children[1];
-                            ASTNode *right = expr->data.list.children[2];
-                            
-                            // Load left operand into x2
-                            if (left->type == AST_INT) {
-                                emit_mov_immediate(codegen, "x2", left->data.int_value);
-                            } else if (left->type == AST_IDENTIFIER) {
-                                emit_load_variable_with_adjustment(codegen, "x2", left->data.string_value, symbols, stack_adjustment);
-                            } else if (left->type == AST_LIST) {
-                                generate_expression_with_adjustment(codegen, left, symbols, stack_adjustment);
-                                emit_code(codegen, "    mov   x2, x0\n");
-                            }
-                            
-                            // Load right operand into x3
-                            if (right->type == AST_INT) {
-                                emit_mov_immediate(codegen, "x3", right->data.int_value);
-                            } else if (right->type == AST_IDENTIFIER) {
-                                emit_load_variable_with_adjustment(codegen, "x3", right->data.string_value, symbols, stack_adjustment);
-                            } else if (right->type == AST_LIST) {
-                                generate_expression_with_adjustment(codegen, right, symbols, stack_adjustment);
-                                emit_code(codegen, "    mov   x3, x0\n");
-                            }
-                            
-                            // Perform operation
-                            emit_arithmetic(codegen, op->data.string_value, "x0", "x2", "x3");
-                        }
-                    }
-                    // For other operations, fall back to normal expression generation
-                    else {
-                        generate_expression(codegen, expr, symbols);
-                    }
-                }
+        case AST_ARRAY:
+            if (a->data.list.count != b->data.list.count) return false;
+            for (size_t i = 0; i < a->data.list.count; i++) {
+                if (!expressions_equal(a->data.list.children[i], b->data.list.children[i])) return false;
             }
-            break;
-            
+            return true;
         default:
-            emit_mov_immediate(codegen, "x0", 0);
-            break;
+            return false;
     }
 }
 
-void generate_expression(CodeGen *codegen, ASTNode *expr, SymbolTable *symbols) {
-    if (!expr) return;
+static bool mentions_variable(ASTNode *expr, const char *name) {
+    if (!expr) return false;
+    if (expr->type == AST_IDENTIFIER) return strcmp(expr->data.string_value, name) == 0;
+    if (expr->type != AST_LIST && expr->type != AST_ARRAY) return false;
     
-    switch (expr->type) {
-        case AST_INT:
-            emit_mov_immediate(codegen, "x0", expr->data.int_value);
-            break;
-            
-        case AST_CHAR:
-            emit_mov_immediate(codegen, "x0", (int)expr->data.char_value);
-            break;
-            
-        case AST_IDENTIFIER:
-            emit_load_variable(codegen, "x0", expr->data.string_value, symbols);
-            break;
-            
-        case AST_LIST:
-            if (expr->data.list.count > 0) {
-                ASTNode *op = expr->data.list.children[0];
-                
-                if (op->type == AST_IDENTIFIER) {
-                    // Handle arithmetic and comparison operators
-                    if (strcmp(op->data.string_value, "+") == 0 ||
-                        strcmp(op->data.string_value, "-") == 0 ||
-                        strcmp(op->data.string_value, "*") == 0 ||
-                        strcmp(op->data.string_value, "/") == 0 ||
-                        strcmp(op->data.string_value, "%") == 0 ||
-                        strcmp(op->data.string_value, "**") == 0 ||
-                        strcmp(op->data.string_value, "==") == 0 ||
-                        strcmp(op->data.string_value, "<") == 0 ||
-                        strcmp(op->data.string_value, ">") == 0 ||
-                        strcmp(op->data.string_value, "<=") == 0 ||
-                        strcmp(op->data.string_value, ">=") == 0) {
-                        
-                        if (expr->data.list.count >= 3) {
-                            // Generate code for operands
-                            ASTNode *left = expr->data.list.children[1];
-                            ASTNode *right = expr->data.list.children[2];
-                            
-                            // Check if right operand contains function calls that might corrupt x2
-                            bool right_has_function_call = false;
-                            if (right->type == AST_LIST) {
-                                // This is a simplification - assume any complex expression might have function calls
-                                right_has_function_call = true;
-                            }
-                            
-                            if (right_has_function_call && left->type == AST_IDENTIFIER) {
-                                // Load right operand first to avoid register corruption
-                                generate_expression(codegen, right, symbols);
-                                emit_code(codegen, "    mov   x3, x0\n");
-                                
-                                // Then load left operand into x2
-                                emit_load_variable(codegen, "x2", left->data.string_value, symbols);
-                            } else {
-                                // Standard order: load left, then right
-                                // Load left operand into x2
-                                if (left->type == AST_INT) {
-                                    emit_mov_immediate(codegen, "x2", left->data.int_value);
-                                } else if (left->type == AST_IDENTIFIER) {
-                                    emit_load_variable(codegen, "x2", left->data.string_value, symbols);
-                                } else if (left->type == AST_LIST) {
-                                    generate_expression(codegen, left, symbols);
-                                    emit_code(codegen, "    mov   x2, x0\n");
-                                }
-                                
-                                // Load right operand into x3
-                                if (right->type == AST_INT) {
-                                    emit_mov_immediate(codegen, "x3", right->data.int_value);
-                                } else if (right->type == AST_IDENTIFIER) {
-                                    emit_load_variable(codegen, "x3", right->data.string_value, symbols);
-                                } else if (right->type == AST_LIST) {
-                                    generate_expression(codegen, right, symbols);
-                                    emit_code(codegen, "    mov   x3, x0\n");
-                                }
-                            }
-                            
-                            // Perform operation
-                            emit_arithmetic(codegen, op->data.string_value, "x0", "x2", "x3");
-                        }
-                    }
-                    // Handle array access: ([] array_var index)
-                    else if (strcmp(op->data.string_value, "[]") == 0) {
-                        if (expr->data.list.count >= 3) {
-                            ASTNode *array_var = expr->data.list.children[1];
-                            ASTNode *index = expr->data.list.children[2];
-                            
-                            if (array_var->type == AST_IDENTIFIER) {
-                                // Get the base offset of the array
-                                int array_offset = get_symbol_offset(symbols, array_var->data.string_value);
-                                
-                                if (array_offset >= 0) {
-                                    // Calculate element offset based on index
-                                    int element_offset = 0;
-                                    if (index->type == AST_INT) {
-                                        // Static index - calculate offset directly
-                                        element_offset = index->data.int_value * 8;  // 8 bytes per element
-                                        emit_code(codegen, "    ldr   x0, [sp, #%d]\n", array_offset + element_offset);
-                                    } else {
-                                        // Dynamic index - need to calculate at runtime
-                                        // Load index into x1
-                                        if (index->type == AST_IDENTIFIER) {
-                                            emit_load_variable(codegen, "x1", index->data.string_value, symbols);
-                                        } else {
-                                            generate_expression(codegen, index, symbols);
-                                            emit_code(codegen, "    mov   x1, x0\n");
-                                        }
-                                        
-                                        // Calculate element address: base + (index * 8)
-                                        emit_code(codegen, "    mov   x2, #8\n");
-                                        emit_code(codegen, "    mul   x1, x1, x2\n");
-                                        emit_code(codegen, "    mov   x2, sp\n");
-                                        emit_code(codegen, "    add   x2, x2, #%d\n", array_offset);
-                                        emit_code(codegen, "    add   x2, x2, x1\n");
-                                        emit_code(codegen, "    ldr   x0, [x2]\n");
-                                    }
-                                } else {
-                                    emit_mov_immediate(codegen, "x0", 0);
-                                }
-                            }
-                        }
-                    }
-                    // Handle field access: (. struct_var field_name)
-                    else if (strcmp(op->data.string_value, ".") == 0) {
-                        if (expr->data.list.count >= 3) {
-                            ASTNode *struct_var = expr->data.list.children[1];
-                            ASTNode *field_name = expr->data.list.children[2];
-                            
-                            if (struct_var->type == AST_IDENTIFIER && field_name->type == AST_IDENTIFIER) {
-                                // Find the struct variable to get its type
-                                Symbol *struct_symbol = find_symbol(symbols, struct_var->data.string_value);
-                                if (struct_symbol && struct_symbol->type == SYM_STRUCT) {
-                                    // Get the struct type name from the symbol
-                                    const char *struct_type_name = struct_symbol->type_info.struct_instance.struct_type_name;
-                                    
-                                    // Find the struct type definition
-                                    StructType *struct_type = find_struct_type(global_struct_types, struct_type_name);
-                                    if (struct_type) {
-                                        // Find the field in the struct type definition
-                                        const char *field = field_name->data.string_value;
-                                        int field_offset = -1;
-                                        
-                                        for (size_t i = 0; i < struct_type->count; i++) {
-                                            if (strcmp(struct_type->fields[i].name, field) == 0) {
-                                                field_offset = i * 8; // Each field is 8 bytes apart
-                                                break;
-                                            }
-                                        }
-                                        
-                                        if (field_offset >= 0) {
-                                            // Load struct base address
-                                            int struct_offset = get_symbol_offset(symbols, struct_var->data.string_value);
-                                            if (struct_offset >= 0) {
-                                                // Load field value at struct_base + field_offset
-                                                emit_code(codegen, "    ldr   x0, [sp, #%d]\n", struct_offset + field_offset);
-                                            } else {
-                                                emit_mov_immediate(codegen, "x0", 0);
-                                            }
-                                        } else {
-                                            // Field not found, emit error value
-                                            emit_mov_immediate(codegen, "x0", 0);
-                                        }
-                                    } else {
-                                        // Struct type not found, emit error value
-                                        emit_mov_immediate(codegen, "x0", 0);
-                                    }
-                                } else {
-                                    // Variable is not a struct, emit error value
-                                    emit_mov_immediate(codegen, "x0", 0);
-                                }
-                            }
-                        }
-                    }
-                    // Handle struct literals: (# ((field1 value1) (field2 value2) ...))
-                    else if (strcmp(op->data.string_value, "#") == 0) {
-                        if (expr->data.list.count >= 2) {
-                            ASTNode *fields = expr->data.list.children[1];
-                            
-                            // For struct initialization, just return the first field's value
-                            // The actual struct layout will be handled during variable assignment
-                            if (fields->type == AST_LIST && fields->data.list.count > 0) {
-                                ASTNode *first_field = fields->data.list.children[0];
-                                if (first_field->type == AST_LIST && first_field->data.list.count >= 2) {
-                                    ASTNode *field_value = first_field->data.list.children[1];
-                                    generate_expression(codegen, field_value, symbols);
-                                } else {
-                                    emit_mov_immediate(codegen, "x0", 0);
-                                }
-                            } else {
-                                emit_mov_immediate(codegen, "x0", 0);
-                            }
-                        } else {
-                            emit_mov_immediate(codegen, "x0", 0);
-                        }
-                    }
-                    // Handle function calls: (function_name arg1 arg2 ...)
-                    else {
-                        // Check if this is a function call using recursive symbol lookup
-                        Symbol *func_symbol = find_symbol_recursive(symbols, op->data.string_value);
-                        if (func_symbol && func_symbol->type == SYM_FUNCTION) {
-                            // Generate function call
-                            emit_code(codegen, "    // Function call: %s\n", op->data.string_value);
-                            
-                            // Save link register
-                            emit_code(codegen, "    stp   x29, x30, [sp, #-16]!\n");
-                            
-                            // Pass arguments - for structs, we need to copy all fields
-                            int arg_count = expr->data.list.count - 1; // Subtract 1 for function name
-                            int reg_index = 0;
-                            
-                            for (int i = 0; i < arg_count && reg_index < 4; i++) {
-                                ASTNode *arg = expr->data.list.children[i + 1];
-                                if (arg->type == AST_INT) {
-                                    emit_mov_immediate(codegen, "x9", arg->data.int_value);
-                                    emit_code(codegen, "    mov   x%d, x9\n", reg_index);
-                                    reg_index++;
-                                } else if (arg->type == AST_IDENTIFIER) {
-                                    // Check if this is a struct or array variable by looking at symbol table
-                                    Symbol *arg_symbol = find_symbol(symbols, arg->data.string_value);
-                                    if (arg_symbol && arg_symbol->type == SYM_STRUCT) {
-                                        // This is a struct - copy all fields (assuming 2 fields for now)
-                                        int struct_offset = get_symbol_offset(symbols, arg->data.string_value);
-                                        // Copy field 0 (x)
-                                        emit_code(codegen, "    ldr   x9, [sp, #%d]\n", struct_offset + 16);
-                                        emit_code(codegen, "    mov   x%d, x9\n", reg_index);
-                                        reg_index++;
-                                        // Copy field 1 (y) if we have register space
-                                        if (reg_index < 4) {
-                                            emit_code(codegen, "    ldr   x9, [sp, #%d]\n", struct_offset + 8 + 16);
-                                            emit_code(codegen, "    mov   x%d, x9\n", reg_index);
-                                            reg_index++;
-                                        }
-                                    } else if (arg_symbol && arg_symbol->type == SYM_ARRAY) {
-                                        // This is an array - copy all elements (assuming 4 elements for now)
-                                        int array_offset = get_symbol_offset(symbols, arg->data.string_value);
-                                        // Copy elements 0, 1, 2, 3
-                                        for (int elem = 0; elem < 4 && reg_index < 4; elem++) {
-                                            emit_code(codegen, "    ldr   x9, [sp, #%d]\n", array_offset + elem * 8 + 16);
-                                            emit_code(codegen, "    mov   x%d, x9\n", reg_index);
-                                            reg_index++;
-                                        }
-                                    } else {
-                                        // Regular variable - need to account for stack pointer movement due to stp instruction
-                                        int arg_offset = get_symbol_offset(symbols, arg->data.string_value);
-                                        if (arg_offset >= 0) {
-                                            // Add 16 to offset to account for saved registers
-                                            emit_code(codegen, "    ldr   x9, [sp, #%d]\n", arg_offset + 16);
-                                        } else {
-                                            emit_mov_immediate(codegen, "x9", 0);
-                                        }
-                                        emit_code(codegen, "    mov   x%d, x9\n", reg_index);
-                                        reg_index++;
-                                    }
-                                } else if (arg->type == AST_LIST) {
-                                    // For complex expressions inside function calls, we need to account for stack adjustment
-                                    // The stack pointer has moved due to the stp instruction above
-                                    generate_expression_with_adjustment(codegen, arg, symbols, 16);
-                                    emit_code(codegen, "    mov   x%d, x0\n", reg_index);
-                                    reg_index++;
-                                }
-                            }
-                            
-                            emit_code(codegen, "    bl    %s\n", op->data.string_value);
-                            
-                            // Restore link register
-                            emit_code(codegen, "    ldp   x29, x30, [sp], #16\n");
-                        } else {
-                            // Unknown function or identifier, return 0
-                            emit_mov_immediate(codegen, "x0", 0);
-                        }
-                    }
-                }
+    for (size_t i = 0; i < expr->data.list.count; i++) {
+        if (mentions_variable(expr->data.list.children[i], name)) return true;
+    }
+    return false;
+}
+
+// Drop entries mentioning name, or every entry when name is NULL
+void invalidate_cached_values(CodeGen *codegen, const char *name) {
+    for (int i = 0; i < VALUE_CACHE_REGS; i++) {
+        if (codegen->cached_values[i] && (!name || mentions_variable(codegen->cached_values[i], name))) {
+            codegen->cached_values[i] = NULL;
+        }
+    }
+}
+
+// Variable at the root of x, arr[i], p.x or p.inner.x
+static ASTNode *access_root(ASTNode *expr) {
+    while (expr->type == AST_LIST && expr->data.list.count >= 2) {
+        expr = expr->data.list.children[1];
+    }
+    return expr;
+}
+
+// Variable, array or struct a let/set/store statement stores to, or the
+// vec a push, pop or reserve changes
+static const char *assigned_variable(ASTNode *stmt) {
+    if (is_vec_operation(stmt)) return stmt->data.list.children[1]->data.string_value;
+    if (!stmt || stmt->type != AST_LIST || stmt->data.list.count < 3) return NULL;
+    
+    ASTNode *op = stmt->data.list.children[0];
+    if (op->type != AST_IDENTIFIER) return NULL;
+    if (strcmp(op->data.string_value, "let") != 0 && strcmp(op->data.string_value, "set") != 0 &&
+        strcmp(op->data.string_value, "store") != 0) return NULL;
+    
+    // The variable at the root of arr[i], p.x or p.inner.x
+    ASTNode *target = access_root(stmt->data.list.children[1]);
+    return target->type == AST_IDENTIFIER ? target->data.string_value : NULL;
+}
+
+// @p, p[i] or p.x with p a pointer: memory reached through a pointer
+static bool is_pointer_target(ASTNode *target, SymbolTable *symbols) {
+    const char *op = operator_name(target);
+    if (!op || target->data.list.count < 2) return false;
+    if (strcmp(op, "@") == 0) return true;
+    if (strcmp(op, "[]") != 0 && strcmp(op, ".") != 0) return false;
+    
+    ASTNode *root = access_root(target);
+    Symbol *symbol = root->type == AST_IDENTIFIER ? find_symbol_recursive(symbols, root->data.string_value) : NULL;
+    return is_indirect(symbol);
+}
+
+// Whether expr reads memory a pointer may reach: through a pointer, or a
+// variable whose address was taken. Any two pointers may share memory, so
+// a store through one makes all such loads stale.
+static bool loads_through_pointer(ASTNode *expr, SymbolTable *symbols) {
+    if (!expr) return false;
+    if (expr->type == AST_IDENTIFIER) {
+        Symbol *symbol = find_symbol_recursive(symbols, expr->data.string_value);
+        return symbol && symbol->address_taken;
+    }
+    if (expr->type != AST_LIST) return false;
+    if (is_pointer_target(expr, symbols)) return true;
+    
+    const char *op = operator_name(expr);
+    if (op && strcmp(op, "&") == 0) return false; // an address, not a load
+    for (size_t i = 1; i < expr->data.list.count; i++) {
+        if (loads_through_pointer(expr->data.list.children[i], symbols)) return true;
+    }
+    return false;
+}
+
+// Whether stmt writes memory a pointer may reach: (set @p value),
+// (set p[i] value) and (set p.x value), or any store to a variable whose
+// address was taken
+static bool is_pointer_store(ASTNode *stmt, SymbolTable *symbols) {
+    const char *name = assigned_variable(stmt);
+    if (!name) return false;
+    
+    const char *op = operator_name(stmt);
+    if (strcmp(op, "set") == 0 && is_pointer_target(stmt->data.list.children[1], symbols)) return true;
+    Symbol *symbol = find_symbol_recursive(symbols, name);
+    return symbol && symbol->address_taken;
+}
+
+static bool stores_through_pointer(ASTNode *node, SymbolTable *symbols) {
+    if (!node || node->type != AST_LIST) return false;
+    if (is_pointer_store(node, symbols)) return true;
+    for (size_t i = 0; i < node->data.list.count; i++) {
+        if (stores_through_pointer(node->data.list.children[i], symbols)) return true;
+    }
+    return false;
+}
+
+static void invalidate_pointer_loads(CodeGen *codegen, SymbolTable *symbols) {
+    for (int i = 0; i < VALUE_CACHE_REGS; i++) {
+        if (loads_through_pointer(codegen->cached_values[i], symbols)) {
+            codegen->cached_values[i] = NULL;
+        }
+    }
+}
+
+// Induction variable of a (for (i start end [step]) body) statement
+const char *loop_variable(ASTNode *stmt) {
+    if (!stmt || stmt->type != AST_LIST || stmt->data.list.count < 2) return NULL;
+    
+    ASTNode *op = stmt->data.list.children[0];
+    if (op->type != AST_IDENTIFIER || strcmp(op->data.string_value, "for") != 0) return NULL;
+    
+    ASTNode *header = stmt->data.list.children[1];
+    if (header->type != AST_LIST || header->data.list.count < 3 ||
+        header->data.list.children[0]->type != AST_IDENTIFIER) {
+        return NULL;
+    }
+    return header->data.list.children[0]->data.string_value;
+}
+
+// Drop entries for everything a statement (and its nested statements) may
+// assign, e.g. before a loop whose body runs again after the back edge
+void invalidate_assigned_values(CodeGen *codegen, ASTNode *stmt, SymbolTable *symbols) {
+    if (!stmt || stmt->type != AST_LIST) return;
+    
+    const char *name = assigned_variable(stmt);
+    if (name) {
+        invalidate_cached_values(codegen, name);
+    }
+    if (is_pointer_store(stmt, symbols)) {
+        invalidate_pointer_loads(codegen, symbols);
+    }
+    if (loop_variable(stmt)) {
+        invalidate_cached_values(codegen, loop_variable(stmt));
+    }
+    for (size_t i = 0; i < stmt->data.list.count; i++) {
+        invalidate_assigned_values(codegen, stmt->data.list.children[i], symbols);
+    }
+}
+
+// Keep only entries also present in other (the state at the end of another
+// path into the current point)
+void intersect_cached_values(CodeGen *codegen, ASTNode **other) {
+    for (int i = 0; i < VALUE_CACHE_REGS; i++) {
+        if (!other[i] || !expressions_equal(codegen->cached_values[i], other[i])) {
+            codegen->cached_values[i] = NULL;
+        }
+    }
+}
+
+static int find_cached_value(CodeGen *codegen, ASTNode *expr) {
+    for (int i = 0; i < VALUE_CACHE_REGS; i++) {
+        if (codegen->cached_values[i] && expressions_equal(codegen->cached_values[i], expr)) return i;
+    }
+    return -1;
+}
+
+// First cache register neither holding a value nor pinned by a loop
+static int free_cache_register(CodeGen *codegen) {
+    for (int i = 0; i < VALUE_CACHE_REGS; i++) {
+        if (!codegen->cached_values[i] && !(codegen->pinned_regs & (1u << i))) return i;
+    }
+    return -1;
+}
+
+// Induction pointer tracking array[index], innermost loop first
+static int find_induction_pointer(CodeGen *codegen, int array_offset, ASTNode *index) {
+    if (index->type != AST_IDENTIFIER) return -1;
+    for (int i = codegen->induction_count - 1; i >= 0; i--) {
+        InductionPointer *pointer = &codegen->induction_pointers[i];
+        if (pointer->array_offset == array_offset && strcmp(pointer->variable, index->data.string_value) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static bool is_repeated_expression(CodeGen *codegen, ASTNode *expr) {
+    for (size_t i = 0; i < codegen->repeated_count; i++) {
+        if (expressions_equal(codegen->repeated_exprs[i], expr)) return true;
+    }
+    return false;
+}
+
+typedef struct {
+    ASTNode **exprs;
+    int *counts;
+    size_t count;
+    size_t capacity;
+} ExpressionCounts;
+
+static void count_expression(ExpressionCounts *counts, ASTNode *expr) {
+    if (!expr || expr->type == AST_INT || expr->type == AST_CHAR || expr->type == AST_STRING) return;
+    
+    if (is_tileable(expr)) {
+        size_t i = 0;
+        while (i < counts->count && !expressions_equal(counts->exprs[i], expr)) i++;
+        if (i == counts->count) {
+            if (counts->count == counts->capacity) {
+                counts->capacity = counts->capacity ? counts->capacity * 2 : 32;
+                counts->exprs = realloc(counts->exprs, counts->capacity * sizeof(ASTNode *));
+                counts->counts = realloc(counts->counts, counts->capacity * sizeof(int));
+            }
+            counts->exprs[counts->count] = expr;
+            counts->counts[counts->count++] = 0;
+        }
+        counts->counts[i]++;
+    }
+    
+    if (expr->type != AST_LIST && expr->type != AST_ARRAY) return;
+    const char *op = expr->type == AST_LIST && expr->data.list.count > 0 &&
+                     expr->data.list.children[0]->type == AST_IDENTIFIER ?
+                     expr->data.list.children[0]->data.string_value : NULL;
+    if (op && strcmp(op, ".") == 0) return;
+    if (op && strcmp(op, "[]") == 0) {
+        if (expr->data.list.count >= 3) count_expression(counts, expr->data.list.children[2]);
+        return;
+    }
+    for (size_t i = op ? 1 : 0; i < expr->data.list.count; i++) {
+        count_expression(counts, expr->data.list.children[i]);
+    }
+}
+
+// Call visit on each expression position of a statement: initializers,
+// values, conditions, indices of store targets and expression statements
+void visit_statement_expressions(ASTNode *stmt, ExpressionVisitor visit, void *context) {
+    if (!stmt || stmt->type != AST_LIST || stmt->data.list.count == 0 ||
+        stmt->data.list.children[0]->type != AST_IDENTIFIER) {
+        visit(context, stmt);
+        return;
+    }
+    
+    const char *op = stmt->data.list.children[0]->data.string_value;
+    size_t count = stmt->data.list.count;
+    if (strcmp(op, "let") == 0) {
+        if (!is_function_definition(stmt) && count >= 3) {
+            visit(context, stmt->data.list.children[count - 1]);
+        }
+    } else if (strcmp(op, "set") == 0) {
+        if (count >= 3) {
+            ASTNode *target = stmt->data.list.children[1];
+            if (target->type == AST_LIST && target->data.list.count >= 3) {
+                ASTNode *selector_op = target->data.list.children[0];
+                if (selector_op->type == AST_IDENTIFIER && strcmp(selector_op->data.string_value, "[]") == 0) {
+                    visit(context, target->data.list.children[2]);
+                }
+            }
+            visit(context, stmt->data.list.children[2]);
+        }
+    } else if (strcmp(op, "if") == 0 || strcmp(op, "while") == 0 || strcmp(op, "begin") == 0 ||
+               strcmp(op, "region") == 0) {
+        // Conditions are expressions, the remaining children statements
+        size_t first = 1;
+        bool block = strcmp(op, "begin") == 0 || strcmp(op, "region") == 0;
+        if (!block && count >= 2) {
+            visit(context, stmt->data.list.children[1]);
+            first = 2;
+        }
+        for (size_t i = first; i < count; i++) {
+            visit_statement_expressions(stmt->data.list.children[i], visit, context);
+        }
+    } else if (strcmp(op, "for") == 0) {
+        // Loop bounds are expressions, the body a statement
+        if (count >= 2 && loop_variable(stmt)) {
+            ASTNode *header = stmt->data.list.children[1];
+            for (size_t i = 1; i < header->data.list.count; i++) {
+                visit(context, header->data.list.children[i]);
+            }
+        }
+        for (size_t i = 2; i < count; i++) {
+            visit_statement_expressions(stmt->data.list.children[i], visit, context);
+        }
+    } else if (strcmp(op, "print") == 0 || strcmp(op, "ret") == 0) {
+        if (count >= 2) visit(context, stmt->data.list.children[1]);
+    } else {
+        visit(context, stmt);
+    }
+}
+
+static void count_expression_visitor(void *context, ASTNode *expr) {
+    count_expression((ExpressionCounts *)context, expr);
+}
+
+// Reset the cache for a new function body and find its repeated expressions
+void begin_value_numbering(CodeGen *codegen, ASTNode **stmts, size_t count) {
+    ExpressionCounts counts = {NULL, NULL, 0, 0};
+    for (size_t i = 0; i < count; i++) {
+        visit_statement_expressions(stmts[i], count_expression_visitor, &counts);
+    }
+    
+    free(codegen->repeated_exprs);
+    codegen->repeated_exprs = malloc((counts.count ? counts.count : 1) * sizeof(ASTNode *));
+    codegen->repeated_count = 0;
+    for (size_t i = 0; i < counts.count; i++) {
+        if (counts.counts[i] > 1) {
+            codegen->repeated_exprs[codegen->repeated_count++] = counts.exprs[i];
+        }
+    }
+    free(counts.exprs);
+    free(counts.counts);
+    
+    invalidate_cached_values(codegen, NULL);
+}
+
+// Tree-pattern instruction selection for arithmetic and comparisons.
+// Every subtree is evaluated into a temporary from a small register stack,
+// x0 first so a whole expression lands where generate_expression leaves it,
+// with operands ordered by register need (Sethi-Ullman). Operands that call
+// out, or that would run past the temporaries, are evaluated first at the
+// current depth and parked in spill slots, so calls never see a live
+// temporary. Tiles cover madd/msub, shifted-register operands, add/sub/cmp
+// immediates and the strength-reduced constant forms; helpers use x16/x17.
+#define EXPRESSION_TEMPS 8
+#define MAX_TILE_OPERANDS 3
+
+static const char *expression_temps[EXPRESSION_TEMPS] = {
+    "x0", "x9", "x10", "x11", "x12", "x13", "x14", "x15"
+};
+
+static void emit_tile(CodeGen *codegen, ASTNode *expr, SymbolTable *symbols, int depth);
+static const char *emit_tile_value(CodeGen *codegen, ASTNode *expr, SymbolTable *symbols, int depth);
+
+static const char *operator_name(ASTNode *expr) {
+    if (!expr || expr->type != AST_LIST || expr->data.list.count == 0) return NULL;
+    ASTNode *first = expr->data.list.children[0];
+    return first->type == AST_IDENTIFIER ? first->data.string_value : NULL;
+}
+
+static bool is_comparison_operator(const char *op) {
+    return strcmp(op, "==") == 0 || strcmp(op, "<") == 0 || strcmp(op, ">") == 0 ||
+           strcmp(op, "<=") == 0 || strcmp(op, ">=") == 0;
+}
+
+static bool is_binary_operator(const char *op) {
+    return strcmp(op, "+") == 0 || strcmp(op, "-") == 0 || strcmp(op, "*") == 0 ||
+           strcmp(op, "/") == 0 || strcmp(op, "%") == 0 || strcmp(op, "**") == 0 ||
+           is_comparison_operator(op);
+}
+
+static bool is_multiply(ASTNode *expr) {
+    const char *op = operator_name(expr);
+    return op && strcmp(op, "*") == 0 && expr->data.list.count >= 3;
+}
+
+static const char *condition_code(const char *op) {
+    if (strcmp(op, "==") == 0) return "eq";
+    if (strcmp(op, "<") == 0) return "lt";
+    if (strcmp(op, ">") == 0) return "gt";
+    if (strcmp(op, "<=") == 0) return "le";
+    return "ge";
+}
+
+static const char *inverted_condition_code(const char *op) {
+    if (strcmp(op, "==") == 0) return "ne";
+    if (strcmp(op, "<") == 0) return "ge";
+    if (strcmp(op, ">") == 0) return "le";
+    if (strcmp(op, "<=") == 0) return "gt";
+    return "lt";
+}
+
+// a op b == b swapped(op) a
+static const char *swapped_comparison(const char *op) {
+    if (strcmp(op, "<") == 0) return ">";
+    if (strcmp(op, ">") == 0) return "<";
+    if (strcmp(op, "<=") == 0) return ">=";
+    if (strcmp(op, ">=") == 0) return "<=";
+    return op;
+}
+
+// add/sub/cmp take a 12-bit unsigned immediate, optionally shifted by 12
+static bool is_add_immediate(long value) {
+    return (value >= 0 && value <= 4095) ||
+           (value > 0 && (value & 0xfff) == 0 && value <= 0xfff000);
+}
+
+static void format_add_immediate(char *buffer, size_t size, long value) {
+    if (value <= 4095) {
+        snprintf(buffer, size, "#%ld", value);
+    } else {
+        snprintf(buffer, size, "#%ld, lsl #12", value >> 12);
+    }
+}
+
+// Whether emit_tile evaluates expr entirely in registers, without calls or
+// falling back to generate_expression
+bool is_tileable(ASTNode *expr) {
+    if (!expr) return false;
+    
+    switch (expr->type) {
+        case AST_INT:
+        case AST_CHAR:
+        case AST_IDENTIFIER:
+            return true;
+        case AST_LIST: {
+            const char *op = operator_name(expr);
+            if (op && expr->data.list.count == 2) {
+                if (strcmp(op, "@") == 0) return is_tileable(expr->data.list.children[1]);
+                if (strcmp(op, "len") == 0) return expr->data.list.children[1]->type == AST_IDENTIFIER;
+                if (strcmp(op, "&") == 0) {
+                    ASTNode *target = expr->data.list.children[1];
+                    const char *target_op = operator_name(target);
+                    return target->type == AST_IDENTIFIER || (target_op && strcmp(target_op, ".") == 0) ||
+                           (target_op && strcmp(target_op, "[]") == 0 && is_tileable(target));
+                }
+            }
+            if (!op || expr->data.list.count < 3) return false;
+            if (is_binary_operator(op)) {
+                if (is_runtime_pow(expr)) return false;
+                return is_tileable(expr->data.list.children[1]) && is_tileable(expr->data.list.children[2]);
+            }
+            if (strcmp(op, "[]") == 0) {
+                return expr->data.list.children[1]->type == AST_IDENTIFIER &&
+                       is_tileable(expr->data.list.children[2]);
+            }
+            return strcmp(op, ".") == 0;
+        }
+        default:
+            return false;
+    }
+}
+
+// Temporaries needed to evaluate expr without spilling
+static int register_need(ASTNode *expr) {
+    const char *op = operator_name(expr);
+    if (op && expr->data.list.count == 2 && (strcmp(op, "@") == 0 || strcmp(op, "&") == 0)) {
+        return register_need(expr->data.list.children[1]);
+    }
+    if (!op || expr->data.list.count < 3) return 1;
+    
+    if (is_binary_operator(op)) {
+        int left = register_need(expr->data.list.children[1]);
+        int right = register_need(expr->data.list.children[2]);
+        return left == right ? left + 1 : (left > right ? left : right);
+    }
+    if (strcmp(op, "[]") == 0) {
+        return register_need(expr->data.list.children[2]);
+    }
+    return 1;
+}
+
+// Evaluate operands into temporaries starting at depth; regs receives the
+// register holding each operand
+static void emit_tile_operands(CodeGen *codegen, ASTNode **operands, int count, SymbolTable *symbols, int depth, const char **regs) {
+    bool isolated[MAX_TILE_OPERANDS];
+    int order[MAX_TILE_OPERANDS];
+    int ordered = 0, isolated_count = 0;
+    
+    for (int i = 0; i < count; i++) {
+        isolated[i] = !is_tileable(operands[i]);
+        if (isolated[i]) isolated_count++;
+    }
+    
+    // The rest go in decreasing register need. Anything that would reach
+    // into the last two temporaries (kept free for reloads) is isolated too.
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        ordered = 0;
+        for (int i = 0; i < count; i++) {
+            if (isolated[i]) continue;
+            int k = ordered++;
+            while (k > 0 && register_need(operands[order[k - 1]]) < register_need(operands[i])) {
+                order[k] = order[k - 1];
+                k--;
+            }
+            order[k] = i;
+        }
+        
+        int position = depth + (isolated_count > 0 ? 1 : 0);
+        for (int k = 0; k < ordered; k++) {
+            if (position + k + register_need(operands[order[k]]) > EXPRESSION_TEMPS - 2) {
+                isolated[order[k]] = true;
+                isolated_count++;
+                changed = true;
+                break;
+            }
+        }
+    }
+    
+    // Isolated operands keep source order since they may have side effects
+    int last_isolated = -1;
+    int slots[MAX_TILE_OPERANDS];
+    int spilled = 0;
+    for (int i = 0; i < count; i++) {
+        if (isolated[i]) last_isolated = i;
+    }
+    for (int i = 0; i < count; i++) {
+        if (!isolated[i]) continue;
+        emit_tile(codegen, operands[i], symbols, depth);
+        if (i == last_isolated) {
+            regs[i] = expression_temps[depth];
+        } else {
+            slots[i] = push_spill_slot(codegen);
+            emit_code(codegen, "    str   %s, [sp, #%d]\n", expression_temps[depth], slots[i]);
+            spilled++;
+        }
+    }
+    
+    int next = depth + (isolated_count > 0 ? 1 : 0);
+    for (int k = 0; k < ordered; k++) {
+        regs[order[k]] = emit_tile_value(codegen, operands[order[k]], symbols, next++);
+    }
+    
+    for (int i = 0; i < count; i++) {
+        if (!isolated[i] || i == last_isolated) continue;
+        emit_code(codegen, "    ldr   %s, [sp, #%d]\n", expression_temps[next], slots[i]);
+        regs[i] = expression_temps[next++];
+    }
+    while (spilled-- > 0) {
+        pop_spill_slot(codegen);
+    }
+}
+
+// Emit the cmp for a comparison and return its operator, flipped when the
+// constant operand was moved to the right
+static const char *emit_comparison(CodeGen *codegen, ASTNode *expr, SymbolTable *symbols, int depth) {
+    const char *op = operator_name(expr);
+    ASTNode *left = expr->data.list.children[1];
+    ASTNode *right = expr->data.list.children[2];
+    
+    if (left->type == AST_INT && right->type != AST_INT) {
+        ASTNode *tmp = left;
+        left = right;
+        right = tmp;
+        op = swapped_comparison(op);
+    }
+    
+    if (right->type == AST_INT) {
+        long value = right->data.int_value;
+        long magnitude = value < 0 ? -value : value;
+        if (is_add_immediate(magnitude)) {
+            char immediate[32];
+            format_add_immediate(immediate, sizeof(immediate), magnitude);
+            const char *reg = emit_tile_value(codegen, left, symbols, depth);
+            emit_code(codegen, "    %s   %s, %s\n", value < 0 ? "cmn" : "cmp", reg, immediate);
+            return op;
+        }
+    }
+    
+    ASTNode *operands[2] = {left, right};
+    const char *regs[2];
+    emit_tile_operands(codegen, operands, 2, symbols, depth, regs);
+    emit_code(codegen, "    cmp   %s, %s\n", regs[0], regs[1]);
+    return op;
+}
+
+// Operands use the temporaries from depth up; only the final instruction
+// writes dest
+static void emit_binary_tile(CodeGen *codegen, ASTNode *expr, SymbolTable *symbols, int depth, const char *dest) {
+    const char *op = operator_name(expr);
+    ASTNode *left = expr->data.list.children[1];
+    ASTNode *right = expr->data.list.children[2];
+    SymbolType pointee;
+    StructType *record;
+    
+    if ((strcmp(op, "+") == 0 || strcmp(op, "-") == 0) && pointer_target(left, symbols, &pointee, &record)) {
+        emit_pointer_arithmetic(codegen, expr, symbols, depth, dest);
+        return;
+    }
+    
+    if (is_comparison_operator(op)) {
+        op = emit_comparison(codegen, expr, symbols, depth);
+        emit_code(codegen, "    cset  %s, %s\n", dest, condition_code(op));
+        return;
+    }
+    
+    // Exponentiation that needs no pow call: 2 ** n is a shift, x ** k with
+    // constant k a multiplication chain
+    if (strcmp(op, "**") == 0 && !is_runtime_pow(expr)) {
+        if (left->type == AST_INT && left->data.int_value == 2) {
+            if (right->type == AST_INT) {
+                int exponent = right->data.int_value;
+                emit_mov_wide(codegen, dest, exponent >= 0 && exponent < 64 ? 1UL << exponent : 0);
+            } else {
+                emit_power_of_two(codegen, dest, emit_tile_value(codegen, right, symbols, depth));
+            }
+        } else {
+            emit_power_constant(codegen, dest, emit_tile_value(codegen, left, symbols, depth), right->data.int_value);
+        }
+        return;
+    }
+    
+    // Commutative operators keep the constant on the right
+    if ((strcmp(op, "+") == 0 || strcmp(op, "*") == 0) &&
+        left->type == AST_INT && right->type != AST_INT) {
+        ASTNode *tmp = left;
+        left = right;
+        right = tmp;
+    }
+    
+    // a +/- b * c: a shifted-register operand when c is a power of two, a
+    // multiply-accumulate unless the product is cheaper strength-reduced
+    if (strcmp(op, "+") == 0 || strcmp(op, "-") == 0) {
+        ASTNode *product = NULL, *addend = NULL;
+        if (is_multiply(right)) {
+            product = right;
+            addend = left;
+        } else if (strcmp(op, "+") == 0 && is_multiply(left)) {
+            product = left;
+            addend = right;
+        }
+        
+        if (product) {
+            ASTNode *factor = product->data.list.children[1];
+            ASTNode *scale = product->data.list.children[2];
+            if (factor->type == AST_INT && scale->type != AST_INT) {
+                ASTNode *tmp = factor;
+                factor = scale;
+                scale = tmp;
+            }
+            
+            if (scale->type == AST_INT && factor->type != AST_INT && is_power_of_two(scale->data.int_value)) {
+                ASTNode *operands[2] = {addend, factor};
+                const char *regs[2];
+                emit_tile_operands(codegen, operands, 2, symbols, depth, regs);
+                emit_code(codegen, "    %s   %s, %s, %s, lsl #%d\n", strcmp(op, "+") == 0 ? "add" : "sub",
+                          dest, regs[0], regs[1], log2_exact(scale->data.int_value));
+                return;
+            }
+            if (scale->type != AST_INT ||
+                (factor->type != AST_INT && !is_strength_reducible("*", scale->data.int_value))) {
+                ASTNode *operands[3] = {factor, scale, addend};
+                const char *regs[3];
+                emit_tile_operands(codegen, operands, 3, symbols, depth, regs);
+                emit_code(codegen, "    %s  %s, %s, %s, %s\n", strcmp(op, "+") == 0 ? "madd" : "msub",
+                          dest, regs[0], regs[1], regs[2]);
+                return;
+            }
+        }
+    }
+    
+    if (right->type == AST_INT) {
+        long value = right->data.int_value;
+        
+        // add/sub with an immediate, negating it if that makes it encodable
+        if (strcmp(op, "+") == 0 || strcmp(op, "-") == 0) {
+            bool subtract = strcmp(op, "-") == 0;
+            if (value < 0) {
+                value = -value;
+                subtract = !subtract;
+            }
+            if (is_add_immediate(value)) {
+                char immediate[32];
+                format_add_immediate(immediate, sizeof(immediate), value);
+                const char *reg = emit_tile_value(codegen, left, symbols, depth);
+                emit_code(codegen, "    %s   %s, %s, %s\n", subtract ? "sub" : "add", dest, reg, immediate);
+                return;
+            }
+            value = right->data.int_value;
+        }
+        
+        // Constant multipliers and divisors are strength-reduced
+        if (is_strength_reducible(op, value)) {
+            emit_arithmetic_constant(codegen, op, dest, emit_tile_value(codegen, left, symbols, depth), value);
+            return;
+        }
+    }
+    
+    ASTNode *operands[2] = {left, right};
+    const char *regs[2];
+    emit_tile_operands(codegen, operands, 2, symbols, depth, regs);
+    emit_arithmetic(codegen, op, dest, regs[0], regs[1]);
+}
+
+// Evaluate expr into dest, using the temporaries from depth up on the way
+static void compute_tile(CodeGen *codegen, ASTNode *expr, SymbolTable *symbols, int depth, const char *dest) {
+    const char *op = operator_name(expr);
+    
+    if (expr->type == AST_INT) {
+        emit_mov_immediate(codegen, dest, expr->data.int_value);
+        return;
+    }
+    if (expr->type == AST_CHAR) {
+        emit_mov_immediate(codegen, dest, (int)expr->data.char_value);
+        return;
+    }
+    if (expr->type == AST_IDENTIFIER) {
+        emit_load_variable(codegen, dest, expr->data.string_value, symbols);
+        return;
+    }
+    if (op && expr->data.list.count == 2 && strcmp(op, "@") == 0) {
+        emit_dereference(codegen, dest, expr->data.list.children[1], symbols, depth);
+        return;
+    }
+    if (op && expr->data.list.count == 2 && strcmp(op, "&") == 0) {
+        emit_address(codegen, dest, expr->data.list.children[1], symbols, depth);
+        return;
+    }
+    if (op && expr->data.list.count == 2 && strcmp(op, "len") == 0) {
+        // The length word of a vec's slot, the count of a map's, or the one
+        // before a string
+        const char *name = expr->data.list.children[1]->data.string_value;
+        Symbol *symbol = find_symbol(symbols, name);
+        if (symbol && symbol->type == SYM_VEC) {
+            emit_code(codegen, "    ldr   %s, [sp, #%d]\n", dest, get_symbol_offset(symbols, name) + VEC_LENGTH);
+        } else if (symbol && symbol->type == SYM_MAP) {
+            emit_code(codegen, "    ldr   %s, [sp, #%d]\n", dest, get_symbol_offset(symbols, name) + MAP_COUNT);
+        } else {
+            emit_load_variable(codegen, dest, name, symbols);
+            emit_string_length(codegen, dest, expr->data.list.children[1], dest);
+        }
+        return;
+    }
+    
+    if (op && expr->data.list.count >= 3) {
+        ASTNode *base = expr->data.list.children[1];
+        ASTNode *selector = expr->data.list.children[2];
+        
+        if (is_binary_operator(op)) {
+            emit_binary_tile(codegen, expr, symbols, depth, dest);
+            return;
+        }
+        
+        // Array element: constant indices fold into the offset, others use the
+        // index register as a scaled offset
+        if (strcmp(op, "[]") == 0 && base->type == AST_IDENTIFIER) {
+            Symbol *symbol = find_symbol_recursive(symbols, base->data.string_value);
+            if (symbol && symbol->type == SYM_VECTOR) {
+                emit_lane_load(codegen, dest, base->data.string_value, selector, symbols, depth);
+                return;
+            }
+            if (is_indirect(symbol)) {
+                char address[48];
+                emit_pointer_element_operand(codegen, address, sizeof(address), base->data.string_value, selector, symbols, depth, "x16");
+                emit_sized_access(codegen, false, symbol->type_info.pointer.element_type, dest, address);
+                return;
+            }
+            int array_offset = get_symbol_offset(symbols, base->data.string_value);
+            if (array_offset < 0) {
+                emit_mov_immediate(codegen, dest, 0);
+                return;
+            }
+            SymbolType element_type = symbol && symbol->type == SYM_ARRAY ? symbol->type_info.array.element_type : SYM_INT;
+            int pointer = find_induction_pointer(codegen, array_offset, selector);
+            char address[48];
+            if (pointer >= 0) {
+                snprintf(address, sizeof(address), "[%s]", value_cache_regs[codegen->induction_pointers[pointer].reg]);
+            } else if (selector->type == AST_INT) {
+                snprintf(address, sizeof(address), "[sp, #%d]", array_offset + selector->data.int_value * type_size(element_type));
+            } else {
+                const char *index = emit_tile_value(codegen, selector, symbols, depth);
+                if (array_offset != 0) {
+                    emit_code(codegen, "    add   x16, sp, #%d\n", array_offset);
+                }
+                format_indexed_address(address, sizeof(address), array_offset == 0 ? "sp" : "x16", index, element_type);
+            }
+            emit_sized_access(codegen, false, element_type, dest, address);
+            return;
+        }
+        
+        // Field access, nested or not: load at its offset in the frame
+        if (strcmp(op, ".") == 0) {
+            int field_offset;
+            SymbolType field_type;
+            StructType *nested;
+            Symbol *pointer;
+            if (resolve_field(symbols, expr, &field_offset, &field_type, &nested) && !nested) {
+                char address[32];
+                snprintf(address, sizeof(address), "[sp, #%d]", field_offset);
+                emit_sized_access(codegen, false, field_type, dest, address);
+            } else if (resolve_pointer_field(symbols, expr, &field_offset, &field_type, &nested, &pointer) && !nested) {
+                char address[48];
+                const char *base = emit_tile_value(codegen, access_root(expr), symbols, depth);
+                snprintf(address, sizeof(address), "[%s, #%d]", base, field_offset);
+                emit_sized_access(codegen, false, field_type, dest, address);
+            } else {
+                // Unknown struct, type or field, emit error value
+                emit_mov_immediate(codegen, dest, 0);
+            }
+            return;
+        }
+    }
+    
+    // Calls and everything else; only reached with no live temporaries
+    generate_expression(codegen, expr, symbols);
+    if (strcmp(dest, "x0") != 0) {
+        emit_code(codegen, "    mov   %s, x0\n", dest);
+    }
+}
+
+// Evaluate expr and return the register holding it: its value-numbered
+// register when it is already available, otherwise the temporary for depth.
+// Repeated expressions are computed straight into a free cache register.
+static const char *emit_tile_value(CodeGen *codegen, ASTNode *expr, SymbolTable *symbols, int depth) {
+    int cached = find_cached_value(codegen, expr);
+    if (cached >= 0) return value_cache_regs[cached];
+    
+    if (expr->type != AST_INT && expr->type != AST_CHAR &&
+        is_tileable(expr) && is_repeated_expression(codegen, expr)) {
+        int reg = free_cache_register(codegen);
+        if (reg >= 0) {
+            compute_tile(codegen, expr, symbols, depth, value_cache_regs[reg]);
+            codegen->cached_values[reg] = expr;
+            return value_cache_regs[reg];
+        }
+    }
+    
+    compute_tile(codegen, expr, symbols, depth, expression_temps[depth]);
+    return expression_temps[depth];
+}
+
+static void emit_tile(CodeGen *codegen, ASTNode *expr, SymbolTable *symbols, int depth) {
+    const char *reg = emit_tile_value(codegen, expr, symbols, depth);
+    if (strcmp(reg, expression_temps[depth]) != 0) {
+        emit_code(codegen, "    mov   %s, %s\n", expression_temps[depth], reg);
+    }
+}
+
+static bool is_constant_condition(ASTNode *condition) {
+    return condition->type == AST_INT || condition->type == AST_CHAR;
+}
+
+static bool constant_condition_value(ASTNode *condition) {
+    return condition->type == AST_INT ? condition->data.int_value != 0 : condition->data.char_value != 0;
+}
+
+// Branch to label when condition is false. Comparisons branch on the flags
+// directly instead of materializing a boolean for cbz; constant conditions
+// need no test at all.
+void emit_branch_if_false(CodeGen *codegen, ASTNode *condition, SymbolTable *symbols, const char *label) {
+    if (is_constant_condition(condition)) {
+        if (!constant_condition_value(condition)) {
+            emit_code(codegen, "    b     %s\n", label);
+        }
+        return;
+    }
+    
+    const char *op = operator_name(condition);
+    if (op && is_comparison_operator(op) && condition->data.list.count >= 3) {
+        op = emit_comparison(codegen, condition, symbols, 0);
+        emit_code(codegen, "    b.%s  %s\n", inverted_condition_code(op), label);
+        return;
+    }
+    
+    generate_expression(codegen, condition, symbols);
+    emit_code(codegen, "    cbz   x0, %s\n", label);
+}
+
+void emit_branch_if_true(CodeGen *codegen, ASTNode *condition, SymbolTable *symbols, const char *label) {
+    if (is_constant_condition(condition)) {
+        if (constant_condition_value(condition)) {
+            emit_code(codegen, "    b     %s\n", label);
+        }
+        return;
+    }
+    
+    const char *op = operator_name(condition);
+    if (op && is_comparison_operator(op) && condition->data.list.count >= 3) {
+        op = emit_comparison(codegen, condition, symbols, 0);
+        emit_code(codegen, "    b.%s  %s\n", condition_code(op), label);
+        return;
+    }
+    
+    generate_expression(codegen, condition, symbols);
+    emit_code(codegen, "    cbnz  x0, %s\n", label);
+}
+
+// Loop optimization for while loops that make no calls, so registers x3-x8
+// survive every iteration. The preheader gives each array indexed by a basic
+// induction variable i, stepped only by (set i (+ i c)) statements at the top
+// level of the body (one per copy of an unrolled body), a
+// pointer to arr[i] that advances alongside i; arr[i] then addresses [xP]
+// directly, and the peephole pass folds the advance into a post-indexed
+// access. Maximal loop-invariant expressions are then computed into free
+// value cache registers, where value numbering finds them inside the loop.
+
+// Statements in node storing to name
+static int count_assignments(ASTNode *node, const char *name) {
+    if (!node || node->type != AST_LIST) return 0;
+    
+    const char *assigned = assigned_variable(node);
+    const char *stepped = loop_variable(node);
+    int count = (assigned && strcmp(assigned, name) == 0) + (stepped && strcmp(stepped, name) == 0);
+    for (size_t i = 0; i < node->data.list.count; i++) {
+        count += count_assignments(node->data.list.children[i], name);
+    }
+    return count;
+}
+
+// Whether every variable expr reads keeps its value throughout loop. A
+// store through any pointer may change what every pointer reads.
+static bool is_loop_invariant(ASTNode *expr, ASTNode *loop, SymbolTable *symbols) {
+    if (expr->type == AST_IDENTIFIER) return count_assignments(loop, expr->data.string_value) == 0;
+    if (expr->type != AST_LIST) return expr->type == AST_INT || expr->type == AST_CHAR;
+    
+    const char *op = operator_name(expr);
+    if (op && strcmp(op, ".") == 0) return is_loop_invariant(expr->data.list.children[1], loop, symbols);
+    if (loads_through_pointer(expr, symbols) && stores_through_pointer(loop, symbols)) return false;
+    for (size_t i = 1; i < expr->data.list.count; i++) {
+        if (!is_loop_invariant(expr->data.list.children[i], loop, symbols)) return false;
+    }
+    return true;
+}
+
+typedef struct {
+    ASTNode *loop;
+    SymbolTable *symbols;
+    ASTNode *invariants[VALUE_CACHE_REGS];
+    int count;
+} InvariantSet;
+
+static void collect_invariants(void *context, ASTNode *expr) {
+    InvariantSet *set = context;
+    if (!expr || expr->type == AST_INT || expr->type == AST_CHAR || expr->type == AST_STRING) return;
+    
+    if (is_tileable(expr) && is_loop_invariant(expr, set->loop, set->symbols)) {
+        for (int i = 0; i < set->count; i++) {
+            if (expressions_equal(set->invariants[i], expr)) return;
+        }
+        if (set->count < VALUE_CACHE_REGS) set->invariants[set->count++] = expr;
+        return;
+    }
+    
+    const char *op = operator_name(expr);
+    if (!op || strcmp(op, ".") == 0) return;
+    if (strcmp(op, "[]") == 0) {
+        if (expr->data.list.count >= 3) collect_invariants(context, expr->data.list.children[2]);
+        return;
+    }
+    for (size_t i = 1; i < expr->data.list.count; i++) {
+        collect_invariants(context, expr->data.list.children[i]);
+    }
+}
+
+// (set i (+ i c)), (set i (+ c i)) or (set i (- i c)) with a constant c
+static bool is_induction_increment(ASTNode *stmt, const char **variable, int *step) {
+    const char *op = operator_name(stmt);
+    if (!op || strcmp(op, "set") != 0 || stmt->data.list.count != 3) return false;
+    
+    ASTNode *target = stmt->data.list.children[1];
+    ASTNode *value = stmt->data.list.children[2];
+    const char *value_op = operator_name(value);
+    if (target->type != AST_IDENTIFIER || !value_op || value->data.list.count != 3) return false;
+    
+    ASTNode *left = value->data.list.children[1];
+    ASTNode *right = value->data.list.children[2];
+    const char *name = target->data.string_value;
+    bool left_is_variable = left->type == AST_IDENTIFIER && strcmp(left->data.string_value, name) == 0;
+    bool right_is_variable = right->type == AST_IDENTIFIER && strcmp(right->data.string_value, name) == 0;
+    
+    if (strcmp(value_op, "+") == 0 && left_is_variable && right->type == AST_INT) {
+        *step = right->data.int_value;
+    } else if (strcmp(value_op, "+") == 0 && right_is_variable && left->type == AST_INT) {
+        *step = left->data.int_value;
+    } else if (strcmp(value_op, "-") == 0 && left_is_variable && right->type == AST_INT) {
+        *step = -right->data.int_value;
+    } else {
+        return false;
+    }
+    *variable = name;
+    return true;
+}
+
+// Whether node assigns name as a whole, rather than one of its elements
+static bool rebinds_variable(ASTNode *node, const char *name) {
+    if (!node || node->type != AST_LIST) return false;
+    
+    // Growing a vec may move its elements
+    if (is_vec_call(node) && strcmp(node->data.list.children[1]->data.string_value, name) == 0) return true;
+    const char *op = operator_name(node);
+    if (op && (strcmp(op, "set") == 0 || strcmp(op, "let") == 0) && node->data.list.count >= 3 &&
+        node->data.list.children[1]->type == AST_IDENTIFIER &&
+        strcmp(node->data.list.children[1]->data.string_value, name) == 0) {
+        return true;
+    }
+    for (size_t i = 0; i < node->data.list.count; i++) {
+        if (rebinds_variable(node->data.list.children[i], name)) return true;
+    }
+    return false;
+}
+
+// Arrays the loop indexes with exactly variable, as their name nodes
+static void collect_indexed_arrays(ASTNode *node, const char *variable, ASTNode **arrays, int *count) {
+    if (!node || node->type != AST_LIST) return;
+    
+    const char *op = operator_name(node);
+    if (op && strcmp(op, "[]") == 0 && node->data.list.count >= 3) {
+        ASTNode *array = node->data.list.children[1];
+        ASTNode *index = node->data.list.children[2];
+        if (array->type == AST_IDENTIFIER && index->type == AST_IDENTIFIER &&
+            strcmp(index->data.string_value, variable) == 0) {
+            for (int i = 0; i < *count; i++) {
+                if (strcmp(arrays[i]->data.string_value, array->data.string_value) == 0) return;
+            }
+            if (*count < VALUE_CACHE_REGS) arrays[(*count)++] = array;
+        }
+    }
+    for (size_t i = 0; i < node->data.list.count; i++) {
+        collect_indexed_arrays(node->data.list.children[i], variable, arrays, count);
+    }
+}
+
+void emit_loop_preheader(CodeGen *codegen, ASTNode *loop, SymbolTable *symbols) {
+    ASTNode *body = loop->data.list.children[2];
+    ASTNode **stmts = &body;
+    size_t stmt_count = 1;
+    const char *body_op = operator_name(body);
+    if (body_op && strcmp(body_op, "begin") == 0) {
+        stmts = body->data.list.children + 1;
+        stmt_count = body->data.list.count - 1;
+    }
+    
+    // Induction pointers for variables only ever assigned by increments at
+    // the top level of the body (an unrolled body has several)
+    for (size_t s = 0; s < stmt_count; s++) {
+        const char *variable;
+        int step;
+        if (!is_induction_increment(stmts[s], &variable, &step)) continue;
+        
+        int increments = 0;
+        bool steps_fit = true;
+        bool seen = false;
+        for (size_t t = 0; t < stmt_count; t++) {
+            const char *other;
+            int other_step;
+            if (!is_induction_increment(stmts[t], &other, &other_step) || strcmp(other, variable) != 0) continue;
+            if (t < s) seen = true;
+            if (other_step == 0 || other_step > 511 || other_step < -511) steps_fit = false;
+            increments++;
+        }
+        if (seen || !steps_fit || count_assignments(loop, variable) != increments) continue;
+        
+        Symbol *symbol = find_symbol(symbols, variable);
+        if (!symbol || symbol->type == SYM_ARRAY || symbol->type == SYM_STRUCT || symbol->type == SYM_FUNCTION) continue;
+        
+        ASTNode *arrays[VALUE_CACHE_REGS];
+        int array_count = 0;
+        collect_indexed_arrays(loop, variable, arrays, &array_count);
+        for (int a = 0; a < array_count; a++) {
+            Symbol *array_symbol = find_symbol(symbols, arrays[a]->data.string_value);
+            int array_offset = get_symbol_offset(symbols, arrays[a]->data.string_value);
+            int reg = free_cache_register(codegen);
+            if (!array_symbol || array_offset < 0 || array_offset > 4095) continue;
+            // Heap elements start wherever the pointer points, as long as
+            // the loop never points it elsewhere
+            bool heap = is_indirect(array_symbol);
+            if (heap ? rebinds_variable(loop, array_symbol->name) : array_symbol->type != SYM_ARRAY) continue;
+            if (reg < 0 || codegen->induction_count == VALUE_CACHE_REGS) break;
+            
+            codegen->pinned_regs |= 1u << reg;
+            const char *index = emit_tile_value(codegen, stmts[s]->data.list.children[1], symbols, 0);
+            const char *pointer = value_cache_regs[reg];
+            SymbolType element_type = heap ? array_symbol->type_info.pointer.element_type :
+                                             array_symbol->type_info.array.element_type;
+            if (heap) {
+                emit_code(codegen, "    ldr   %s, [sp, #%d]\n", pointer, array_offset);
+            } else {
+                emit_code(codegen, "    add   %s, sp, #%d\n", pointer, array_offset);
+            }
+            emit_code(codegen, "    add   %s, %s, %s, lsl #%d\n", pointer, pointer, index, type_shift(element_type));
+            codegen->induction_pointers[codegen->induction_count++] =
+                (InductionPointer){variable, array_offset, type_size(element_type), reg};
+        }
+    }
+    
+    // Hoist invariants into the cache registers that are left
+    InvariantSet set = {loop, symbols, {NULL}, 0};
+    visit_statement_expressions(loop, collect_invariants, &set);
+    for (int i = 0; i < set.count; i++) {
+        if (find_cached_value(codegen, set.invariants[i]) >= 0) continue;
+        int reg = free_cache_register(codegen);
+        if (reg < 0) break;
+        compute_tile(codegen, set.invariants[i], symbols, 0, value_cache_regs[reg]);
+        codegen->cached_values[reg] = set.invariants[i];
+    }
+}
+
+// Keep induction pointers in step after stmt, an increment of their variable
+void advance_induction_pointers(CodeGen *codegen, ASTNode *stmt) {
+    const char *variable;
+    int step;
+    if (codegen->induction_count == 0 || !is_induction_increment(stmt, &variable, &step)) return;
+    
+    for (int i = 0; i < codegen->induction_count; i++) {
+        InductionPointer *pointer = &codegen->induction_pointers[i];
+        if (strcmp(pointer->variable, variable) != 0) continue;
+        
+        const char *reg = value_cache_regs[pointer->reg];
+        if (step > 0) {
+            emit_code(codegen, "    add   %s, %s, #%d\n", reg, reg, step * pointer->element_size);
+        } else {
+            emit_code(codegen, "    sub   %s, %s, #%d\n", reg, reg, -step * pointer->element_size);
+        }
+    }
+}
+
+// Memory operand for array[index] while x0 holds a value to store. Constant
+// indices fold into the immediate offset. Register-only indices are tiled
+// from the second temporary up, which leaves x0 alone; anything else goes
+// through x1 and clobbers x0. The array base is sp itself or x2, unless a
+// loop keeps an induction pointer to the element.
+void emit_array_element_operand(CodeGen *codegen, char *operand, size_t size, int array_offset, SymbolType element_type, ASTNode *index, SymbolTable *symbols) {
+    if (index->type == AST_INT) {
+        snprintf(operand, size, "[sp, #%d]", array_offset + index->data.int_value * type_size(element_type));
+        return;
+    }
+    int pointer = find_induction_pointer(codegen, array_offset, index);
+    if (pointer >= 0) {
+        snprintf(operand, size, "[%s]", value_cache_regs[codegen->induction_pointers[pointer].reg]);
+        return;
+    }
+    
+    const char *reg = "x1";
+    if (is_tileable(index)) {
+        reg = emit_tile_value(codegen, index, symbols, 1);
+    } else {
+        emit_load_operand(codegen, "x1", index, symbols);
+    }
+    if (array_offset == 0) {
+        format_indexed_address(operand, size, "sp", reg, element_type);
+    } else {
+        emit_code(codegen, "    add   x2, sp, #%d\n", array_offset);
+        format_indexed_address(operand, size, "x2", reg, element_type);
+    }
+}
+
+static void emit_copy_from_pointer(CodeGen *codegen, int source, int offset, int size);
+
+void generate_expression(CodeGen *codegen, ASTNode *expr, SymbolTable *symbols) {
+    if (!expr) return;
+    
+    switch (expr->type) {
+        case AST_INT:
+            emit_mov_immediate(codegen, "x0", expr->data.int_value);
+            break;
+            
+        case AST_CHAR:
+            emit_mov_immediate(codegen, "x0", (int)expr->data.char_value);
+            break;
+            
+        case AST_IDENTIFIER:
+            emit_tile(codegen, expr, symbols, 0);
+            break;
+            
+        case AST_STRING:
+            generate_string_literal(codegen, "x0", expr);
+            break;
+            
+        case AST_LIST:
+            if (expr->data.list.count > 0) {
+                ASTNode *op = expr->data.list.children[0];
+                
+                if (op->type == AST_IDENTIFIER) {
+                    // Horizontal vector reductions yield scalars
+                    if (is_vector_reduction(expr)) {
+                        generate_vector_reduction(codegen, expr, symbols);
+                    }
+                    // sort, search, fill, copy, min, max and sum over arrays
+                    else if (is_bulk_builtin(expr, symbols)) {
+                        generate_bulk_builtin(codegen, expr, symbols);
+                    }
+                    // put, get, has, del, len and reserve on maps
+                    else if (is_map_builtin(expr, symbols)) {
+                        generate_map_builtin(codegen, expr, symbols);
+                    }
+                    // push, pop, len and reserve on vecs
+                    else if (is_vec_builtin(expr, symbols)) {
+                        generate_vec_builtin(codegen, expr, symbols);
+                    }
+                    // len, concat and eq on strings
+                    else if (is_string_builtin(expr)) {
+                        generate_string_builtin(codegen, expr, symbols);
+                    }
+                    // Heap elements from the current region
+                    else if (strcmp(op->data.string_value, "alloc") == 0 && expr->data.list.count == 3) {
+                        generate_alloc(codegen, expr, symbols);
+                    }
+                    // Addresses and loads through pointers
+                    else if ((strcmp(op->data.string_value, "&") == 0 || strcmp(op->data.string_value, "@") == 0) &&
+                             expr->data.list.count == 2) {
+                        emit_tile(codegen, expr, symbols, 0);
+                    }
+                    // Arithmetic, comparisons, exponentiation, array elements
+                    // and fields are tiled
+                    else if (is_binary_operator(op->data.string_value) ||
+                        strcmp(op->data.string_value, "[]") == 0 ||
+                        strcmp(op->data.string_value, ".") == 0) {
+                        if (expr->data.list.count >= 3) {
+                            emit_tile(codegen, expr, symbols, 0);
+                        }
+                    }
+                    // Handle struct literals: (# ((field1 value1) (field2 value2) ...))
+                    else if (strcmp(op->data.string_value, "#") == 0) {
+                        if (expr->data.list.count >= 2) {
+                            ASTNode *fields = expr->data.list.children[1];
+                            
+                            // For struct initialization, just return the first field's value
+                            // The actual struct layout will be handled during variable assignment
+                            if (fields->type == AST_LIST && fields->data.list.count > 0) {
+                                ASTNode *first_field = fields->data.list.children[0];
+                                if (first_field->type == AST_LIST && first_field->data.list.count >= 2) {
+                                    ASTNode *field_value = first_field->data.list.children[1];
+                                    generate_expression(codegen, field_value, symbols);
+                                } else {
+                                    emit_mov_immediate(codegen, "x0", 0);
+                                }
+                            } else {
+                                emit_mov_immediate(codegen, "x0", 0);
+                            }
+                        } else {
+                            emit_mov_immediate(codegen, "x0", 0);
+                        }
+                    }
+                    // Handle function calls: (function_name arg1 arg2 ...)
+                    else {
+                        // Check if this is a function call using recursive symbol lookup
+                        Symbol *func_symbol = find_symbol_recursive(symbols, op->data.string_value);
+                        if (func_symbol && func_symbol->type == SYM_FUNCTION) {
+                            // Generate function call
+                            emit_code(codegen, "    // Function call: %s\n", op->data.string_value);
+                            
+                            // Pass arguments - for structs, we need to copy all fields.
+                            // Arguments that need evaluating go first, all but the
+                            // last parked in spill slots so a later one cannot
+                            // clobber them; the rest load straight into place.
+                            // An aggregate travels the way the callee declares it
+                            // (see argument_registers), in chunks or by reference.
+                            // C functions get all eight argument registers and C
+                            // layouts (see c_argument_registers).
+                            int arg_count = expr->data.list.count - 1; // Subtract 1 for function name
+                            int arg_regs[arg_count > 0 ? arg_count : 1];
+                            int arg_slots[arg_count > 0 ? arg_count : 1];
+                            int arg_chunks[arg_count > 0 ? arg_count : 1];
+                            bool arg_by_reference[arg_count > 0 ? arg_count : 1];
+                            int arg_copies[arg_count > 0 ? arg_count : 1];
+                            ASTNode *fn_node = func_symbol->init_value;
+                            ASTNode *params = fn_node && fn_node->type == AST_LIST && fn_node->data.list.count >= 2 ?
+                                fn_node->data.list.children[1] : NULL;
+                            bool external = is_extern_declaration(fn_node);
+                            int max_regs = external ? C_ARGUMENT_REGS : ARGUMENT_REGS;
+                            int reg_index = 0;
+                            int last_evaluated = -1;
+                            int spilled = 0;
+                            char reg[16];
+                            
+                            for (int i = 0; i < arg_count; i++) {
+                                ASTNode *arg = expr->data.list.children[i + 1];
+                                Symbol *arg_symbol = arg->type == AST_IDENTIFIER ? find_symbol(symbols, arg->data.string_value) : NULL;
+                                
+                                arg_regs[i] = reg_index < max_regs ? reg_index : -1;
+                                arg_chunks[i] = 1;
+                                arg_by_reference[i] = false;
+                                arg_copies[i] = -1;
+                                if (arg_regs[i] < 0) {
+                                    argument_register_error(external ? "C function" : "function", op->data.string_value, max_regs);
+                                }
+                                Symbol param;
+                                bool declared = params && (params->type == AST_LIST || params->type == AST_ARRAY) &&
+                                    (size_t)i < params->data.list.count &&
+                                    parse_parameter(params->data.list.children[i], &param);
+                                if (arg_symbol && is_aggregate(arg_symbol) && declared && param.type == SYM_POINTER) {
+                                    // A *T parameter takes the address, uncopied
+                                    arg_by_reference[i] = true;
+                                } else if (arg_symbol && is_aggregate(arg_symbol) && external) {
+                                    arg_chunks[i] = c_argument_registers(arg_symbol, &arg_by_reference[i]);
+                                    if (arg_by_reference[i] && arg_symbol->type == SYM_STRUCT) {
+                                        // The callee owns the struct it is handed,
+                                        // so it gets a copy
+                                        int size = symbol_slot_size(arg_symbol);
+                                        arg_copies[i] = push_spill_slot(codegen);
+                                        for (int slot = 8; slot < size; slot += 8) push_spill_slot(codegen);
+                                        emit_code(codegen, "    add   x0, sp, #%d\n", get_symbol_offset(symbols, arg_symbol->name));
+                                        emit_copy_from_pointer(codegen, 0, arg_copies[i], size);
+                                        spilled += (size + 7) / 8;
+                                    }
+                                } else if (arg_symbol && is_aggregate(arg_symbol)) {
+                                    arg_chunks[i] = argument_registers(declared && is_aggregate(&param) ? &param : arg_symbol,
+                                                                       &arg_by_reference[i]);
+                                }
+                                if (reg_index + arg_chunks[i] > max_regs) {
+                                    argument_register_error(external ? "C function" : "function", op->data.string_value, max_regs);
+                                }
+                                reg_index += arg_chunks[i];
+                                if (arg->type != AST_INT && arg->type != AST_CHAR && arg->type != AST_IDENTIFIER) {
+                                    last_evaluated = i;
+                                }
+                            }
+                            
+                            // A C function writes to stdout past the runtime's
+                            // output buffer, which is flushed just before the
+                            // call; every argument waits in a spill slot. pfor
+                            // chunks skip the flush: they run on several
+                            // threads at once, after clumsy_pfor flushed.
+                            bool flush = external && !codegen->in_pfor_chunk;
+                            int in_register = flush ? -1 : last_evaluated;
+                            for (int i = 0; i <= last_evaluated && i != in_register; i++) {
+                                ASTNode *arg = expr->data.list.children[i + 1];
+                                if (arg_regs[i] < 0 || arg->type == AST_INT || arg->type == AST_CHAR || arg->type == AST_IDENTIFIER) continue;
+                                generate_expression(codegen, arg, symbols);
+                                arg_slots[i] = push_spill_slot(codegen);
+                                emit_code(codegen, "    str   x0, [sp, #%d]\n", arg_slots[i]);
+                                spilled++;
+                            }
+                            if (in_register >= 0) {
+                                generate_expression(codegen, expr->data.list.children[in_register + 1], symbols);
+                            }
+                            // Argument registers overlap the value cache, which
+                            // the call clobbers anyway
+                            invalidate_cached_values(codegen, NULL);
+                            if (flush) {
+                                emit_code(codegen, "    bl    _clumsy_flush\n");
+                            } else if (in_register >= 0 && arg_regs[in_register] != 0) {
+                                emit_code(codegen, "    mov   x%d, x0\n", arg_regs[in_register]);
+                            }
+                            
+                            for (int i = 0; i < arg_count; i++) {
+                                ASTNode *arg = expr->data.list.children[i + 1];
+                                if (arg_regs[i] < 0 || i == in_register) continue;
+                                snprintf(reg, sizeof(reg), "x%d", arg_regs[i]);
+                                
+                                if (arg->type == AST_INT) {
+                                    emit_mov_immediate(codegen, reg, arg->data.int_value);
+                                } else if (arg->type == AST_CHAR) {
+                                    emit_mov_immediate(codegen, reg, (int)arg->data.char_value);
+                                } else if (arg->type == AST_IDENTIFIER) {
+                                    // Check if this is a struct or array variable by looking at symbol table
+                                    Symbol *arg_symbol = find_symbol(symbols, arg->data.string_value);
+                                    int offset = get_symbol_offset(symbols, arg->data.string_value);
+                                    if (arg_symbol && is_aggregate(arg_symbol) && arg_by_reference[i]) {
+                                        emit_code(codegen, "    add   %s, sp, #%d\n", reg, arg_copies[i] >= 0 ? arg_copies[i] : offset);
+                                    } else if (arg_symbol && is_aggregate(arg_symbol)) {
+                                        // Raw 8-byte chunks, one per register
+                                        for (int part = 0; part < arg_chunks[i] && arg_regs[i] + part < max_regs; part++) {
+                                            emit_code(codegen, "    ldr   x%d, [sp, #%d]\n", arg_regs[i] + part, offset + part * 8);
+                                        }
+                                    } else {
+                                        // Regular variable
+                                        emit_load_variable(codegen, reg, arg->data.string_value, symbols);
+                                    }
+                                } else {
+                                    emit_code(codegen, "    ldr   %s, [sp, #%d]\n", reg, arg_slots[i]);
+                                }
+                            }
+                            while (spilled-- > 0) {
+                                pop_spill_slot(codegen);
+                            }
+                            
+                            if (external) {
+                                emit_code(codegen, "    bl    _%s\n", op->data.string_value);
+                                emit_c_result_extension(codegen, op->data.string_value, fn_node);
+                            } else {
+                                emit_code(codegen, "    bl    %s\n", op->data.string_value);
+                            }
+                        } else {
+                            // Unknown function or identifier, return 0
+                            emit_mov_immediate(codegen, "x0", 0);
+                        }
+                    }
+                }
+            }
+            break;
+            
+        case AST_ARRAY:
+            // Handle array literals [1 2 3 4]
+            // For now, just load the first element (simplified implementation)
+            if (expr->data.list.count > 0) {
+                generate_expression(codegen, expr->data.list.children[0], symbols);
+            } else {
+                emit_mov_immediate(codegen, "x0", 0);
+            }
+            break;
+            
+        default:
+            emit_mov_immediate(codegen, "x0", 0);
+            break;
+    }
+}
+
+// Elements of a #(...) literal, or NULL when value is not one
+static ASTNode *literal_elements(ASTNode *value) {
+    const char *op = operator_name(value);
+    if (op && strcmp(op, "#") == 0 && value->data.list.count >= 2 &&
+        value->data.list.children[1]->type == AST_LIST) {
+        return value->data.list.children[1];
+    }
+    return NULL;
+}
+
+static void store_values(CodeGen *codegen, ASTNode **values, size_t count, Symbol *array,
+                         StructType *type, int base_offset, const char *name, SymbolTable *symbols) {
+    for (size_t i = 0; i < count; i++) {
+        int offset, next_offset;
+        SymbolType element_type, next_type;
+        StructType *nested, *next_nested;
+        if (!sequence_element(array, type, i, &offset, &element_type, &nested)) {
+            fprintf(stderr, "Error: too many initializers for %s\n", name);
+            exit(1);
+        }
+        if (nested) {
+            // A nested struct takes a literal of its own
+            ASTNode *elements = literal_elements(values[i]);
+            if (!elements) {
+                fprintf(stderr, "Error: field %zu of %s needs a #(...) initializer\n", i, name);
+                exit(1);
+            }
+            store_values(codegen, elements->data.list.children, elements->data.list.count,
+                         NULL, nested, base_offset + offset, name, symbols);
+            continue;
+        }
+        char address[32];
+        snprintf(address, sizeof(address), "[sp, #%d]", base_offset + offset);
+        generate_expression(codegen, values[i], symbols);
+        if (i + 1 < count && is_tileable(values[i + 1]) && type_size(element_type) == 8 &&
+            sequence_element(array, type, i + 1, &next_offset, &next_type, &next_nested) &&
+            !next_nested && type_size(next_type) == 8 && next_offset == offset + 8) {
+            emit_tile(codegen, values[i + 1], symbols, 1);
+            emit_code(codegen, "    str   x0, %s\n", address);
+            emit_code(codegen, "    str   %s, [sp, #%d]\n", expression_temps[1], base_offset + next_offset);
+            i++;
+        } else {
+            emit_sized_access(codegen, true, element_type, "x0", address);
+        }
+    }
+}
+
+// Send emit_code to buffer, or back to the code when called again
+static void swap_output(CodeGen *codegen, OutputBuffer *buffer) {
+    OutputBuffer code = {codegen->output, codegen->output_size, codegen->output_capacity};
+    codegen->output = buffer->output;
+    codegen->output_size = buffer->output_size;
+    codegen->output_capacity = buffer->output_capacity;
+    *buffer = code;
+}
+
+// Send emit_code to the read-only data, or back to the code when called
+// again
+static void swap_constant_output(CodeGen *codegen) {
+    swap_output(codegen, &codegen->constants);
+}
+
+// Value of an integer or character literal, or a difference of them, the
+// way negative numbers are written
+static bool constant_value(ASTNode *expr, long *value) {
+    if (expr->type == AST_INT) {
+        *value = expr->data.int_value;
+        return true;
+    }
+    if (expr->type == AST_CHAR) {
+        *value = expr->data.char_value;
+        return true;
+    }
+    const char *op = operator_name(expr);
+    long lhs, rhs;
+    if (op && strcmp(op, "-") == 0 && expr->data.list.count == 3 &&
+        constant_value(expr->data.list.children[1], &lhs) &&
+        constant_value(expr->data.list.children[2], &rhs)) {
+        *value = lhs - rhs;
+        return true;
+    }
+    return false;
+}
+
+// Lay values out in bytes as store_values would store them; false when one
+// is not a constant or the literal does not fit
+static bool constant_bytes(unsigned char *bytes, ASTNode **values, size_t count, Symbol *array,
+                           StructType *type, int base_offset) {
+    for (size_t i = 0; i < count; i++) {
+        int offset;
+        SymbolType element_type;
+        StructType *nested;
+        long value;
+        if (!sequence_element(array, type, i, &offset, &element_type, &nested)) return false;
+        if (nested) {
+            ASTNode *elements = literal_elements(values[i]);
+            if (!elements || !constant_bytes(bytes, elements->data.list.children, elements->data.list.count,
+                                             NULL, nested, base_offset + offset)) {
+                return false;
+            }
+        } else if (constant_value(values[i], &value)) {
+            for (int k = 0; k < type_size(element_type); k++) {
+                bytes[base_offset + offset + k] = (unsigned char)((unsigned long)value >> (8 * k));
+            }
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Emit bytes as a 16-byte aligned read-only blob, trailing zeros as .zero;
+// returns the number of its Lconst_ label
+static int emit_constant_blob(CodeGen *codegen, const unsigned char *bytes, int size) {
+    int id = ++codegen->constant_count;
+    swap_constant_output(codegen);
+    if (codegen->output_size == 0) emit_code(codegen, "\n    .section __TEXT,__const\n");
+    emit_code(codegen, "    .p2align 4\nLconst_%d:\n", id);
+    
+    int used = size;
+    while (used > 0 && bytes[used - 1] == 0) used--;
+    int spelled = (used + 7) / 8 * 8 <= size ? (used + 7) / 8 * 8 : used;
+    for (int i = 0; i + 8 <= spelled; i += 8) {
+        unsigned long quad = 0;
+        for (int k = 0; k < 8; k++) quad |= (unsigned long)bytes[i + k] << (8 * k);
+        emit_code(codegen, "%s0x%lx%s", i % 32 == 0 ? "    .quad " : ", ", quad,
+                  i % 32 == 24 || i + 16 > spelled ? "\n" : "");
+    }
+    for (int i = spelled / 8 * 8; i < spelled; i++) {
+        emit_code(codegen, "    .byte %d\n", bytes[i]);
+    }
+    if (spelled < size) emit_code(codegen, "    .zero %d\n", size - spelled);
+    swap_constant_output(codegen);
+    return id;
+}
+
+// Copy size bytes from the address in x<source> to [sp, #offset], 16 at a
+// time through q16 (in a loop past four), then the tail through x17
+static void emit_copy_from_pointer(CodeGen *codegen, int source, int offset, int size) {
+    emit_code(codegen, "    add   x16, sp, #%d\n", offset);
+    int blocks = size / 16;
+    if (blocks > 4) {
+        char *loop = new_label(codegen, "copy");
+        emit_mov_immediate(codegen, "x17", blocks);
+        emit_code(codegen, "%s:\n", loop);
+        emit_code(codegen, "    ldr   q16, [x%d], #16\n", source);
+        emit_code(codegen, "    str   q16, [x16], #16\n");
+        emit_code(codegen, "    subs  x17, x17, #1\n");
+        emit_code(codegen, "    b.ne  %s\n", loop);
+        free(loop);
+    } else {
+        for (int i = 0; i < blocks; i++) {
+            emit_code(codegen, "    ldr   q16, [x%d], #16\n", source);
+            emit_code(codegen, "    str   q16, [x16], #16\n");
+        }
+    }
+    static const struct { int size; const char *load; const char *store; const char *reg; } tails[] = {
+        {8, "ldr  ", "str  ", "x17"}, {4, "ldr  ", "str  ", "w17"}, {2, "ldrh ", "strh ", "w17"}, {1, "ldrb ", "strb ", "w17"},
+    };
+    int remaining = size % 16;
+    for (size_t i = 0; i < sizeof(tails) / sizeof(tails[0]); i++) {
+        for (; remaining >= tails[i].size; remaining -= tails[i].size) {
+            emit_code(codegen, "    %s %s, [x%d], #%d\n", tails[i].load, tails[i].reg, source, tails[i].size);
+            emit_code(codegen, "    %s %s, [x16], #%d\n", tails[i].store, tails[i].reg, tails[i].size);
+        }
+    }
+}
+
+// (let a T[n] value) starts every element at value. A zero clears 16 bytes
+// per store pair, any other value is stored element by element; in a loop
+// past four stores, like emit_copy_from_pointer.
+static void emit_array_fill(CodeGen *codegen, Symbol *array, ASTNode *value, SymbolTable *symbols) {
+    SymbolType element_type = array->type_info.array.element_type;
+    int element_size = type_size(element_type);
+    int length = array_length(array);
+    long constant;
+    bool zero = constant_value(value, &constant) && constant == 0;
+    if (!zero) generate_expression(codegen, value, symbols);
+    
+    char post_index[32];
+    snprintf(post_index, sizeof(post_index), "[x16], #%d", element_size);
+    emit_code(codegen, "    add   x16, sp, #%d\n", get_symbol_offset(symbols, array->name));
+    int blocks = zero ? length * element_size / 16 : length;
+    char *loop = blocks > 4 ? new_label(codegen, "fill") : NULL;
+    if (loop) {
+        emit_mov_immediate(codegen, "x17", blocks);
+        emit_code(codegen, "%s:\n", loop);
+    }
+    for (int i = 0; i < (loop ? 1 : blocks); i++) {
+        if (zero) {
+            emit_code(codegen, "    stp   xzr, xzr, [x16], #16\n");
+        } else {
+            emit_sized_access(codegen, true, element_type, "x0", post_index);
+        }
+    }
+    if (loop) {
+        emit_code(codegen, "    subs  x17, x17, #1\n");
+        emit_code(codegen, "    b.ne  %s\n", loop);
+        free(loop);
+    }
+    for (int i = zero ? blocks * 16 / element_size : length; i < length; i++) {
+        emit_sized_access(codegen, true, element_type, "xzr", post_index);
+    }
+}
+
+// Constant initializers up to this many bytes are stored element by
+// element; bigger ones come from read-only data
+#define CONSTANT_BLOB_MIN 32
+
+// Store values to the elements of an array or the fields of a struct in
+// order, descending into #(...) literals for nested struct fields. When two
+// 8-byte elements are adjacent, the second value is evaluated into x9 while
+// its predecessor still sits in x0, so the two stores are adjacent and the
+// peephole pass can merge them into an stp.
+void emit_store_sequence(CodeGen *codegen, ASTNode **values, size_t count, Symbol *target, SymbolTable *symbols) {
+    int base_offset = target ? get_symbol_offset(symbols, target->name) : -1;
+    if (base_offset < 0) return;
+    
+    Symbol *array = target->type == SYM_ARRAY ? target : NULL;
+    StructType *type = target->type == SYM_STRUCT ? symbol_struct_type(target) : NULL;
+    int size = symbol_slot_size(target);
+    if (size > CONSTANT_BLOB_MIN) {
+        // Copied whole from read-only data, so the code no longer grows
+        // with the initializer; elements it leaves out come out zero
+        unsigned char *bytes = calloc(size, 1);
+        if (constant_bytes(bytes, values, count, array, type, 0)) {
+            int id = emit_constant_blob(codegen, bytes, size);
+            emit_code(codegen, "    adrp  x0, Lconst_%d@PAGE\n", id);
+            emit_code(codegen, "    add   x0, x0, Lconst_%d@PAGEOFF\n", id);
+            emit_copy_from_pointer(codegen, 0, base_offset, size);
+            free(bytes);
+            return;
+        }
+        free(bytes);
+    }
+    store_values(codegen, values, count, array, type, base_offset, target->name, symbols);
+}
+
+// Strings. A str is a pointer to NUL-terminated characters with their
+// length in the 8 bytes before them, so printing, len and eq never scan for
+// the terminator. Literals are interned once in the constant pool with
+// their escapes decoded; concat builds new strings at run time.
+
+// Decode the escapes of a quoted literal; the caller frees the result
+static char *decode_string(const char *quoted, size_t *length) {
+    size_t source_length = strlen(quoted);
+    const char *source = quoted;
+    if (source_length >= 2 && quoted[0] == '"' && quoted[source_length - 1] == '"') {
+        source++;
+        source_length -= 2;
+    }
+    char *text = malloc(source_length + 1);
+    size_t n = 0;
+    for (size_t i = 0; i < source_length; i++) {
+        char c = source[i];
+        if (c == '\\' && i + 1 < source_length) {
+            switch (source[++i]) {
+                case 'n': c = '\n'; break;
+                case 't': c = '\t'; break;
+                case 'r': c = '\r'; break;
+                case '0': c = '\0'; break;
+                default: c = source[i]; break; // \\, \" and anything else stand for themselves
+            }
+        }
+        text[n++] = c;
+    }
+    text[n] = '\0';
+    *length = n;
+    return text;
+}
+
+// Index of text in the pool, adding it (and emitting it) when new; takes
+// ownership of text
+static size_t intern_string(CodeGen *codegen, char *text, size_t length) {
+    for (size_t i = 0; i < codegen->string_count; i++) {
+        PooledString *pooled = &codegen->strings[i];
+        if (pooled->length == length && memcmp(pooled->text, text, length) == 0) {
+            free(text);
+            return i;
+        }
+    }
+    if (codegen->string_count == codegen->string_capacity) {
+        codegen->string_capacity = codegen->string_capacity ? codegen->string_capacity * 2 : 16;
+        codegen->strings = realloc(codegen->strings, codegen->string_capacity * sizeof(PooledString));
+    }
+    size_t index = codegen->string_count++;
+    codegen->strings[index] = (PooledString){text, length};
+    
+    swap_constant_output(codegen);
+    if (codegen->output_size == 0) emit_code(codegen, "\n    .section __TEXT,__const\n");
+    emit_code(codegen, "    .p2align 3\n    .quad %zu\nLstr_%zu:\n    .asciz \"", length, index);
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = (unsigned char)text[i];
+        if (c == '"' || c == '\\') {
+            emit_code(codegen, "\\%c", c);
+        } else if (c < 32 || c >= 127) {
+            emit_code(codegen, "\\%03o", c);
+        } else {
+            emit_code(codegen, "%c", c);
+        }
+    }
+    emit_code(codegen, "\"\n");
+    swap_constant_output(codegen);
+    return index;
+}
+
+// Pool index of the string a literal stands for
+static size_t literal_index(CodeGen *codegen, ASTNode *literal) {
+    size_t length;
+    char *text = decode_string(literal->data.string_value, &length);
+    return intern_string(codegen, text, length);
+}
+
+// Valid until the next string is interned
+static PooledString *literal_string(CodeGen *codegen, ASTNode *literal) {
+    size_t index = literal_index(codegen, literal);
+    return &codegen->strings[index];
+}
+
+void generate_string_literal(CodeGen *codegen, const char *reg, ASTNode *literal) {
+    size_t index = literal_index(codegen, literal);
+    emit_code(codegen, "    adrp  %s, Lstr_%zu@PAGE\n", reg, index);
+    emit_code(codegen, "    add   %s, %s, Lstr_%zu@PAGEOFF\n", reg, reg, index);
+}
+
+static const char *string_operator(ASTNode *expr) {
+    const char *op = operator_name(expr);
+    if (!op) return NULL;
+    if (strcmp(op, "len") == 0 && expr->data.list.count == 2) return op;
+    if ((strcmp(op, "concat") == 0 || strcmp(op, "eq") == 0) && expr->data.list.count == 3) return op;
+    return NULL;
+}
+
+bool is_string_builtin(ASTNode *expr) {
+    return string_operator(expr) != NULL;
+}
+
+// concat and eq call into the runtime unless both operands are literals
+bool is_string_call(ASTNode *expr) {
+    const char *op = string_operator(expr);
+    return op && strcmp(op, "len") != 0 &&
+           !(expr->data.list.children[1]->type == AST_STRING && expr->data.list.children[2]->type == AST_STRING);
+}
+
+bool is_string_expression(ASTNode *expr, SymbolTable *symbols) {
+    if (expr->type == AST_STRING) return true;
+    if (expr->type == AST_IDENTIFIER) {
+        Symbol *symbol = find_symbol(symbols, expr->data.string_value);
+        return symbol && symbol->type == SYM_STR;
+    }
+    const char *op = operator_name(expr);
+    if (!op) return false;
+    if (strcmp(op, "concat") == 0) return is_string_builtin(expr);
+    if (strcmp(op, ".") == 0) {
+        int offset;
+        SymbolType type;
+        StructType *nested;
+        Symbol *pointer = NULL;
+        return resolve_field_path(symbols, expr, &offset, &type, &nested, &pointer) && type == SYM_STR;
+    }
+    if (strcmp(op, "[]") == 0 && expr->data.list.count >= 3 && expr->data.list.children[1]->type == AST_IDENTIFIER) {
+        Symbol *symbol = find_symbol(symbols, expr->data.list.children[1]->data.string_value);
+        return symbol && ((symbol->type == SYM_ARRAY && symbol->type_info.array.element_type == SYM_STR) ||
+                          (is_indirect(symbol) && symbol->type_info.pointer.element_type == SYM_STR));
+    }
+    if (strcmp(op, "@") == 0 && expr->data.list.count == 2) {
+        SymbolType type;
+        StructType *record;
+        return pointer_target(expr->data.list.children[1], symbols, &type, &record) && type == SYM_STR;
+    }
+    if (strcmp(op, "get") == 0 && is_map_builtin(expr, symbols)) {
+        return find_symbol(symbols, expr->data.list.children[1]->data.string_value)->type_info.map.value_type == SYM_STR;
+    }
+    return false;
+}
+
+// dest = length of the string expr, whose pointer is already in pointer;
+// a literal's length is known without touching memory
+void emit_string_length(CodeGen *codegen, const char *dest, ASTNode *expr, const char *pointer) {
+    if (expr->type == AST_STRING) {
+        emit_mov_immediate(codegen, dest, (int)literal_string(codegen, expr)->length);
+    } else {
+        emit_code(codegen, "    ldr   %s, [%s, #-8]\n", dest, pointer);
+    }
+}
+
+// (len s), (concat a b) and (eq a b); literal operands fold at compile time
+void generate_string_builtin(CodeGen *codegen, ASTNode *expr, SymbolTable *symbols) {
+    const char *op = string_operator(expr);
+    ASTNode *left = expr->data.list.children[1];
+    
+    if (strcmp(op, "len") == 0) {
+        if (left->type == AST_STRING) {
+            emit_string_length(codegen, "x0", left, NULL);
+        } else {
+            generate_expression(codegen, left, symbols);
+            emit_string_length(codegen, "x0", left, "x0");
+        }
+        return;
+    }
+    
+    ASTNode *right = expr->data.list.children[2];
+    if (left->type == AST_STRING && right->type == AST_STRING) {
+        PooledString *a = literal_string(codegen, left);
+        size_t a_length = a->length;
+        char *a_text = a->text; // the text itself never moves
+        PooledString *b = literal_string(codegen, right);
+        if (strcmp(op, "eq") == 0) {
+            emit_mov_immediate(codegen, "x0", a_length == b->length && memcmp(a_text, b->text, a_length) == 0);
+        } else {
+            char *text = malloc(a_length + b->length + 1);
+            memcpy(text, a_text, a_length);
+            memcpy(text + a_length, b->text, b->length + 1);
+            size_t index = intern_string(codegen, text, a_length + b->length);
+            emit_code(codegen, "    adrp  x0, Lstr_%zu@PAGE\n", index);
+            emit_code(codegen, "    add   x0, x0, Lstr_%zu@PAGEOFF\n", index);
+        }
+        return;
+    }
+    
+    // The left operand waits in a spill slot while the right one is evaluated
+    generate_expression(codegen, left, symbols);
+    int slot = push_spill_slot(codegen);
+    emit_code(codegen, "    str   x0, [sp, #%d]\n", slot);
+    generate_expression(codegen, right, symbols);
+    emit_code(codegen, "    mov   x1, x0\n");
+    emit_code(codegen, "    ldr   x0, [sp, #%d]\n", slot);
+    pop_spill_slot(codegen);
+    invalidate_cached_values(codegen, NULL);
+    emit_code(codegen, "    bl    %s\n", strcmp(op, "eq") == 0 ? "_str_eq" : "_str_concat");
+}
+
+// Heap allocation. The runtime bump-allocates from an arena of large
+// chunks; (region stmt...) opens a region of it, and everything allocated
+// inside is released at once when the region ends. (alloc T n) yields a
+// pointer to n elements of the scalar T in the innermost region, and
+// (let name (alloc T n)) declares name as such a pointer. Its elements are
+// indexed like an array's, from the pointer loaded out of its slot.
+
+// Element type of (alloc T n); false when expr is not an alloc
+bool alloc_element_type(ASTNode *expr, SymbolType *element_type) {
+    const char *op = operator_name(expr);
+    if (!op || strcmp(op, "alloc") != 0 || expr->data.list.count != 3) return false;
+    
+    ASTNode *type_node = expr->data.list.children[1];
+    if (type_node->type != AST_IDENTIFIER || !parse_scalar_type(type_node->data.string_value, element_type)) {
+        fprintf(stderr, "Error: alloc needs a scalar element type\n");
+        exit(1);
+    }
+    return true;
+}
+
+// alloc and region call into the runtime arena
+bool is_heap_call(ASTNode *expr) {
+    const char *op = operator_name(expr);
+    return op && ((strcmp(op, "alloc") == 0 && expr->data.list.count == 3) || strcmp(op, "region") == 0);
+}
+
+void generate_alloc(CodeGen *codegen, ASTNode *expr, SymbolTable *symbols) {
+    SymbolType element_type;
+    alloc_element_type(expr, &element_type);
+    ASTNode *count = expr->data.list.children[2];
+    if (count->type == AST_INT) {
+        emit_mov_wide(codegen, "x0", (unsigned long)((long)count->data.int_value * type_size(element_type)));
+    } else {
+        generate_expression(codegen, count, symbols);
+        if (type_shift(element_type) > 0) {
+            emit_code(codegen, "    lsl   x0, x0, #%d\n", type_shift(element_type));
+        }
+    }
+    invalidate_cached_values(codegen, NULL);
+    emit_code(codegen, "    bl    _clumsy_alloc\n");
+}
+
+// Memory operand for pointer[index], with the index tiled at depth and the
+// pointer loaded into base. Small constant indices fold into the offset, and
+// a loop may keep an induction pointer to the element instead. For stores
+// the caller passes depth 1, which leaves x0 alone unless the index is not
+// tileable and has to go through x1.
+void emit_pointer_element_operand(CodeGen *codegen, char *operand, size_t size, const char *name, ASTNode *index,
+                                  SymbolTable *symbols, int depth, const char *base) {
+    Symbol *symbol = find_symbol_recursive(symbols, name);
+    SymbolType element_type = symbol->type_info.pointer.element_type;
+    int pointer = find_induction_pointer(codegen, get_symbol_offset(symbols, name), index);
+    if (pointer >= 0) {
+        snprintf(operand, size, "[%s]", value_cache_regs[codegen->induction_pointers[pointer].reg]);
+        return;
+    }
+    
+    if (index->type == AST_INT && index->data.int_value >= 0 && index->data.int_value < 4096) {
+        emit_load_variable(codegen, base, name, symbols);
+        snprintf(operand, size, "[%s, #%d]", base, index->data.int_value * type_size(element_type));
+        return;
+    }
+    const char *reg = "x1";
+    if (is_tileable(index)) {
+        reg = emit_tile_value(codegen, index, symbols, depth);
+    } else {
+        emit_load_operand(codegen, "x1", index, symbols);
+    }
+    emit_load_variable(codegen, base, name, symbols);
+    format_indexed_address(operand, size, base, reg, element_type);
+}
+
+// Pointers. *T points at a scalar or a struct T. (& x) is the address of a
+// variable, element or field; (@ p) loads what p points at and (set @p v)
+// stores it. p[i] indexes from p and p.x reaches into the struct it points
+// at. (+ p n) and (- p n) step whole elements, so @(+ p i) is one indexed
+// ldr. An array or struct passed for a *T parameter goes by address, with
+// no copy. Stores through pointers may change any variable whose address
+// was taken, so those are kept out of registers across such stores.
+
+// *T, where T is a scalar or a struct type name
+bool parse_pointer_type(const char *name, Symbol *symbol) {
+    if (name[0] != '*' || name[1] == '\0') return false;
+    symbol->type = SYM_POINTER;
+    symbol->type_info.pointer.struct_type_name = NULL;
+    if (!parse_scalar_type(name + 1, &symbol->type_info.pointer.element_type)) {
+        symbol->type_info.pointer.element_type = SYM_STRUCT;
+        symbol->type_info.pointer.struct_type_name = (char *)name + 1;
+    }
+    return true;
+}
+
+// Bytes a pointer steps per element
+static int pointee_size(SymbolType type, StructType *record) {
+    return record ? layout_struct(record, NULL, NULL) : type_size(type);
+}
+
+// What &target points at: the scalar type or the struct (*record) of a
+// variable, array element or field. An array itself gives a pointer to its
+// first element.
+static bool address_target(ASTNode *target, SymbolTable *symbols, SymbolType *type, StructType **record) {
+    *record = NULL;
+    if (target->type == AST_IDENTIFIER) {
+        Symbol *symbol = find_symbol(symbols, target->data.string_value);
+        if (!symbol || symbol->type == SYM_FUNCTION || symbol->type == SYM_VECTOR || symbol->type == SYM_MAP ||
+            is_indirect(symbol)) {
+            return false;
+        }
+        if (symbol->type == SYM_ARRAY) {
+            *type = symbol->type_info.array.element_type;
+        } else {
+            *type = symbol->type;
+            if (symbol->type == SYM_STRUCT) *record = symbol_struct_type(symbol);
+        }
+        return true;
+    }
+    
+    const char *op = operator_name(target);
+    if (!op || target->data.list.count < 3) return false;
+    if (strcmp(op, ".") == 0) {
+        int offset;
+        Symbol *pointer = NULL;
+        return resolve_field_path(symbols, target, &offset, type, record, &pointer);
+    }
+    if (strcmp(op, "[]") == 0 && target->data.list.children[1]->type == AST_IDENTIFIER) {
+        Symbol *symbol = find_symbol(symbols, target->data.list.children[1]->data.string_value);
+        if (symbol && symbol->type == SYM_ARRAY) {
+            *type = symbol->type_info.array.element_type;
+            return true;
+        }
+        if (is_indirect(symbol)) {
+            *type = symbol->type_info.pointer.element_type;
+            *record = pointee_struct_type(symbol);
+            return true;
+        }
+    }
+    return false;
+}
+
+// What the pointer expr points at, as for address_target; false when expr
+// is not a pointer
+bool pointer_target(ASTNode *expr, SymbolTable *symbols, SymbolType *type, StructType **record) {
+    *record = NULL;
+    if (expr->type == AST_IDENTIFIER) {
+        Symbol *symbol = find_symbol_recursive(symbols, expr->data.string_value);
+        if (!symbol || symbol->type != SYM_POINTER) return false;
+        *type = symbol->type_info.pointer.element_type;
+        *record = pointee_struct_type(symbol);
+        return true;
+    }
+    
+    const char *op = operator_name(expr);
+    if (!op) return false;
+    if ((strcmp(op, "+") == 0 || strcmp(op, "-") == 0) && expr->data.list.count == 3) {
+        SymbolType step_type;
+        StructType *step_record;
+        return pointer_target(expr->data.list.children[1], symbols, type, record) &&
+               !pointer_target(expr->data.list.children[2], symbols, &step_type, &step_record);
+    }
+    if (strcmp(op, "&") == 0 && expr->data.list.count == 2) {
+        return address_target(expr->data.list.children[1], symbols, type, record);
+    }
+    
+    // A call to a function declared to return *T
+    Symbol *function = find_symbol_recursive(symbols, op);
+    ASTNode *fn_node = function && function->type == SYM_FUNCTION ? function->init_value : NULL;
+    if (fn_node && fn_node->type == AST_LIST && fn_node->data.list.count >= 3 &&
+        fn_node->data.list.children[2]->type == AST_IDENTIFIER) {
+        Symbol result = {0};
+        result.name = function->name;
+        if (!parse_pointer_type(fn_node->data.list.children[2]->data.string_value, &result)) return false;
+        *type = result.type_info.pointer.element_type;
+        *record = pointee_struct_type(&result);
+        return true;
+    }
+    return alloc_element_type(expr, type);
+}
+
+// dest = base + index * size, or base - index * size
+static void emit_scaled_add(CodeGen *codegen, const char *dest, const char *base, const char *index, int size, bool subtract) {
+    if ((size & (size - 1)) == 0) {
+        emit_code(codegen, "    %s   %s, %s, %s, lsl #%d\n", subtract ? "sub" : "add", dest, base, index, size_shift(size));
+    } else {
+        emit_mov_immediate(codegen, "x17", size);
+        emit_code(codegen, "    %s  %s, %s, x17, %s\n", subtract ? "msub" : "madd", dest, index, base);
+    }
+}
+
+// (+ p n) or (- p n) stepping whole elements, and (- p q) counting them
+void emit_pointer_arithmetic(CodeGen *codegen, ASTNode *expr, SymbolTable *symbols, int depth, const char *dest) {
+    bool subtract = strcmp(operator_name(expr), "-") == 0;
+    ASTNode *pointer = expr->data.list.children[1];
+    ASTNode *step = expr->data.list.children[2];
+    SymbolType type, step_type;
+    StructType *record, *step_record;
+    pointer_target(pointer, symbols, &type, &record);
+    int size = pointee_size(type, record);
+    
+    if (step->type == AST_INT && is_add_immediate((long)step->data.int_value * size)) {
+        char immediate[32];
+        format_add_immediate(immediate, sizeof(immediate), (long)step->data.int_value * size);
+        const char *reg = emit_tile_value(codegen, pointer, symbols, depth);
+        emit_code(codegen, "    %s   %s, %s, %s\n", subtract ? "sub" : "add", dest, reg, immediate);
+        return;
+    }
+    
+    ASTNode *operands[2] = {pointer, step};
+    const char *regs[2];
+    emit_tile_operands(codegen, operands, 2, symbols, depth, regs);
+    if (!pointer_target(step, symbols, &step_type, &step_record)) {
+        emit_scaled_add(codegen, dest, regs[0], regs[1], size, subtract);
+        return;
+    }
+    emit_code(codegen, "    sub   %s, %s, %s\n", dest, regs[0], regs[1]);
+    if ((size & (size - 1)) == 0) {
+        if (size > 1) emit_code(codegen, "    asr   %s, %s, #%d\n", dest, dest, size_shift(size));
+    } else {
+        emit_mov_immediate(codegen, "x17", size);
+        emit_code(codegen, "    sdiv  %s, %s, x17\n", dest, dest);
+    }
+}
+
+// dest = &target, using the temporaries from depth up
+void emit_address(CodeGen *codegen, const char *dest, ASTNode *target, SymbolTable *symbols, int depth) {
+    SymbolType type;
+    StructType *record;
+    if (!address_target(target, symbols, &type, &record)) {
+        fprintf(stderr, "Error: & needs a variable, array element or struct field\n");
+        exit(1);
+    }
+    char immediate[32];
+    
+    if (target->type == AST_IDENTIFIER) {
+        emit_code(codegen, "    add   %s, sp, #%d\n", dest, get_symbol_offset(symbols, target->data.string_value));
+        return;
+    }
+    if (strcmp(operator_name(target), ".") == 0) {
+        int offset;
+        StructType *nested;
+        Symbol *pointer;
+        if (resolve_pointer_field(symbols, target, &offset, &type, &nested, &pointer)) {
+            const char *base = emit_tile_value(codegen, access_root(target), symbols, depth);
+            format_add_immediate(immediate, sizeof(immediate), offset);
+            emit_code(codegen, "    add   %s, %s, %s\n", dest, base, immediate);
+        } else {
+            resolve_field(symbols, target, &offset, &type, &nested);
+            emit_code(codegen, "    add   %s, sp, #%d\n", dest, offset);
+        }
+        return;
+    }
+    
+    // &a[i]: the element's address, from the frame or from a pointer
+    ASTNode *base = target->data.list.children[1];
+    ASTNode *index = target->data.list.children[2];
+    int size = pointee_size(type, record);
+    Symbol *symbol = find_symbol(symbols, base->data.string_value);
+    if (is_indirect(symbol)) {
+        ASTNode *operands[2] = {base, index};
+        const char *regs[2];
+        emit_tile_operands(codegen, operands, 2, symbols, depth, regs);
+        emit_scaled_add(codegen, dest, regs[0], regs[1], size, false);
+        return;
+    }
+    int array_offset = get_symbol_offset(symbols, base->data.string_value);
+    if (index->type == AST_INT) {
+        emit_code(codegen, "    add   %s, sp, #%d\n", dest, array_offset + index->data.int_value * size);
+        return;
+    }
+    const char *reg = emit_tile_value(codegen, index, symbols, depth);
+    emit_code(codegen, "    add   x16, sp, #%d\n", array_offset);
+    emit_scaled_add(codegen, dest, "x16", reg, size, false);
+}
+
+// Memory operand for what pointer points at, tiled from depth. A constant
+// step folds into the offset and a variable one into the index register.
+static void emit_deref_operand(CodeGen *codegen, char *operand, size_t size, ASTNode *pointer, SymbolTable *symbols, int depth) {
+    SymbolType type, step_type;
+    StructType *record, *step_record;
+    const char *op = operator_name(pointer);
+    if (op && (strcmp(op, "+") == 0 || strcmp(op, "-") == 0) && pointer->data.list.count == 3 &&
+        pointer_target(pointer->data.list.children[1], symbols, &type, &record) &&
+        !pointer_target(pointer->data.list.children[2], symbols, &step_type, &step_record)) {
+        bool subtract = strcmp(op, "-") == 0;
+        ASTNode *step = pointer->data.list.children[2];
+        int element_size = pointee_size(type, record);
+        
+        if (step->type == AST_INT) {
+            long offset = (long)step->data.int_value * element_size * (subtract ? -1 : 1);
+            if (offset > -256 && offset < 4096) {
+                const char *reg = emit_tile_value(codegen, pointer->data.list.children[1], symbols, depth);
+                snprintf(operand, size, "[%s, #%ld]", reg, offset);
+                return;
+            }
+        } else if (!subtract && !record) {
+            ASTNode *operands[2] = {pointer->data.list.children[1], step};
+            const char *regs[2];
+            emit_tile_operands(codegen, operands, 2, symbols, depth, regs);
+            format_indexed_address(operand, size, regs[0], regs[1], type);
+            return;
+        }
+    }
+    snprintf(operand, size, "[%s]", emit_tile_value(codegen, pointer, symbols, depth));
+}
+
+// Scalar type (@ pointer) loads or stores
+static SymbolType dereferenced_type(ASTNode *pointer, SymbolTable *symbols) {
+    SymbolType type;
+    StructType *record;
+    if (!pointer_target(pointer, symbols, &type, &record) || record) {
+        fprintf(stderr, "Error: @ needs a pointer to a scalar; reach struct fields with p.field\n");
+        exit(1);
+    }
+    return type;
+}
+
+// dest = (@ pointer), a scalar loaded through a pointer
+void emit_dereference(CodeGen *codegen, const char *dest, ASTNode *pointer, SymbolTable *symbols, int depth) {
+    SymbolType type = dereferenced_type(pointer, symbols);
+    char operand[64];
+    emit_deref_operand(codegen, operand, sizeof(operand), pointer, symbols, depth);
+    emit_sized_access(codegen, false, type, dest, operand);
+}
+
+// (set @p value) or (set p.x value) through a pointer p
+void generate_pointer_store(CodeGen *codegen, ASTNode *target, ASTNode *value, SymbolTable *symbols) {
+    SymbolType type;
+    int offset = 0;
+    ASTNode *pointer = target->data.list.children[1];
+    bool deref = strcmp(operator_name(target), "@") == 0;
+    if (deref) {
+        type = dereferenced_type(pointer, symbols);
+    } else {
+        StructType *nested;
+        Symbol *symbol;
+        if (!resolve_pointer_field(symbols, target, &offset, &type, &nested, &symbol) || nested) {
+            fprintf(stderr, "Error: cannot assign a whole struct through a pointer\n");
+            exit(1);
+        }
+        pointer = access_root(target);
+    }
+    
+    generate_expression(codegen, value, symbols);
+    int slot = -1;
+    if (!is_tileable(pointer)) {
+        // Computing the pointer clobbers x0, so park the value
+        slot = push_spill_slot(codegen);
+        emit_code(codegen, "    str   x0, [sp, #%d]\n", slot);
+    }
+    char operand[64];
+    if (deref) {
+        emit_deref_operand(codegen, operand, sizeof(operand), pointer, symbols, 1);
+    } else {
+        snprintf(operand, sizeof(operand), "[%s, #%d]", emit_tile_value(codegen, pointer, symbols, 1), offset);
+    }
+    if (slot >= 0) {
+        emit_code(codegen, "    ldr   x0, [sp, #%d]\n", slot);
+        pop_spill_slot(codegen);
+    }
+    emit_sized_access(codegen, true, type, "x0", operand);
+}
+
+// Flag the variables whose address node takes with &
+void mark_address_taken(SymbolTable *table, ASTNode *node) {
+    if (!node || node->type != AST_LIST) return;
+    
+    const char *op = operator_name(node);
+    if (op && strcmp(op, "&") == 0 && node->data.list.count == 2) {
+        ASTNode *root = access_root(node->data.list.children[1]);
+        Symbol *symbol = root->type == AST_IDENTIFIER ? find_symbol(table, root->data.string_value) : NULL;
+        if (symbol && !is_indirect(symbol)) {
+            symbol->address_taken = true;
+        }
+    }
+    for (size_t i = 0; i < node->data.list.count; i++) {
+        if (!is_function_definition(node->data.list.children[i])) {
+            mark_address_taken(table, node->data.list.children[i]);
+        }
+    }
+}
+
+// Growable vecs. The slot of a vec<T> holds a pointer to its elements,
+// their count and the capacity of the buffer, which the runtime doubles
+// when a push finds it full. Elements are indexed like heap memory, from
+// the pointer in the slot, so in a loop v[i] is the same single ldr as an
+// array element. Only growing calls the runtime; pop and len are inline.
+// A vec declared inside a region frees its buffer when the region ends.
+
+bool parse_vec_type(const char *name, Symbol *symbol) {
+    size_t length = strlen(name);
+    if (strncmp(name, "vec<", 4) != 0 || length < 6 || name[length - 1] != '>') return false;
+    
+    char element[16] = {0};
+    if (length - 5 >= sizeof(element) ||
+        (memcpy(element, name + 4, length - 5), !parse_scalar_type(element, &symbol->type_info.pointer.element_type))) {
+        fprintf(stderr, "Error: vec elements must be a scalar type, not %s\n", name);
+        exit(1);
+    }
+    symbol->type = SYM_VEC;
+    symbol->type_info.pointer.struct_type_name = NULL;
+    return true;
+}
+
+// (push v x), (pop v) and (reserve v n), which change v
+bool is_vec_operation(ASTNode *expr) {
+    const char *op = operator_name(expr);
+    if (!op || expr->data.list.count < 2 || expr->data.list.children[1]->type != AST_IDENTIFIER) return false;
+    size_t count = expr->data.list.count;
+    return (strcmp(op, "pop") == 0 && count == 2) ||
+           ((strcmp(op, "push") == 0 || strcmp(op, "reserve") == 0) && count == 3);
+}
+
+// push and reserve may grow the buffer, and a vec declared in a region
+// registers with it
+bool is_vec_call(ASTNode *expr) {
+    const char *op = operator_name(expr);
+    if (!op || expr->data.list.count < 3 || expr->data.list.children[1]->type != AST_IDENTIFIER) return false;
+    if (strcmp(op, "let") == 0) {
+        ASTNode *type_node = expr->data.list.children[2];
+        return type_node->type == AST_IDENTIFIER && strncmp(type_node->data.string_value, "vec<", 4) == 0;
+    }
+    return is_vec_operation(expr) && strcmp(op, "pop") != 0;
+}
+
+// A vec operation, or len, on a vec variable
+bool is_vec_builtin(ASTNode *expr, SymbolTable *symbols) {
+    const char *op = operator_name(expr);
+    if (!is_vec_operation(expr) &&
+        !(op && strcmp(op, "len") == 0 && expr->data.list.count == 2 &&
+          expr->data.list.children[1]->type == AST_IDENTIFIER)) {
+        return false;
+    }
+    Symbol *symbol = find_symbol(symbols, expr->data.list.children[1]->data.string_value);
+    if (symbol && symbol->type == SYM_VEC) return true;
+    if (strcmp(op, "len") != 0 && !(symbol && symbol->type == SYM_FUNCTION)) {
+        fprintf(stderr, "Error: %s needs a vec, not %s\n", op, expr->data.list.children[1]->data.string_value);
+        exit(1);
+    }
+    return false;
+}
+
+void generate_vec_builtin(CodeGen *codegen, ASTNode *expr, SymbolTable *symbols) {
+    const char *op = operator_name(expr);
+    const char *name = expr->data.list.children[1]->data.string_value;
+    Symbol *vec = find_symbol(symbols, name);
+    SymbolType element_type = vec->type_info.pointer.element_type;
+    int offset = get_symbol_offset(symbols, name);
+    char operand[48];
+    
+    if (strcmp(op, "len") == 0) {
+        emit_tile(codegen, expr, symbols, 0);
+        return;
+    }
+    if (strcmp(op, "pop") == 0) {
+        // The last element; popping an empty vec is undefined, like an
+        // array index past the end
+        emit_code(codegen, "    ldr   x16, [sp, #%d]\n", offset + VEC_LENGTH);
+        emit_code(codegen, "    sub   x16, x16, #1\n");
+        emit_code(codegen, "    str   x16, [sp, #%d]\n", offset + VEC_LENGTH);
+        emit_code(codegen, "    ldr   x17, [sp, #%d]\n", offset);
+        format_indexed_address(operand, sizeof(operand), "x17", "x16", element_type);
+        emit_sized_access(codegen, false, element_type, "x0", operand);
+        invalidate_cached_values(codegen, name);
+        return;
+    }
+    if (strcmp(op, "reserve") == 0) {
+        generate_expression(codegen, expr->data.list.children[2], symbols);
+        emit_code(codegen, "    mov   x1, x0\n");
+        emit_code(codegen, "    add   x0, sp, #%d\n", offset);
+        emit_mov_immediate(codegen, "x2", type_size(element_type));
+        invalidate_cached_values(codegen, NULL);
+        emit_code(codegen, "    bl    _clumsy_vec_reserve\n");
+        return;
+    }
+    
+    // push: call the runtime only when the buffer is full, then store at
+    // the end. The pushed value stays in x0.
+    char *room_label = new_label(codegen, "push");
+    generate_expression(codegen, expr->data.list.children[2], symbols);
+    invalidate_cached_values(codegen, NULL);
+    emit_code(codegen, "    ldr   x16, [sp, #%d]\n", offset + VEC_LENGTH);
+    emit_code(codegen, "    ldr   x17, [sp, #%d]\n", offset + VEC_CAPACITY);
+    emit_code(codegen, "    cmp   x16, x17\n");
+    emit_code(codegen, "    b.lt  %s\n", room_label);
+    int slot = push_spill_slot(codegen);
+    emit_code(codegen, "    str   x0, [sp, #%d]\n", slot);
+    emit_code(codegen, "    add   x0, sp, #%d\n", offset);
+    emit_mov_immediate(codegen, "x1", type_size(element_type));
+    emit_code(codegen, "    bl    _clumsy_vec_grow\n");
+    emit_code(codegen, "    ldr   x0, [sp, #%d]\n", slot);
+    pop_spill_slot(codegen);
+    emit_code(codegen, "    ldr   x16, [sp, #%d]\n", offset + VEC_LENGTH);
+    emit_code(codegen, "%s:\n", room_label);
+    emit_code(codegen, "    ldr   x17, [sp, #%d]\n", offset);
+    format_indexed_address(operand, sizeof(operand), "x17", "x16", element_type);
+    emit_sized_access(codegen, true, element_type, "x0", operand);
+    emit_code(codegen, "    add   x16, x16, #1\n");
+    emit_code(codegen, "    str   x16, [sp, #%d]\n", offset + VEC_LENGTH);
+    free(room_label);
+}
+
+// (let v vec<T>) starts empty; (let v vec<T> [a b c]) reserves room for
+// the literal and stores it
+void generate_vec_let(CodeGen *codegen, Symbol *vec, ASTNode *init, SymbolTable *symbols) {
+    int offset = get_symbol_offset(symbols, vec->name);
+    SymbolType element_type = vec->type_info.pointer.element_type;
+    invalidate_cached_values(codegen, vec->name);
+    if (codegen->region_depth > 0) {
+        invalidate_cached_values(codegen, NULL);
+        emit_code(codegen, "    add   x0, sp, #%d\n", offset);
+        emit_code(codegen, "    bl    _clumsy_vec_init\n");
+    } else {
+        for (int word = 0; word < VEC_HEADER_SIZE; word += 8) {
+            emit_code(codegen, "    str   xzr, [sp, #%d]\n", offset + word);
+        }
+    }
+    if (!init) return;
+    if (init->type != AST_ARRAY) {
+        fprintf(stderr, "Error: vec %s starts empty or from an array literal\n", vec->name);
+        exit(1);
+    }
+    size_t count = init->data.list.count;
+    if (count == 0) return;
+    
+    invalidate_cached_values(codegen, NULL);
+    emit_code(codegen, "    add   x0, sp, #%d\n", offset);
+    emit_mov_immediate(codegen, "x1", (int)count);
+    emit_mov_immediate(codegen, "x2", type_size(element_type));
+    emit_code(codegen, "    bl    _clumsy_vec_reserve\n");
+    for (size_t i = 0; i < count; i++) {
+        char operand[48];
+        generate_expression(codegen, init->data.list.children[i], symbols);
+        emit_code(codegen, "    ldr   x16, [sp, #%d]\n", offset);
+        snprintf(operand, sizeof(operand), "[x16, #%d]", (int)i * type_size(element_type));
+        emit_sized_access(codegen, true, element_type, "x0", operand);
+    }
+    emit_mov_immediate(codegen, "x16", (int)count);
+    emit_code(codegen, "    str   x16, [sp, #%d]\n", offset + VEC_LENGTH);
+}
+
+// Hash maps. A map<K,V> slot holds the header of an open-addressing table
+// in the runtime, whose entry points are specialized by key type: integer
+// keys, of any width, compare as 64-bit values and str keys by content.
+// Values are kept widened to 64 bits, as in registers. (get m k) is the
+// value for k, or 0 (or a given default) when it is missing.
+
+bool parse_map_type(const char *name, Symbol *symbol) {
+    size_t length = strlen(name);
+    const char *comma = strchr(name, ',');
+    if (strncmp(name, "map<", 4) != 0 || !comma || name[length - 1] != '>') return false;
+    
+    char key[16] = {0}, value[16] = {0};
+    size_t key_length = comma - name - 4, value_length = name + length - 1 - comma - 1;
+    if (key_length >= sizeof(key) || value_length >= sizeof(value) ||
+        (memcpy(key, name + 4, key_length), !parse_scalar_type(key, &symbol->type_info.map.key_type)) ||
+        (memcpy(value, comma + 1, value_length), !parse_scalar_type(value, &symbol->type_info.map.value_type))) {
+        fprintf(stderr, "Error: map keys and values must be scalar types, not %s\n", name);
+        exit(1);
+    }
+    symbol->type = SYM_MAP;
+    return true;
+}
+
+// (put m k v), (get m k [default]), (has m k), (del m k), and the let of a
+// map, which registers it with the region it is declared in
+bool is_map_call(ASTNode *expr) {
+    const char *op = operator_name(expr);
+    if (!op || expr->data.list.count < 3 || expr->data.list.children[1]->type != AST_IDENTIFIER) return false;
+    if (strcmp(op, "let") == 0) {
+        ASTNode *type_node = expr->data.list.children[2];
+        return type_node->type == AST_IDENTIFIER && strncmp(type_node->data.string_value, "map<", 4) == 0;
+    }
+    return strcmp(op, "put") == 0 || strcmp(op, "get") == 0 || strcmp(op, "has") == 0 || strcmp(op, "del") == 0;
+}
+
+// A map operation, len or reserve whose first operand is a map variable.
+// The names stay free for functions on anything else.
+bool is_map_builtin(ASTNode *expr, SymbolTable *symbols) {
+    const char *op = operator_name(expr);
+    if (!op || expr->data.list.count < 2 || expr->data.list.children[1]->type != AST_IDENTIFIER) return false;
+    Symbol *symbol = find_symbol(symbols, expr->data.list.children[1]->data.string_value);
+    if (!symbol || symbol->type != SYM_MAP) return false;
+    
+    size_t count = expr->data.list.count;
+    if ((strcmp(op, "len") == 0 && count == 2) || (strcmp(op, "put") == 0 && count == 4) ||
+        (strcmp(op, "get") == 0 && (count == 3 || count == 4)) ||
+        ((strcmp(op, "has") == 0 || strcmp(op, "del") == 0 || strcmp(op, "reserve") == 0) && count == 3)) {
+        return true;
+    }
+    fprintf(stderr, "Error: wrong number of operands to %s on map %s\n", op, symbol->name);
+    exit(1);
+}
+
+// Call the runtime entry point clumsy_map_<key kind>_<operation> with the
+// map's address in x0 and the operands in x1, x2
+static void emit_map_call(CodeGen *codegen, Symbol *map, const char *operation,
+                          ASTNode **operands, int count, SymbolTable *symbols) {
+    int slot = 0;
+    for (int i = 0; i < count; i++) {
+        generate_expression(codegen, operands[i], symbols);
+        if (i < count - 1) {
+            slot = push_spill_slot(codegen);
+            emit_code(codegen, "    str   x0, [sp, #%d]\n", slot);
+        }
+    }
+    if (count == 2) {
+        emit_code(codegen, "    mov   x2, x0\n");
+        emit_code(codegen, "    ldr   x1, [sp, #%d]\n", slot);
+        pop_spill_slot(codegen);
+    } else if (count == 1) {
+        emit_code(codegen, "    mov   x1, x0\n");
+    }
+    emit_code(codegen, "    add   x0, sp, #%d\n", get_symbol_offset(symbols, map->name));
+    invalidate_cached_values(codegen, NULL);
+    emit_code(codegen, "    bl    _clumsy_map_%s_%s\n",
+              map->type_info.map.key_type == SYM_STR ? "str" : "int", operation);
+}
+
+void generate_map_builtin(CodeGen *codegen, ASTNode *expr, SymbolTable *symbols) {
+    const char *op = operator_name(expr);
+    Symbol *map = find_symbol(symbols, expr->data.list.children[1]->data.string_value);
+    ASTNode **operands = expr->data.list.children + 2;
+    
+    if (strcmp(op, "len") == 0) {
+        emit_tile(codegen, expr, symbols, 0);
+    } else if (strcmp(op, "get") == 0) {
+        ASTNode zero = {.type = AST_INT};
+        ASTNode *fallback[2] = {operands[0], expr->data.list.count == 4 ? operands[1] : &zero};
+        emit_map_call(codegen, map, "get", fallback, 2, symbols);
+    } else if (strcmp(op, "put") == 0) {
+        emit_map_call(codegen, map, "put", operands, 2, symbols);
+    } else {
+        // has, del and reserve
+        emit_map_call(codegen, map, op, operands, 1, symbols);
+    }
+}
+
+// (let m map<K,V>) starts empty; (let m map<K,V> n) makes room for n
+// entries up front
+void generate_map_let(CodeGen *codegen, Symbol *map, ASTNode *init, SymbolTable *symbols) {
+    int offset = get_symbol_offset(symbols, map->name);
+    invalidate_cached_values(codegen, map->name);
+    if (codegen->region_depth > 0) {
+        invalidate_cached_values(codegen, NULL);
+        emit_code(codegen, "    add   x0, sp, #%d\n", offset);
+        emit_code(codegen, "    bl    _clumsy_map_init\n");
+    } else {
+        for (int word = 0; word < MAP_HEADER_SIZE; word += 8) {
+            emit_code(codegen, "    str   xzr, [sp, #%d]\n", offset + word);
+        }
+    }
+    if (init) emit_map_call(codegen, map, "reserve", &init, 1, symbols);
+}
+
+// (for (k m) body) runs body for each key; clumsy_map_next finds the slot
+// of the next entry after the current one, kept in a spill slot, or -1 at
+// the end. Entries put during the loop may or may not be visited.
+void generate_map_loop(CodeGen *codegen, ASTNode *stmt, SymbolTable *symbols) {
+    ASTNode *header = stmt->data.list.children[1];
+    const char *key = header->data.list.children[0]->data.string_value;
+    int map_offset = get_symbol_offset(symbols, header->data.list.children[1]->data.string_value);
+    int slot_offset = push_spill_slot(codegen);
+    bool tail = codegen->tail_position;
+    
+    char *loop_label = new_label(codegen, "loop");
+    char *end_label = new_label(codegen, "end_loop");
+    invalidate_cached_values(codegen, NULL);
+    emit_code(codegen, "    mov   x0, #-1\n");
+    emit_code(codegen, "%s:\n", loop_label);
+    emit_code(codegen, "    mov   x1, x0\n");
+    emit_code(codegen, "    add   x0, sp, #%d\n", map_offset);
+    emit_code(codegen, "    bl    _clumsy_map_next\n");
+    emit_code(codegen, "    cmp   x0, #0\n");
+    emit_code(codegen, "    b.lt  %s\n", end_label);
+    emit_code(codegen, "    str   x0, [sp, #%d]\n", slot_offset);
+    emit_code(codegen, "    ldr   x16, [sp, #%d]\n", map_offset + MAP_KEYS);
+    if (get_symbol_offset(symbols, key) >= 0) {
+        emit_code(codegen, "    ldr   x0, [x16, x0, lsl #3]\n");
+        emit_store_variable(codegen, "x0", key, symbols);
+    }
+    if (stmt->data.list.count >= 3) {
+        codegen->tail_position = false;
+        generate_statement(codegen, stmt->data.list.children[2], symbols);
+        codegen->tail_position = tail;
+    }
+    invalidate_cached_values(codegen, NULL);
+    emit_code(codegen, "    ldr   x0, [sp, #%d]\n", slot_offset);
+    emit_code(codegen, "    b     %s\n", loop_label);
+    emit_code(codegen, "%s:\n", end_label);
+    pop_spill_slot(codegen);
+    
+    free(loop_label);
+    free(end_label);
+}
+
+// Bulk array operations. (sort a), (search a x), (fill a x), (copy to from),
+// (min a), (max a) and (sum a) work on an array, a vec, or a pointer with
+// an explicit count, as in (sort p n); a count also limits an array or vec
+// to its first n elements. Each lowers to one call with the address of
+// the first element and the count: clumsy_<op>_<element type> in the
+// runtime, or memmove for copy. A function of the same name wins.
+
+static const char *bulk_operators[] = {"sort", "search", "fill", "copy", "min", "max", "sum"};
+
+// Operands before the optional count
+static int bulk_operand_count(const char *op) {
+    return strcmp(op, "search") == 0 || strcmp(op, "fill") == 0 || strcmp(op, "copy") == 0 ? 2 : 1;
+}
+
+static Symbol *bulk_array(ASTNode *operand, SymbolTable *symbols) {
+    if (operand->type != AST_IDENTIFIER) return NULL;
+    Symbol *symbol = find_symbol(symbols, operand->data.string_value);
+    if (!symbol || !(symbol->type == SYM_ARRAY || symbol->type == SYM_VEC ||
+                     (symbol->type == SYM_POINTER && !symbol->type_info.pointer.struct_type_name))) {
+        return NULL;
+    }
+    return symbol;
+}
+
+static SymbolType bulk_element_type(Symbol *array) {
+    return array->type == SYM_ARRAY ? array->type_info.array.element_type : array->type_info.pointer.element_type;
+}
+
+bool is_bulk_builtin(ASTNode *expr, SymbolTable *symbols) {
+    const char *op = operator_name(expr);
+    if (!op || expr->data.list.count < 2) return false;
+    for (size_t i = 0; i < sizeof(bulk_operators) / sizeof(bulk_operators[0]); i++) {
+        if (strcmp(op, bulk_operators[i]) != 0) continue;
+        Symbol *function = find_symbol_recursive(symbols, op);
+        return !(function && function->type == SYM_FUNCTION) && bulk_array(expr->data.list.children[1], symbols);
+    }
+    return false;
+}
+
+// reg = address of the first element of array
+static void emit_bulk_base(CodeGen *codegen, const char *reg, Symbol *array, SymbolTable *symbols) {
+    int offset = get_symbol_offset(symbols, array->name);
+    if (array->type == SYM_ARRAY) {
+        emit_code(codegen, "    add   %s, sp, #%d\n", reg, offset);
+    } else {
+        emit_code(codegen, "    ldr   %s, [sp, #%d]\n", reg, offset);
+    }
+}
+
+// reg = element count of array; a pointer has none
+static void emit_bulk_length(CodeGen *codegen, const char *reg, Symbol *array, SymbolTable *symbols, const char *op) {
+    if (array->type == SYM_ARRAY) {
+        emit_mov_immediate(codegen, reg, array_length(array));
+    } else if (array->type == SYM_VEC) {
+        emit_code(codegen, "    ldr   %s, [sp, #%d]\n", reg, get_symbol_offset(symbols, array->name) + VEC_LENGTH);
+    } else {
+        fprintf(stderr, "Error: %s on pointer %s needs an element count\n", op, array->name);
+        exit(1);
+    }
+}
+
+static const char *element_suffix(SymbolType type) {
+    switch (type) {
+        case SYM_I8:  return "i8";
+        case SYM_I16: return "i16";
+        case SYM_I32: return "i32";
+        case SYM_U8: case SYM_CHAR: case SYM_BOOL: return "u8";
+        case SYM_U16: return "u16";
+        case SYM_U32: return "u32";
+        case SYM_U64: case SYM_STR: return "u64";
+        default: return "i64";
+    }
+}
+
+void generate_bulk_builtin(CodeGen *codegen, ASTNode *expr, SymbolTable *symbols) {
+    const char *op = operator_name(expr);
+    Symbol *array = bulk_array(expr->data.list.children[1], symbols);
+    SymbolType element_type = bulk_element_type(array);
+    int operands = bulk_operand_count(op);
+    size_t count = expr->data.list.count;
+    if (count != (size_t)operands + 1 && count != (size_t)operands + 2) {
+        fprintf(stderr, "Error: wrong number of operands to %s\n", op);
+        exit(1);
+    }
+    ASTNode *limit = count == (size_t)operands + 2 ? expr->data.list.children[count - 1] : NULL;
+    
+    if (strcmp(op, "copy") == 0) {
+        Symbol *source = bulk_array(expr->data.list.children[2], symbols);
+        if (!source || type_size(bulk_element_type(source)) != type_size(element_type)) {
+            fprintf(stderr, "Error: copy needs an array, vec or pointer of the same element size as %s\n", array->name);
+            exit(1);
+        }
+        // Without a count, as many elements as both hold
+        if (limit) {
+            generate_expression(codegen, limit, symbols);
+            emit_code(codegen, "    mov   x2, x0\n");
+        } else if (array->type == SYM_POINTER) {
+            emit_bulk_length(codegen, "x2", source, symbols, op);
+        } else if (source->type == SYM_POINTER) {
+            emit_bulk_length(codegen, "x2", array, symbols, op);
+        } else {
+            emit_bulk_length(codegen, "x2", array, symbols, op);
+            emit_bulk_length(codegen, "x16", source, symbols, op);
+            emit_code(codegen, "    cmp   x2, x16\n");
+            emit_code(codegen, "    csel  x2, x2, x16, le\n");
+        }
+        if (type_shift(element_type) > 0) {
+            emit_code(codegen, "    lsl   x2, x2, #%d\n", type_shift(element_type));
+        }
+        emit_bulk_base(codegen, "x0", array, symbols);
+        emit_bulk_base(codegen, "x1", source, symbols);
+        invalidate_cached_values(codegen, NULL);
+        emit_code(codegen, "    bl    _memmove\n");
+        return;
+    }
+    
+    if (element_type == SYM_STR && strcmp(op, "fill") != 0) {
+        fprintf(stderr, "Error: %s needs integer elements, not the strings of %s\n", op, array->name);
+        exit(1);
+    }
+    // x2 = the value searched for or filled with, x1 = the count
+    if (operands == 2) {
+        generate_expression(codegen, expr->data.list.children[2], symbols);
+        if (limit) {
+            int slot = push_spill_slot(codegen);
+            emit_code(codegen, "    str   x0, [sp, #%d]\n", slot);
+            generate_expression(codegen, limit, symbols);
+            emit_code(codegen, "    mov   x1, x0\n");
+            emit_code(codegen, "    ldr   x2, [sp, #%d]\n", slot);
+            pop_spill_slot(codegen);
+        } else {
+            emit_code(codegen, "    mov   x2, x0\n");
+        }
+    } else if (limit) {
+        generate_expression(codegen, limit, symbols);
+        emit_code(codegen, "    mov   x1, x0\n");
+    }
+    if (!limit) emit_bulk_length(codegen, "x1", array, symbols, op);
+    emit_bulk_base(codegen, "x0", array, symbols);
+    invalidate_cached_values(codegen, NULL);
+    emit_code(codegen, "    bl    _clumsy_%s_%s\n", op, element_suffix(element_type));
+}
+
+// SIMD vector types. i8x16, i16x8, i32x4 and i64x2 variables live in 16-byte
+// aligned stack slots and map onto one NEON register each. A vector
+// expression evaluated at depth d lands in v16 + d, so operands never need
+// spilling. Lanes are read and written in place as v[k]. A scalar mixed
+// into vector arithmetic is broadcast to every lane. Comparisons give
+// all-ones or all-zero lanes, ready for select. Vector expressions may not
+// call functions, since calls clobber v16-v31.
+
+#define SIMD_FIRST_REG 16
+#define SIMD_DEPTH 13 // v16-v28, so shuffles still have three registers
+
+bool parse_vector_type(const char *name, VectorType *type) {
+    static const VectorType types[] = {{16, 8}, {8, 16}, {4, 32}, {2, 64}};
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+        char spelling[8];
+        snprintf(spelling, sizeof(spelling), "i%dx%d", types[i].lane_bits, types[i].lanes);
+        if (strcmp(name, spelling) == 0) {
+            *type = types[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+static void simd_error(const char *message, ASTNode *expr) {
+    const char *op = operator_name(expr);
+    fprintf(stderr, "Error: %s%s%s\n", message, op ? " in " : "", op ? op : "");
+    exit(1);
+}
+
+// Arrangement specifier such as 4s, and the lane size letter alone
+static const char *arrangement(VectorType type) {
+    switch (type.lane_bits) {
+        case 8: return "16b";
+        case 16: return "8h";
+        case 32: return "4s";
+        default: return "2d";
+    }
+}
+
+static char lane_letter(VectorType type) {
+    return arrangement(type)[strlen(arrangement(type)) - 1];
+}
+
+static bool is_comparison_or_arithmetic(const char *op) {
+    return is_comparison_operator(op) || strcmp(op, "+") == 0 || strcmp(op, "-") == 0 ||
+           strcmp(op, "*") == 0 || strcmp(op, "/") == 0 || strcmp(op, "%") == 0;
+}
+
+// Whether expr is a vector value, and which type
+bool vector_type_of(ASTNode *expr, SymbolTable *symbols, VectorType *type) {
+    if (expr->type == AST_IDENTIFIER) {
+        Symbol *symbol = find_symbol_recursive(symbols, expr->data.string_value);
+        if (!symbol || symbol->type != SYM_VECTOR) return false;
+        *type = symbol->type_info.vector;
+        return true;
+    }
+    
+    const char *op = operator_name(expr);
+    if (!op || expr->data.list.count < 2) return false;
+    if (parse_vector_type(op, type)) return true;
+    
+    ASTNode *first = expr->data.list.children[1];
+    if (strcmp(op, "load") == 0) {
+        return first->type == AST_IDENTIFIER && parse_vector_type(first->data.string_value, type);
+    }
+    if (strcmp(op, "shuffle") == 0) return vector_type_of(first, symbols, type);
+    if (strcmp(op, "select") == 0 && expr->data.list.count == 4) {
+        return vector_type_of(expr->data.list.children[2], symbols, type);
+    }
+    if (is_comparison_or_arithmetic(op) && expr->data.list.count == 3) {
+        return vector_type_of(first, symbols, type) ||
+               vector_type_of(expr->data.list.children[2], symbols, type);
+    }
+    return false;
+}
+
+// Materialize 16 constant bytes in register reg through x16 and x17
+static void emit_vector_constant(CodeGen *codegen, int reg, const unsigned char bytes[16]) {
+    unsigned long low = 0, high = 0;
+    for (int i = 7; i >= 0; i--) {
+        low = (low << 8) | bytes[i];
+        high = (high << 8) | bytes[i + 8];
+    }
+    emit_mov_wide(codegen, "x16", low);
+    emit_code(codegen, "    fmov  d%d, x16\n", reg);
+    if (high != 0) {
+        emit_mov_wide(codegen, "x17", high);
+        emit_code(codegen, "    mov   v%d.d[1], x17\n", reg);
+    }
+}
+
+// x0 = the scalar expr, keeping v16 through register reg intact for a
+// reduction nested inside it
+static void emit_vector_scalar(CodeGen *codegen, int reg, ASTNode *expr, SymbolTable *symbols) {
+    int saved_depth = codegen->simd_depth;
+    codegen->simd_depth = reg - SIMD_FIRST_REG + 1;
+    generate_expression(codegen, expr, symbols);
+    codegen->simd_depth = saved_depth;
+}
+
+// Broadcast the scalar expr to every lane of register reg
+static void emit_vector_splat(CodeGen *codegen, int reg, ASTNode *expr, VectorType type, SymbolTable *symbols) {
+    emit_vector_scalar(codegen, reg, expr, symbols);
+    emit_code(codegen, "    dup   v%d.%s, %s\n", reg, arrangement(type), type.lane_bits == 64 ? "x0" : "w0");
+}
+
+// x16 = address of array[index] for lanes elements starting there. Arrays
+// of the lane width map onto the vector directly, int arrays are narrowed
+// on load and widened on store; returns the array's element size.
+static int emit_element_address(CodeGen *codegen, ASTNode *array, ASTNode *index, VectorType type, SymbolTable *symbols) {
+    Symbol *symbol = array->type == AST_IDENTIFIER ? find_symbol(symbols, array->data.string_value) : NULL;
+    int offset = symbol && symbol->type == SYM_ARRAY ? get_symbol_offset(symbols, array->data.string_value) : -1;
+    if (offset < 0) simd_error("vector load or store needs an array", NULL);
+    
+    SymbolType element_type = symbol->type_info.array.element_type;
+    int element_size = type_size(element_type);
+    if (element_size * 8 != type.lane_bits && !(element_size == 8 && type.lanes <= 4)) {
+        simd_error("array elements do not fit this vector type", array);
+    }
+    if (type.lanes > array_length(symbol) ||
+        (index->type == AST_INT && (index->data.int_value < 0 || index->data.int_value + type.lanes > array_length(symbol)))) {
+        simd_error("vector runs past the end of the array", array);
+    }
+    
+    if (index->type == AST_INT) {
+        emit_code(codegen, "    add   x16, sp, #%d\n", offset + index->data.int_value * element_size);
+    } else {
+        const char *reg = emit_tile_value(codegen, index, symbols, 0);
+        emit_code(codegen, "    add   x16, sp, #%d\n", offset);
+        emit_code(codegen, "    add   x16, x16, %s, lsl #%d\n", reg, type_shift(element_type));
+    }
+    return element_size;
+}
+
+static int emit_vector_expression_at(CodeGen *codegen, ASTNode *expr, VectorType type, SymbolTable *symbols, int depth);
+
+// (i32x4 a b c d) with one value per lane, or (i32x4 x) for a splat
+static void emit_vector_literal(CodeGen *codegen, ASTNode *expr, VectorType type, SymbolTable *symbols, int reg) {
+    size_t count = expr->data.list.count - 1;
+    ASTNode **lanes = expr->data.list.children + 1;
+    if (count == 1) {
+        emit_vector_splat(codegen, reg, lanes[0], type, symbols);
+        return;
+    }
+    if ((int)count != type.lanes) simd_error("wrong number of lanes", expr);
+    
+    bool constant = true;
+    for (size_t i = 0; i < count; i++) {
+        if (lanes[i]->type != AST_INT && lanes[i]->type != AST_CHAR) constant = false;
+    }
+    if (constant) {
+        unsigned char bytes[16];
+        int lane_bytes = type.lane_bits / 8;
+        for (size_t i = 0; i < count; i++) {
+            long value = lanes[i]->type == AST_INT ? lanes[i]->data.int_value : lanes[i]->data.char_value;
+            for (int b = 0; b < lane_bytes; b++) {
+                bytes[i * lane_bytes + b] = (unsigned char)(value >> (8 * b));
+            }
+        }
+        emit_vector_constant(codegen, reg, bytes);
+        return;
+    }
+    for (size_t i = 0; i < count; i++) {
+        emit_vector_scalar(codegen, reg, lanes[i], symbols);
+        emit_code(codegen, "    mov   v%d.%c[%d], %s\n", reg, lane_letter(type), (int)i,
+                  type.lane_bits == 64 ? "x0" : "w0");
+    }
+}
+
+// (load i32x4 array index): lanes from consecutive elements, narrowed from
+// int elements
+static void emit_vector_load(CodeGen *codegen, ASTNode *expr, VectorType type, SymbolTable *symbols, int reg) {
+    if (expr->data.list.count != 4) simd_error("expected (load type array index)", expr);
+    
+    int element_size = emit_element_address(codegen, expr->data.list.children[2], expr->data.list.children[3], type, symbols);
+    if (element_size * 8 == type.lane_bits) {
+        emit_code(codegen, "    ldr   q%d, [x16]\n", reg);
+    } else {
+        emit_code(codegen, "    ldp   q%d, q%d, [x16]\n", reg, reg + 1);
+        emit_code(codegen, "    uzp1  v%d.4s, v%d.4s, v%d.4s\n", reg, reg, reg + 1);
+    }
+}
+
+// (shuffle a [b] i0 i1 ...): lane k of the result is lane ik of a, or of b
+// counting on from a's last lane
+static void emit_vector_shuffle(CodeGen *codegen, ASTNode *expr, VectorType type, SymbolTable *symbols, int depth) {
+    int reg = SIMD_FIRST_REG + depth;
+    ASTNode **children = expr->data.list.children;
+    bool two_sources = expr->data.list.count > 2 && children[2]->type != AST_INT;
+    size_t first_index = two_sources ? 3 : 2;
+    if ((int)(expr->data.list.count - first_index) != type.lanes) simd_error("wrong number of lanes", expr);
+    
+    unsigned char table[16];
+    int lane_bytes = type.lane_bits / 8;
+    for (int k = 0; k < type.lanes; k++) {
+        ASTNode *index = children[first_index + k];
+        if (index->type != AST_INT || index->data.int_value < 0 ||
+            index->data.int_value >= type.lanes * (two_sources ? 2 : 1)) {
+            simd_error("shuffle lanes must be constants within the sources", expr);
+        }
+        for (int b = 0; b < lane_bytes; b++) {
+            table[k * lane_bytes + b] = (unsigned char)(index->data.int_value * lane_bytes + b);
+        }
+    }
+    
+    emit_vector_expression_at(codegen, children[1], type, symbols, depth);
+    if (two_sources) emit_vector_expression_at(codegen, children[2], type, symbols, depth + 1);
+    int table_reg = reg + (two_sources ? 2 : 1);
+    emit_vector_constant(codegen, table_reg, table);
+    if (two_sources) {
+        emit_code(codegen, "    tbl   v%d.16b, {v%d.16b, v%d.16b}, v%d.16b\n", reg, reg, reg + 1, table_reg);
+    } else {
+        emit_code(codegen, "    tbl   v%d.16b, {v%d.16b}, v%d.16b\n", reg, reg, table_reg);
+    }
+}
+
+// Evaluate a vector expression of the given type into v16 + depth
+static int emit_vector_expression_at(CodeGen *codegen, ASTNode *expr, VectorType type, SymbolTable *symbols, int depth) {
+    int reg = SIMD_FIRST_REG + depth;
+    if (depth >= SIMD_DEPTH) simd_error("vector expression nested too deeply", expr);
+    
+    VectorType actual;
+    if (!vector_type_of(expr, symbols, &actual)) {
+        emit_vector_splat(codegen, reg, expr, type, symbols);
+        return reg;
+    }
+    if (actual.lanes != type.lanes) simd_error("mismatched vector types", expr);
+    
+    if (expr->type == AST_IDENTIFIER) {
+        emit_code(codegen, "    ldr   q%d, [sp, #%d]\n", reg, get_symbol_offset(symbols, expr->data.string_value));
+        return reg;
+    }
+    
+    const char *op = operator_name(expr);
+    ASTNode **children = expr->data.list.children;
+    const char *arr = arrangement(type);
+    if (strcmp(op, "load") == 0) {
+        emit_vector_load(codegen, expr, type, symbols, reg);
+    } else if (strcmp(op, "shuffle") == 0) {
+        emit_vector_shuffle(codegen, expr, type, symbols, depth);
+    } else if (strcmp(op, "select") == 0) {
+        // bsl keeps lanes of the first operand where the mask is set
+        emit_vector_expression_at(codegen, children[1], type, symbols, depth);
+        emit_vector_expression_at(codegen, children[2], type, symbols, depth + 1);
+        emit_vector_expression_at(codegen, children[3], type, symbols, depth + 2);
+        emit_code(codegen, "    bsl   v%d.16b, v%d.16b, v%d.16b\n", reg, reg + 1, reg + 2);
+    } else if (is_comparison_or_arithmetic(op)) {
+        emit_vector_expression_at(codegen, children[1], type, symbols, depth);
+        emit_vector_expression_at(codegen, children[2], type, symbols, depth + 1);
+        int left = reg, right = reg + 1;
+        const char *instruction;
+        if (strcmp(op, "+") == 0) {
+            instruction = "add";
+        } else if (strcmp(op, "-") == 0) {
+            instruction = "sub";
+        } else if (strcmp(op, "*") == 0 && type.lane_bits < 64) {
+            instruction = "mul";
+        } else if (strcmp(op, "==") == 0) {
+            instruction = "cmeq";
+        } else if (strcmp(op, ">") == 0 || strcmp(op, "<") == 0) {
+            instruction = "cmgt";
+        } else if (strcmp(op, ">=") == 0 || strcmp(op, "<=") == 0) {
+            instruction = "cmge";
+        } else {
+            simd_error("operator has no NEON form for this vector type", expr);
+            return reg;
+        }
+        if (op[0] == '<') {
+            left = reg + 1;
+            right = reg;
+        }
+        emit_code(codegen, "    %-5s v%d.%s, v%d.%s, v%d.%s\n", instruction, reg, arr, left, arr, right, arr);
+    } else {
+        emit_vector_literal(codegen, expr, type, symbols, reg);
+    }
+    return reg;
+}
+
+static void check_vector_expression(ASTNode *expr, SymbolTable *symbols) {
+    if (contains_call(expr, symbols)) {
+        simd_error("vector expressions cannot call functions; assign the result to a variable first", expr);
+    }
+}
+
+// (let v i32x4 value) or (set v value)
+void generate_vector_assignment(CodeGen *codegen, const char *name, ASTNode *value, SymbolTable *symbols) {
+    Symbol *symbol = find_symbol(symbols, name);
+    check_vector_expression(value, symbols);
+    int reg = emit_vector_expression_at(codegen, value, symbol->type_info.vector, symbols, 0);
+    emit_code(codegen, "    str   q%d, [sp, #%d]\n", reg, get_symbol_offset(symbols, name));
+}
+
+// dest = lane of the vector variable name, sign-extended
+void emit_lane_load(CodeGen *codegen, const char *dest, const char *name, ASTNode *lane, SymbolTable *symbols, int depth) {
+    Symbol *symbol = find_symbol_recursive(symbols, name);
+    int offset = get_symbol_offset(symbols, name);
+    int lane_bytes = symbol->type_info.vector.lane_bits / 8;
+    const char *load = lane_bytes == 1 ? "ldrsb" : lane_bytes == 2 ? "ldrsh" : lane_bytes == 4 ? "ldrsw" : "ldr";
+    
+    if (lane->type == AST_INT) {
+        if (lane->data.int_value < 0 || lane->data.int_value >= symbol->type_info.vector.lanes) {
+            simd_error("lane index out of range", NULL);
+        }
+        emit_code(codegen, "    %-5s %s, [sp, #%d]\n", load, dest, offset + lane->data.int_value * lane_bytes);
+        return;
+    }
+    const char *index = emit_tile_value(codegen, lane, symbols, depth);
+    emit_code(codegen, "    add   x16, sp, #%d\n", offset);
+    if (lane_bytes == 1) {
+        emit_code(codegen, "    %-5s %s, [x16, %s]\n", load, dest, index);
+    } else {
+        emit_code(codegen, "    %-5s %s, [x16, %s, lsl #%d]\n", load, dest, index, log2_exact(lane_bytes));
+    }
+}
+
+// (set v[k] value): store the low bits of value into one lane
+void generate_lane_store(CodeGen *codegen, const char *name, ASTNode *lane, ASTNode *value, SymbolTable *symbols) {
+    Symbol *symbol = find_symbol(symbols, name);
+    int offset = get_symbol_offset(symbols, name);
+    int lane_bytes = symbol->type_info.vector.lane_bits / 8;
+    const char *store = lane_bytes == 1 ? "strb" : lane_bytes == 2 ? "strh" : "str";
+    const char *reg = lane_bytes == 8 ? "x0" : "w0";
+    
+    generate_expression(codegen, value, symbols);
+    if (lane->type == AST_INT) {
+        if (lane->data.int_value < 0 || lane->data.int_value >= symbol->type_info.vector.lanes) {
+            simd_error("lane index out of range", NULL);
+        }
+        emit_code(codegen, "    %-5s %s, [sp, #%d]\n", store, reg, offset + lane->data.int_value * lane_bytes);
+        return;
+    }
+    
+    // Computing the lane clobbers x0 unless it tiles from the second temporary
+    int slot = -1;
+    if (!is_tileable(lane)) {
+        slot = push_spill_slot(codegen);
+        emit_code(codegen, "    str   x0, [sp, #%d]\n", slot);
+    }
+    const char *index = emit_tile_value(codegen, lane, symbols, slot < 0 ? 1 : 0);
+    if (slot >= 0) {
+        if (strcmp(index, "x0") == 0) {
+            emit_code(codegen, "    mov   x17, x0\n");
+            index = "x17";
+        }
+        emit_code(codegen, "    ldr   x0, [sp, #%d]\n", slot);
+        pop_spill_slot(codegen);
+    }
+    emit_code(codegen, "    add   x16, sp, #%d\n", offset);
+    if (lane_bytes == 1) {
+        emit_code(codegen, "    %-5s %s, [x16, %s]\n", store, reg, index);
+    } else {
+        emit_code(codegen, "    %-5s %s, [x16, %s, lsl #%d]\n", store, reg, index, log2_exact(lane_bytes));
+    }
+}
+
+// (store array index v): lanes to consecutive elements, sign-extended to
+// int elements
+void generate_vector_store(CodeGen *codegen, ASTNode *stmt, SymbolTable *symbols) {
+    VectorType type;
+    if (stmt->data.list.count != 4 || !vector_type_of(stmt->data.list.children[3], symbols, &type)) {
+        simd_error("expected (store array index vector)", stmt);
+    }
+    check_vector_expression(stmt, symbols);
+    
+    int reg = emit_vector_expression_at(codegen, stmt->data.list.children[3], type, symbols, 0);
+    int element_size = emit_element_address(codegen, stmt->data.list.children[1], stmt->data.list.children[2], type, symbols);
+    if (element_size * 8 == type.lane_bits) {
+        emit_code(codegen, "    str   q%d, [x16]\n", reg);
+    } else {
+        emit_code(codegen, "    sxtl2 v%d.2d, v%d.4s\n", reg + 1, reg);
+        emit_code(codegen, "    sxtl  v%d.2d, v%d.2s\n", reg, reg);
+        emit_code(codegen, "    stp   q%d, q%d, [x16]\n", reg, reg + 1);
+    }
+}
+
+// (hadd v), (hmax v) or (hmin v)
+bool is_vector_reduction(ASTNode *expr) {
+    const char *op = operator_name(expr);
+    return op && expr->data.list.count == 2 &&
+           (strcmp(op, "hadd") == 0 || strcmp(op, "hmax") == 0 || strcmp(op, "hmin") == 0);
+}
+
+// x0 = the lanes of a vector summed, or their maximum or minimum
+void generate_vector_reduction(CodeGen *codegen, ASTNode *expr, SymbolTable *symbols) {
+    const char *op = operator_name(expr);
+    ASTNode *operand = expr->data.list.children[1];
+    VectorType type;
+    if (!vector_type_of(operand, symbols, &type)) simd_error("expected a vector", expr);
+    check_vector_expression(operand, symbols);
+    
+    // Above any registers an enclosing vector expression still holds
+    int reg = emit_vector_expression_at(codegen, operand, type, symbols, codegen->simd_depth);
+    if (type.lane_bits == 64) {
+        // No across-lanes form for 64-bit lanes
+        if (strcmp(op, "hadd") == 0) {
+            emit_code(codegen, "    addp  d%d, v%d.2d\n", reg, reg);
+            emit_code(codegen, "    fmov  x0, d%d\n", reg);
+        } else {
+            emit_code(codegen, "    fmov  x0, d%d\n", reg);
+            emit_code(codegen, "    mov   x16, v%d.d[1]\n", reg);
+            emit_code(codegen, "    cmp   x0, x16\n");
+            emit_code(codegen, "    csel  x0, x0, x16, %s\n", strcmp(op, "hmax") == 0 ? "gt" : "lt");
+        }
+        return;
+    }
+    
+    const char *instruction = strcmp(op, "hadd") == 0 ? "addv" : strcmp(op, "hmax") == 0 ? "smaxv" : "sminv";
+    char letter = lane_letter(type);
+    emit_code(codegen, "    %-5s %c%d, v%d.%s\n", instruction, letter, reg, reg, arrangement(type));
+    emit_code(codegen, "    smov  x0, v%d.%c[0]\n", reg, letter);
+}
+
+// Dead code elimination. Variables no statement reads lose their stack slot
+// and every store to them; a store that is overwritten (or goes out of scope)
+// before anything reads it is dropped; expression statements whose value is
+// discarded are skipped when they have no side effects; statements after a
+// return are never generated. Discarded values that may call out are still
+// evaluated for their effects.
+
+bool is_side_effect_free(ASTNode *expr) {
+    if (!expr || expr->type == AST_STRING || is_tileable(expr)) return true;
+    // pow is a pure runtime helper
+    if (is_runtime_pow(expr)) {
+        return is_side_effect_free(expr->data.list.children[1]) &&
+               is_side_effect_free(expr->data.list.children[2]);
+    }
+    return false;
+}
+
+// Like mentions_variable, but store targets and field names are not reads
+static bool reads_variable(ASTNode *node, const char *name) {
+    if (!node) return false;
+    if (node->type == AST_IDENTIFIER) return strcmp(node->data.string_value, name) == 0;
+    if (node->type != AST_LIST && node->type != AST_ARRAY) return false;
+    
+    const char *op = operator_name(node);
+    size_t count = node->data.list.count;
+    if (op && strcmp(op, ".") == 0) {
+        return count >= 2 && reads_variable(node->data.list.children[1], name);
+    }
+    if (op && (strcmp(op, "let") == 0 || strcmp(op, "set") == 0)) {
+        if (count < 3) return false;
+        ASTNode *target = node->data.list.children[1];
+        const char *target_op = operator_name(target);
+        if (strcmp(op, "set") == 0 && target_op && strcmp(target_op, "[]") == 0 &&
+            target->data.list.count >= 3 && reads_variable(target->data.list.children[2], name)) {
+            return true;
+        }
+        // (set @p value) reads the pointer
+        if (target_op && strcmp(target_op, "@") == 0 && reads_variable(target, name)) {
+            return true;
+        }
+        return reads_variable(node->data.list.children[count - 1], name);
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (reads_variable(node->data.list.children[i], name)) return true;
+    }
+    return false;
+}
+
+// Whether node stores an element or field through the pointer name. Other
+// pointers to the same memory may read it, so the store is never dead.
+static bool stores_through(ASTNode *node, const char *name) {
+    if (!node || node->type != AST_LIST) return false;
+    
+    const char *op = operator_name(node);
+    if (op && strcmp(op, "set") == 0 && node->data.list.count >= 3) {
+        ASTNode *target = node->data.list.children[1];
+        const char *target_op = operator_name(target);
+        ASTNode *root = access_root(target);
+        if (target_op && (strcmp(target_op, "[]") == 0 || strcmp(target_op, ".") == 0) &&
+            root->type == AST_IDENTIFIER && strcmp(root->data.string_value, name) == 0) {
+            return true;
+        }
+    }
+    for (size_t i = 0; i < node->data.list.count; i++) {
+        if (stores_through(node->data.list.children[i], name)) return true;
+    }
+    return false;
+}
+
+static bool is_aggregate_literal(ASTNode *expr) {
+    const char *op = operator_name(expr);
+    return expr->type == AST_ARRAY || (op && strcmp(op, "#") == 0);
+}
+
+// Mark the top-level variables nothing reads. Aggregates are only dropped
+// when their initializer makes no calls, since element stores are skipped
+// wholesale.
+void eliminate_unused_variables(SymbolTable *symbols, ASTNode *ast) {
+    if (ast->type != AST_LIST) return;
+    
+    for (size_t i = 0; i < symbols->count; i++) {
+        Symbol *symbol = &symbols->symbols[i];
+        if (symbol->type == SYM_FUNCTION) continue;
+        
+        bool read = false;
+        for (size_t j = 0; j < ast->data.list.count && !read; j++) {
+            ASTNode *stmt = ast->data.list.children[j];
+            read = !is_function_definition(stmt) && reads_variable(stmt, symbol->name);
+        }
+        if (read || symbol->address_taken) continue;
+        if (is_indirect(symbol) && stores_through(ast, symbol->name)) continue;
+        if ((symbol->type == SYM_ARRAY || symbol->type == SYM_STRUCT) &&
+            contains_call(symbol->init_value, symbols)) continue;
+        symbol->eliminated = true;
+    }
+}
+
+// A let/set whose target is eliminated or marked dead by the enclosing
+// sequence. Struct type definitions have no symbol and never match.
+static bool is_dead_store(CodeGen *codegen, ASTNode *stmt, SymbolTable *symbols) {
+    const char *name = assigned_variable(stmt);
+    if (!name || is_function_definition(stmt)) return false;
+    
+    Symbol *symbol = find_symbol(symbols, name);
+    return symbol && (symbol->eliminated || codegen->dead_store);
+}
+
+// Evaluate the parts of a dead store that may have side effects
+static void generate_discarded_store(CodeGen *codegen, ASTNode *stmt, SymbolTable *symbols) {
+    ASTNode *value = stmt->data.list.children[stmt->data.list.count - 1];
+    ASTNode *target = stmt->data.list.children[1];
+    const char *target_op = operator_name(target);
+    
+    if (!is_aggregate_literal(value) && !is_side_effect_free(value)) {
+        generate_expression(codegen, value, symbols);
+    }
+    if (target_op && strcmp(target_op, "[]") == 0 && target->data.list.count >= 3 &&
+        !is_side_effect_free(target->data.list.children[2])) {
+        generate_expression(codegen, target->data.list.children[2], symbols);
+    }
+}
+
+// Whether the scalar stored by stmts[index] is overwritten, or dies with the
+// sequence, before any later statement reads it
+static bool is_overwritten_before_read(ASTNode **stmts, size_t count, size_t index, SymbolTable *symbols, bool live_at_end) {
+    ASTNode *stmt = stmts[index];
+    const char *name = assigned_variable(stmt);
+    if (!name || stmt->data.list.children[1]->type != AST_IDENTIFIER || is_function_definition(stmt)) return false;
+    
+    Symbol *symbol = find_symbol(symbols, name);
+    if (!symbol || symbol->type == SYM_ARRAY || symbol->type == SYM_STRUCT || symbol->type == SYM_FUNCTION ||
+        symbol->type == SYM_VEC || symbol->type == SYM_MAP || symbol->address_taken) {
+        return false;
+    }
+    
+    for (size_t i = index + 1; i < count; i++) {
+        ASTNode *next = stmts[i];
+        if (reads_variable(next, name)) return false;
+        if (is_indirect(symbol) && stores_through(next, name)) return false;
+        
+        const char *assigned = assigned_variable(next);
+        if (assigned && strcmp(assigned, name) == 0 && next->data.list.children[1]->type == AST_IDENTIFIER) {
+            return true;
+        }
+    }
+    return !live_at_end;
+}
+
+// Print statements fused into one print_values call take at most this
+// many values, one per argument register after the layout
+#define FUSED_PRINT_VALUES 7
+#define PRINT_VALUE '\1' // layout marker, see print_values in clumsyrt.c
+
+// A print that can join a fused group. Its value must make no calls, since
+// every value is evaluated before anything is printed.
+static bool is_fusable_print(ASTNode *stmt, SymbolTable *symbols) {
+    const char *op = operator_name(stmt);
+    return op && strcmp(op, "print") == 0 && stmt->data.list.count == 2 &&
+           !contains_call(stmt->data.list.children[1], symbols);
+}
+
+// Fuse the run of prints starting at stmts[index] into a single runtime
+// call: literals are spelled into a layout string and the other values go
+// in x1-x7. Returns the statements consumed, 0 when there is no run to fuse.
+static size_t generate_fused_prints(CodeGen *codegen, ASTNode **stmts, size_t count, size_t index, SymbolTable *symbols) {
+    ASTNode *values[FUSED_PRINT_VALUES];
+    int value_count = 0;
+    size_t layout_capacity = 64, layout_length = 0;
+    char *layout = malloc(layout_capacity);
+    size_t end = index;
+    
+    for (; end < count && is_fusable_print(stmts[end], symbols); end++) {
+        ASTNode *expr = stmts[end]->data.list.children[1];
+        char kind = 0;
+        size_t length = 1;
+        char *text = NULL;
+        if (expr->type == AST_STRING) {
+            text = decode_string(expr->data.string_value, &length);
+        } else if (expr->type == AST_CHAR) {
+            text = malloc(2);
+            text[0] = expr->data.char_value;
+            text[1] = '\0';
+        } else if (value_count < FUSED_PRINT_VALUES) {
+            kind = is_string_expression(expr, symbols) ? 's' : 'd';
+            length = 2;
+        } else {
+            break;
+        }
+        if (text && memchr(text, PRINT_VALUE, length)) {
+            free(text);
+            break;
+        }
+        
+        while (layout_length + length + 1 > layout_capacity) {
+            layout_capacity *= 2;
+            layout = realloc(layout, layout_capacity);
+        }
+        if (text) {
+            memcpy(layout + layout_length, text, length);
+            free(text);
+        } else {
+            layout[layout_length] = PRINT_VALUE;
+            layout[layout_length + 1] = kind;
+            values[value_count++] = expr;
+        }
+        layout_length += length;
+    }
+    if (end - index < 2) {
+        free(layout);
+        return 0;
+    }
+    layout[layout_length] = '\0';
+    size_t layout_index = intern_string(codegen, layout, layout_length);
+    
+    // Values needing evaluation wait in spill slots; variables and
+    // constants load straight into their argument registers
+    int slots[FUSED_PRINT_VALUES];
+    int spilled = 0;
+    for (int i = 0; i < value_count; i++) {
+        if (values[i]->type == AST_IDENTIFIER || values[i]->type == AST_INT) continue;
+        generate_expression(codegen, values[i], symbols);
+        slots[i] = push_spill_slot(codegen);
+        emit_code(codegen, "    str   x0, [sp, #%d]\n", slots[i]);
+        spilled++;
+    }
+    invalidate_cached_values(codegen, NULL);
+    for (int i = 0; i < value_count; i++) {
+        char reg[8];
+        snprintf(reg, sizeof(reg), "x%d", i + 1);
+        if (values[i]->type == AST_IDENTIFIER) {
+            emit_load_variable(codegen, reg, values[i]->data.string_value, symbols);
+        } else if (values[i]->type == AST_INT) {
+            emit_mov_immediate(codegen, reg, values[i]->data.int_value);
+        } else {
+            emit_code(codegen, "    ldr   %s, [sp, #%d]\n", reg, slots[i]);
+        }
+    }
+    while (spilled-- > 0) {
+        pop_spill_slot(codegen);
+    }
+    
+    emit_code(codegen, "    adrp  x0, Lstr_%zu@PAGE\n", layout_index);
+    emit_code(codegen, "    add   x0, x0, Lstr_%zu@PAGEOFF\n", layout_index);
+    if (value_count == 0) {
+        emit_mov_immediate(codegen, "x1", (int)layout_length);
+        emit_code(codegen, "    bl    _print_str\n");
+    } else {
+        emit_code(codegen, "    bl    _print_values\n");
+    }
+    return end - index;
+}
+
+// Generate stmts[index] of a statement sequence, and any prints fused with
+// it; returns how many statements that covered. live_at_end says whether
+// variables may still be read once the sequence finishes.
+static size_t generate_sequence_statement(CodeGen *codegen, ASTNode **stmts, size_t count, size_t index, SymbolTable *symbols, bool live_at_end) {
+    ASTNode *stmt = stmts[index];
+    
+    // A pure expression statement only matters as a function's result
+    if (stmt->type == AST_LIST && is_side_effect_free(stmt) &&
+        !(codegen->tail_position && codegen->return_label)) {
+        return 1;
+    }
+    
+    size_t fused = generate_fused_prints(codegen, stmts, count, index, symbols);
+    if (fused > 0) return fused;
+    
+    codegen->dead_store = is_overwritten_before_read(stmts, count, index, symbols, live_at_end);
+    generate_statement(codegen, stmt, symbols);
+    codegen->dead_store = false;
+    return 1;
+}
+
+// Statements of a begin block up to and including the first return; the rest
+// can never run
+size_t reachable_count(ASTNode *block) {
+    size_t count = block->data.list.count;
+    for (size_t i = 1; i < count; i++) {
+        const char *op = operator_name(block->data.list.children[i]);
+        if (op && strcmp(op, "ret") == 0) return i + 1;
+    }
+    return count;
+}
+
+// Counted loops. (for (i start end [step]) body) runs body for i = start,
+// start + step, ... while i < end, with end re-evaluated before each
+// iteration like a C for loop, and leaves i at its first value past the
+// range. It lowers to (set i start) and a while loop over the body followed
+// by the increment. Short bodies that leave i alone are unrolled: the main
+// loop runs unroll_factor copies of body and increment per test, against
+// end - (unroll_factor - 1) * step, and a second loop takes the remaining
+// iterations. Constant ranges of a few iterations are unrolled completely,
+// with i replaced by its value in each copy.
+
+#define UNROLL_BODY_NODES 48 // largest body, in AST nodes, that is unrolled
+#define FULL_UNROLL_TRIPS 8  // most iterations a constant loop is unrolled to
+
+static int unroll_factor = 4;
+
+// Copies of each loop body per iteration; 1 disables unrolling
+void set_unroll_factor(int factor) {
+    unroll_factor = factor < 1 ? 1 : factor;
+}
+
+// A node owned by codegen; lists may share children with the source tree
+static ASTNode *synthesize_node(CodeGen *codegen, ASTNodeType type) {
+    if (codegen->synthesized_count >= codegen->synthesized_capacity) {
+        codegen->synthesized_capacity = codegen->synthesized_capacity == 0 ? 16 : codegen->synthesized_capacity * 2;
+        codegen->synthesized = realloc(codegen->synthesized, codegen->synthesized_capacity * sizeof(ASTNode*));
+        if (!codegen->synthesized) {
+            fprintf(stderr, "Error: Failed to allocate memory for synthesized nodes\n");
+            exit(1);
+        }
+    }
+    ASTNode *node = create_ast_node(type);
+    codegen->synthesized[codegen->synthesized_count++] = node;
+    return node;
+}
+
+static ASTNode *synthesize_identifier(CodeGen *codegen, const char *name) {
+    ASTNode *node = synthesize_node(codegen, AST_IDENTIFIER);
+    node->data.string_value = strdup(name);
+    return node;
+}
+
+static ASTNode *synthesize_int(CodeGen *codegen, int value) {
+    ASTNode *node = synthesize_node(codegen, AST_INT);
+    node->data.int_value = value;
+    return node;
+}
+
+// (op left right)
+static ASTNode *synthesize_binary(CodeGen *codegen, const char *op, ASTNode *left, ASTNode *right) {
+    ASTNode *node = synthesize_node(codegen, AST_LIST);
+    add_ast_child(node, synthesize_identifier(codegen, op));
+    add_ast_child(node, left);
+    add_ast_child(node, right);
+    return node;
+}
+
+// Copy of node with every read of name replaced by value; field names
+// after . are left alone
+static ASTNode *substitute_constant(CodeGen *codegen, ASTNode *node, const char *name, int value) {
+    if (node->type == AST_IDENTIFIER) {
+        if (strcmp(node->data.string_value, name) == 0) return synthesize_int(codegen, value);
+        return synthesize_identifier(codegen, node->data.string_value);
+    }
+    if (node->type != AST_LIST && node->type != AST_ARRAY) {
+        ASTNode *copy = synthesize_node(codegen, node->type);
+        copy->data = node->data;
+        if (node->type == AST_STRING) copy->data.string_value = strdup(node->data.string_value);
+        return copy;
+    }
+    
+    ASTNode *copy = synthesize_node(codegen, node->type);
+    const char *op = operator_name(node);
+    bool is_selector = op && strcmp(op, ".") == 0;
+    for (size_t i = 0; i < node->data.list.count; i++) {
+        ASTNode *child = node->data.list.children[i];
+        if (is_selector && i == 2 && child->type == AST_IDENTIFIER) {
+            add_ast_child(copy, synthesize_identifier(codegen, child->data.string_value));
+        } else {
+            add_ast_child(copy, substitute_constant(codegen, child, name, value));
+        }
+    }
+    return copy;
+}
+
+static int count_nodes(ASTNode *node) {
+    if (!node || (node->type != AST_LIST && node->type != AST_ARRAY)) return 1;
+    int count = 1;
+    for (size_t i = 0; i < node->data.list.count; i++) {
+        count += count_nodes(node->data.list.children[i]);
+    }
+    return count;
+}
+
+static bool contains_loop(ASTNode *node) {
+    const char *op = operator_name(node);
+    if (op && (strcmp(op, "while") == 0 || strcmp(op, "for") == 0)) return true;
+    if (!node || node->type != AST_LIST) return false;
+    for (size_t i = 0; i < node->data.list.count; i++) {
+        if (contains_loop(node->data.list.children[i])) return true;
+    }
+    return false;
+}
+
+// (while (< i bound) (begin body increment body increment ...))
+static ASTNode *synthesize_loop(CodeGen *codegen, ASTNode *variable, ASTNode *bound, ASTNode *body, ASTNode *increment, int copies) {
+    ASTNode *block = synthesize_node(codegen, AST_LIST);
+    add_ast_child(block, synthesize_identifier(codegen, "begin"));
+    for (int i = 0; i < copies; i++) {
+        if (body) add_ast_child(block, body);
+        add_ast_child(block, increment);
+    }
+    
+    ASTNode *loop = synthesize_node(codegen, AST_LIST);
+    add_ast_child(loop, synthesize_identifier(codegen, "while"));
+    add_ast_child(loop, synthesize_binary(codegen, "<", variable, bound));
+    add_ast_child(loop, block);
+    return loop;
+}
+
+// Loop vectorization. A unit-step for loop whose body only stores
+// element-wise maps (set d[i] E) and accumulates sums (set s (+ s E)) or
+// (set s (- s E)) runs two elements per iteration in NEON registers, then
+// a scalar iteration takes an odd one left over. E combines arrays indexed
+// by exactly i with + and -, multiplication by powers of two, and
+// loop-invariant values broadcast to both lanes. Arrays are separate stack
+// slots, so the only possible alias is an array both read and stored by the
+// loop; accessing it anywhere but at i makes the access neither element-wise
+// nor invariant, which rejects the loop in place of a runtime overlap test.
+//
+// Array k walks x9 + k and holds its current pair in vk, expression
+// temporaries are v16-v23, sums accumulate in v24-v27 and broadcasts live in
+// v28-v31. v8-v15 are left alone: their low halves are callee-saved, and
+// loops in pfor bodies run in chunks called from C. x17 counts the
+// remaining pairs and x16 holds i after the loop.
+
+#define VECTOR_ARRAYS 7
+#define VECTOR_FIRST_TEMP 16
+#define VECTOR_DEPTH 8
+#define VECTOR_SUMS 4
+#define VECTOR_BROADCASTS 4
+
+static bool vectorize_loops = true;
+
+void set_vectorize(bool enabled) {
+    vectorize_loops = enabled;
+}
+
+typedef struct {
+    ASTNode *loop;
+    const char *variable;
+    SymbolTable *symbols;
+    const char *arrays[VECTOR_ARRAYS];
+    bool stored[VECTOR_ARRAYS];
+    bool loaded[VECTOR_ARRAYS];   // vk holds the current pair
+    int array_count;
+    const char *sums[VECTOR_SUMS];
+    int sum_count;
+    ASTNode *broadcasts[VECTOR_BROADCASTS];
+    int broadcast_count;
+} VectorLoop;
+
+// Array name of array[i], or NULL for any other expression
+static const char *element_array(VectorLoop *vector, ASTNode *expr) {
+    const char *op = operator_name(expr);
+    if (!op || strcmp(op, "[]") != 0 || expr->data.list.count != 3) return NULL;
+    
+    ASTNode *array = expr->data.list.children[1];
+    ASTNode *index = expr->data.list.children[2];
+    if (array->type != AST_IDENTIFIER || index->type != AST_IDENTIFIER ||
+        strcmp(index->data.string_value, vector->variable) != 0) {
+        return NULL;
+    }
+    Symbol *symbol = find_symbol(vector->symbols, array->data.string_value);
+    return symbol && symbol->type == SYM_ARRAY && type_size(symbol->type_info.array.element_type) == 8 ?
+           array->data.string_value : NULL;
+}
+
+// Index of an array in the loop, added on first use; -1 when out of registers
+static int vector_array(VectorLoop *vector, const char *name) {
+    for (int k = 0; k < vector->array_count; k++) {
+        if (strcmp(vector->arrays[k], name) == 0) return k;
+    }
+    int offset = get_symbol_offset(vector->symbols, name);
+    if (vector->array_count == VECTOR_ARRAYS || offset < 0 || offset > 4095) return -1;
+    vector->arrays[vector->array_count] = name;
+    return vector->array_count++;
+}
+
+static int vector_broadcast(VectorLoop *vector, ASTNode *expr) {
+    for (int b = 0; b < vector->broadcast_count; b++) {
+        if (expressions_equal(vector->broadcasts[b], expr)) return b;
+    }
+    if (vector->broadcast_count == VECTOR_BROADCASTS) return -1;
+    vector->broadcasts[vector->broadcast_count] = expr;
+    return vector->broadcast_count++;
+}
+
+// Power-of-two multiplier of (* E c) or (* c E), with E in *operand
+static int vector_multiplier(ASTNode *expr, ASTNode **operand) {
+    ASTNode *left = expr->data.list.children[1];
+    ASTNode *right = expr->data.list.children[2];
+    ASTNode *constant = right->type == AST_INT ? right : left;
+    *operand = constant == right ? left : right;
+    if (constant->type != AST_INT || !is_power_of_two(constant->data.int_value)) return 0;
+    return constant->data.int_value;
+}
+
+// Whether expr can be computed lane-wise at temporaries from v16 + depth
+static bool is_vector_expression(VectorLoop *vector, ASTNode *expr, int depth) {
+    if (depth >= VECTOR_DEPTH) return false;
+    
+    const char *array = element_array(vector, expr);
+    if (array) return vector_array(vector, array) >= 0;
+    if (is_tileable(expr) && is_loop_invariant(expr, vector->loop, vector->symbols)) {
+        return vector_broadcast(vector, expr) >= 0;
+    }
+    
+    const char *op = operator_name(expr);
+    if (!op || expr->data.list.count != 3) return false;
+    if (strcmp(op, "+") == 0 || strcmp(op, "-") == 0) {
+        return is_vector_expression(vector, expr->data.list.children[1], depth) &&
+               is_vector_expression(vector, expr->data.list.children[2], depth + 1);
+    }
+    ASTNode *operand;
+    if (strcmp(op, "*") == 0 && vector_multiplier(expr, &operand) > 0) {
+        return is_vector_expression(vector, operand, depth);
+    }
+    return false;
+}
+
+// Summed term of (set s (+ s E)), (set s (+ E s)) or (set s (- s E))
+static ASTNode *summed_term(ASTNode *stmt, bool *subtract) {
+    ASTNode *target = stmt->data.list.children[1];
+    ASTNode *value = stmt->data.list.children[2];
+    const char *op = operator_name(value);
+    if (target->type != AST_IDENTIFIER || !op || value->data.list.count != 3) return NULL;
+    
+    const char *name = target->data.string_value;
+    ASTNode *left = value->data.list.children[1];
+    ASTNode *right = value->data.list.children[2];
+    bool left_is_sum = left->type == AST_IDENTIFIER && strcmp(left->data.string_value, name) == 0;
+    bool right_is_sum = right->type == AST_IDENTIFIER && strcmp(right->data.string_value, name) == 0;
+    
+    *subtract = strcmp(op, "-") == 0;
+    if ((strcmp(op, "+") == 0 || *subtract) && left_is_sum) return right;
+    if (strcmp(op, "+") == 0 && right_is_sum) return left;
+    return NULL;
+}
+
+static bool is_vector_statement(VectorLoop *vector, ASTNode *stmt) {
+    const char *op = operator_name(stmt);
+    if (!op || strcmp(op, "set") != 0 || stmt->data.list.count != 3) return false;
+    
+    ASTNode *target = stmt->data.list.children[1];
+    const char *array = element_array(vector, target);
+    if (array) {
+        int k = vector_array(vector, array);
+        if (k < 0) return false;
+        vector->stored[k] = true;
+        return is_vector_expression(vector, stmt->data.list.children[2], 0);
+    }
+    
+    bool subtract;
+    ASTNode *term = summed_term(stmt, &subtract);
+    if (!term) return false;
+    const char *name = target->data.string_value;
+    Symbol *symbol = find_symbol(vector->symbols, name);
+    if (!symbol || symbol->type == SYM_ARRAY || symbol->type == SYM_STRUCT || symbol->type == SYM_FUNCTION ||
+        strcmp(name, vector->variable) == 0 || reads_variable(term, name)) {
+        return false;
+    }
+    for (int s = 0; s < vector->sum_count; s++) {
+        if (strcmp(vector->sums[s], name) == 0) return false;
+    }
+    if (vector->sum_count == VECTOR_SUMS) return false;
+    vector->sums[vector->sum_count++] = name;
+    return is_vector_expression(vector, term, 0);
+}
+
+// Whether every statement is a map or a sum nothing else in the body reads
+static bool is_vectorizable(VectorLoop *vector, ASTNode **stmts, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (!is_vector_statement(vector, stmts[i])) return false;
+    }
+    for (int s = 0; s < vector->sum_count; s++) {
+        for (size_t i = 0; i < count; i++) {
+            const char *assigned = assigned_variable(stmts[i]);
+            if (strcmp(assigned, vector->sums[s]) != 0 && reads_variable(stmts[i], vector->sums[s])) return false;
+        }
+    }
+    return vector->array_count > 0;
+}
+
+// Vector register holding expr, evaluated with temporaries from v16 + depth
+static int emit_vector_expression(CodeGen *codegen, VectorLoop *vector, ASTNode *expr, int depth) {
+    const char *array = element_array(vector, expr);
+    if (array) {
+        int k = vector_array(vector, array);
+        if (!vector->loaded[k]) {
+            // Arrays the loop stores advance with their last store instead
+            emit_code(codegen, "    ld1   {v%d.2d}, [x%d]%s\n", k, 9 + k, vector->stored[k] ? "" : ", #16");
+            vector->loaded[k] = true;
+        }
+        return k;
+    }
+    for (int b = 0; b < vector->broadcast_count; b++) {
+        if (expressions_equal(vector->broadcasts[b], expr)) return 28 + b;
+    }
+    
+    int result = VECTOR_FIRST_TEMP + depth;
+    const char *op = operator_name(expr);
+    if (strcmp(op, "*") == 0) {
+        ASTNode *operand;
+        int multiplier = vector_multiplier(expr, &operand);
+        int source = emit_vector_expression(codegen, vector, operand, depth);
+        if (multiplier == 1) return source;
+        emit_code(codegen, "    shl   v%d.2d, v%d.2d, #%d\n", result, source, log2_exact(multiplier));
+        return result;
+    }
+    int left = emit_vector_expression(codegen, vector, expr->data.list.children[1], depth);
+    int right = emit_vector_expression(codegen, vector, expr->data.list.children[2], depth + 1);
+    emit_code(codegen, "    %s   v%d.2d, v%d.2d, v%d.2d\n", strcmp(op, "+") == 0 ? "add" : "sub", result, left, right);
+    return result;
+}
+
+static void emit_vector_body(CodeGen *codegen, VectorLoop *vector, ASTNode **stmts, size_t count) {
+    memset(vector->loaded, 0, sizeof(vector->loaded));
+    for (size_t i = 0; i < count; i++) {
+        ASTNode *target = stmts[i]->data.list.children[1];
+        const char *array = element_array(vector, target);
+        if (!array) {
+            bool subtract;
+            int sum = 0;
+            while (strcmp(vector->sums[sum], target->data.string_value) != 0) sum++;
+            int term = emit_vector_expression(codegen, vector, summed_term(stmts[i], &subtract), 0);
+            emit_code(codegen, "    add   v%d.2d, v%d.2d, v%d.2d\n", 24 + sum, 24 + sum, term);
+            continue;
+        }
+        
+        int k = vector_array(vector, array);
+        int value = emit_vector_expression(codegen, vector, stmts[i]->data.list.children[2], 0);
+        bool last_store = true;
+        bool read_later = false;
+        for (size_t j = i + 1; j < count; j++) {
+            const char *later = element_array(vector, stmts[j]->data.list.children[1]);
+            if (later && strcmp(later, array) == 0) last_store = false;
+            if (reads_variable(stmts[j], array)) read_later = true;
+        }
+        emit_code(codegen, "    st1   {v%d.2d}, [x%d]%s\n", value, 9 + k, last_store ? ", #16" : "");
+        if (read_later && value != k) {
+            emit_code(codegen, "    mov   v%d.16b, v%d.16b\n", k, value);
+        }
+        vector->loaded[k] = true;
+    }
+}
+
+// Vectorized form of a unit-step (for (i start end) body) when the body
+// qualifies; returns false, having emitted nothing, otherwise
+static bool generate_vector_for(CodeGen *codegen, ASTNode *stmt, SymbolTable *symbols) {
+    const char *name = loop_variable(stmt);
+    ASTNode *header = stmt->data.list.children[1];
+    ASTNode *start = header->data.list.children[1];
+    ASTNode *end = header->data.list.children[2];
+    ASTNode *body = stmt->data.list.count >= 3 ? stmt->data.list.children[2] : NULL;
+    if (!vectorize_loops || !body || !is_tileable(end) || !is_loop_invariant(end, stmt, symbols)) {
+        return false;
+    }
+    
+    ASTNode **stmts = &body;
+    size_t count = 1;
+    const char *body_op = operator_name(body);
+    if (body_op && strcmp(body_op, "begin") == 0) {
+        stmts = body->data.list.children + 1;
+        count = body->data.list.count - 1;
+    }
+    VectorLoop vector = {stmt, name, symbols, {NULL}, {false}, {false}, 0, {NULL}, 0, {NULL}, 0};
+    if (!is_vectorizable(&vector, stmts, count)) return false;
+    
+    // A constant range fixes the number of pairs and whether one is left over
+    bool constant_range = start->type == AST_INT && end->type == AST_INT;
+    long trips = constant_range ? (long)end->data.int_value - start->data.int_value : 0;
+    if (constant_range && trips < 2) return false;
+    
+    ASTNode *variable = synthesize_identifier(codegen, name);
+    generate_statement(codegen, synthesize_binary(codegen, "set", variable, start), symbols);
+    for (int b = 0; b < vector.broadcast_count; b++) {
+        generate_expression(codegen, vector.broadcasts[b], symbols);
+        emit_code(codegen, "    dup   v%d.2d, x0\n", 28 + b);
+    }
+    for (int s = 0; s < vector.sum_count; s++) {
+        emit_code(codegen, "    movi  v%d.2d, #0\n", 24 + s);
+    }
+    
+    char *skip_label = NULL;
+    if (constant_range) {
+        emit_mov_immediate(codegen, "x17", (int)(trips / 2));
+    } else {
+        skip_label = new_label(codegen, "vector_skip");
+        generate_expression(codegen, synthesize_binary(codegen, "-", end, variable), symbols);
+        emit_code(codegen, "    cmp   x0, #2\n");
+        emit_code(codegen, "    b.lt  %s\n", skip_label);
+        emit_code(codegen, "    lsr   x17, x0, #1\n");
+    }
+    emit_load_variable(codegen, "x16", name, symbols);
+    for (int k = 0; k < vector.array_count; k++) {
+        emit_code(codegen, "    add   x%d, sp, #%d\n", 9 + k, get_symbol_offset(symbols, vector.arrays[k]));
+        emit_code(codegen, "    add   x%d, x%d, x16, lsl #3\n", 9 + k, 9 + k);
+    }
+    emit_code(codegen, "    add   x16, x16, x17, lsl #1\n");
+    
+    char *loop_label = new_label(codegen, "vector_loop");
+    emit_code(codegen, "%s:\n", loop_label);
+    emit_vector_body(codegen, &vector, stmts, count);
+    emit_code(codegen, "    subs  x17, x17, #1\n");
+    emit_code(codegen, "    b.ne  %s\n", loop_label);
+    emit_store_variable(codegen, "x16", name, symbols);
+    if (skip_label) {
+        emit_code(codegen, "%s:\n", skip_label);
+    }
+    
+    // Fold each pair of partial sums into its variable
+    for (int s = 0; s < vector.sum_count; s++) {
+        bool subtract = false;
+        for (size_t i = 0; i < count; i++) {
+            const char *assigned = assigned_variable(stmts[i]);
+            if (strcmp(assigned, vector.sums[s]) == 0) summed_term(stmts[i], &subtract);
+        }
+        emit_code(codegen, "    addp  d%d, v%d.2d\n", 24 + s, 24 + s);
+        emit_code(codegen, "    fmov  x0, d%d\n", 24 + s);
+        emit_load_variable(codegen, "x9", vector.sums[s], symbols);
+        emit_code(codegen, "    %s   x0, x9, x0\n", subtract ? "sub" : "add");
+        emit_store_variable(codegen, "x0", vector.sums[s], symbols);
+        invalidate_cached_values(codegen, vector.sums[s]);
+    }
+    invalidate_cached_values(codegen, name);
+    for (int k = 0; k < vector.array_count; k++) {
+        if (vector.stored[k]) invalidate_cached_values(codegen, vector.arrays[k]);
+    }
+    
+    // Scalar epilogue for an odd element
+    if (constant_range) {
+        if (trips % 2) {
+            generate_statement(codegen, substitute_constant(codegen, body, name, end->data.int_value - 1), symbols);
+            generate_statement(codegen, synthesize_binary(codegen, "set", variable, end), symbols);
+        }
+    } else {
+        ASTNode *increment = synthesize_binary(codegen, "set", variable,
+                                               synthesize_binary(codegen, "+", variable, synthesize_int(codegen, 1)));
+        ASTNode *block = synthesize_node(codegen, AST_LIST);
+        add_ast_child(block, synthesize_identifier(codegen, "begin"));
+        add_ast_child(block, body);
+        add_ast_child(block, increment);
+        ASTNode *epilogue = synthesize_node(codegen, AST_LIST);
+        add_ast_child(epilogue, synthesize_identifier(codegen, "if"));
+        add_ast_child(epilogue, synthesize_binary(codegen, "<", variable, end));
+        add_ast_child(epilogue, block);
+        generate_statement(codegen, epilogue, symbols);
+    }
+    
+    free(loop_label);
+    free(skip_label);
+    return true;
+}
+
+void generate_for(CodeGen *codegen, ASTNode *stmt, SymbolTable *symbols) {
+    ASTNode *each = stmt->data.list.count >= 2 ? stmt->data.list.children[1] : NULL;
+    if (each && each->type == AST_LIST && each->data.list.count == 2 &&
+        each->data.list.children[1]->type == AST_IDENTIFIER) {
+        Symbol *collection = find_symbol(symbols, each->data.list.children[1]->data.string_value);
+        if (collection && collection->type == SYM_MAP) {
+            generate_map_loop(codegen, stmt, symbols);
+            return;
+        }
+    }
+    const char *name = loop_variable(stmt);
+    if (!name) {
+        fprintf(stderr, "Error: for expects (for (variable start end [step]) body)\n");
+        exit(1);
+    }
+    ASTNode *header = stmt->data.list.children[1];
+    ASTNode *start = header->data.list.children[1];
+    ASTNode *end = header->data.list.children[2];
+    ASTNode *body = stmt->data.list.count >= 3 ? stmt->data.list.children[2] : NULL;
+    int step = 1;
+    if (header->data.list.count >= 4) {
+        ASTNode *step_node = header->data.list.children[3];
+        if (step_node->type != AST_INT || step_node->data.int_value <= 0) {
+            fprintf(stderr, "Error: for step must be a positive integer constant\n");
+            exit(1);
+        }
+        step = step_node->data.int_value;
+    }
+    
+    bool tail = codegen->tail_position;
+    codegen->tail_position = false;
+    if (step == 1 && generate_vector_for(codegen, stmt, symbols)) {
+        codegen->tail_position = tail;
+        return;
+    }
+    
+    ASTNode *variable = synthesize_identifier(codegen, name);
+    ASTNode *increment = synthesize_binary(codegen, "set", variable,
+                                           synthesize_binary(codegen, "+", variable, synthesize_int(codegen, step)));
+    bool unrollable = unroll_factor > 1 && count_assignments(body, name) == 0 &&
+                      count_nodes(body) <= UNROLL_BODY_NODES;
+    
+    // Constant range: unroll completely when short, and know the remainder
+    bool constant_range = start->type == AST_INT && end->type == AST_INT;
+    long trips = 0;
+    if (constant_range && end->data.int_value > start->data.int_value) {
+        trips = ((long)end->data.int_value - start->data.int_value + step - 1) / step;
+    }
+    if (unrollable && constant_range && trips <= FULL_UNROLL_TRIPS) {
+        for (long k = 0; k < trips && body; k++) {
+            generate_statement(codegen, substitute_constant(codegen, body, name, start->data.int_value + (int)k * step), symbols);
+        }
+        int final = start->data.int_value + (int)trips * step;
+        generate_statement(codegen, synthesize_binary(codegen, "set", variable, synthesize_int(codegen, final)), symbols);
+        codegen->tail_position = tail;
+        return;
+    }
+    
+    generate_statement(codegen, synthesize_binary(codegen, "set", variable, start), symbols);
+    
+    // The unrolled loop needs an end it can adjust once, up front
+    if (unrollable && !contains_loop(body) && is_tileable(end) && is_loop_invariant(end, stmt, symbols)) {
+        ASTNode *bound;
+        if (end->type == AST_INT) {
+            bound = synthesize_int(codegen, end->data.int_value - (unroll_factor - 1) * step);
+        } else {
+            bound = synthesize_binary(codegen, "-", end, synthesize_int(codegen, (unroll_factor - 1) * step));
+        }
+        generate_statement(codegen, synthesize_loop(codegen, variable, bound, body, increment, unroll_factor), symbols);
+        
+        // With a constant range the leftover iterations are known as well
+        if (constant_range) {
+            long remainder = trips % unroll_factor;
+            int first = start->data.int_value + (int)(trips - remainder) * step;
+            for (long k = 0; k < remainder && body; k++) {
+                generate_statement(codegen, substitute_constant(codegen, body, name, first + (int)k * step), symbols);
             }
-            break;
-            
-        case AST_ARRAY:
-            // Handle array literals [1 2 3 4]
-            // For now, just load the first element (simplified implementation)
-            if (expr->data.list.count > 0) {
-                generate_expression(codegen, expr->data.list.children[0], symbols);
-            } else {
-                emit_mov_immediate(codegen, "x0", 0);
+            if (remainder > 0) {
+                int final = start->data.int_value + (int)trips * step;
+                generate_statement(codegen, synthesize_binary(codegen, "set", variable, synthesize_int(codegen, final)), symbols);
             }
-            break;
-            
-        default:
-            emit_mov_immediate(codegen, "x0", 0);
-            break;
+            codegen->tail_position = tail;
+            return;
+        }
     }
+    generate_statement(codegen, synthesize_loop(codegen, variable, end, body, increment, 1), symbols);
+    codegen->tail_position = tail;
 }
 
 void generate_statement(CodeGen *codegen, ASTNode *stmt, SymbolTable *symbols) {
@@ -755,10 +5308,21 @@ void generate_statement(CodeGen *codegen, ASTNode *stmt, SymbolTable *symbols) {
         return;
     }
     
-    if (strcmp(op->data.string_value, "let") == 0) {
+    if (is_dead_store(codegen, stmt, symbols)) {
+        generate_discarded_store(codegen, stmt, symbols);
+    } else if (strcmp(op->data.string_value, "let") == 0) {
         // Variable declaration: (let name type [init]) or (let name value)
         if (stmt->data.list.count >= 3) {
             ASTNode *name_node = stmt->data.list.children[1];
+            Symbol *declared = name_node->type == AST_IDENTIFIER ? find_symbol(symbols, name_node->data.string_value) : NULL;
+            if (declared && declared->type == SYM_VEC) {
+                generate_vec_let(codegen, declared, stmt->data.list.count >= 4 ? stmt->data.list.children[3] : NULL, symbols);
+                return;
+            }
+            if (declared && declared->type == SYM_MAP) {
+                generate_map_let(codegen, declared, stmt->data.list.count >= 4 ? stmt->data.list.children[3] : NULL, symbols);
+                return;
+            }
             
             if (stmt->data.list.count >= 4) {
                 // 4-element format: (let name type init)
@@ -767,76 +5331,22 @@ void generate_statement(CodeGen *codegen, ASTNode *stmt, SymbolTable *symbols) {
                 
                 // Check if this is a struct type definition: (let TypeName struct #((field1 type1 val1) ...))
                 if (type_node->type == AST_IDENTIFIER && strcmp(type_node->data.string_value, "struct") == 0) {
-                    // This is a struct type definition - parse and store it
-                    if (init->type == AST_LIST && init->data.list.count >= 2 &&
-                        init->data.list.children[0]->type == AST_IDENTIFIER &&
-                        strcmp(init->data.list.children[0]->data.string_value, "#") == 0) {
-                        
-                        // Parse struct fields from #((field1 type1 val1) (field2 type2 val2) ...)
-                        ASTNode *fields_list = init->data.list.children[1];
-                        if (fields_list->type == AST_LIST) {
-                            // Create struct fields array
-                            size_t field_count = fields_list->data.list.count;
-                            StructField *fields = malloc(field_count * sizeof(StructField));
-                            
-                            for (size_t i = 0; i < field_count; i++) {
-                                ASTNode *field = fields_list->data.list.children[i];
-                                if (field->type == AST_LIST && field->data.list.count >= 3) {
-                                    ASTNode *field_name = field->data.list.children[0];
-                                    ASTNode *field_type = field->data.list.children[1];
-                                    ASTNode *field_default = field->data.list.children[2];
-                                    
-                                    if (field_name->type == AST_IDENTIFIER && field_type->type == AST_IDENTIFIER) {
-                                        fields[i].name = strdup(field_name->data.string_value);
-                                        
-                                        // Map type string to SymbolType
-                                        const char *type_str = field_type->data.string_value;
-                                        if (strcmp(type_str, "int") == 0) {
-                                            fields[i].type = SYM_INT;
-                                        } else if (strcmp(type_str, "char") == 0) {
-                                            fields[i].type = SYM_CHAR;
-                                        } else if (strcmp(type_str, "str") == 0) {
-                                            fields[i].type = SYM_STR;
-                                        } else if (strcmp(type_str, "bool") == 0) {
-                                            fields[i].type = SYM_BOOL;
-                                        } else {
-                                            // Assume it's a user-defined struct type
-                                            fields[i].type = SYM_STRUCT;
-                                        }
-                                        
-                                        fields[i].default_value = field_default; // Store reference to default value
-                                    }
-                                }
-                            }
-                            
-                            // Initialize global struct types table if not already done
-                            if (!global_struct_types) {
-                                global_struct_types = create_struct_type_table();
-                            }
-                            
-                            // Add struct type to table
-                            add_struct_type(global_struct_types, name_node->data.string_value, fields, field_count);
-                            
-                            // Clean up temporary fields array (add_struct_type makes its own copy)
-                            for (size_t i = 0; i < field_count; i++) {
-                                free(fields[i].name);
-                            }
-                            free(fields);
-                        }
-                    }
+                    // Registered up front by define_reachable_struct_types
                     return; // Don't generate code for struct type definitions
                 }
                 
+                Symbol *symbol = find_symbol(symbols, name_node->data.string_value);
+                if (symbol && symbol->type == SYM_VECTOR) {
+                    generate_vector_assignment(codegen, name_node->data.string_value, init, symbols);
+                    return;
+                }
+                
                 // Check if this is a struct or array initialization
-                if (init->type == AST_ARRAY) {
+                if (symbol && symbol->type == SYM_ARRAY && init->type != AST_ARRAY && !literal_elements(init)) {
+                    emit_array_fill(codegen, symbol, init, symbols);
+                } else if (init->type == AST_ARRAY) {
                     // Handle AST_ARRAY type: [1 2 3 4]
-                    int base_offset = get_symbol_offset(symbols, name_node->data.string_value);
-                    for (size_t i = 0; i < init->data.list.count; i++) {
-                        ASTNode *element = init->data.list.children[i];
-                        generate_expression(codegen, element, symbols);
-                        // Store each element at base + element_index * 8
-                        emit_code(codegen, "    str   x0, [sp, #%d]\n", base_offset + (int)i * 8);
-                    }
+                    emit_store_sequence(codegen, init->data.list.children, init->data.list.count, symbol, symbols);
                 } else if (init->type == AST_LIST && init->data.list.count >= 2) {
                     ASTNode *init_op = init->data.list.children[0];
                     if (init_op->type == AST_IDENTIFIER && strcmp(init_op->data.string_value, "#") == 0) {
@@ -862,25 +5372,13 @@ void generate_statement(CodeGen *codegen, ASTNode *stmt, SymbolTable *symbols) {
                             // This is an array literal like #(10 20 30 40)
                             ASTNode *elements = init->data.list.children[1];
                             if (elements->type == AST_LIST) {
-                                int base_offset = get_symbol_offset(symbols, name_node->data.string_value);
-                                for (size_t i = 0; i < elements->data.list.count; i++) {
-                                    ASTNode *element = elements->data.list.children[i];
-                                    generate_expression(codegen, element, symbols);
-                                    // Store each element at base + element_index * 8
-                                    emit_code(codegen, "    str   x0, [sp, #%d]\n", base_offset + (int)i * 8);
-                                }
+                                emit_store_sequence(codegen, elements->data.list.children, elements->data.list.count, symbol, symbols);
                             }
                         } else if (is_struct_type) {
                             // This is a user-defined struct instance with positional values: #(val1 val2 ...)
                             ASTNode *values = init->data.list.children[1];
                             if (values->type == AST_LIST) {
-                                int base_offset = get_symbol_offset(symbols, name_node->data.string_value);
-                                for (size_t i = 0; i < values->data.list.count; i++) {
-                                    ASTNode *value = values->data.list.children[i];
-                                    generate_expression(codegen, value, symbols);
-                                    // Store each field at base + field_index * 8
-                                    emit_code(codegen, "    str   x0, [sp, #%d]\n", base_offset + (int)i * 8);
-                                }
+                                emit_store_sequence(codegen, values->data.list.children, values->data.list.count, symbol, symbols);
                             }
                         } else {
                             // This is a struct literal with named fields - store each field
@@ -892,8 +5390,19 @@ void generate_statement(CodeGen *codegen, ASTNode *stmt, SymbolTable *symbols) {
                                     if (field->type == AST_LIST && field->data.list.count >= 2) {
                                         ASTNode *field_value = field->data.list.children[1];
                                         generate_expression(codegen, field_value, symbols);
-                                        // Store each field at base + field_index * 8
-                                        emit_code(codegen, "    str   x0, [sp, #%d]\n", base_offset + (int)i * 8);
+                                        // Store each field at base + its laid-out offset, or
+                                        // 8 bytes apart for a type that was never defined
+                                        int field_offset = (int)i * 8;
+                                        SymbolType field_type = SYM_INT;
+                                        StructType *nested;
+                                        StructType *type = symbol && symbol->type == SYM_STRUCT ? symbol_struct_type(symbol) : NULL;
+                                        if (!sequence_element(NULL, type, i, &field_offset, &field_type, &nested) || nested) {
+                                            field_offset = (int)i * 8;
+                                            field_type = SYM_INT;
+                                        }
+                                        char address[32];
+                                        snprintf(address, sizeof(address), "[sp, #%d]", base_offset + field_offset);
+                                        emit_sized_access(codegen, true, field_type, "x0", address);
                                     }
                                 }
                             }
@@ -924,18 +5433,85 @@ void generate_statement(CodeGen *codegen, ASTNode *stmt, SymbolTable *symbols) {
             ASTNode *name_node = stmt->data.list.children[1];
             ASTNode *value = stmt->data.list.children[2];
             
-            generate_expression(codegen, value, symbols);
-            emit_store_variable(codegen, "x0", name_node->data.string_value, symbols);
+            if (is_pointer_target(name_node, symbols) && strcmp(operator_name(name_node), "[]") != 0) {
+                // Store through a pointer: (set @p value) or (set p.x value)
+                generate_pointer_store(codegen, name_node, value, symbols);
+            } else if (name_node->type == AST_LIST && name_node->data.list.count >= 3 &&
+                name_node->data.list.children[0]->type == AST_IDENTIFIER &&
+                strcmp(name_node->data.list.children[0]->data.string_value, ".") == 0) {
+                // Field store, possibly nested: (set p.x value) or (set o.inner.x value)
+                int field_offset;
+                SymbolType field_type;
+                StructType *nested;
+                generate_expression(codegen, value, symbols);
+                if (resolve_field(symbols, name_node, &field_offset, &field_type, &nested) && !nested) {
+                    char address[32];
+                    snprintf(address, sizeof(address), "[sp, #%d]", field_offset);
+                    emit_sized_access(codegen, true, field_type, "x0", address);
+                } else {
+                    emit_code(codegen, "    // Error: unknown field in assignment\n");
+                }
+            } else if (name_node->type == AST_LIST && name_node->data.list.count >= 3 &&
+                name_node->data.list.children[0]->type == AST_IDENTIFIER &&
+                name_node->data.list.children[1]->type == AST_IDENTIFIER) {
+                // Element store: (set arr[i] value)
+                const char *target_op = name_node->data.list.children[0]->data.string_value;
+                const char *target = name_node->data.list.children[1]->data.string_value;
+                ASTNode *selector = name_node->data.list.children[2];
+                int base_offset = get_symbol_offset(symbols, target);
+                Symbol *symbol = find_symbol(symbols, target);
+                if (symbol && symbol->type == SYM_VECTOR && strcmp(target_op, "[]") == 0) {
+                    generate_lane_store(codegen, target, selector, value, symbols);
+                    return;
+                }
+                
+                generate_expression(codegen, value, symbols);
+                
+                if (base_offset < 0) {
+                    emit_code(codegen, "    // Error: undefined variable %s\n", target);
+                } else if (strcmp(target_op, "[]") == 0) {
+                    char operand[48];
+                    bool heap = is_indirect(symbol);
+                    SymbolType element_type = heap ? symbol->type_info.pointer.element_type :
+                        symbol && symbol->type == SYM_ARRAY ? symbol->type_info.array.element_type : SYM_INT;
+                    int slot = -1;
+                    if (!is_tileable(selector)) {
+                        // Computing the index clobbers x0, so park the value
+                        slot = push_spill_slot(codegen);
+                        emit_code(codegen, "    str   x0, [sp, #%d]\n", slot);
+                    }
+                    if (heap) {
+                        emit_pointer_element_operand(codegen, operand, sizeof(operand), target, selector, symbols, 1, "x2");
+                    } else {
+                        emit_array_element_operand(codegen, operand, sizeof(operand), base_offset, element_type, selector, symbols);
+                    }
+                    if (slot >= 0) {
+                        emit_code(codegen, "    ldr   x0, [sp, #%d]\n", slot);
+                        pop_spill_slot(codegen);
+                    }
+                    emit_sized_access(codegen, true, element_type, "x0", operand);
+                }
+            } else if (name_node->type == AST_IDENTIFIER) {
+                Symbol *symbol = find_symbol(symbols, name_node->data.string_value);
+                if (symbol && symbol->type == SYM_VECTOR) {
+                    generate_vector_assignment(codegen, name_node->data.string_value, value, symbols);
+                } else {
+                    generate_expression(codegen, value, symbols);
+                    emit_store_variable(codegen, "x0", name_node->data.string_value, symbols);
+                }
+            }
         }
     } else if (strcmp(op->data.string_value, "print") == 0) {
         // Print statement: (print expr)
         if (stmt->data.list.count >= 2) {
             ASTNode *expr = stmt->data.list.children[1];
             generate_expression(codegen, expr, symbols);
+            invalidate_cached_values(codegen, NULL);
             
             // Call appropriate print helper function
             // The value is already in x0 (first argument register)
-            if (expr->type == AST_STRING) {
+            if (is_string_expression(expr, symbols)) {
+                emit_string_length(codegen, "x1", expr, "x0");
                 emit_code(codegen, "    bl    _print_str\n");
             } else if (expr->type == AST_CHAR) {
                 emit_code(codegen, "    bl    _print_char\n");
@@ -951,24 +5527,38 @@ void generate_statement(CodeGen *codegen, ASTNode *stmt, SymbolTable *symbols) {
             ASTNode *then_branch = stmt->data.list.children[2];
             ASTNode *else_branch = (stmt->data.list.count >= 4) ? stmt->data.list.children[3] : NULL;
             
-            char *else_label = new_label(codegen, "else");
+            if (is_constant_condition(condition)) {
+                // Only the taken branch is reachable
+                ASTNode *taken = constant_condition_value(condition) ? then_branch : else_branch;
+                if (taken) {
+                    generate_shrink_wrapped(codegen, taken, symbols);
+                }
+                return;
+            }
+            
+            char *else_label = else_branch ? new_label(codegen, "else") : NULL;
             char *end_label = new_label(codegen, "end_if");
             
             // Generate condition
-            generate_expression(codegen, condition, symbols);
-            emit_code(codegen, "    cbz   x0, %s\n", else_label);
+            emit_branch_if_false(codegen, condition, symbols, else_branch ? else_label : end_label);
+            ASTNode *cached_at_branch[VALUE_CACHE_REGS];
+            memcpy(cached_at_branch, codegen->cached_values, sizeof(cached_at_branch));
             
             // Generate then branch
-            generate_statement(codegen, then_branch, symbols);
-            emit_code(codegen, "    b     %s\n", end_label);
+            generate_shrink_wrapped(codegen, then_branch, symbols);
+            ASTNode *cached_after_then[VALUE_CACHE_REGS];
+            memcpy(cached_after_then, codegen->cached_values, sizeof(cached_after_then));
+            memcpy(codegen->cached_values, cached_at_branch, sizeof(cached_at_branch));
             
             // Generate else branch
-            emit_code(codegen, "%s:\n", else_label);
             if (else_branch) {
-                generate_statement(codegen, else_branch, symbols);
+                emit_code(codegen, "    b     %s\n", end_label);
+                emit_code(codegen, "%s:\n", else_label);
+                generate_shrink_wrapped(codegen, else_branch, symbols);
             }
             
             emit_code(codegen, "%s:\n", end_label);
+            intersect_cached_values(codegen, cached_after_then);
             
             free(else_label);
             free(end_label);
@@ -978,69 +5568,389 @@ void generate_statement(CodeGen *codegen, ASTNode *stmt, SymbolTable *symbols) {
         if (stmt->data.list.count >= 3) {
             ASTNode *condition = stmt->data.list.children[1];
             ASTNode *body = stmt->data.list.children[2];
+            bool tail = codegen->tail_position;
+            
+            if (is_constant_condition(condition) && !constant_condition_value(condition)) {
+                return; // The body never runs
+            }
             
             char *loop_label = new_label(codegen, "loop");
             char *end_label = new_label(codegen, "end_loop");
             
-            // Loop start
-            emit_code(codegen, "%s:\n", loop_label);
+            // Values reaching the loop head must also survive the back edge
+            bool calls = contains_call(stmt, symbols);
+            if (calls) {
+                invalidate_cached_values(codegen, NULL);
+            } else {
+                invalidate_assigned_values(codegen, body, symbols);
+            }
             
-            // Generate condition
-            generate_expression(codegen, condition, symbols);
-            emit_code(codegen, "    cbz   x0, %s\n", end_label);
+            // Preheader
+            int induction_count = codegen->induction_count;
+            unsigned pinned_regs = codegen->pinned_regs;
+            if (!calls) {
+                emit_loop_preheader(codegen, stmt, symbols);
+            }
+            
+            // Rotated loop: a guard before entry and the test at the bottom,
+            // so each iteration takes a single branch
+            emit_branch_if_false(codegen, condition, symbols, end_label);
+            ASTNode *cached_at_exit[VALUE_CACHE_REGS];
+            memcpy(cached_at_exit, codegen->cached_values, sizeof(cached_at_exit));
+            if (calls) {
+                invalidate_cached_values(codegen, NULL);
+            } else {
+                invalidate_assigned_values(codegen, body, symbols);
+            }
             
-            // Generate body
+            emit_code(codegen, "%s:\n", loop_label);
+            codegen->tail_position = false;
             generate_statement(codegen, body, symbols);
-            emit_code(codegen, "    b     %s\n", loop_label);
+            codegen->tail_position = tail;
+            emit_branch_if_true(codegen, condition, symbols, loop_label);
             
-            // Loop end
+            // Loop end, reached from the guard or the bottom test
             emit_code(codegen, "%s:\n", end_label);
+            intersect_cached_values(codegen, cached_at_exit);
+            codegen->induction_count = induction_count;
+            codegen->pinned_regs = pinned_regs;
             
             free(loop_label);
             free(end_label);
         }
+    } else if (strcmp(op->data.string_value, "for") == 0) {
+        // Counted loop: (for (i start end [step]) body)
+        generate_for(codegen, stmt, symbols);
+    } else if (strcmp(op->data.string_value, "pfor") == 0) {
+        // Parallel loop: (pfor (i start end) [reductions] body)
+        generate_pfor(codegen, stmt, symbols);
+    } else if (strcmp(op->data.string_value, "store") == 0) {
+        // Vector store: (store array index vector)
+        generate_vector_store(codegen, stmt, symbols);
     } else if (strcmp(op->data.string_value, "begin") == 0) {
         // Begin block: (begin stmt1 stmt2 ...)
-        for (size_t i = 1; i < stmt->data.list.count; i++) {
-            generate_statement(codegen, stmt->data.list.children[i], symbols);
+        bool tail = codegen->tail_position;
+        bool live_at_end = !(tail && codegen->return_label);
+        size_t count = reachable_count(stmt);
+        for (size_t i = 1; i < count; ) {
+            codegen->tail_position = tail && i == count - 1;
+            i += generate_sequence_statement(codegen, stmt->data.list.children, count, i, symbols, live_at_end);
+        }
+        codegen->tail_position = tail;
+    } else if (strcmp(op->data.string_value, "region") == 0) {
+        // Region block: (region stmt1 stmt2 ...), its allocations released
+        // together at the end. Returns inside must leave it as well, so
+        // none of its statements is in tail position.
+        bool tail = codegen->tail_position;
+        size_t count = reachable_count(stmt);
+        invalidate_cached_values(codegen, NULL);
+        emit_code(codegen, "    bl    _clumsy_region_begin\n");
+        codegen->tail_position = false;
+        codegen->region_depth++;
+        for (size_t i = 1; i < count; ) {
+            i += generate_sequence_statement(codegen, stmt->data.list.children, count, i, symbols, true);
         }
+        codegen->region_depth--;
+        codegen->tail_position = tail;
+        invalidate_cached_values(codegen, NULL);
+        emit_code(codegen, "    bl    _clumsy_region_end\n");
     } else if (strcmp(op->data.string_value, "ret") == 0) {
         // Return statement: (ret expr)
         if (stmt->data.list.count >= 2) {
             ASTNode *expr = stmt->data.list.children[1];
             generate_expression(codegen, expr, symbols);
-            // Don't emit ret here - let function epilogue handle it
         } else {
             // Return void
             emit_mov_immediate(codegen, "x0", 0);
-            // Don't emit ret here - let function epilogue handle it
+        }
+        
+        // Leave the enclosing regions; region_end hands back x0 untouched
+        for (int i = 0; i < codegen->region_depth; i++) {
+            emit_code(codegen, "    bl    _clumsy_region_end\n");
+        }
+        
+        // A return in tail position falls through to the epilogue; anything
+        // else branches to it, restoring the frame record first if it is live
+        if (codegen->return_label && !codegen->tail_position) {
+            if (codegen->frame_saved) {
+                emit_code(codegen, "    b     %s\n", codegen->framed_return_label);
+                codegen->framed_return_used = true;
+            } else {
+                emit_code(codegen, "    b     %s\n", codegen->return_label);
+            }
         }
     } else {
-        // Check if this is a function call
-        if (stmt->type == AST_LIST && stmt->data.list.count > 0) {
-            ASTNode *function_name = stmt->data.list.children[0];
-            if (function_name->type == AST_IDENTIFIER) {
-                Symbol *func_symbol = find_symbol(symbols, function_name->data.string_value);
-                if (func_symbol && func_symbol->type == SYM_FUNCTION) {
-                    // Generate function call
-                    emit_code(codegen, "    // Function call: %s\n", function_name->data.string_value);
-                    
-                    // Save link register
-                    emit_code(codegen, "    stp   x29, x30, [sp, #-16]!\n");
-                    
-                    // TODO: Handle function arguments properly
-                    // For now, just call the function
-                    emit_code(codegen, "    bl    %s\n", function_name->data.string_value);
-                    
-                    // Restore link register
-                    emit_code(codegen, "    ldp   x29, x30, [sp], #16\n");
-                    return;
+        // Function calls and other expressions
+        generate_expression(codegen, stmt, symbols);
+    }
+    
+    // Values computed from the old contents of a stored variable are stale
+    const char *assigned = assigned_variable(stmt);
+    if (assigned) {
+        invalidate_cached_values(codegen, assigned);
+        if (is_pointer_store(stmt, symbols)) {
+            invalidate_pointer_loads(codegen, symbols);
+        }
+        advance_induction_pointers(codegen, stmt);
+    }
+}
+
+bool is_function_definition(ASTNode *stmt) {
+    // (let name (fn ...)) or (let name type (fn ...))
+    if (stmt->type != AST_LIST || stmt->data.list.count < 3) return false;
+    
+    ASTNode *op = stmt->data.list.children[0];
+    if (op->type != AST_IDENTIFIER || strcmp(op->data.string_value, "let") != 0) return false;
+    
+    ASTNode *init_value = stmt->data.list.children[stmt->data.list.count == 3 ? 2 : 3];
+    return init_value->type == AST_LIST && init_value->data.list.count >= 3 &&
+           init_value->data.list.children[0]->type == AST_IDENTIFIER &&
+           strcmp(init_value->data.list.children[0]->data.string_value, "fn") == 0;
+}
+
+bool contains_call(ASTNode *node, SymbolTable *symbols) {
+    if (!node || (node->type != AST_LIST && node->type != AST_ARRAY)) return false;
+    
+    if (node->type == AST_LIST && node->data.list.count > 0) {
+        ASTNode *op = node->data.list.children[0];
+        if (op->type == AST_IDENTIFIER) {
+            // print, **, string operations, alloc, regions, growing vecs,
+            // maps, bulk array operations and pfor lower to calls into the
+            // runtime helpers, pow and memmove
+            if (strcmp(op->data.string_value, "print") == 0 || strcmp(op->data.string_value, "pfor") == 0 ||
+                is_runtime_pow(node) || is_string_call(node) ||
+                is_heap_call(node) || is_vec_call(node) || is_map_call(node) || is_bulk_builtin(node, symbols)) {
+                return true;
+            }
+            Symbol *symbol = find_symbol_recursive(symbols, op->data.string_value);
+            if (symbol && symbol->type == SYM_FUNCTION) {
+                return true;
+            }
+        }
+    }
+    
+    // Statements after a return are never generated
+    size_t count = node->data.list.count;
+    if (node->type == AST_LIST && count > 0 && node->data.list.children[0]->type == AST_IDENTIFIER &&
+        strcmp(node->data.list.children[0]->data.string_value, "begin") == 0) {
+        count = reachable_count(node);
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (contains_call(node->data.list.children[i], symbols)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int get_locals_size(SymbolTable *table) {
+    int size = layout_frame(table, NULL);
+    if (size % 16 != 0) {
+        size += 16 - (size % 16);
+    }
+    return size;
+}
+
+void emit_frame_record_save(CodeGen *codegen) {
+    emit_code(codegen, "    stp   x29, x30, [sp, #%d]\n", codegen->frame_record_offset);
+    emit_code(codegen, "    add   x29, sp, #%d\n", codegen->frame_record_offset);
+    codegen->frame_saved = true;
+}
+
+void emit_frame_record_restore(CodeGen *codegen) {
+    emit_code(codegen, "    ldp   x29, x30, [sp, #%d]\n", codegen->frame_record_offset);
+    codegen->frame_saved = false;
+}
+
+// Generate a statement, saving the frame record as late as possible: call-free
+// branches of an if and call-free leading statements of a begin run without
+// it, so early exits never pay for the save/restore.
+void generate_shrink_wrapped(CodeGen *codegen, ASTNode *stmt, SymbolTable *symbols) {
+    if (codegen->frame_saved || codegen->frame_record_offset < 0 || !contains_call(stmt, symbols)) {
+        generate_statement(codegen, stmt, symbols);
+        return;
+    }
+    
+    if (stmt->type == AST_LIST && stmt->data.list.children[0]->type == AST_IDENTIFIER) {
+        const char *op = stmt->data.list.children[0]->data.string_value;
+        size_t count = stmt->data.list.count;
+        
+        // The if handler shrink-wraps each branch on its own
+        if (strcmp(op, "if") == 0 && count >= 3 && !contains_call(stmt->data.list.children[1], symbols)) {
+            generate_statement(codegen, stmt, symbols);
+            return;
+        }
+        
+        if (strcmp(op, "begin") == 0) {
+            bool tail = codegen->tail_position;
+            bool live_at_end = !(tail && codegen->return_label);
+            size_t i = 1;
+            count = reachable_count(stmt);
+            for (; i < count && !contains_call(stmt->data.list.children[i], symbols); i++) {
+                codegen->tail_position = tail && i == count - 1;
+                generate_sequence_statement(codegen, stmt->data.list.children, count, i, symbols, live_at_end);
+            }
+            if (i == count - 1) {
+                codegen->tail_position = tail;
+                generate_shrink_wrapped(codegen, stmt->data.list.children[i], symbols);
+            } else if (i < count) {
+                emit_frame_record_save(codegen);
+                while (i < count) {
+                    codegen->tail_position = tail && i == count - 1;
+                    i += generate_sequence_statement(codegen, stmt->data.list.children, count, i, symbols, live_at_end);
                 }
+                emit_frame_record_restore(codegen);
             }
+            codegen->tail_position = tail;
+            return;
         }
+    }
+    
+    emit_frame_record_save(codegen);
+    generate_statement(codegen, stmt, symbols);
+    emit_frame_record_restore(codegen);
+}
+
+// Frames up to 16 MB: offsets split into a 12-bit high part, shifted, and
+// a 12-bit low part
+#define FRAME_LIMIT (1 << 24)
+
+static void check_frame_size(int size) {
+    if (size >= FRAME_LIMIT) {
+        fprintf(stderr, "Error: stack frame of %d bytes exceeds %d\n", size, FRAME_LIMIT);
+        exit(1);
+    }
+}
+
+// sub/add sp, sp, #amount, in two steps when it needs more than 12 bits
+static void emit_stack_adjust(CodeGen *codegen, const char *mnemonic, int amount) {
+    check_frame_size(amount);
+    if (amount >> 12) {
+        emit_code(codegen, "    %-5s sp, sp, #%d, lsl #12\n", mnemonic, amount >> 12);
+    }
+    if (amount & 0xfff) {
+        emit_code(codegen, "    %-5s sp, sp, #%d\n", mnemonic, amount & 0xfff);
+    }
+}
+
+// Whether [base, #offset] encodes for an access of size bytes: ldp/stp take
+// a scaled signed 7-bit immediate, ldr/str a scaled unsigned 12-bit one or
+// an unscaled signed 9-bit one
+static bool offset_encodes(int offset, int size, bool pair) {
+    if (pair) return offset % size == 0 && offset / size <= 63;
+    return (offset % size == 0 && offset / size <= 4095) || offset <= 255;
+}
+
+// Bytes moved per register by a load or store, from its mnemonic and
+// first data register
+static int access_size(const char *mnemonic, const char *reg) {
+    size_t length = strlen(mnemonic);
+    if (strcmp(mnemonic, "ldrsw") == 0) return 4;
+    if (mnemonic[length - 1] == 'b') return 1;
+    if (mnemonic[length - 1] == 'h') return 2;
+    switch (reg[0]) {
+        case 'q': return 16;
+        case 'w': case 's': return 4;
+        case 'h': return 2;
+        case 'b': return 1;
+        default: return 8;
+    }
+}
+
+// Rewrite the sp offsets in text that outgrow their instruction's
+// immediate once frames pass 4 KB. `add xD, sp, #N` splits into a shifted
+// add and a plain one; a memory operand [sp, #N] is rebased on x16 (x17
+// when the instruction already uses x16), set to sp plus the high part.
+static char *legalize_frame_offsets(const char *text) {
+    size_t lines = 1;
+    for (const char *c = text; *c; c++) lines += *c == '\n';
+    size_t capacity = strlen(text) + lines * 64 + 1;
+    char *result = malloc(capacity);
+    if (!result) {
+        fprintf(stderr, "Error: Failed to allocate memory for frame offsets\n");
+        exit(1);
+    }
+    char *out = result;
+    
+    for (const char *line = text; *line; ) {
+        const char *end = strchr(line, '\n');
+        size_t length = end ? (size_t)(end - line) + 1 : strlen(line);
+        char buffer[256], mnemonic[16], reg[16];
+        int offset, consumed = 0;
+        snprintf(buffer, sizeof(buffer), "%.*s", (int)length, line);
+        char *memory = strstr(buffer, "[sp, #");
         
-        // Other expressions
-        generate_expression(codegen, stmt, symbols);
+        if (sscanf(buffer, " add %15[^,], sp, #%d %n", reg, &offset, &consumed) == 2 &&
+            buffer[consumed] == '\0' && offset > 4095) {
+            check_frame_size(offset);
+            out += sprintf(out, "    add   %s, sp, #%d, lsl #12\n", reg, offset >> 12);
+            if (offset & 0xfff) {
+                out += sprintf(out, "    add   %s, %s, #%d\n", reg, reg, offset & 0xfff);
+            }
+        } else if (memory && sscanf(memory, "[sp, #%d]%n", &offset, &consumed) == 1 &&
+                   memory[consumed] != '!' && sscanf(buffer, " %15s %15[^,]", mnemonic, reg) == 2 &&
+                   mnemonic[0] != '/') {
+            bool pair = strcmp(mnemonic, "ldp") == 0 || strcmp(mnemonic, "stp") == 0;
+            int size = access_size(mnemonic, reg);
+            if (offset_encodes(offset, size, pair)) {
+                memcpy(out, line, length);
+                out += length;
+            } else {
+                check_frame_size(offset);
+                const char *scratch = strstr(buffer, "x16") || strstr(buffer, "w16") ? "x17" : "x16";
+                int low = offset & 0xfff;
+                out += sprintf(out, "    add   %s, sp, #%d, lsl #12\n", scratch, offset >> 12);
+                if (low && !offset_encodes(low, size, pair)) {
+                    out += sprintf(out, "    add   %s, %s, #%d\n", scratch, scratch, low);
+                    low = 0;
+                }
+                char operand[32];
+                if (low) {
+                    snprintf(operand, sizeof(operand), "[%s, #%d]", scratch, low);
+                } else {
+                    snprintf(operand, sizeof(operand), "[%s]", scratch);
+                }
+                out += sprintf(out, "%.*s%s%s", (int)(memory - buffer), buffer, operand, memory + consumed);
+            }
+        } else {
+            memcpy(out, line, length);
+            out += length;
+        }
+        line += length;
+    }
+    *out = '\0';
+    return result;
+}
+
+// Store the register parameters into their slots. Scalars and chunked
+// aggregates are written out; aggregates passed by reference are copied in.
+// Parameters the body never reads keep their slot but skip the store.
+static void emit_parameter_stores(CodeGen *codegen, ASTNode *params, ASTNode *body, SymbolTable *func_symbols) {
+    if (params->type != AST_LIST && params->type != AST_ARRAY) return;
+    
+    int reg_index = 0;
+    for (size_t i = 0; i < params->data.list.count && reg_index < ARGUMENT_REGS; i++) {
+        Symbol declared;
+        if (!parse_parameter(params->data.list.children[i], &declared)) continue;
+        Symbol *symbol = find_symbol(func_symbols, declared.name);
+        int offset = get_symbol_offset(func_symbols, declared.name);
+        bool by_reference;
+        int registers = argument_registers(symbol, &by_reference);
+        if (reads_variable(body, declared.name) && offset >= 0) {
+            if (by_reference) {
+                emit_copy_from_pointer(codegen, reg_index, offset, symbol_slot_size(symbol));
+            } else if (is_aggregate(symbol)) {
+                for (int part = 0; part < registers && reg_index + part < ARGUMENT_REGS; part++) {
+                    emit_code(codegen, "    str   x%d, [sp, #%d]\n", reg_index + part, offset + part * 8);
+                }
+            } else {
+                char reg[8], address[32];
+                snprintf(reg, sizeof(reg), "x%d", reg_index);
+                snprintf(address, sizeof(address), "[sp, #%d]", offset);
+                emit_sized_access(codegen, true, symbol->type, reg, address);
+            }
+        }
+        reg_index += registers;
     }
 }
 
@@ -1048,10 +5958,6 @@ void generate_function_definition(CodeGen *codegen, const char *func_name, ASTNo
     // Generate function label
     emit_code(codegen, "%s:\n", func_name);
     
-    // Setup frame
-    emit_code(codegen, "    stp   x29, x30, [sp, #-16]!\n");
-    emit_code(codegen, "    mov   x29, sp\n");
-    
     // Create function-local symbol table
     SymbolTable *func_symbols = malloc(sizeof(SymbolTable));
     func_symbols->symbols = NULL;
@@ -1064,249 +5970,546 @@ void generate_function_definition(CodeGen *codegen, const char *func_name, ASTNo
     if (fn_node->data.list.count >= 2) {
         ASTNode *params = fn_node->data.list.children[1];
         if (params->type == AST_LIST || params->type == AST_ARRAY) {
-            param_count = params->data.list.count;
-            
-            // Allocate stack space for parameters (calculate after processing all params)
-            int stack_space = 0;
-            
-            // First pass: analyze parameters and add to symbol table (don't store yet)
-            int reg_index = 0;
-            for (int i = 0; i < param_count && reg_index < 4; i++) {
-                ASTNode *param = params->data.list.children[i];
-                const char *param_name = NULL;
-                const char *param_type = NULL;
-                
-                if (param->type == AST_IDENTIFIER) {
-                    // Simple parameter: just the name
-                    param_name = param->data.string_value;
-                } else if (param->type == AST_LIST && param->data.list.count >= 2) {
-                    // Parameter with type: (name type)
-                    ASTNode *name_node = param->data.list.children[0];
-                    ASTNode *type_node = param->data.list.children[1];
-                    if (name_node->type == AST_IDENTIFIER) {
-                        param_name = name_node->data.string_value;
-                    }
-                    if (type_node->type == AST_IDENTIFIER) {
-                        param_type = type_node->data.string_value;
-                    } else if (type_node->type == AST_LIST && type_node->data.list.count >= 1) {
-                        // Check if this is an array type: ([] int 4)
-                        ASTNode *first_child = type_node->data.list.children[0];
-                        if (first_child->type == AST_IDENTIFIER && strcmp(first_child->data.string_value, "[]") == 0) {
-                            param_type = "array"; // Mark as array type
-                        }
-                    }
-                }
-                
-                if (param_name) {
-                    // Check parameter type to determine how to handle it
-                    if (param_type && (strcmp(param_type, "Point") == 0 || 
-                                     strcmp(param_type, "struct") == 0 ||
-                                     // Add more struct type names as needed
-                                     (param_type[0] >= 'A' && param_type[0] <= 'Z'))) {
-                        // This is a struct parameter - track register usage
-                        reg_index += 2; // Struct uses 2 registers
-                        
-                        // Add struct symbol to function symbol table
-                        Symbol symbol;
-                        symbol.name = strdup(param_name);
-                        symbol.type = SYM_STRUCT;
-                        add_symbol(func_symbols, symbol);
-                    } else if (param_type && (strstr(param_type, "[") != NULL || strcmp(param_type, "array") == 0)) {
-                        // This is an array parameter - track register usage
-                        reg_index += 4; // Array uses 4 registers
-                        
-                        // Add array symbol to function symbol table
-                        Symbol symbol;
-                        symbol.name = strdup(param_name);
-                        symbol.type = SYM_ARRAY;
-                        add_symbol(func_symbols, symbol);
-                    } else {
-                        // Regular parameter - track register usage
-                        reg_index++;
-                        
-                        // Add to function symbol table
-                        Symbol symbol;
-                        symbol.name = strdup(param_name);
-                        symbol.type = SYM_INT; // Default to int
-                        add_symbol(func_symbols, symbol);
-                    }
-                }
-            }
-            
-            // Calculate and allocate stack space based on parameter types
-            for (size_t i = 0; i < func_symbols->count; i++) {
-                if (func_symbols->symbols[i].type == SYM_ARRAY) {
-                    stack_space += 32; // 4 elements × 8 bytes for arrays (assuming int[4])
-                } else if (func_symbols->symbols[i].type == SYM_STRUCT) {
-                    stack_space += 16; // 2 fields × 8 bytes for structs  
-                } else {
-                    stack_space += 8; // 8 bytes for regular variables
-                }
-            }
-            if (stack_space % 16 != 0) {
-                stack_space += 16 - (stack_space % 16);
-            }
-            if (stack_space > 0) {
-                emit_code(codegen, "    sub   sp, sp, #%d\n", stack_space);
-            }
+            param_count = params->data.list.count;
             
-            // Second pass: store parameters from registers to stack
-            reg_index = 0;
-            for (int i = 0; i < param_count && reg_index < 4; i++) {
-                ASTNode *param = params->data.list.children[i];
-                const char *param_name = NULL;
-                const char *param_type = NULL;
-                
-                // Extract parameter info (same logic as first pass)
-                if (param->type == AST_IDENTIFIER) {
-                    param_name = param->data.string_value;
-                } else if (param->type == AST_LIST && param->data.list.count >= 2) {
-                    ASTNode *name_node = param->data.list.children[0];
-                    ASTNode *type_node = param->data.list.children[1];
-                    if (name_node->type == AST_IDENTIFIER) {
-                        param_name = name_node->data.string_value;
-                    }
-                    if (type_node->type == AST_IDENTIFIER) {
-                        param_type = type_node->data.string_value;
-                    } else if (type_node->type == AST_LIST && type_node->data.list.count >= 1) {
-                        ASTNode *first_child = type_node->data.list.children[0];
-                        if (first_child->type == AST_IDENTIFIER && strcmp(first_child->data.string_value, "[]") == 0) {
-                            param_type = "array";
-                        }
-                    }
-                }
-                
-                if (param_name) {
-                    // Store parameter based on type
-                    if (param_type && (strcmp(param_type, "Point") == 0 || 
-                                     strcmp(param_type, "struct") == 0 ||
-                                     (param_type[0] >= 'A' && param_type[0] <= 'Z'))) {
-                        // Store struct fields
-                        emit_code(codegen, "    str   x%d, [sp, #%d]\n", reg_index, reg_index * 8);
-                        reg_index++;
-                        if (reg_index < 4) {
-                            emit_code(codegen, "    str   x%d, [sp, #%d]\n", reg_index, reg_index * 8);
-                            reg_index++;
-                        }
-                    } else if (param_type && (strstr(param_type, "[") != NULL || strcmp(param_type, "array") == 0)) {
-                        // Store array elements
-                        for (int elem = 0; elem < 4 && reg_index < 4; elem++) {
-                            emit_code(codegen, "    str   x%d, [sp, #%d]\n", reg_index, reg_index * 8);
-                            reg_index++;
-                        }
-                    } else {
-                        // Store regular parameter
-                        emit_code(codegen, "    str   x%d, [sp, #%d]\n", reg_index, reg_index * 8);
-                        reg_index++;
-                    }
-                }
+            // Declare the parameters that arrive in registers; they are
+            // stored once the frame is known (see emit_parameter_stores)
+            int reg_index = 0;
+            for (int i = 0; i < param_count; i++) {
+                Symbol symbol;
+                if (!parse_parameter(params->data.list.children[i], &symbol)) continue;
+                bool by_reference;
+                reg_index += argument_registers(&symbol, &by_reference);
+                if (reg_index > ARGUMENT_REGS) argument_register_error("function", func_name, ARGUMENT_REGS);
+                symbol.name = strdup(symbol.name);
+                add_symbol(func_symbols, symbol);
             }
         }
     }
     
-    // Generate function body with function-local symbols
-    if (fn_node->data.list.count >= 4) {
-        ASTNode *body = fn_node->data.list.children[3];
-        generate_statement(codegen, body, func_symbols);
+    // Frame layout: [sp, #0] parameters and locals, [sp, #locals_size] the
+    // frame record, then spill slots. Leaf functions never touch x29/x30, so
+    // they get no frame record at all. Non-leaf functions reserve the slot up
+    // front but only save into it on paths that reach a call (see
+    // generate_shrink_wrapped).
+    ASTNode *body = (fn_node->data.list.count >= 4) ? fn_node->data.list.children[3] : NULL;
+    declare_region_variables(func_symbols, body);
+    declare_loop_variables(func_symbols, body);
+    mark_address_taken(func_symbols, body);
+    int locals_size = get_locals_size(func_symbols);
+    bool is_leaf = !contains_call(body, func_symbols);
+    // stp only encodes offsets up to 504; bigger frames save in the prologue
+    bool shrink_wrap = !is_leaf && locals_size <= 504;
+    
+    char *return_label = new_label(codegen, "ret");
+    char *framed_return_label = new_label(codegen, "ret_framed");
+    codegen->return_label = return_label;
+    codegen->framed_return_label = framed_return_label;
+    codegen->frame_record_offset = shrink_wrap ? locals_size : -1;
+    codegen->frame_saved = false;
+    codegen->framed_return_used = false;
+    codegen->tail_position = true;
+    codegen->spill_base = locals_size + (shrink_wrap ? 16 : 0);
+    codegen->spill_depth = 0;
+    codegen->spill_max = 0;
+    
+    // Generate function body with function-local symbols. It is emitted into
+    // its own buffer because the spill area is only known afterwards.
+    OutputBuffer saved_output;
+    push_output_buffer(codegen, &saved_output);
+    if (fn_node->data.list.count >= 2) {
+        emit_parameter_stores(codegen, fn_node->data.list.children[1], body, func_symbols);
+    }
+    begin_value_numbering(codegen, &body, body ? 1 : 0);
+    if (body) {
+        generate_shrink_wrapped(codegen, body, func_symbols);
     } else {
         // No body, return 0
         emit_mov_immediate(codegen, "x0", 0);
     }
+    char *generated = pop_output_buffer(codegen, &saved_output);
+    char *body_text = legalize_frame_offsets(generated);
+    free(generated);
+    
+    int frame_size = codegen->spill_base + codegen->spill_max * 8;
+    if (frame_size % 16 != 0) {
+        frame_size += 16 - (frame_size % 16);
+    }
+    
+    if (!is_leaf && !shrink_wrap) {
+        emit_code(codegen, "    stp   x29, x30, [sp, #-16]!\n");
+        emit_code(codegen, "    mov   x29, sp\n");
+    }
+    emit_stack_adjust(codegen, "sub", frame_size);
+    
+    emit_code(codegen, "%s", body_text);
+    free(body_text);
+    
+    // Epilogue
+    emit_code(codegen, "%s:\n", return_label);
+    emit_stack_adjust(codegen, "add", frame_size);
+    if (!is_leaf && !shrink_wrap) {
+        emit_code(codegen, "    ldp   x29, x30, [sp], #16\n");
+    }
+    emit_code(codegen, "    ret\n");
+    
+    // Early returns taken while the frame record is live
+    if (codegen->framed_return_used) {
+        emit_code(codegen, "%s:\n", framed_return_label);
+        emit_code(codegen, "    ldp   x29, x30, [sp, #%d]\n", locals_size);
+        emit_stack_adjust(codegen, "add", frame_size);
+        emit_code(codegen, "    ret\n");
+    }
+    
+    codegen->return_label = NULL;
+    codegen->framed_return_label = NULL;
+    codegen->frame_record_offset = -1;
+    codegen->tail_position = false;
+    free(return_label);
+    free(framed_return_label);
+    
+    // Free function symbol table
+    free_symbol_table(func_symbols);
+    
+    emit_code(codegen, "\n");
+}
+
+// Parallel loops. (pfor (i start end) clauses... body) runs the iterations
+// of body on the runtime's thread pool. The body is outlined into a
+// function Lpfor_N(context, start, end) that runs (for (i start end) body)
+// over one chunk of the range, with the usual loop optimizations, and
+// clumsy_pfor hands chunks to the worker threads. The context holds a word
+// per variable the body uses: the address of an array, whose elements all
+// chunks share, or of any other variable, which each chunk copies on entry,
+// so scalars the body sets stay private to the chunk. A (sum v), (min v) or
+// (max v) clause gives each chunk its own int v starting from the identity,
+// folded into a context word with an atomic add, min or max when the chunk
+// ends and into v after the loop. Iterations must be independent, and
+// neither the body nor a function it calls can print, allocate, or change a
+// vec or map.
+
+static const struct {
+    const char *name;
+    const char *atomic;     // LSE store-only atomic folding a chunk's result
+    unsigned long identity;
+    const char *condition;  // csel condition keeping the old value, or NULL to add
+} pfor_reductions[] = {
+    {"sum", "stadd", 0, NULL},
+    {"min", "stsmin", 0x7fffffffffffffffUL, "lt"},
+    {"max", "stsmax", 0x8000000000000000UL, "gt"},
+};
+
+// Functions a pfor body reaches, each checked once
+typedef struct {
+    Symbol **functions;
+    size_t count;
+} PforReach;
+
+// Reject operations on state every thread shares without a lock: the
+// output buffer, the arena, and the headers of vecs and maps. A function
+// of the same name is fine, but the functions node mentions are checked in
+// turn, since their iterations run in parallel as well. caller names the
+// function node belongs to, or is NULL in the body itself.
+static void check_pfor_code(ASTNode *node, SymbolTable *symbols, const char *caller, PforReach *reach) {
+    static const char *serial[] = {"print", "ret", "alloc", "region", "push", "pop", "reserve", "put", "del"};
+    if (!node) return;
+    
+    if (node->type == AST_IDENTIFIER) {
+        Symbol *function = find_symbol_recursive(symbols, node->data.string_value);
+        if (!function || function->type != SYM_FUNCTION || !function->init_value ||
+            function->init_value->data.list.count < 4) {
+            return;
+        }
+        for (size_t i = 0; i < reach->count; i++) {
+            if (reach->functions[i] == function) return;
+        }
+        reach->functions = realloc(reach->functions, (reach->count + 1) * sizeof(Symbol *));
+        reach->functions[reach->count++] = function;
+        check_pfor_code(function->init_value->data.list.children[3], symbols, function->name, reach);
+        return;
+    }
+    if (node->type != AST_LIST && node->type != AST_ARRAY) return;
     
-    // Cleanup stack space for parameters
-    if (func_symbols->count > 0) {
-        int cleanup_space = 0;
-        for (size_t i = 0; i < func_symbols->count; i++) {
-            if (func_symbols->symbols[i].type == SYM_ARRAY) {
-                cleanup_space += 32; // 4 elements × 8 bytes for arrays (assuming int[4])
-            } else if (func_symbols->symbols[i].type == SYM_STRUCT) {
-                cleanup_space += 16; // 2 fields × 8 bytes for structs  
+    const char *op = operator_name(node);
+    Symbol *function = op ? find_symbol_recursive(symbols, op) : NULL;
+    for (size_t i = 0; op && i < sizeof(serial) / sizeof(serial[0]); i++) {
+        if (strcmp(op, serial[i]) == 0 && !(function && function->type == SYM_FUNCTION) &&
+            !(caller && strcmp(op, "ret") == 0)) {
+            if (caller) {
+                fprintf(stderr, "Error: %s is not allowed in %s, which a pfor body calls\n", op, caller);
             } else {
-                cleanup_space += 8; // 8 bytes for regular variables
+                fprintf(stderr, "Error: %s is not allowed in a pfor body, whose iterations run in parallel\n", op);
             }
+            exit(1);
+        }
+    }
+    for (size_t i = 0; i < node->data.list.count; i++) {
+        check_pfor_code(node->data.list.children[i], symbols, caller, reach);
+    }
+}
+
+static void check_pfor_body(ASTNode *body, SymbolTable *symbols) {
+    PforReach reach = {NULL, 0};
+    check_pfor_code(body, symbols, NULL, &reach);
+    free(reach.functions);
+}
+
+// Index into pfor_reductions of a (sum v), (min v) or (max v) clause
+static int pfor_reduction(ASTNode *clause, SymbolTable *symbols) {
+    const char *op = operator_name(clause);
+    for (int i = 0; op && i < (int)(sizeof(pfor_reductions) / sizeof(pfor_reductions[0])); i++) {
+        if (strcmp(op, pfor_reductions[i].name) != 0 || clause->data.list.count != 2 ||
+            clause->data.list.children[1]->type != AST_IDENTIFIER) {
+            continue;
         }
-        if (cleanup_space % 16 != 0) {
-            cleanup_space += 16 - (cleanup_space % 16);
+        Symbol *symbol = find_symbol(symbols, clause->data.list.children[1]->data.string_value);
+        if (!symbol || symbol->type != SYM_INT) {
+            fprintf(stderr, "Error: pfor %s needs an int variable\n", op);
+            exit(1);
         }
-        if (cleanup_space > 0) {
-            emit_code(codegen, "    add   sp, sp, #%d\n", cleanup_space);
+        return i;
+    }
+    fprintf(stderr, "Error: pfor clauses are (sum v), (min v) or (max v)\n");
+    exit(1);
+}
+
+static const char *pfor_reduction_variable(ASTNode *clause) {
+    return clause->data.list.children[1]->data.string_value;
+}
+
+// Declare in chunk each variable of the enclosing scope node mentions that
+// chunk does not declare yet, and list it in captures. An array becomes a
+// pointer to the enclosing one.
+static void declare_pfor_captures(SymbolTable *chunk, SymbolTable *enclosing, ASTNode *node,
+                                  Symbol **captures, size_t *count) {
+    if (!node) return;
+    if (node->type == AST_LIST || node->type == AST_ARRAY) {
+        for (size_t i = 0; i < node->data.list.count; i++) {
+            declare_pfor_captures(chunk, enclosing, node->data.list.children[i], captures, count);
         }
+        return;
     }
+    if (node->type != AST_IDENTIFIER) return;
     
-    // Restore frame and return
-    emit_code(codegen, "    ldp   x29, x30, [sp], #16\n");
-    emit_code(codegen, "    ret\n");
+    Symbol *symbol = find_symbol(enclosing, node->data.string_value);
+    if (!symbol || symbol->type == SYM_FUNCTION || find_symbol(chunk, symbol->name)) return;
     
-    // Free function symbol table
-    free_symbol_table(func_symbols);
+    Symbol declared = *symbol;
+    declared.name = strdup(symbol->name);
+    declared.init_value = NULL;
+    declared.address_taken = false;
+    declared.eliminated = get_symbol_offset(enclosing, symbol->name) < 0;
+    if (symbol->type == SYM_ARRAY) {
+        declared.type = SYM_POINTER;
+        declared.type_info.pointer.element_type = symbol->type_info.array.element_type;
+        declared.type_info.pointer.struct_type_name = NULL;
+    }
+    add_symbol(chunk, declared);
+    captures[(*count)++] = symbol;
+}
+
+// Put back the per-function state of enclosing after a chunk function was
+// generated; the output, labels and pools belong to the whole program
+static void restore_function_state(CodeGen *codegen, const CodeGen *enclosing) {
+    free(codegen->repeated_exprs);
+    codegen->return_label = enclosing->return_label;
+    codegen->framed_return_label = enclosing->framed_return_label;
+    codegen->frame_record_offset = enclosing->frame_record_offset;
+    codegen->frame_saved = enclosing->frame_saved;
+    codegen->framed_return_used = enclosing->framed_return_used;
+    codegen->tail_position = enclosing->tail_position;
+    codegen->dead_store = enclosing->dead_store;
+    codegen->spill_base = enclosing->spill_base;
+    codegen->spill_depth = enclosing->spill_depth;
+    codegen->spill_max = enclosing->spill_max;
+    codegen->region_depth = enclosing->region_depth;
+    codegen->in_pfor_chunk = enclosing->in_pfor_chunk;
+    memcpy(codegen->cached_values, enclosing->cached_values, sizeof(codegen->cached_values));
+    codegen->repeated_exprs = enclosing->repeated_exprs;
+    codegen->repeated_count = enclosing->repeated_count;
+    memcpy(codegen->induction_pointers, enclosing->induction_pointers, sizeof(codegen->induction_pointers));
+    codegen->induction_count = enclosing->induction_count;
+    codegen->pinned_regs = enclosing->pinned_regs;
+}
+
+// Generate Lpfor_N for a pfor with the given header, reduction clauses and
+// body into the outlined code. It receives the context in x0 and its range
+// in x1, x2. Fills in the variables it captures from symbols, in context
+// order, and returns the label; the caller frees it.
+static char *generate_pfor_chunk(CodeGen *codegen, ASTNode *header, ASTNode **clauses, const int *reductions,
+                                 size_t reduction_count, ASTNode *body, SymbolTable *symbols,
+                                 Symbol **captures, size_t *capture_count) {
+    char *label = malloc(32);
+    snprintf(label, 32, "Lpfor_%d", ++codegen->outlined_count);
     
-    emit_code(codegen, "\n");
+    // Like a function, the chunk only sees its own variables and the
+    // program's functions
+    SymbolTable *globals = symbols;
+    while (globals->parent) globals = globals->parent;
+    SymbolTable *chunk = malloc(sizeof(SymbolTable));
+    chunk->symbols = NULL;
+    chunk->count = 0;
+    chunk->capacity = 0;
+    chunk->parent = globals;
+    
+    // (for (i pfor.start pfor.end) body) over the chunk's range
+    ASTNode *range = synthesize_node(codegen, AST_LIST);
+    add_ast_child(range, header->data.list.children[0]);
+    add_ast_child(range, synthesize_identifier(codegen, "pfor.start"));
+    add_ast_child(range, synthesize_identifier(codegen, "pfor.end"));
+    ASTNode *loop = synthesize_binary(codegen, "for", range, body);
+    
+    const char *arguments[] = {"pfor.context", "pfor.start", "pfor.end"};
+    for (int i = 0; i < 3; i++) {
+        Symbol symbol = {0};
+        symbol.name = strdup(arguments[i]);
+        symbol.type = SYM_INT;
+        add_symbol(chunk, symbol);
+    }
+    declare_loop_variables(chunk, loop);
+    for (size_t i = 0; i < reduction_count; i++) {
+        if (!find_symbol(chunk, pfor_reduction_variable(clauses[i]))) {
+            Symbol symbol = {0};
+            symbol.name = strdup(pfor_reduction_variable(clauses[i]));
+            symbol.type = SYM_INT;
+            add_symbol(chunk, symbol);
+        }
+    }
+    *capture_count = 0;
+    declare_pfor_captures(chunk, symbols, body, captures, capture_count);
+    mark_address_taken(chunk, body);
+    
+    int locals_size = get_locals_size(chunk);
+    bool is_leaf = !contains_call(loop, chunk);
+    CodeGen enclosing = *codegen;
+    codegen->return_label = NULL;
+    codegen->framed_return_label = NULL;
+    codegen->frame_record_offset = -1;
+    codegen->frame_saved = false;
+    codegen->framed_return_used = false;
+    codegen->tail_position = false;
+    codegen->dead_store = false;
+    codegen->spill_base = locals_size;
+    codegen->spill_depth = 0;
+    codegen->spill_max = 0;
+    codegen->region_depth = 0;
+    codegen->in_pfor_chunk = true;
+    codegen->repeated_exprs = NULL;
+    codegen->repeated_count = 0;
+    codegen->induction_count = 0;
+    codegen->pinned_regs = 0;
+    
+    // Arguments into their slots, then the captured variables in from the
+    // context and each reduction variable set to its identity
+    OutputBuffer saved_output;
+    push_output_buffer(codegen, &saved_output);
+    int context = get_symbol_offset(chunk, "pfor.context");
+    if (reduction_count > 0) {
+        emit_code(codegen, "    str   x0, [sp, #%d]\n", context);
+    }
+    emit_code(codegen, "    str   x1, [sp, #%d]\n", get_symbol_offset(chunk, "pfor.start"));
+    emit_code(codegen, "    str   x2, [sp, #%d]\n", get_symbol_offset(chunk, "pfor.end"));
+    for (size_t i = 0; i < *capture_count; i++) {
+        Symbol *captured = find_symbol(chunk, captures[i]->name);
+        int offset = get_symbol_offset(chunk, captured->name);
+        if (offset < 0) continue;
+        emit_code(codegen, "    ldr   x9, [x0, #%d]\n", (int)i * 8);
+        if (captures[i]->type == SYM_ARRAY) {
+            emit_code(codegen, "    str   x9, [sp, #%d]\n", offset);
+        } else {
+            emit_copy_from_pointer(codegen, 9, offset, symbol_slot_size(captured));
+        }
+    }
+    for (size_t i = 0; i < reduction_count; i++) {
+        emit_mov_wide(codegen, "x0", pfor_reductions[reductions[i]].identity);
+        emit_store_variable(codegen, "x0", pfor_reduction_variable(clauses[i]), chunk);
+    }
+    
+    begin_value_numbering(codegen, &loop, 1);
+    generate_statement(codegen, loop, chunk);
+    
+    // Fold this chunk's results into the accumulators after the captures
+    for (size_t i = 0; i < reduction_count; i++) {
+        emit_code(codegen, "    ldr   x17, [sp, #%d]\n", context);
+        emit_load_variable(codegen, "x16", pfor_reduction_variable(clauses[i]), chunk);
+        emit_code(codegen, "    add   x17, x17, #%d\n", (int)(*capture_count + i) * 8);
+        emit_code(codegen, "    %-5s x16, [x17]\n", pfor_reductions[reductions[i]].atomic);
+    }
+    char *generated = pop_output_buffer(codegen, &saved_output);
+    char *body_text = legalize_frame_offsets(generated);
+    free(generated);
+    
+    int frame_size = codegen->spill_base + codegen->spill_max * 8;
+    if (frame_size % 16 != 0) {
+        frame_size += 16 - (frame_size % 16);
+    }
+    
+    swap_output(codegen, &codegen->outlined);
+    emit_code(codegen, "%s:\n", label);
+    if (!is_leaf) {
+        emit_code(codegen, "    stp   x29, x30, [sp, #-16]!\n");
+        emit_code(codegen, "    mov   x29, sp\n");
+    }
+    emit_stack_adjust(codegen, "sub", frame_size);
+    emit_code(codegen, "%s", body_text);
+    emit_stack_adjust(codegen, "add", frame_size);
+    if (!is_leaf) {
+        emit_code(codegen, "    ldp   x29, x30, [sp], #16\n");
+    }
+    emit_code(codegen, "    ret\n\n");
+    swap_output(codegen, &codegen->outlined);
+    free(body_text);
+    
+    restore_function_state(codegen, &enclosing);
+    free_symbol_table(chunk);
+    return label;
+}
+
+void generate_pfor(CodeGen *codegen, ASTNode *stmt, SymbolTable *symbols) {
+    size_t count = stmt->data.list.count;
+    ASTNode *header = count >= 3 ? stmt->data.list.children[1] : NULL;
+    if (!header || header->type != AST_LIST || header->data.list.count != 3 ||
+        header->data.list.children[0]->type != AST_IDENTIFIER) {
+        fprintf(stderr, "Error: pfor expects (pfor (variable start end) [(sum v)|(min v)|(max v)]... body)\n");
+        exit(1);
+    }
+    ASTNode *body = stmt->data.list.children[count - 1];
+    ASTNode **clauses = stmt->data.list.children + 2;
+    size_t reduction_count = count - 3;
+    check_pfor_body(body, symbols);
+    int *reductions = malloc((reduction_count + 1) * sizeof(int));
+    for (size_t i = 0; i < reduction_count; i++) {
+        reductions[i] = pfor_reduction(clauses[i], symbols);
+    }
+    
+    Symbol **captures = malloc((symbols->count + 1) * sizeof(Symbol *));
+    size_t capture_count;
+    char *label = generate_pfor_chunk(codegen, header, clauses, reductions, reduction_count, body, symbols,
+                                      captures, &capture_count);
+    
+    // The context: the address of each captured variable, then an
+    // accumulator per reduction starting from the identity
+    size_t words = capture_count + reduction_count;
+    int context = codegen->spill_base + codegen->spill_depth * 8;
+    for (size_t i = 0; i < words; i++) {
+        push_spill_slot(codegen);
+    }
+    for (size_t i = 0; i < capture_count; i++) {
+        int offset = get_symbol_offset(symbols, captures[i]->name);
+        if (offset < 0) continue;
+        emit_code(codegen, "    add   x0, sp, #%d\n", offset);
+        emit_code(codegen, "    str   x0, [sp, #%d]\n", context + (int)i * 8);
+    }
+    for (size_t i = 0; i < reduction_count; i++) {
+        emit_mov_wide(codegen, "x0", pfor_reductions[reductions[i]].identity);
+        emit_code(codegen, "    str   x0, [sp, #%d]\n", context + (int)(capture_count + i) * 8);
+    }
+    
+    generate_expression(codegen, header->data.list.children[1], symbols);
+    int start_slot = push_spill_slot(codegen);
+    emit_code(codegen, "    str   x0, [sp, #%d]\n", start_slot);
+    generate_expression(codegen, header->data.list.children[2], symbols);
+    emit_code(codegen, "    mov   x3, x0\n");
+    emit_code(codegen, "    ldr   x2, [sp, #%d]\n", start_slot);
+    pop_spill_slot(codegen);
+    emit_code(codegen, "    add   x1, sp, #%d\n", context);
+    emit_code(codegen, "    adrp  x0, %s@PAGE\n", label);
+    emit_code(codegen, "    add   x0, x0, %s@PAGEOFF\n", label);
+    invalidate_cached_values(codegen, NULL);
+    emit_code(codegen, "    bl    _clumsy_pfor\n");
+    
+    // v = v + sum, or the smaller or bigger of v and the accumulator
+    for (size_t i = 0; i < reduction_count; i++) {
+        const char *name = pfor_reduction_variable(clauses[i]);
+        emit_code(codegen, "    ldr   x0, [sp, #%d]\n", context + (int)(capture_count + i) * 8);
+        emit_load_variable(codegen, "x1", name, symbols);
+        if (pfor_reductions[reductions[i]].condition) {
+            emit_code(codegen, "    cmp   x1, x0\n");
+            emit_code(codegen, "    csel  x0, x1, x0, %s\n", pfor_reductions[reductions[i]].condition);
+        } else {
+            emit_code(codegen, "    add   x0, x1, x0\n");
+        }
+        emit_store_variable(codegen, "x0", name, symbols);
+    }
+    for (size_t i = 0; i < words; i++) {
+        pop_spill_slot(codegen);
+    }
+    
+    free(label);
+    free(captures);
+    free(reductions);
+}
+
+// Operators of statements, which never serve as main's exit value
+static bool is_statement_form(const char *op) {
+    static const char *forms[] = {"let", "set", "print", "if", "while", "for", "pfor", "store",
+                                  "begin", "region", "ret"};
+    for (size_t i = 0; i < sizeof(forms) / sizeof(forms[0]); i++) {
+        if (strcmp(op, forms[i]) == 0) return true;
+    }
+    return false;
 }
 
 void generate_main_function(CodeGen *codegen, ASTNode *ast, SymbolTable *symbols) {
     // Generate main function
     emit_code(codegen, "_main:\n");
     
-    // Setup frame pointer
-    emit_code(codegen, "    stp   x29, x30, [sp, #-16]!\n");
-    emit_code(codegen, "    mov   x29, sp\n");
-    
-    // Calculate stack space needed
-    int stack_space = 0;
-    for (size_t i = 0; i < symbols->count; i++) {
-        if (symbols->symbols[i].type == SYM_ARRAY) {
-            stack_space += 32; // 4 elements × 8 bytes for arrays (assuming int[4])
-        } else if (symbols->symbols[i].type == SYM_STRUCT) {
-            stack_space += 16; // 2 fields × 8 bytes for structs  
-        } else {
-            stack_space += 8; // 8 bytes for regular variables
+    // Only set up a frame record if something below calls out
+    bool is_leaf = true;
+    if (ast->type == AST_LIST) {
+        for (size_t i = 0; i < ast->data.list.count && is_leaf; i++) {
+            ASTNode *stmt = ast->data.list.children[i];
+            if (!is_function_definition(stmt) && contains_call(stmt, symbols)) {
+                is_leaf = false;
+            }
         }
     }
-    if (stack_space % 16 != 0) {
-        stack_space += 16 - (stack_space % 16);
+    if (!is_leaf) {
+        emit_code(codegen, "    stp   x29, x30, [sp, #-16]!\n");
+        emit_code(codegen, "    mov   x29, sp\n");
     }
     
-    // Allocate stack space
-    if (stack_space > 0) {
-        emit_code(codegen, "    sub   sp, sp, #%d\n", stack_space);
+    // Locals first, spill slots above them; the body is generated into its
+    // own buffer so the spill area can be sized before the prologue
+    eliminate_unused_variables(symbols, ast);
+    int locals_size = get_locals_size(symbols);
+    codegen->spill_base = locals_size;
+    codegen->spill_depth = 0;
+    codegen->spill_max = 0;
+    
+    OutputBuffer saved_output;
+    push_output_buffer(codegen, &saved_output);
+    if (ast->type == AST_LIST) {
+        begin_value_numbering(codegen, ast->data.list.children, ast->data.list.count);
     }
     
-    // Generate code for each statement (skip function definitions)
-    // Also find the final expression to use as exit code
+    // The exit code is the last statement, when that is an expression.
+    // Expression statements before it run in place like any other.
     ASTNode *final_expr = NULL;
     if (ast->type == AST_LIST) {
-        for (size_t i = 0; i < ast->data.list.count; i++) {
+        for (size_t i = ast->data.list.count; i-- > 0; ) {
             ASTNode *stmt = ast->data.list.children[i];
-            
-            // Skip function definitions - they were already generated above
-            bool is_function_def = false;
-            if (stmt->type == AST_LIST && stmt->data.list.count >= 3) {
-                ASTNode *op = stmt->data.list.children[0];
-                if (op->type == AST_IDENTIFIER && strcmp(op->data.string_value, "let") == 0) {
-                    ASTNode *init_value = (stmt->data.list.count >= 4) ? stmt->data.list.children[3] : NULL;
-                    if (init_value && init_value->type == AST_LIST && 
-                        init_value->data.list.count >= 3) {
-                        ASTNode *fn_node = init_value->data.list.children[0];
-                        if (fn_node->type == AST_IDENTIFIER && strcmp(fn_node->data.string_value, "fn") == 0) {
-                            is_function_def = true;
-                        }
-                    }
-                }
+            if (is_function_definition(stmt)) continue;
+            if (stmt->type == AST_IDENTIFIER || stmt->type == AST_INT || 
+                (stmt->type == AST_LIST && stmt->data.list.count > 0 && 
+                 stmt->data.list.children[0]->type == AST_IDENTIFIER &&
+                 !is_statement_form(stmt->data.list.children[0]->data.string_value))) {
+                final_expr = stmt;
             }
+            break;
+        }
+    }
+    
+    // Generate code for each statement (skip function definitions)
+    if (ast->type == AST_LIST) {
+        for (size_t i = 0; i < ast->data.list.count; ) {
+            ASTNode *stmt = ast->data.list.children[i];
             
-            if (!is_function_def) {
-                generate_statement(codegen, stmt, symbols);
-                // If this is not a statement (no operator), it's an expression for exit code
-                if (stmt->type == AST_IDENTIFIER || stmt->type == AST_INT || 
-                    (stmt->type == AST_LIST && stmt->data.list.count > 0 && 
-                     stmt->data.list.children[0]->type == AST_IDENTIFIER &&
-                     (strcmp(stmt->data.list.children[0]->data.string_value, "let") != 0 &&
-                      strcmp(stmt->data.list.children[0]->data.string_value, "set") != 0 &&
-                      strcmp(stmt->data.list.children[0]->data.string_value, "print") != 0 &&
-                      strcmp(stmt->data.list.children[0]->data.string_value, "if") != 0 &&
-                      strcmp(stmt->data.list.children[0]->data.string_value, "while") != 0))) {
-                    final_expr = stmt;
-                }
+            // Skip function definitions - they were already generated above
+            if (!is_function_definition(stmt) && stmt != final_expr) {
+                i += generate_sequence_statement(codegen, ast->data.list.children, ast->data.list.count, i, symbols, false);
+            } else {
+                i++;
             }
         }
     }
@@ -1318,16 +6521,169 @@ void generate_main_function(CodeGen *codegen, ASTNode *ast, SymbolTable *symbols
         emit_mov_immediate(codegen, "x0", 0);
     }
     
-    // Deallocate stack space
-    if (stack_space > 0) {
-        emit_code(codegen, "    add   sp, sp, #%d\n", stack_space);
+    char *generated = pop_output_buffer(codegen, &saved_output);
+    char *body_text = legalize_frame_offsets(generated);
+    free(generated);
+    
+    // Calculate stack space needed
+    int stack_space = locals_size + codegen->spill_max * 8;
+    if (stack_space % 16 != 0) {
+        stack_space += 16 - (stack_space % 16);
     }
     
+    // Allocate stack space
+    emit_stack_adjust(codegen, "sub", stack_space);
+    emit_code(codegen, "%s", body_text);
+    free(body_text);
+    
+    // Deallocate stack space
+    emit_stack_adjust(codegen, "add", stack_space);
+    
     // Restore frame pointer and return address, then exit
-    emit_code(codegen, "    ldp   x29, x30, [sp], #16\n");
+    if (!is_leaf) {
+        emit_code(codegen, "    ldp   x29, x30, [sp], #16\n");
+    }
     emit_code(codegen, "    ret\n");
 }
 
+// Whole-program pruning. Functions are generated only when the top-level
+// statements reach them through calls, and struct types are registered only
+// when reachable code names them. Reachable functions whose generated code
+// matches up to local label numbers share one body under several labels.
+
+typedef struct {
+    ASTNode **definitions;  // top-level (let name (fn ...)) statements
+    bool *reached;
+    size_t count;
+} FunctionSet;
+
+static const char *definition_name(ASTNode *definition) {
+    return definition->data.list.children[1]->data.string_value;
+}
+
+static ASTNode *definition_function(ASTNode *definition) {
+    return definition->data.list.children[definition->data.list.count == 3 ? 2 : 3];
+}
+
+static void mark_reached_functions(FunctionSet *functions, ASTNode *node) {
+    if (!node) return;
+    
+    if (node->type == AST_IDENTIFIER) {
+        for (size_t i = 0; i < functions->count; i++) {
+            if (!functions->reached[i] && strcmp(definition_name(functions->definitions[i]), node->data.string_value) == 0) {
+                functions->reached[i] = true;
+                mark_reached_functions(functions, definition_function(functions->definitions[i]));
+            }
+        }
+    } else if (node->type == AST_LIST || node->type == AST_ARRAY) {
+        for (size_t i = 0; i < node->data.list.count; i++) {
+            mark_reached_functions(functions, node->data.list.children[i]);
+        }
+    }
+}
+
+static int count_mentions(ASTNode *node, const char *name) {
+    if (!node) return 0;
+    if (node->type == AST_IDENTIFIER) return strcmp(node->data.string_value, name) == 0;
+    if (node->type != AST_LIST && node->type != AST_ARRAY) return 0;
+    
+    int count = 0;
+    for (size_t i = 0; i < node->data.list.count; i++) {
+        count += count_mentions(node->data.list.children[i], name);
+    }
+    return count;
+}
+
+static bool is_struct_definition(ASTNode *stmt) {
+    return stmt->type == AST_LIST && stmt->data.list.count >= 4 &&
+           stmt->data.list.children[0]->type == AST_IDENTIFIER &&
+           strcmp(stmt->data.list.children[0]->data.string_value, "let") == 0 &&
+           stmt->data.list.children[1]->type == AST_IDENTIFIER &&
+           stmt->data.list.children[2]->type == AST_IDENTIFIER &&
+           strcmp(stmt->data.list.children[2]->data.string_value, "struct") == 0;
+}
+
+// Mentions of name across _main and the reached functions
+static int count_reachable_mentions(ASTNode *ast, FunctionSet *functions, const char *name) {
+    int count = 0;
+    for (size_t i = 0; i < ast->data.list.count; i++) {
+        ASTNode *stmt = ast->data.list.children[i];
+        if (!is_function_definition(stmt)) count += count_mentions(stmt, name);
+    }
+    for (size_t i = 0; i < functions->count; i++) {
+        if (functions->reached[i]) count += count_mentions(definition_function(functions->definitions[i]), name);
+    }
+    return count;
+}
+
+// Register struct definitions found anywhere below node whose name is
+// mentioned somewhere besides the definition itself
+static void define_reachable_struct_types(ASTNode *node, ASTNode *ast, FunctionSet *functions) {
+    if (!node || node->type != AST_LIST) return;
+    
+    if (is_struct_definition(node)) {
+        const char *name = node->data.list.children[1]->data.string_value;
+        if (count_reachable_mentions(ast, functions, name) > count_mentions(node, name) &&
+            !find_struct_type(global_struct_types, name)) {
+            define_struct_type(name, node->data.list.children[3]);
+        }
+        return;
+    }
+    for (size_t i = 0; i < node->data.list.count; i++) {
+        define_reachable_struct_types(node->data.list.children[i], ast, functions);
+    }
+}
+
+// Function text without its entry label, with local labels renumbered in
+// order of appearance so identical bodies compare equal
+static char *normalize_function_text(const char *text) {
+    const char *body = strchr(text, '\n');
+    body = body ? body + 1 : text;
+    
+    char **labels = NULL;
+    size_t label_count = 0;
+    size_t capacity = strlen(body) + 1;
+    char *result = malloc(capacity);
+    size_t length = 0;
+    
+    for (const char *p = body; *p; ) {
+        if (*p == '.' && (p == body || isspace((unsigned char)p[-1]))) {
+            size_t token_length = 1 + strspn(p + 1, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_");
+            size_t id = 0;
+            while (id < label_count && !(strlen(labels[id]) == token_length && strncmp(labels[id], p, token_length) == 0)) id++;
+            if (id == label_count) {
+                labels = realloc(labels, (label_count + 1) * sizeof(char *));
+                labels[label_count] = malloc(token_length + 1);
+                memcpy(labels[label_count], p, token_length);
+                labels[label_count++][token_length] = '\0';
+            }
+            
+            char replacement[32];
+            int replacement_length = snprintf(replacement, sizeof(replacement), ".L%zu", id);
+            if (length + replacement_length + 1 > capacity) {
+                capacity = capacity * 2 + replacement_length;
+                result = realloc(result, capacity);
+            }
+            memcpy(result + length, replacement, replacement_length);
+            length += replacement_length;
+            p += token_length;
+            continue;
+        }
+        if (length + 2 > capacity) {
+            capacity *= 2;
+            result = realloc(result, capacity);
+        }
+        result[length++] = *p++;
+    }
+    result[length] = '\0';
+    
+    for (size_t i = 0; i < label_count; i++) {
+        free(labels[i]);
+    }
+    free(labels);
+    return result;
+}
+
 char *compile_to_arm64(ASTNode *ast, SymbolTable *symbols, StructTypeTable *struct_types) {
     CodeGen *codegen = create_codegen();
     
@@ -1336,50 +6692,99 @@ char *compile_to_arm64(ASTNode *ast, SymbolTable *symbols, StructTypeTable *stru
         global_struct_types = create_struct_type_table();
     }
     
+    // Find the functions reachable from the top-level statements
+    FunctionSet functions = {NULL, NULL, 0};
+    if (ast->type == AST_LIST) {
+        functions.definitions = malloc((ast->data.list.count + 1) * sizeof(ASTNode *));
+        for (size_t i = 0; i < ast->data.list.count; i++) {
+            ASTNode *stmt = ast->data.list.children[i];
+            if (is_function_definition(stmt) && stmt->data.list.children[1]->type == AST_IDENTIFIER) {
+                functions.definitions[functions.count++] = stmt;
+            }
+        }
+        functions.reached = calloc(functions.count + 1, sizeof(bool));
+        for (size_t i = 0; i < ast->data.list.count; i++) {
+            ASTNode *stmt = ast->data.list.children[i];
+            if (!is_function_definition(stmt)) {
+                mark_reached_functions(&functions, stmt);
+            }
+        }
+        
+        for (size_t i = 0; i < ast->data.list.count; i++) {
+            ASTNode *stmt = ast->data.list.children[i];
+            if (!is_function_definition(stmt)) {
+                define_reachable_struct_types(stmt, ast, &functions);
+            }
+        }
+        for (size_t i = 0; i < functions.count; i++) {
+            if (functions.reached[i]) {
+                define_reachable_struct_types(definition_function(functions.definitions[i]), ast, &functions);
+            }
+        }
+    }
+    
     generate_preamble(codegen);
     
-    // Only generate pow function if exponentiation is used
-    if (uses_exponentiation(ast)) {
+    // Only generate pow function if reachable code exponentiates at runtime
+    bool needs_pow = false;
+    if (ast->type == AST_LIST) {
+        for (size_t i = 0; i < ast->data.list.count && !needs_pow; i++) {
+            needs_pow = !is_function_definition(ast->data.list.children[i]) &&
+                        uses_exponentiation(ast->data.list.children[i]);
+        }
+    }
+    for (size_t i = 0; i < functions.count && !needs_pow; i++) {
+        needs_pow = functions.reached[i] && uses_exponentiation(definition_function(functions.definitions[i]));
+    }
+    if (needs_pow) {
         generate_pow_function(codegen);
     }
     
-    // Generate all function definitions first
-    if (ast->type == AST_LIST) {
-        for (size_t i = 0; i < ast->data.list.count; i++) {
-            ASTNode *stmt = ast->data.list.children[i];
-            
-            if (stmt->type == AST_LIST && stmt->data.list.count >= 3) {
-                ASTNode *op = stmt->data.list.children[0];
-                
-                if (op->type == AST_IDENTIFIER && strcmp(op->data.string_value, "let") == 0) {
-                    ASTNode *name_node = stmt->data.list.children[1];
-                    
-                    // Check different let statement formats:
-                    // 3 elements: (let name (fn ...))  
-                    // 4 elements: (let name type value) or (let name type (fn ...))
-                    ASTNode *init_value = NULL;
-                    if (stmt->data.list.count == 3) {
-                        init_value = stmt->data.list.children[2];
-                    } else if (stmt->data.list.count >= 4) {
-                        init_value = stmt->data.list.children[3];
-                    }
-                    
-                    // Check if this is a function definition
-                    if (init_value && init_value->type == AST_LIST && 
-                        init_value->data.list.count >= 3) {
-                        ASTNode *fn_node = init_value->data.list.children[0];
-                        if (fn_node->type == AST_IDENTIFIER && strcmp(fn_node->data.string_value, "fn") == 0) {
-                            generate_function_definition(codegen, name_node->data.string_value, init_value, symbols);
-                        }
-                    }
-                }
+    // Generate the reachable functions into their own buffers, then emit each
+    // distinct body once with the labels of all functions that match it
+    char **texts = calloc(functions.count + 1, sizeof(char *));
+    char **normalized = calloc(functions.count + 1, sizeof(char *));
+    for (size_t i = 0; i < functions.count; i++) {
+        if (!functions.reached[i] || is_extern_declaration(definition_function(functions.definitions[i]))) continue;
+        
+        OutputBuffer saved_output;
+        push_output_buffer(codegen, &saved_output);
+        generate_function_definition(codegen, definition_name(functions.definitions[i]),
+                                     definition_function(functions.definitions[i]), symbols);
+        texts[i] = pop_output_buffer(codegen, &saved_output);
+        normalized[i] = normalize_function_text(texts[i]);
+    }
+    for (size_t i = 0; i < functions.count; i++) {
+        if (!texts[i]) continue;
+        
+        bool folded = false;
+        for (size_t j = 0; j < i && !folded; j++) {
+            folded = texts[j] && strcmp(normalized[i], normalized[j]) == 0;
+        }
+        if (folded) continue;
+        
+        for (size_t j = i + 1; j < functions.count; j++) {
+            if (texts[j] && strcmp(normalized[i], normalized[j]) == 0) {
+                emit_code(codegen, "%s:\n", definition_name(functions.definitions[j]));
             }
         }
+        emit_code(codegen, "%s", texts[i]);
     }
+    for (size_t i = 0; i < functions.count; i++) {
+        free(texts[i]);
+        free(normalized[i]);
+    }
+    free(texts);
+    free(normalized);
+    free(functions.definitions);
+    free(functions.reached);
     
     generate_main_function(codegen, ast, symbols);
-    
-    // No longer need format strings since we use print helper functions
+    // pfor bodies fold their reductions with LSE atomics
+    if (codegen->outlined_count > 0) {
+        emit_code(codegen, "\n.arch_extension lse\n\n%s", codegen->outlined.output);
+    }
+    emit_code(codegen, "%s", codegen->constants.output);
     
     char *result = strdup(codegen->output);
     free_codegen(codegen);
@@ -1420,12 +6825,69 @@ void add_struct_type(StructTypeTable *table, const char *name, StructField *fiel
     for (size_t i = 0; i < field_count; i++) {
         type->fields[i].name = strdup(fields[i].name);
         type->fields[i].type = fields[i].type;
+        type->fields[i].struct_type_name = fields[i].struct_type_name ? strdup(fields[i].struct_type_name) : NULL;
         type->fields[i].default_value = fields[i].default_value; // Shallow copy for now
     }
     
     table->count++;
 }
 
+// Parse (let TypeName struct #((field1 type1 val1) ...)) into the global
+// struct type table
+void define_struct_type(const char *name, ASTNode *init) {
+    if (init->type == AST_LIST && init->data.list.count >= 2 &&
+        init->data.list.children[0]->type == AST_IDENTIFIER &&
+        strcmp(init->data.list.children[0]->data.string_value, "#") == 0) {
+        
+        // Parse struct fields from #((field1 type1 val1) (field2 type2 val2) ...)
+        ASTNode *fields_list = init->data.list.children[1];
+        if (fields_list->type == AST_LIST) {
+            // Create struct fields array
+            size_t field_count = fields_list->data.list.count;
+            StructField *fields = malloc(field_count * sizeof(StructField));
+            
+            for (size_t i = 0; i < field_count; i++) {
+                ASTNode *field = fields_list->data.list.children[i];
+                if (field->type != AST_LIST || field->data.list.count < 3 ||
+                    field->data.list.children[0]->type != AST_IDENTIFIER ||
+                    field->data.list.children[1]->type != AST_IDENTIFIER) {
+                    fprintf(stderr, "Error: field %zu of struct %s needs a name, a type and a default\n", i + 1, name);
+                    exit(1);
+                }
+                ASTNode *field_name = field->data.list.children[0];
+                ASTNode *field_type = field->data.list.children[1];
+                ASTNode *field_default = field->data.list.children[2];
+                
+                fields[i].name = strdup(field_name->data.string_value);
+                fields[i].struct_type_name = NULL;
+                
+                // Map type string to SymbolType
+                if (!parse_scalar_type(field_type->data.string_value, &fields[i].type)) {
+                    // A nested struct, laid out once every type is known
+                    fields[i].type = SYM_STRUCT;
+                    fields[i].struct_type_name = field_type->data.string_value;
+                }
+                
+                fields[i].default_value = field_default; // Store reference to default value
+            }
+            
+            // Initialize global struct types table if not already done
+            if (!global_struct_types) {
+                global_struct_types = create_struct_type_table();
+            }
+            
+            // Add struct type to table
+            add_struct_type(global_struct_types, name, fields, field_count);
+            
+            // Clean up temporary fields array (add_struct_type makes its own copy)
+            for (size_t i = 0; i < field_count; i++) {
+                free(fields[i].name);
+            }
+            free(fields);
+        }
+    }
+}
+
 StructType *find_struct_type(StructTypeTable *table, const char *name) {
     if (!table) return NULL;
     
@@ -1444,6 +6906,7 @@ void free_struct_type_table(StructTypeTable *table) {
         free(table->types[i].name);
         for (size_t j = 0; j < table->types[i].count; j++) {
             free(table->types[i].fields[j].name);
+            free(table->types[i].fields[j].struct_type_name);
         }
         free(table->types[i].fields);
     }
@@ -3,12 +3,75 @@
 
 #include "types.h"
 
+// Registers x3-x8 that hold value-numbered expressions
+#define VALUE_CACHE_REGS 6
+
+// Pointer to array[variable] kept in step with a loop's induction variable
+typedef struct {
+    const char *variable;   // induction variable
+    int array_offset;       // sp offset of the array
+    int element_size;       // bytes the pointer advances per step
+    int reg;                // value cache register holding the pointer
+} InductionPointer;
+
+// Saved emission target while a body is generated ahead of its prologue
+typedef struct {
+    char *output;
+    size_t output_size;
+    size_t output_capacity;
+} OutputBuffer;
+
+// String literal interned in the constant pool, escapes decoded
+typedef struct {
+    char *text;
+    size_t length;
+} PooledString;
+
 // Code generation context
 typedef struct {
     char *output;
     size_t output_size;
     size_t output_capacity;
     int label_counter;
+
+    // Per-function frame state
+    const char *return_label;        // epilogue for frameless returns (NULL in _main)
+    const char *framed_return_label; // epilogue that first restores the frame record
+    int frame_record_offset;         // sp offset of the reserved x29/x30 slot
+    bool frame_saved;                // frame record is live at the current point
+    bool framed_return_used;
+    bool tail_position;              // current statement is the last one executed before return
+    bool dead_store;                 // current let/set stores a value nothing reads
+    int spill_base;                  // sp offset of the first spill slot
+    int spill_depth;                 // spill slots in use
+    int spill_max;                   // high-water mark, sizes the frame
+    int region_depth;                // regions entered and not yet left
+    int simd_depth;                  // v16 + i registers held by enclosing vector expressions
+    bool in_pfor_chunk;              // code runs on pool threads; clumsy_pfor flushed output first
+
+    // Value numbering state for the current function
+    ASTNode *cached_values[VALUE_CACHE_REGS]; // expression held in x3 + i, NULL when free
+    ASTNode **repeated_exprs;        // expressions occurring more than once
+    size_t repeated_count;
+
+    // Loop optimization state
+    InductionPointer induction_pointers[VALUE_CACHE_REGS]; // innermost last
+    int induction_count;
+    unsigned pinned_regs;            // x3 + i bits held by induction pointers
+    ASTNode **synthesized;           // nodes built by lowering, owned here
+    size_t synthesized_count;
+    size_t synthesized_capacity;
+
+    // Read-only data emitted after the code
+    OutputBuffer constants;          // constant aggregate initializers and strings
+    int constant_count;
+    PooledString *strings;           // Lstr_<index>, each emitted once
+    size_t string_count;
+    size_t string_capacity;
+    
+    // pfor bodies, emitted as functions after the program's code
+    OutputBuffer outlined;
+    int outlined_count;
 } CodeGen;
 
 // Compiler functions
@@ -21,25 +84,154 @@ CodeGen *create_codegen(void);
 void free_codegen(CodeGen *codegen);
 void emit_code(CodeGen *codegen, const char *format, ...);
 char *new_label(CodeGen *codegen, const char *prefix);
+void push_output_buffer(CodeGen *codegen, OutputBuffer *saved);
+char *pop_output_buffer(CodeGen *codegen, OutputBuffer *saved);
+int push_spill_slot(CodeGen *codegen);
+void pop_spill_slot(CodeGen *codegen);
+
+// Struct types
+void define_struct_type(const char *name, ASTNode *init);
 
 // Symbol table helpers
 Symbol *find_symbol(SymbolTable *table, const char *name);
 void add_symbol(SymbolTable *table, Symbol symbol);
 int get_symbol_offset(SymbolTable *table, const char *name);
+bool resolve_field(SymbolTable *symbols, ASTNode *expr, int *offset, SymbolType *type, StructType **nested);
+
+// Sized scalars and memory layout
+bool parse_scalar_type(const char *name, SymbolType *type);
+int type_size(SymbolType type);
+int layout_struct(StructType *type, int *offsets, int *alignment);
+int array_length(Symbol *symbol);
 
 // AST traversal and code generation
 void generate_preamble(CodeGen *codegen);
 void generate_main_function(CodeGen *codegen, ASTNode *ast, SymbolTable *symbols);
 void generate_function_definitions(CodeGen *codegen, ASTNode *ast, SymbolTable *symbols);
 void generate_expression(CodeGen *codegen, ASTNode *expr, SymbolTable *symbols);
-void generate_expression_with_adjustment(CodeGen *codegen, ASTNode *expr, SymbolTable *symbols, int stack_adjustment);
 void generate_statement(CodeGen *codegen, ASTNode *stmt, SymbolTable *symbols);
 
+// C functions
+#define C_ARGUMENT_REGS 8
+bool is_extern_declaration(ASTNode *fn_node);
+
+// Frame layout and shrink-wrapping
+bool is_function_definition(ASTNode *stmt);
+bool contains_call(ASTNode *node, SymbolTable *symbols);
+int get_locals_size(SymbolTable *table);
+void emit_frame_record_save(CodeGen *codegen);
+void emit_frame_record_restore(CodeGen *codegen);
+void generate_shrink_wrapped(CodeGen *codegen, ASTNode *stmt, SymbolTable *symbols);
+
 // ARM64 instruction helpers
 void emit_mov_immediate(CodeGen *codegen, const char *reg, int value);
 void emit_load_variable(CodeGen *codegen, const char *reg, const char *var_name, SymbolTable *symbols);
 void emit_load_variable_with_adjustment(CodeGen *codegen, const char *reg, const char *var_name, SymbolTable *symbols, int stack_adjustment);
 void emit_store_variable(CodeGen *codegen, const char *reg, const char *var_name, SymbolTable *symbols);
 void emit_arithmetic(CodeGen *codegen, const char *op, const char *dest, const char *src1, const char *src2);
+void emit_load_operand(CodeGen *codegen, const char *reg, ASTNode *operand, SymbolTable *symbols);
+void emit_array_element_operand(CodeGen *codegen, char *operand, size_t size, int array_offset, SymbolType element_type, ASTNode *index, SymbolTable *symbols);
+void emit_sized_access(CodeGen *codegen, bool store, SymbolType type, const char *reg, const char *address);
+void format_indexed_address(char *operand, size_t size, const char *base, const char *index, SymbolType type);
+void emit_mov_wide(CodeGen *codegen, const char *reg, unsigned long value);
+
+// Value numbering
+typedef void (*ExpressionVisitor)(void *context, ASTNode *expr);
+bool expressions_equal(ASTNode *a, ASTNode *b);
+void visit_statement_expressions(ASTNode *stmt, ExpressionVisitor visit, void *context);
+void begin_value_numbering(CodeGen *codegen, ASTNode **stmts, size_t count);
+void invalidate_cached_values(CodeGen *codegen, const char *name);
+void invalidate_assigned_values(CodeGen *codegen, ASTNode *stmt, SymbolTable *symbols);
+void intersect_cached_values(CodeGen *codegen, ASTNode **other);
+
+// SIMD vector types
+bool parse_vector_type(const char *name, VectorType *type);
+bool vector_type_of(ASTNode *expr, SymbolTable *symbols, VectorType *type);
+void generate_vector_assignment(CodeGen *codegen, const char *name, ASTNode *value, SymbolTable *symbols);
+void emit_lane_load(CodeGen *codegen, const char *dest, const char *name, ASTNode *lane, SymbolTable *symbols, int depth);
+void generate_lane_store(CodeGen *codegen, const char *name, ASTNode *lane, ASTNode *value, SymbolTable *symbols);
+void generate_vector_store(CodeGen *codegen, ASTNode *stmt, SymbolTable *symbols);
+bool is_vector_reduction(ASTNode *expr);
+void generate_vector_reduction(CodeGen *codegen, ASTNode *expr, SymbolTable *symbols);
+
+// Length-prefixed strings
+bool is_string_builtin(ASTNode *expr);
+bool is_string_call(ASTNode *expr);
+bool is_string_expression(ASTNode *expr, SymbolTable *symbols);
+void generate_string_literal(CodeGen *codegen, const char *reg, ASTNode *literal);
+void generate_string_builtin(CodeGen *codegen, ASTNode *expr, SymbolTable *symbols);
+void emit_string_length(CodeGen *codegen, const char *dest, ASTNode *expr, const char *pointer);
+
+// Heap allocation in regions
+bool alloc_element_type(ASTNode *expr, SymbolType *element_type);
+bool is_heap_call(ASTNode *expr);
+void generate_alloc(CodeGen *codegen, ASTNode *expr, SymbolTable *symbols);
+void emit_pointer_element_operand(CodeGen *codegen, char *operand, size_t size, const char *name, ASTNode *index, SymbolTable *symbols, int depth, const char *base);
+
+// Pointers
+bool parse_pointer_type(const char *name, Symbol *symbol);
+bool pointer_target(ASTNode *expr, SymbolTable *symbols, SymbolType *type, StructType **record);
+void emit_pointer_arithmetic(CodeGen *codegen, ASTNode *expr, SymbolTable *symbols, int depth, const char *dest);
+void emit_address(CodeGen *codegen, const char *dest, ASTNode *target, SymbolTable *symbols, int depth);
+void emit_dereference(CodeGen *codegen, const char *dest, ASTNode *pointer, SymbolTable *symbols, int depth);
+void generate_pointer_store(CodeGen *codegen, ASTNode *target, ASTNode *value, SymbolTable *symbols);
+void mark_address_taken(SymbolTable *table, ASTNode *node);
+
+// Growable vecs: the slot holds the elements pointer, length and capacity
+#define VEC_HEADER_SIZE 24
+#define VEC_LENGTH 8
+#define VEC_CAPACITY 16
+bool parse_vec_type(const char *name, Symbol *symbol);
+bool is_vec_operation(ASTNode *expr);
+bool is_vec_call(ASTNode *expr);
+bool is_vec_builtin(ASTNode *expr, SymbolTable *symbols);
+void generate_vec_builtin(CodeGen *codegen, ASTNode *expr, SymbolTable *symbols);
+void generate_vec_let(CodeGen *codegen, Symbol *vec, ASTNode *init, SymbolTable *symbols);
+
+// Hash maps: the slot holds the runtime's table header
+#define MAP_HEADER_SIZE 48
+#define MAP_KEYS 8
+#define MAP_COUNT 24
+bool parse_map_type(const char *name, Symbol *symbol);
+bool is_map_call(ASTNode *expr);
+bool is_map_builtin(ASTNode *expr, SymbolTable *symbols);
+void generate_map_builtin(CodeGen *codegen, ASTNode *expr, SymbolTable *symbols);
+void generate_map_let(CodeGen *codegen, Symbol *map, ASTNode *init, SymbolTable *symbols);
+void generate_map_loop(CodeGen *codegen, ASTNode *stmt, SymbolTable *symbols);
+
+// Bulk array operations
+bool is_bulk_builtin(ASTNode *expr, SymbolTable *symbols);
+void generate_bulk_builtin(CodeGen *codegen, ASTNode *expr, SymbolTable *symbols);
+
+// Parallel loops
+void generate_pfor(CodeGen *codegen, ASTNode *stmt, SymbolTable *symbols);
+
+// Dead code elimination
+bool is_side_effect_free(ASTNode *expr);
+size_t reachable_count(ASTNode *block);
+void eliminate_unused_variables(SymbolTable *symbols, ASTNode *ast);
+
+// Loop optimization
+const char *loop_variable(ASTNode *stmt);
+void set_unroll_factor(int factor);
+void set_vectorize(bool enabled);
+void generate_for(CodeGen *codegen, ASTNode *stmt, SymbolTable *symbols);
+void emit_loop_preheader(CodeGen *codegen, ASTNode *loop, SymbolTable *symbols);
+void advance_induction_pointers(CodeGen *codegen, ASTNode *stmt);
+
+// Instruction selection
+bool is_tileable(ASTNode *expr);
+void emit_branch_if_false(CodeGen *codegen, ASTNode *condition, SymbolTable *symbols, const char *label);
+void emit_branch_if_true(CodeGen *codegen, ASTNode *condition, SymbolTable *symbols, const char *label);
+void emit_store_sequence(CodeGen *codegen, ASTNode **values, size_t count, Symbol *target, SymbolTable *symbols);
+
+// Strength reduction for constant operands
+bool is_strength_reducible(const char *op, int value);
+void emit_arithmetic_constant(CodeGen *codegen, const char *op, const char *dest, const char *src, int value);
+
+// Exponentiation
+bool is_runtime_pow(ASTNode *node);
+void emit_power_constant(CodeGen *codegen, const char *dest, const char *base, int exponent);
+void emit_power_of_two(CodeGen *codegen, const char *dest, const char *exponent);
 
 #endif // COMPILER_H
\ No newline at end of file
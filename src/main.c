@@ -3,12 +3,16 @@
 #include "tokenizer.h"
 #include "parser.h"
 #include "compiler.h"
+#include "peephole.h"
 
 void usage(const char *program_name) {
-    fprintf(stderr, "usage: %s [--debug] <source_file>\n", program_name);
+    fprintf(stderr, "usage: %s [--debug] [--emit-stats] [--unroll N] [--no-vectorize] <source_file>\n", program_name);
     fprintf(stderr, "compile clumsy to ARM64 assembly\n");
     fprintf(stderr, "options:\n");
-    fprintf(stderr, "  --debug    print syntax tree and symbol table to stderr\n");
+    fprintf(stderr, "  --debug         print syntax tree and symbol table to stderr\n");
+    fprintf(stderr, "  --emit-stats    print optimization statistics to stderr\n");
+    fprintf(stderr, "  --unroll N      copies of each for loop body per iteration (default 4, 1 disables)\n");
+    fprintf(stderr, "  --no-vectorize  keep array loops scalar instead of using NEON\n");
     exit(1);
 }
 
@@ -41,12 +45,22 @@ char *read_file(const char *filename) {
 
 int main(int argc, char *argv[]) {
     bool debug = false;
+    bool emit_stats = false;
     const char *source_file = NULL;
     
     // Parse command line arguments
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "--debug") == 0) {
             debug = true;
+        } else if (strcmp(argv[i], "--emit-stats") == 0) {
+            emit_stats = true;
+        } else if (strcmp(argv[i], "--unroll") == 0) {
+            if (i + 1 >= argc || atoi(argv[i + 1]) < 1) {
+                usage(argv[0]);
+            }
+            set_unroll_factor(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--no-vectorize") == 0) {
+            set_vectorize(false);
         } else if (source_file == NULL) {
             source_file = argv[i];
         } else {
@@ -108,6 +122,16 @@ int main(int argc, char *argv[]) {
         exit(1);
     }
     
+    // Clean up the emitted instruction stream
+    PeepholeStats peephole_stats;
+    char *optimized = peephole_optimize(assembly, &peephole_stats);
+    free(assembly);
+    assembly = optimized;
+    
+    if (emit_stats) {
+        print_peephole_stats(&peephole_stats);
+    }
+    
     // Output assembly
     printf("%s", assembly);
     
@@ -192,6 +192,24 @@ ASTNode *parse_exp(Parser *parser) {
         case TOKEN_IDENTIFIER:
         case TOKEN_KEYWORD:
         case TOKEN_OPERATOR: {
+            // prefix forms written against their operand: &x is (& x), the
+            // address of x, and @p is (@ p), what p points to
+            if ((match_value(parser, "&") || match_value(parser, "@")) &&
+                peek_token(parser)->line == token->line && peek_token(parser)->column == token->column + 1 &&
+                (peek_token(parser)->type == TOKEN_IDENTIFIER || peek_token(parser)->type == TOKEN_LPAREN)) {
+                ASTNode *prefix = create_ast_node(AST_LIST);
+                ASTNode *prefix_op = create_ast_node(AST_IDENTIFIER);
+                prefix_op->data.string_value = strdup(token->value);
+                add_ast_child(prefix, prefix_op);
+                next_token(parser); // consume '&' or '@'
+                
+                ASTNode *operand = parse_exp(parser);
+                if (operand) {
+                    add_ast_child(prefix, operand);
+                }
+                return prefix;
+            }
+            
             // struct literals: #((field value)...)
             if (match_value(parser, "#") && peek_token(parser)->type == TOKEN_LPAREN) {
                 next_token(parser); // consume '#'
@@ -213,10 +231,14 @@ ASTNode *parse_exp(Parser *parser) {
             }
             ASTNode *node = create_ast_node(AST_IDENTIFIER);
             node->data.string_value = strdup(token->value);
+            // a[i] and int[n] are written against the name; a bracket after
+            // a space starts an array literal, as in (let v vec<int> [1 2])
+            bool indexed = peek_token(parser)->type == TOKEN_LBRACKET && peek_token(parser)->line == token->line &&
+                           peek_token(parser)->column == token->column + (int)strlen(token->value);
             next_token(parser);
             
             // array indexing: identifier[expression]
-            if (match_token(parser, TOKEN_LBRACKET)) {
+            if (indexed) {
                 next_token(parser); // consume '['
                 
                 ASTNode *index_expr = create_ast_node(AST_LIST);
@@ -263,12 +285,29 @@ ASTNode *parse_exp(Parser *parser) {
                     add_ast_child(field_access, field);
                     next_token(parser);
                     
+                    // nested fields: a.b.c is (. (. a b) c)
+                    while (match_value(parser, ".") && peek_token(parser)->type == TOKEN_IDENTIFIER) {
+                        next_token(parser); // consume '.'
+                        
+                        ASTNode *outer = create_ast_node(AST_LIST);
+                        ASTNode *outer_op = create_ast_node(AST_IDENTIFIER);
+                        outer_op->data.string_value = strdup(".");
+                        add_ast_child(outer, outer_op);
+                        add_ast_child(outer, field_access);
+                        
+                        ASTNode *outer_field = create_ast_node(AST_IDENTIFIER);
+                        outer_field->data.string_value = strdup(current_token(parser)->value);
+                        add_ast_child(outer, outer_field);
+                        next_token(parser);
+                        field_access = outer;
+                    }
+                    
                     return field_access;
                 }
             }
             
             // array type: type[size]
-            if (match_token(parser, TOKEN_LBRACKET)) {
+            if (indexed) {
                 next_token(parser); // consume '['
                 
                 ASTNode *array_type = create_ast_node(AST_LIST);
@@ -364,6 +403,23 @@ void free_ast(ASTNode *node) {
     free(node);
 }
 
+static void print_scalar_type(SymbolType type) {
+    switch (type) {
+        case SYM_INT: fprintf(stderr, "int"); break;
+        case SYM_STR: fprintf(stderr, "str"); break;
+        case SYM_CHAR: fprintf(stderr, "char"); break;
+        case SYM_BOOL: fprintf(stderr, "bool"); break;
+        case SYM_I8: fprintf(stderr, "i8"); break;
+        case SYM_I16: fprintf(stderr, "i16"); break;
+        case SYM_I32: fprintf(stderr, "i32"); break;
+        case SYM_U8: fprintf(stderr, "u8"); break;
+        case SYM_U16: fprintf(stderr, "u16"); break;
+        case SYM_U32: fprintf(stderr, "u32"); break;
+        case SYM_U64: fprintf(stderr, "u64"); break;
+        default: fprintf(stderr, "unknown_type(%d)", type); break;
+    }
+}
+
 void print_symbol_table(SymbolTable *symbols) {
     if (!symbols) {
         fprintf(stderr, "  (null symbol table)\n");
@@ -380,54 +436,45 @@ void print_symbol_table(SymbolTable *symbols) {
         fprintf(stderr, "  %s: ", sym->name);
         
         switch (sym->type) {
-            case SYM_INT:
-                fprintf(stderr, "int");
-                break;
-            case SYM_STR:
-                fprintf(stderr, "str");
-                break;
-            case SYM_CHAR:
-                fprintf(stderr, "char");
-                break;
-            case SYM_BOOL:
-                fprintf(stderr, "bool");
-                break;
             case SYM_ARRAY:
                 fprintf(stderr, "array[%d] of ", sym->type_info.array.size);
-                switch (sym->type_info.array.element_type) {
-                    case SYM_INT: fprintf(stderr, "int"); break;
-                    case SYM_STR: fprintf(stderr, "str"); break;
-                    case SYM_CHAR: fprintf(stderr, "char"); break;
-                    case SYM_BOOL: fprintf(stderr, "bool"); break;
-                    default: fprintf(stderr, "unknown"); break;
-                }
+                print_scalar_type(sym->type_info.array.element_type);
                 break;
             case SYM_STRUCT:
                 fprintf(stderr, "struct %s", sym->type_info.struct_instance.struct_type_name);
                 break;
+            case SYM_POINTER:
+                fprintf(stderr, "pointer to ");
+                if (sym->type_info.pointer.struct_type_name) {
+                    fprintf(stderr, "%s", sym->type_info.pointer.struct_type_name);
+                } else {
+                    print_scalar_type(sym->type_info.pointer.element_type);
+                }
+                break;
+            case SYM_VEC:
+                fprintf(stderr, "vec of ");
+                print_scalar_type(sym->type_info.pointer.element_type);
+                break;
+            case SYM_MAP:
+                fprintf(stderr, "map of ");
+                print_scalar_type(sym->type_info.map.key_type);
+                fprintf(stderr, " to ");
+                print_scalar_type(sym->type_info.map.value_type);
+                break;
+            case SYM_VECTOR:
+                fprintf(stderr, "i%dx%d", sym->type_info.vector.lane_bits, sym->type_info.vector.lanes);
+                break;
             case SYM_FUNCTION:
                 fprintf(stderr, "fn(");
                 for (int j = 0; j < sym->type_info.function.param_count; j++) {
                     if (j > 0) fprintf(stderr, ", ");
-                    switch (sym->type_info.function.param_types[j]) {
-                        case SYM_INT: fprintf(stderr, "int"); break;
-                        case SYM_STR: fprintf(stderr, "str"); break;
-                        case SYM_CHAR: fprintf(stderr, "char"); break;
-                        case SYM_BOOL: fprintf(stderr, "bool"); break;
-                        default: fprintf(stderr, "unknown"); break;
-                    }
+                    print_scalar_type(sym->type_info.function.param_types[j]);
                 }
                 fprintf(stderr, ") -> ");
-                switch (sym->type_info.function.return_type) {
-                    case SYM_INT: fprintf(stderr, "int"); break;
-                    case SYM_STR: fprintf(stderr, "str"); break;
-                    case SYM_CHAR: fprintf(stderr, "char"); break;
-                    case SYM_BOOL: fprintf(stderr, "bool"); break;
-                    default: fprintf(stderr, "unknown"); break;
-                }
+                print_scalar_type(sym->type_info.function.return_type);
                 break;
             default:
-                fprintf(stderr, "unknown_type(%d)", sym->type);
+                print_scalar_type(sym->type);
                 break;
         }
         fprintf(stderr, "\n");
@@ -0,0 +1,703 @@
+#include "peephole.h"
+#include <ctype.h>
+#include <stdint.h>
+
+// Peephole optimizer over the emitted ARM64 text. Works on straight-line
+// runs between labels, branches and calls:
+//   - ldr after a str/ldr of the same slot becomes a mov (or disappears)
+//   - mov B, A folds into the instruction that defined A when A is dead
+//   - adjacent ldr/str of neighbouring slots merge into ldp/stp
+//   - add xP, xP, #n after the last access through [xP] becomes a
+//     post-indexed access
+//   - code after an unconditional branch up to the next label is dropped, as
+//     is a branch to the label right after it
+// Anything it does not recognise ends the current run, so new instruction
+// forms are safe by default.
+
+#define MAX_OPERANDS 6
+#define OPERAND_SIZE 64
+#define MAX_AVAILABLE 64
+
+#define REG_SP 31
+#define REG_ZR 32
+
+typedef enum {
+    LINE_BLANK,         // empty or comment only
+    LINE_LABEL,
+    LINE_DIRECTIVE,
+    LINE_INSTRUCTION
+} LineType;
+
+typedef enum {
+    KIND_PLAIN,         // writes its first operand, reads the rest
+    KIND_COMPARE,       // reads everything, writes flags only
+    KIND_LOAD,
+    KIND_STORE,
+    KIND_BRANCH,
+    KIND_CALL,
+    KIND_RETURN,
+    KIND_UNKNOWN
+} InstructionKind;
+
+typedef struct {
+    char *text;                 // line as emitted, kept unless rewritten
+    LineType type;
+    char mnemonic[16];
+    char operands[MAX_OPERANDS][OPERAND_SIZE];
+    int operand_count;
+    bool deleted;
+    bool rewritten;
+} Line;
+
+typedef struct {
+    Line *lines;
+    size_t count;
+    size_t capacity;
+} Program;
+
+// [base, #offset] with optional index register and writeback
+typedef struct {
+    int base;
+    int index;
+    long offset;
+    bool writeback;
+} Address;
+
+// A stack slot whose current value is known to sit in a register
+typedef struct {
+    int base;
+    long offset;
+    int reg;
+} AvailableSlot;
+
+static const char *plain_mnemonics[] = {
+    "mov", "movz", "movn", "movk", "add", "sub", "adds", "subs", "mul", "madd",
+    "msub", "sdiv", "udiv", "smulh", "umulh", "lsl", "lsr", "asr", "neg", "negs",
+    "and", "orr", "eor", "csel", "cset", "csneg", "csinc", "cneg", "sxtb", "sxth",
+    "sxtw", "uxtb", "uxth", "adr", "adrp", NULL
+};
+
+static bool in_list(const char *word, const char **list) {
+    for (int i = 0; list[i]; i++) {
+        if (strcmp(word, list[i]) == 0) return true;
+    }
+    return false;
+}
+
+static char *trim(char *s) {
+    while (isspace((unsigned char)*s)) s++;
+    char *end = s + strlen(s);
+    while (end > s && isspace((unsigned char)end[-1])) end--;
+    *end = '\0';
+    return s;
+}
+
+static void parse_line(Line *line) {
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), "%s", line->text);
+
+    char *comment = strstr(buffer, "//");
+    if (comment) *comment = '\0';
+    char *body = trim(buffer);
+
+    line->operand_count = 0;
+    line->mnemonic[0] = '\0';
+    if (*body == '\0') {
+        line->type = LINE_BLANK;
+        return;
+    }
+    if (*body == '.' && body[strlen(body) - 1] != ':') {
+        line->type = LINE_DIRECTIVE;
+        return;
+    }
+    if (body[strlen(body) - 1] == ':') {
+        line->type = LINE_LABEL;
+        return;
+    }
+
+    line->type = LINE_INSTRUCTION;
+    size_t length = strcspn(body, " \t");
+    if (length >= sizeof(line->mnemonic)) length = sizeof(line->mnemonic) - 1;
+    memcpy(line->mnemonic, body, length);
+    line->mnemonic[length] = '\0';
+
+    // Split operands on commas outside brackets
+    char *cursor = body + strcspn(body, " \t");
+    int depth = 0;
+    char *start = cursor;
+    for (char *p = cursor; ; p++) {
+        if (*p == '[') depth++;
+        if (*p == ']') depth--;
+        if ((*p == ',' && depth == 0) || *p == '\0') {
+            bool end = *p == '\0';
+            *p = '\0';
+            char *operand = trim(start);
+            if (*operand && line->operand_count < MAX_OPERANDS) {
+                snprintf(line->operands[line->operand_count++], OPERAND_SIZE, "%s", operand);
+            }
+            if (end) break;
+            start = p + 1;
+        }
+    }
+}
+
+static void render_line(Line *line) {
+    char buffer[256];
+    int used = snprintf(buffer, sizeof(buffer), "    %-5s", line->mnemonic);
+    for (int i = 0; i < line->operand_count && used < (int)sizeof(buffer); i++) {
+        used += snprintf(buffer + used, sizeof(buffer) - used, "%s%s", i == 0 ? " " : ", ", line->operands[i]);
+    }
+    free(line->text);
+    line->text = strdup(buffer);
+    line->rewritten = false;
+}
+
+// 0-30 for x/w registers, REG_SP, REG_ZR, or -1
+static int register_number(const char *operand) {
+    if (strcmp(operand, "sp") == 0) return REG_SP;
+    if (strcmp(operand, "xzr") == 0 || strcmp(operand, "wzr") == 0) return REG_ZR;
+    if ((operand[0] == 'x' || operand[0] == 'w') && isdigit((unsigned char)operand[1])) {
+        char *end;
+        long n = strtol(operand + 1, &end, 10);
+        if (*end == '\0' && n <= 30) return (int)n;
+    }
+    return -1;
+}
+
+static bool is_x_register(const char *operand) {
+    int reg = register_number(operand);
+    return operand[0] == 'x' && reg >= 0 && reg <= 30;
+}
+
+static uint64_t register_bit(int reg) {
+    return reg >= 0 && reg < REG_ZR ? (uint64_t)1 << reg : 0;
+}
+
+static bool parse_address(const char *operand, Address *address) {
+    if (operand[0] != '[') return false;
+
+    char buffer[OPERAND_SIZE];
+    snprintf(buffer, sizeof(buffer), "%s", operand + 1);
+    char *close = strchr(buffer, ']');
+    if (!close) return false;
+    address->writeback = close[1] == '!';
+    *close = '\0';
+
+    address->index = -1;
+    address->offset = 0;
+    char *part = strtok(buffer, ",");
+    address->base = part ? register_number(trim(part)) : -1;
+    part = strtok(NULL, ",");
+    if (part) {
+        part = trim(part);
+        if (part[0] == '#') {
+            address->offset = strtol(part + 1, NULL, 10);
+        } else {
+            address->index = register_number(part);
+        }
+    }
+    return address->base >= 0;
+}
+
+static InstructionKind classify(Line *line) {
+    const char *m = line->mnemonic;
+    if (in_list(m, plain_mnemonics)) return KIND_PLAIN;
+    if (strcmp(m, "cmp") == 0 || strcmp(m, "cmn") == 0 || strcmp(m, "tst") == 0) return KIND_COMPARE;
+    if (strncmp(m, "ldr", 3) == 0 || strcmp(m, "ldp") == 0) return KIND_LOAD;
+    if (strncmp(m, "str", 3) == 0 || strcmp(m, "stp") == 0) return KIND_STORE;
+    if (strcmp(m, "bl") == 0 || strcmp(m, "blr") == 0) return KIND_CALL;
+    if (strcmp(m, "ret") == 0) return KIND_RETURN;
+    if (strcmp(m, "b") == 0 || strncmp(m, "b.", 2) == 0 || strcmp(m, "br") == 0 ||
+        strcmp(m, "cbz") == 0 || strcmp(m, "cbnz") == 0 ||
+        strcmp(m, "tbz") == 0 || strcmp(m, "tbnz") == 0) return KIND_BRANCH;
+    return KIND_UNKNOWN;
+}
+
+// Registers read and written by an instruction
+static InstructionKind register_effects(Line *line, uint64_t *reads, uint64_t *writes) {
+    InstructionKind kind = classify(line);
+    *reads = 0;
+    *writes = 0;
+
+    switch (kind) {
+        case KIND_CALL:
+            *reads = 0xff;                                  // x0-x7 arguments
+            *writes = 0x7ffff | register_bit(30);           // x0-x18 and lr
+            return kind;
+        case KIND_RETURN:
+            *reads = register_bit(0) | register_bit(30);
+            return kind;
+        default:
+            break;
+    }
+
+    int data_operands = line->operand_count;
+    bool post_index = false;
+    if (kind == KIND_LOAD || kind == KIND_STORE) {
+        // Data registers come first, then the address, then a post-index
+        for (int i = 0; i < line->operand_count; i++) {
+            Address address;
+            if (parse_address(line->operands[i], &address)) {
+                data_operands = i;
+                *reads |= register_bit(address.base) | register_bit(address.index);
+                post_index = i + 1 < line->operand_count;
+                if (address.writeback || post_index) *writes |= register_bit(address.base);
+                break;
+            }
+        }
+    }
+
+    for (int i = 0; i < data_operands; i++) {
+        int reg = register_number(line->operands[i]);
+        if (reg < 0) continue;
+        bool destination = (kind == KIND_PLAIN && i == 0) || kind == KIND_LOAD;
+        if (destination) {
+            *writes |= register_bit(reg);
+            if (strcmp(line->mnemonic, "movk") == 0) *reads |= register_bit(reg);
+        } else {
+            *reads |= register_bit(reg);
+        }
+    }
+    return kind;
+}
+
+static bool is_block_boundary(InstructionKind kind) {
+    return kind == KIND_BRANCH || kind == KIND_CALL || kind == KIND_RETURN || kind == KIND_UNKNOWN;
+}
+
+// Whether reg's value is never read after line index, judged within the
+// straight-line run; unknown successors count as reads
+static bool is_dead_after(Program *program, size_t index, int reg) {
+    uint64_t bit = register_bit(reg);
+
+    for (size_t j = index + 1; j < program->count; j++) {
+        Line *line = &program->lines[j];
+        if (line->deleted || line->type == LINE_BLANK) continue;
+        if (line->type != LINE_INSTRUCTION) return false;
+
+        uint64_t reads, writes;
+        InstructionKind kind = register_effects(line, &reads, &writes);
+        if (reads & bit) return false;
+        if (writes & bit) return true;
+        if (kind == KIND_RETURN) return reg >= 1 && reg <= 18;
+        if (is_block_boundary(kind)) return false;
+    }
+    return false;
+}
+
+// Plain 64-bit ldr/str with an immediate (or no) offset
+static bool is_simple_access(Line *line, const char *mnemonic, Address *address) {
+    if (strcmp(line->mnemonic, mnemonic) != 0 || line->operand_count != 2) return false;
+    if (!is_x_register(line->operands[0]) &&
+        !(strcmp(mnemonic, "str") == 0 && strcmp(line->operands[0], "xzr") == 0)) return false;
+    if (!parse_address(line->operands[1], address)) return false;
+    return address->index < 0 && !address->writeback;
+}
+
+// Single-register ldr/str of any width (ldrb, ldrsw, strh, ...) with an
+// immediate (or no) offset; its size in bytes, or 0
+static int sized_access(Line *line, bool store, Address *address) {
+    static const char *loads[] = {"ldr", "ldrb", "ldrh", "ldrsb", "ldrsh", "ldrsw", NULL};
+    static const char *stores[] = {"str", "strb", "strh", NULL};
+    if (!in_list(line->mnemonic, store ? stores : loads) || line->operand_count != 2) return 0;
+    int reg = register_number(line->operands[0]);
+    if (reg < 0 || reg == REG_SP) return 0;
+    if (!parse_address(line->operands[1], address) || address->index >= 0 || address->writeback) return 0;
+
+    const char *m = line->mnemonic;
+    char last = m[strlen(m) - 1];
+    if (last == 'b') return 1;
+    if (last == 'h') return 2;
+    return last == 'w' || line->operands[0][0] == 'w' ? 4 : 8;
+}
+
+static void remove_available(AvailableSlot *slots, int *count, int i) {
+    slots[i] = slots[--(*count)];
+}
+
+static void invalidate_registers(AvailableSlot *slots, int *count, uint64_t written) {
+    for (int i = *count - 1; i >= 0; i--) {
+        if ((register_bit(slots[i].reg) | register_bit(slots[i].base)) & written) {
+            remove_available(slots, count, i);
+        }
+    }
+}
+
+// Forget slots a store to [base, offset, offset + size) may overwrite.
+// Different base registers may alias each other.
+static void invalidate_memory(AvailableSlot *slots, int *count, int base, long offset, long size) {
+    for (int i = *count - 1; i >= 0; i--) {
+        if (slots[i].base != base ||
+            (slots[i].offset < offset + size && offset < slots[i].offset + 8)) {
+            remove_available(slots, count, i);
+        }
+    }
+}
+
+static void delete_line(Line *line) {
+    line->deleted = true;
+}
+
+static bool forward_loads(Program *program, PeepholeStats *stats) {
+    AvailableSlot slots[MAX_AVAILABLE];
+    int count = 0;
+    bool changed = false;
+
+    for (size_t i = 0; i < program->count; i++) {
+        Line *line = &program->lines[i];
+        if (line->deleted || line->type == LINE_BLANK) continue;
+        if (line->type != LINE_INSTRUCTION) {
+            count = 0;
+            continue;
+        }
+
+        uint64_t reads, writes;
+        InstructionKind kind = register_effects(line, &reads, &writes);
+        if (is_block_boundary(kind)) {
+            count = 0;
+            continue;
+        }
+
+        Address address;
+        if (is_simple_access(line, "ldr", &address)) {
+            int dest = register_number(line->operands[0]);
+            int known = -1;
+            for (int s = 0; s < count; s++) {
+                if (slots[s].base == address.base && slots[s].offset == address.offset) known = slots[s].reg;
+            }
+
+            if (known == dest) {
+                delete_line(line);
+                stats->loads_forwarded++;
+                changed = true;
+                continue;
+            }
+            if (known >= 0) {
+                snprintf(line->mnemonic, sizeof(line->mnemonic), "mov");
+                snprintf(line->operands[1], OPERAND_SIZE, "x%d", known);
+                line->rewritten = true;
+                stats->loads_forwarded++;
+                changed = true;
+                invalidate_registers(slots, &count, writes);
+                continue;
+            }
+
+            invalidate_registers(slots, &count, writes);
+            if (dest != address.base && count < MAX_AVAILABLE) {
+                slots[count++] = (AvailableSlot){address.base, address.offset, dest};
+            }
+        } else if (is_simple_access(line, "str", &address)) {
+            int value = register_number(line->operands[0]);
+            invalidate_memory(slots, &count, address.base, address.offset, 8);
+            if (value <= 30 && count < MAX_AVAILABLE) {
+                slots[count++] = (AvailableSlot){address.base, address.offset, value};
+            }
+        } else if (kind == KIND_STORE) {
+            Address pair;
+            int size = sized_access(line, true, &address);
+            if (size > 0) {
+                invalidate_memory(slots, &count, address.base, address.offset, size);
+            } else if (strcmp(line->mnemonic, "stp") == 0 && line->operand_count == 3 &&
+                parse_address(line->operands[2], &pair) && pair.index < 0 && !pair.writeback) {
+                invalidate_memory(slots, &count, pair.base, pair.offset, 16);
+            } else {
+                count = 0;
+            }
+            invalidate_registers(slots, &count, writes);
+        } else {
+            invalidate_registers(slots, &count, writes);
+            if (writes & register_bit(REG_SP)) count = 0;
+        }
+    }
+    return changed;
+}
+
+static Line *previous_instruction(Program *program, size_t index) {
+    while (index-- > 0) {
+        Line *line = &program->lines[index];
+        if (line->deleted || line->type == LINE_BLANK) continue;
+        return line->type == LINE_INSTRUCTION ? line : NULL;
+    }
+    return NULL;
+}
+
+static bool remove_redundant_moves(Program *program, PeepholeStats *stats) {
+    bool changed = false;
+
+    for (size_t i = 0; i < program->count; i++) {
+        Line *line = &program->lines[i];
+        if (line->deleted || line->type != LINE_INSTRUCTION) continue;
+        if (strcmp(line->mnemonic, "mov") != 0 || line->operand_count != 2) continue;
+        if (!is_x_register(line->operands[0]) || !is_x_register(line->operands[1])) continue;
+
+        int dest = register_number(line->operands[0]);
+        int source = register_number(line->operands[1]);
+        if (dest == source) {
+            delete_line(line);
+            stats->moves_removed++;
+            changed = true;
+            continue;
+        }
+
+        // Retarget the instruction that computed the source
+        // (a narrow load keeps its w destination, which zero-extends)
+        Line *definition = previous_instruction(program, i);
+        if (!definition || definition->operand_count == 0) continue;
+        Address address;
+        bool load = sized_access(definition, false, &address) > 0;
+        if (load ? register_number(definition->operands[0]) != source
+                 : strcmp(definition->operands[0], line->operands[1]) != 0) continue;
+
+        uint64_t reads, writes;
+        InstructionKind kind = register_effects(definition, &reads, &writes);
+        bool retargetable = (kind == KIND_PLAIN && strcmp(definition->mnemonic, "movk") != 0) || load;
+        if (!retargetable || writes != register_bit(source)) continue;
+        if (!is_dead_after(program, i, source)) continue;
+
+        snprintf(definition->operands[0], OPERAND_SIZE, "%c%d", definition->operands[0][0], dest);
+        definition->rewritten = true;
+        delete_line(line);
+        stats->moves_removed++;
+        changed = true;
+    }
+    return changed;
+}
+
+static bool merge_pairs(Program *program, PeepholeStats *stats) {
+    static const char *singles[] = {"ldr", "str"};
+    static const char *pairs[] = {"ldp", "stp"};
+    bool changed = false;
+
+    for (size_t i = 0; i < program->count; i++) {
+        Line *first = &program->lines[i];
+        if (first->deleted || first->type != LINE_INSTRUCTION) continue;
+
+        size_t j = i + 1;
+        while (j < program->count && (program->lines[j].deleted || program->lines[j].type == LINE_BLANK)) j++;
+        if (j >= program->count || program->lines[j].type != LINE_INSTRUCTION) continue;
+        Line *second = &program->lines[j];
+
+        for (int form = 0; form < 2; form++) {
+            Address a, b;
+            if (!is_simple_access(first, singles[form], &a) || !is_simple_access(second, singles[form], &b)) continue;
+            if (a.base != b.base || labs(a.offset - b.offset) != 8) continue;
+
+            Line *low = a.offset < b.offset ? first : second;
+            Line *high = a.offset < b.offset ? second : first;
+            long offset = a.offset < b.offset ? a.offset : b.offset;
+            if (offset % 8 != 0 || offset < -512 || offset > 504) continue;
+
+            if (form == 0) {
+                // Both loads must see the original base and land in distinct registers
+                int first_dest = register_number(first->operands[0]);
+                if (first_dest == register_number(second->operands[0]) || first_dest == a.base) continue;
+            }
+
+            char low_reg[OPERAND_SIZE], high_reg[OPERAND_SIZE];
+            snprintf(low_reg, sizeof(low_reg), "%s", low->operands[0]);
+            snprintf(high_reg, sizeof(high_reg), "%s", high->operands[0]);
+            snprintf(first->mnemonic, sizeof(first->mnemonic), "%s", pairs[form]);
+            snprintf(first->operands[0], OPERAND_SIZE, "%s", low_reg);
+            snprintf(first->operands[1], OPERAND_SIZE, "%s", high_reg);
+            if (a.base == REG_SP) {
+                snprintf(first->operands[2], OPERAND_SIZE, "[sp, #%ld]", offset);
+            } else {
+                snprintf(first->operands[2], OPERAND_SIZE, "[x%d, #%ld]", a.base, offset);
+            }
+            first->operand_count = 3;
+            first->rewritten = true;
+            delete_line(second);
+            stats->pairs_merged++;
+            changed = true;
+            break;
+        }
+    }
+    return changed;
+}
+
+// ldr/str Rt, [xP] followed by add xP, xP, #n with nothing in between
+// touching xP becomes ldr/str Rt, [xP], #n
+static void fold_post_increments(Program *program, PeepholeStats *stats) {
+    for (size_t i = 0; i < program->count; i++) {
+        Line *line = &program->lines[i];
+        if (line->deleted || line->type != LINE_INSTRUCTION || line->operand_count != 3) continue;
+
+        bool subtract = strcmp(line->mnemonic, "sub") == 0;
+        if (!subtract && strcmp(line->mnemonic, "add") != 0) continue;
+        if (strcmp(line->operands[0], line->operands[1]) != 0 || !is_x_register(line->operands[0])) continue;
+        if (line->operands[2][0] != '#') continue;
+
+        char *end;
+        long amount = strtol(line->operands[2] + 1, &end, 10);
+        if (*end != '\0') continue;
+        if (subtract) amount = -amount;
+        if (amount < -256 || amount > 255) continue;
+
+        // The closest earlier instruction touching the pointer
+        int pointer = register_number(line->operands[0]);
+        Line *access = NULL;
+        for (size_t j = i; j-- > 0; ) {
+            Line *previous = &program->lines[j];
+            if (previous->deleted || previous->type == LINE_BLANK) continue;
+            if (previous->type != LINE_INSTRUCTION) break;
+
+            uint64_t reads, writes;
+            InstructionKind kind = register_effects(previous, &reads, &writes);
+            if (is_block_boundary(kind)) break;
+            if ((reads | writes) & register_bit(pointer)) {
+                access = previous;
+                break;
+            }
+        }
+
+        Address address;
+        if (!access) continue;
+        bool load = sized_access(access, false, &address) > 0;
+        if (!load && sized_access(access, true, &address) == 0) continue;
+        if (address.base != pointer || address.offset != 0) continue;
+        // Writeback to the transfer register is unpredictable, loads and
+        // stores alike
+        if (register_number(access->operands[0]) == pointer) continue;
+
+        snprintf(access->operands[1], OPERAND_SIZE, "[%s]", line->operands[0]);
+        snprintf(access->operands[2], OPERAND_SIZE, "#%ld", amount);
+        access->operand_count = 3;
+        access->rewritten = true;
+        delete_line(line);
+        stats->post_increments_folded++;
+    }
+}
+
+static bool is_unconditional_jump(Line *line) {
+    return strcmp(line->mnemonic, "b") == 0 || strcmp(line->mnemonic, "br") == 0 ||
+           strcmp(line->mnemonic, "ret") == 0;
+}
+
+// Whether label_line names the label operand of a branch
+static bool is_label_for(Line *label_line, const char *label) {
+    size_t length = strlen(label);
+    const char *text = label_line->text;
+    while (isspace((unsigned char)*text)) text++;
+    return strncmp(text, label, length) == 0 && text[length] == ':';
+}
+
+static void remove_unreachable(Program *program, PeepholeStats *stats) {
+    bool reachable = true;
+    for (size_t i = 0; i < program->count; i++) {
+        Line *line = &program->lines[i];
+        if (line->deleted || line->type == LINE_BLANK) continue;
+        if (line->type != LINE_INSTRUCTION) {
+            reachable = true;
+            continue;
+        }
+        if (!reachable) {
+            delete_line(line);
+            stats->unreachable_removed++;
+            continue;
+        }
+        reachable = !is_unconditional_jump(line);
+    }
+
+    // b L where L labels the next instruction
+    for (size_t i = 0; i < program->count; i++) {
+        Line *line = &program->lines[i];
+        if (line->deleted || line->type != LINE_INSTRUCTION) continue;
+        if (strcmp(line->mnemonic, "b") != 0 || line->operand_count != 1) continue;
+
+        for (size_t j = i + 1; j < program->count; j++) {
+            Line *next = &program->lines[j];
+            if (next->deleted || next->type == LINE_BLANK) continue;
+            if (next->type != LINE_LABEL) break;
+            if (is_label_for(next, line->operands[0])) {
+                delete_line(line);
+                stats->unreachable_removed++;
+                break;
+            }
+        }
+    }
+}
+
+static int count_instructions(Program *program) {
+    int count = 0;
+    for (size_t i = 0; i < program->count; i++) {
+        if (!program->lines[i].deleted && program->lines[i].type == LINE_INSTRUCTION) count++;
+    }
+    return count;
+}
+
+static void add_line(Program *program, const char *start, size_t length) {
+    if (program->count == program->capacity) {
+        program->capacity = program->capacity ? program->capacity * 2 : 256;
+        program->lines = realloc(program->lines, program->capacity * sizeof(Line));
+        if (!program->lines) {
+            fprintf(stderr, "Error: Failed to allocate memory for peephole pass\n");
+            exit(1);
+        }
+    }
+
+    Line *line = &program->lines[program->count++];
+    memset(line, 0, sizeof(Line));
+    line->text = malloc(length + 1);
+    memcpy(line->text, start, length);
+    line->text[length] = '\0';
+    parse_line(line);
+}
+
+char *peephole_optimize(const char *assembly, PeepholeStats *stats) {
+    Program program = {NULL, 0, 0};
+
+    const char *start = assembly;
+    while (*start) {
+        const char *end = strchr(start, '\n');
+        size_t length = end ? (size_t)(end - start) : strlen(start);
+        add_line(&program, start, length);
+        start += length + (end ? 1 : 0);
+    }
+
+    memset(stats, 0, sizeof(PeepholeStats));
+    stats->instructions_before = count_instructions(&program);
+
+    // Forwarding exposes moves and moves feed forwarding; pairs go last so
+    // they see the final set of loads and stores
+    remove_unreachable(&program, stats);
+    bool changed = true;
+    while (changed) {
+        changed = forward_loads(&program, stats);
+        changed |= remove_redundant_moves(&program, stats);
+    }
+    fold_post_increments(&program, stats);
+    merge_pairs(&program, stats);
+
+    stats->instructions_after = count_instructions(&program);
+
+    size_t size = 1;
+    for (size_t i = 0; i < program.count; i++) {
+        if (program.lines[i].rewritten) render_line(&program.lines[i]);
+        if (!program.lines[i].deleted) size += strlen(program.lines[i].text) + 1;
+    }
+
+    char *result = malloc(size);
+    char *out = result;
+    for (size_t i = 0; i < program.count; i++) {
+        if (!program.lines[i].deleted) {
+            size_t length = strlen(program.lines[i].text);
+            memcpy(out, program.lines[i].text, length);
+            out[length] = '\n';
+            out += length + 1;
+        }
+        free(program.lines[i].text);
+    }
+    *out = '\0';
+    free(program.lines);
+
+    return result;
+}
+
+void print_peephole_stats(const PeepholeStats *stats) {
+    fprintf(stderr, "peephole: %d -> %d instructions\n", stats->instructions_before, stats->instructions_after);
+    fprintf(stderr, "  load/store pairs merged: %d\n", stats->pairs_merged);
+    fprintf(stderr, "  loads forwarded:         %d\n", stats->loads_forwarded);
+    fprintf(stderr, "  moves removed:           %d\n", stats->moves_removed);
+    fprintf(stderr, "  unreachable removed:     %d\n", stats->unreachable_removed);
+    fprintf(stderr, "  post-increments folded:  %d\n", stats->post_increments_folded);
+}
@@ -0,0 +1,20 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#include "types.h"
+
+// Counts of what the peephole pass changed, reported by --emit-stats
+typedef struct {
+    int instructions_before;
+    int instructions_after;
+    int pairs_merged;           // adjacent ldr/str folded into ldp/stp
+    int loads_forwarded;        // loads replaced by a register already holding the slot
+    int moves_removed;          // moves deleted or folded into the defining instruction
+    int unreachable_removed;    // code after an unconditional branch, jumps to the next line
+    int post_increments_folded; // pointer increments merged into post-indexed ldr/str
+} PeepholeStats;
+
+char *peephole_optimize(const char *assembly, PeepholeStats *stats);
+void print_peephole_stats(const PeepholeStats *stats);
+
+#endif // PEEPHOLE_H
@@ -1,13 +0,0 @@
-#include <stdio.h>
-
-void print_int(long value) {
-    printf("%ld", value);
-}
-
-void print_str(const char* str) {
-    printf("%s", str);
-}
-
-void print_char(char c) {
-    printf("%c", c);
-}
\ No newline at end of file
@@ -4,13 +4,13 @@
 static const char *keywords[] = {
     "int", "str", "let", "bool", "char", "struct",
     "set", "fn", "ret", "if", "else", "while",
-    NULL
+    "for", NULL
 };
 
 static const char *operators[] = {
     "+", "-", "*", "/", "%", "**", "!", "~", ".",
     "<", ">", "|", "&", "=",
-    "<=", ">=", "||", "&&", "==",
+    "<=", ">=", "||", "&&", "==", "@",
     NULL
 };
 
@@ -229,6 +229,28 @@ TokenArray *tokenize(const char *source) {
             continue;
         }
 
+        // pointer types: *T is one token, unlike (* a b). Right after an
+        // opening paren * is the operator, so (*x 2) still multiplies.
+        bool operator_position = tokens->count > 0 && tokens->tokens[tokens->count - 1].type == TOKEN_LPAREN;
+        if (c == '*' && !operator_position && idx + 1 < len && (is_alpha(source[idx + 1]) || source[idx + 1] == '_')) {
+            int start_idx = idx;
+            idx++;
+            column++;
+            while (idx < len && is_ident(source[idx])) {
+                idx++;
+                column++;
+            }
+            
+            int id_len = idx - start_idx;
+            char *identifier = malloc(id_len + 1);
+            strncpy(identifier, source + start_idx, id_len);
+            identifier[id_len] = '\0';
+            
+            token_array_add(tokens, create_token(TOKEN_IDENTIFIER, identifier, line, column - id_len));
+            free(identifier);
+            continue;
+        }
+
         // operators (maximal munch)
         bool found_operator = false;
         for (int op_len = 2; op_len >= 1 && !found_operator; op_len--) {
@@ -250,13 +272,23 @@ TokenArray *tokenize(const char *source) {
             continue;
         }
 
-        // ids
+        // ids, and generic type names such as vec<int> written without spaces
         if (is_alpha(c) || c == '_') {
             int start_idx = idx;
             while (idx < len && is_ident(source[idx])) {
                 idx++;
                 column++;
             }
+            if (idx < len && source[idx] == '<') {
+                int end_idx = idx + 1;
+                while (end_idx < len && (is_ident(source[end_idx]) || source[end_idx] == ',' || source[end_idx] == '*')) {
+                    end_idx++;
+                }
+                if (end_idx < len && end_idx > idx + 1 && source[end_idx] == '>') {
+                    column += end_idx + 1 - idx;
+                    idx = end_idx + 1;
+                }
+            }
             
             int id_len = idx - start_idx;
             char *identifier = malloc(id_len + 1);
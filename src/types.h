@@ -60,15 +60,32 @@ typedef struct ASTNode {
 } ASTNode;
 
 typedef enum {
-    SYM_INT,
+    SYM_INT,                // i64
     SYM_STR,
     SYM_CHAR,
     SYM_BOOL,
+    SYM_I8,
+    SYM_I16,
+    SYM_I32,
+    SYM_U8,
+    SYM_U16,
+    SYM_U32,
+    SYM_U64,
     SYM_ARRAY,
     SYM_STRUCT,
-    SYM_FUNCTION
+    SYM_FUNCTION,
+    SYM_VECTOR,
+    SYM_POINTER,            // *T, or heap elements from alloc
+    SYM_VEC,                // vec<T>: elements, length and capacity
+    SYM_MAP                 // map<K,V>: hash table with int or str keys
 } SymbolType;
 
+// SIMD vector type such as i32x4: lanes * lane_bits is always 128
+typedef struct {
+    int lanes;
+    int lane_bits;
+} VectorType;
+
 typedef struct {
     char *name;
     SymbolType type;
@@ -85,13 +102,25 @@ typedef struct {
         struct {
             char *struct_type_name;
         } struct_instance;
+        struct {
+            SymbolType element_type;
+            char *struct_type_name;     // pointee struct type, else NULL
+        } pointer;                      // also the elements of a vec
+        struct {
+            SymbolType key_type;
+            SymbolType value_type;
+        } map;
+        VectorType vector;
     } type_info;
     ASTNode *init_value;
+    bool eliminated;    // never read: no stack slot, stores dropped
+    bool address_taken; // &name appears: pointer stores may change it
 } Symbol;
 
 typedef struct {
     char *name;
     SymbolType type;
+    char *struct_type_name;     // type of a nested struct field, else NULL
     ASTNode *default_value;
 } StructField;
 
@@ -20,7 +20,7 @@ endif()
 execute_process(
         COMMAND clang -o ${TMP_DIR}/${TEST_NAME_ONLY}.x
         ${TMP_DIR}/${TEST_NAME_ONLY}.s
-        ${SRC_DIR}/print_helpers.o
+        ${RUNTIME}
         ERROR_QUIET
         RESULT_VARIABLE LINK_RESULT
 )